@@ -0,0 +1,114 @@
+#include "flow-table.hpp"
+#include "benchmark/benchmark.h"
+
+#include <random>
+#include <unordered_map>
+
+/* lookups in a flow table keyed by a 5-tuple like IPFlowID, half of them
+ * hits, against std::unordered_map which chains buckets like HashMap.
+ * the batched variant looks up 32 keys at a time with find_batch
+ *
+ * usage: flow-table-bench [benchmark flags]
+ */
+
+struct FlowKey {
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+
+    bool operator==(const FlowKey &o) const {
+        return saddr == o.saddr && daddr == o.daddr && sport == o.sport && dport == o.dport;
+    }
+};
+
+struct FlowKeyHash {
+    size_t operator()(const FlowKey &k) const {
+        uint64_t h = ((uint64_t)k.saddr << 32 | k.daddr) * 0x9e3779b97f4a7c15ull;
+        h ^= ((uint64_t)k.sport << 16 | k.dport) * 0xc2b2ae3d27d4eb4full;
+        return h ^ (h >> 29);
+    }
+};
+
+static std::vector<FlowKey> make_keys(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<FlowKey> keys(n);
+    for (auto &k : keys) {
+        k = {(uint32_t)rng(), (uint32_t)rng(), (uint16_t)rng(), (uint16_t)rng()};
+    }
+    return keys;
+}
+
+template <typename Insert, typename Find>
+static void run_lookups(benchmark::State &state, Insert &&insert, Find &&find) {
+    auto n = state.range(0);
+    auto present = make_keys(n, 1);
+    auto absent = make_keys(n, 2);
+    for (size_t i = 0; i < present.size(); i++) {
+        insert(present[i], (uint32_t)i);
+    }
+    for (auto _ : state) {
+        uint64_t found = 0;
+        for (size_t i = 0; i < present.size(); i++) {
+            found += find(present[i]) + find(absent[i]);
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations() * n * 2);
+}
+
+static void BM_FlowTableFind(benchmark::State &state) {
+    FlowTable<FlowKey, uint32_t, FlowKeyHash> t(state.range(0));
+    run_lookups(state,
+                [&](const FlowKey &k, uint32_t v) { t.insert(k, v); },
+                [&](const FlowKey &k) { return t.findp(k) != nullptr; });
+}
+
+static void BM_SwissFlowTableFind(benchmark::State &state) {
+    SwissFlowTable<FlowKey, uint32_t, FlowKeyHash> t(state.range(0));
+    run_lookups(state,
+                [&](const FlowKey &k, uint32_t v) { t.insert(k, v); },
+                [&](const FlowKey &k) { return t.findp(k) != nullptr; });
+}
+
+static void BM_SwissFlowTableFindBatch(benchmark::State &state) {
+    auto n = state.range(0);
+    SwissFlowTable<FlowKey, uint32_t, FlowKeyHash> t(n);
+    auto present = make_keys(n, 1);
+    auto absent = make_keys(n, 2);
+    for (size_t i = 0; i < present.size(); i++) {
+        t.insert(present[i], (uint32_t)i);
+    }
+    std::vector<FlowKey> keys;
+    for (size_t i = 0; i < present.size(); i++) {
+        keys.emplace_back(present[i]);
+        keys.emplace_back(absent[i]);
+    }
+    std::vector<uint32_t *> out(32);
+    for (auto _ : state) {
+        uint64_t found = 0;
+        for (size_t i = 0; i < keys.size(); i += 32) {
+            auto m = std::min<size_t>(32, keys.size() - i);
+            t.find_batch(&keys[i], m, out.data());
+            for (size_t j = 0; j < m; j++) {
+                found += out[j] != nullptr;
+            }
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations() * n * 2);
+}
+
+static void BM_UnorderedMapFind(benchmark::State &state) {
+    std::unordered_map<FlowKey, uint32_t, FlowKeyHash> t;
+    run_lookups(state,
+                [&](const FlowKey &k, uint32_t v) { t[k] = v; },
+                [&](const FlowKey &k) { return t.find(k) != t.end(); });
+}
+
+BENCHMARK(BM_FlowTableFind)->Range(1 << 10, 1 << 20);
+BENCHMARK(BM_SwissFlowTableFind)->Range(1 << 10, 1 << 20);
+BENCHMARK(BM_SwissFlowTableFindBatch)->Range(1 << 10, 1 << 20);
+BENCHMARK(BM_UnorderedMapFind)->Range(1 << 10, 1 << 20);
+
+BENCHMARK_MAIN();
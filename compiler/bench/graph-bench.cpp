@@ -0,0 +1,191 @@
+#include "graph.hpp"
+#include "highLv-ir.hpp"
+#include "llvm-load.hpp"
+#include "hir-common-pass.hpp"
+#include "benchmark/benchmark.h"
+
+#include <random>
+#include <boost/filesystem.hpp>
+#include <string>
+
+/* synthetic graphs are CFG-shaped: every vertex falls through to the next one,
+ * about half of them branch forward a short distance and a few jump back
+ * (loops). TopologicalSort and IsAcyclic run on the same shape without the
+ * back edges.
+ *
+ * usage: graph-bench [benchmark flags] [ir_dir ...] [ElementName ...]
+ * directories are loaded as llvm ir, every other argument names an element
+ * whose real CFGs are benchmarked as well
+ */
+
+using EdgePairs = std::vector<std::pair<size_t, size_t>>;
+
+EdgePairs gen_cfg_edges(size_t n_vertex, bool with_back_edges) {
+    std::mt19937_64 rng(n_vertex);
+    std::uniform_int_distribution<size_t> dist(1, 16);
+    EdgePairs result;
+    for (size_t i = 0; i + 1 < n_vertex; i++) {
+        result.emplace_back(i, i + 1);
+        if (rng() % 2 == 0) {
+            auto dst = std::min(n_vertex - 1, i + dist(rng));
+            result.emplace_back(i, dst);
+        }
+        if (with_back_edges && rng() % 8 == 0) {
+            auto back = dist(rng);
+            result.emplace_back(i, i >= back ? i - back : 0);
+        }
+    }
+    return result;
+}
+
+template <typename C>
+C build_edges(size_t n_vertex, const EdgePairs &pairs) {
+    C edges(n_vertex);
+    for (auto &e : pairs) {
+        edges.set_edge(e.first, e.second, std::monostate());
+    }
+    return edges;
+}
+
+template <typename C>
+Graph<std::monostate, std::monostate, C> build_graph(size_t n_vertex, bool with_back_edges) {
+    auto pairs = gen_cfg_edges(n_vertex, with_back_edges);
+    std::vector<std::monostate> vertices(n_vertex, std::monostate());
+    return Graph<std::monostate, std::monostate, C>(
+        std::move(vertices), build_edges<C>(n_vertex, pairs));
+}
+
+template <typename C>
+void BM_EdgeConstruction(benchmark::State &state) {
+    size_t n = state.range(0);
+    auto pairs = gen_cfg_edges(n, true);
+    for (auto _ : state) {
+        auto edges = build_edges<C>(n, pairs);
+        benchmark::DoNotOptimize(edges);
+    }
+    state.SetItemsProcessed(state.iterations() * pairs.size());
+}
+
+template <typename C>
+void BM_OutEdgeIter(benchmark::State &state) {
+    size_t n = state.range(0);
+    auto pairs = gen_cfg_edges(n, true);
+    auto edges = build_edges<C>(n, pairs);
+    for (auto _ : state) {
+        size_t sum = 0;
+        for (size_t v = 0; v < n; v++) {
+            for (auto iter = edges.out_edge_begin(v); iter != iter.end(); iter++) {
+                sum += *iter;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * pairs.size());
+}
+
+template <typename C>
+void BM_TopologicalSort(benchmark::State &state) {
+    auto g = build_graph<C>(state.range(0), false);
+    for (auto _ : state) {
+        auto order = g.TopologicalSort();
+        benchmark::DoNotOptimize(order);
+    }
+    state.SetItemsProcessed(state.iterations() * g.n_vertex());
+}
+
+template <typename C>
+void BM_StronglyConnectedComponents(benchmark::State &state) {
+    auto g = build_graph<C>(state.range(0), true);
+    for (auto _ : state) {
+        auto scc_list = g.StronglyConnectedComponents();
+        benchmark::DoNotOptimize(scc_list);
+    }
+    state.SetItemsProcessed(state.iterations() * g.n_vertex());
+}
+
+template <typename C>
+void BM_IsAcyclic(benchmark::State &state) {
+    auto g = build_graph<C>(state.range(0), false);
+    for (auto _ : state) {
+        auto acyclic = g.IsAcyclic();
+        benchmark::DoNotOptimize(acyclic);
+    }
+    state.SetItemsProcessed(state.iterations() * g.n_vertex());
+}
+
+using ListT = AdjacencyList<std::monostate>;
+using MatrixT = AdjacencyMatrix<std::monostate>;
+
+// the matrix is n^2 in memory, so it stops well before the list does
+#define GRAPH_BENCH(fn)                                                          \
+    BENCHMARK_TEMPLATE(fn, ListT)->RangeMultiplier(10)->Range(100, 1000000);     \
+    BENCHMARK_TEMPLATE(fn, MatrixT)->RangeMultiplier(10)->Range(100, 4000)
+
+GRAPH_BENCH(BM_EdgeConstruction);
+GRAPH_BENCH(BM_OutEdgeIter);
+GRAPH_BENCH(BM_TopologicalSort);
+GRAPH_BENCH(BM_StronglyConnectedComponents);
+GRAPH_BENCH(BM_IsAcyclic);
+
+#undef GRAPH_BENCH
+
+void register_element_benchmarks(
+        std::shared_ptr<HIR::Module> m,
+        const LLVMStore &store,
+        const std::string &element_name) {
+    auto ele = std::make_shared<HIR::Element>(*m, store, element_name);
+    for (auto &f : ele->funcs) {
+        if (f->is_built_in || f->bbs.empty()) {
+            continue;
+        }
+        auto cfg = std::make_shared<decltype(HIR::control_graph_of_func(*f))>(
+            HIR::control_graph_of_func(*f));
+        auto prefix = "BM_ElementCFG/" + element_name + "/" + f->name + "/";
+        benchmark::RegisterBenchmark((prefix + "scc").c_str(), [cfg] (benchmark::State &state) {
+            for (auto _ : state) {
+                auto scc_list = cfg->StronglyConnectedComponents();
+                benchmark::DoNotOptimize(scc_list);
+            }
+            state.counters["bbs"] = cfg->n_vertex();
+        });
+        benchmark::RegisterBenchmark((prefix + "condensed_topo").c_str(), [cfg] (benchmark::State &state) {
+            for (auto _ : state) {
+                auto scc_list = cfg->StronglyConnectedComponents();
+                auto order = cfg->CondensedGraph(scc_list).TopologicalSort();
+                benchmark::DoNotOptimize(order);
+            }
+            state.counters["bbs"] = cfg->n_vertex();
+        });
+    }
+    benchmark::RegisterBenchmark(("BM_ElementCFG/" + element_name + "/build_cfg").c_str(), [ele] (benchmark::State &state) {
+        auto &f = *ele->entry();
+        for (auto _ : state) {
+            auto cfg = HIR::control_graph_of_func(f);
+            benchmark::DoNotOptimize(cfg);
+        }
+    });
+}
+
+int main(int argc, char *argv[]) {
+    benchmark::Initialize(&argc, argv);
+
+    // whatever is left after benchmark flags are ir dirs and element names
+    LLVMStore store;
+    auto m = std::make_shared<HIR::Module>();
+    std::vector<std::string> element_names;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (boost::filesystem::is_directory(arg)) {
+            store.load_directory(arg);
+        } else {
+            element_names.emplace_back(arg);
+        }
+    }
+    for (auto &name : element_names) {
+        register_element_benchmarks(m, store, name);
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
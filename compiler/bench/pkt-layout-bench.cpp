@@ -0,0 +1,52 @@
+#include "pkt-layout.hpp"
+#include "benchmark/benchmark.h"
+
+/* field lookups as done by replace_packet_access_op: one FindFieldByOffset
+ * per GEP into a header, sweeping every byte offset of the header so both
+ * hits and misses (offsets inside a field) are measured
+ *
+ * usage: pkt-layout-bench [benchmark flags]
+ */
+
+static const HeaderLayout &header_of(int idx) {
+    static const char *names[] = {"ether", "ipv4", "ipv6", "tcp"};
+    return CommonHdr::default_layout.headers.at(names[idx]);
+}
+
+static void BM_FindFieldByOffset(benchmark::State &state) {
+    auto &hdr = header_of(state.range(0));
+    auto sz = hdr.HeaderSize();
+    for (auto _ : state) {
+        size_t found = 0;
+        for (size_t off = 0; off < sz; off++) {
+            found += (hdr.FindFieldByOffset(off) != nullptr);
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations() * sz);
+}
+
+static void BM_FindFieldByName(benchmark::State &state) {
+    auto &hdr = header_of(state.range(0));
+    for (auto _ : state) {
+        size_t found = 0;
+        for (auto &e : hdr.Fields()) {
+            found += (hdr.FindFieldByName(e.field_name) != nullptr);
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations() * hdr.Fields().size());
+}
+
+static void BM_HeaderSize(benchmark::State &state) {
+    auto &hdr = header_of(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hdr.HeaderSize());
+    }
+}
+
+BENCHMARK(BM_FindFieldByOffset)->DenseRange(0, 3);
+BENCHMARK(BM_FindFieldByName)->DenseRange(0, 3);
+BENCHMARK(BM_HeaderSize)->DenseRange(0, 3);
+
+BENCHMARK_MAIN();
@@ -3,6 +3,7 @@
 #include "hir-common-pass.hpp"
 #include "hir-pktop.hpp"
 #include "hir-stateop.hpp"
+#include "hir-loop.hpp"
 
 #include <iostream>
 
@@ -14,14 +15,19 @@ int main(int argc, char *argv[]) {
     auto m = std::make_shared<HIR::Module>();
     auto ele = std::make_shared<HIR::Element>(*m, store, "MyIPRewriter");
     element_function_inline(*ele);
+    unroll_small_loops(*ele->entry());
+    scalar_replace_aggregates(*ele->module(), *ele->entry());
     replace_packet_access_op(*ele, CommonHdr::default_layout);
     remove_unused_phi_entry(*ele->entry());
 
     split_stateptr_branch(*ele);
     replace_vector_ops(*ele);
     replace_map_ops(*ele);
+    replace_fixsized_array_ops(*ele);
     replace_regular_struct_access(*ele->entry());
     replace_packet_meta_op(*ele);
+    replace_checksum_update(*ele);
+    remove_redundant_pkt_access(*ele, CommonHdr::default_layout);
     remove_unused_ops(*ele);
     ele->print(std::cout);
     return 0;
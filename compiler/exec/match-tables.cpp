@@ -0,0 +1,54 @@
+#include "highLv-ir.hpp"
+#include "llvm-load.hpp"
+#include "hir-common-pass.hpp"
+#include "hir-pktop.hpp"
+#include "hir-stateop.hpp"
+#include "hir-loop.hpp"
+#include "hir-table.hpp"
+
+#include <iostream>
+
+// usage: match-tables [--layout <file>] <ElementName> <ir_dir> [ir_dir ...]
+// runs the same passes as example-hir and prints the element's HashMap
+// states as exact match tables, as json
+int main(int argc, char *argv[]) {
+    PacketLayout layout = CommonHdr::default_layout;
+    int argi = 1;
+    if (argc > 2 && std::string(argv[1]) == "--layout") {
+        layout = PacketLayout::LoadFile(argv[2]);
+        argi = 3;
+    }
+    if (argc - argi < 2) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--layout <file>] <ElementName> <ir_dir> [ir_dir ...]" << std::endl;
+        return 1;
+    }
+    LLVMStore store;
+    for (int i = argi + 1; i < argc; i++) {
+        store.load_directory(argv[i]);
+    }
+
+    auto m = std::make_shared<HIR::Module>();
+    auto ele = std::make_shared<HIR::Element>(*m, store, argv[argi]);
+    element_function_inline(*ele);
+    unroll_small_loops(*ele->entry());
+    scalar_replace_aggregates(*ele->module(), *ele->entry());
+    replace_packet_access_op(*ele, layout);
+    remove_unused_phi_entry(*ele->entry());
+
+    split_stateptr_branch(*ele);
+    replace_vector_ops(*ele);
+    replace_map_ops(*ele);
+    replace_fixsized_array_ops(*ele);
+    replace_regular_struct_access(*ele->entry());
+    replace_packet_meta_op(*ele);
+    replace_checksum_update(*ele);
+    remove_redundant_pkt_access(*ele, layout);
+    remove_unused_ops(*ele);
+
+    auto tables = HIR::match_tables(*ele);
+    auto arrays = HIR::register_arrays(*ele);
+    auto steering = HIR::shard_tables(tables, HIR::summarize_state_access(*ele));
+    HIR::print_tables_json(std::cout, *ele, tables, arrays, steering);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "highLv-ir.hpp"
+#include "llvm-load.hpp"
+#include "hir-common-pass.hpp"
+#include "hir-pktop.hpp"
+#include "hir-stateop.hpp"
+#include "hir-loop.hpp"
+#include "hir-parsegraph.hpp"
+
+#include <iostream>
+#include <sstream>
+
+// usage: parse-graph [--layout <file>] [--p4] <ElementName>[,<ElementName>...] <ir_dir> [ir_dir ...]
+// runs the same passes as example-hir on every element and prints the
+// parse graph needed by all of them together (a pipeline), either as
+// a summary or as a P4 parser
+int main(int argc, char *argv[]) {
+    PacketLayout layout = CommonHdr::default_layout;
+    bool p4 = false;
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+        std::string flag = argv[argi];
+        if (flag == "--layout" && argi + 1 < argc) {
+            layout = PacketLayout::LoadFile(argv[argi + 1]);
+            argi += 2;
+        } else if (flag == "--p4") {
+            p4 = true;
+            argi++;
+        } else {
+            break;
+        }
+    }
+    if (argc - argi < 2) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--layout <file>] [--p4] <ElementName>[,<ElementName>...] <ir_dir> [ir_dir ...]"
+                  << std::endl;
+        return 1;
+    }
+    LLVMStore store;
+    for (int i = argi + 1; i < argc; i++) {
+        store.load_directory(argv[i]);
+    }
+
+    std::vector<std::string> ele_names;
+    std::stringstream ss(argv[argi]);
+    std::string name;
+    while (std::getline(ss, name, ',')) {
+        ele_names.emplace_back(name);
+    }
+
+    auto m = std::make_shared<HIR::Module>();
+    HIR::HeaderUsage usage;
+    for (auto &ele_name : ele_names) {
+        auto ele = std::make_shared<HIR::Element>(*m, store, ele_name);
+        element_function_inline(*ele);
+        unroll_small_loops(*ele->entry());
+        scalar_replace_aggregates(*ele->module(), *ele->entry());
+        replace_packet_access_op(*ele, layout);
+        remove_unused_phi_entry(*ele->entry());
+
+        split_stateptr_branch(*ele);
+        replace_vector_ops(*ele);
+        replace_map_ops(*ele);
+        replace_fixsized_array_ops(*ele);
+        replace_regular_struct_access(*ele->entry());
+        replace_packet_meta_op(*ele);
+        replace_checksum_update(*ele);
+        remove_redundant_pkt_access(*ele, layout);
+        remove_unused_ops(*ele);
+        usage += HIR::header_usage_of(*ele->entry());
+    }
+
+    auto graph = HIR::extract_parse_graph(layout, usage);
+    if (p4) {
+        auto parser_name = (ele_names.size() == 1 ? ele_names[0] : "Pipeline") + "Parser";
+        graph.print_p4(std::cout, layout, parser_name);
+    } else {
+        graph.print(std::cout);
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "highLv-ir.hpp"
+#include "llvm-load.hpp"
+#include "hir-common-pass.hpp"
+#include "hir-pktop.hpp"
+#include "hir-stateop.hpp"
+#include "hir-loop.hpp"
+#include "hir-liveness.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+#include <sstream>
+
+// usage: phv-report [--layout <file>] <ElementName>[,<ElementName>...] <ir_dir> [ir_dir ...]
+// runs the same passes as example-hir on every element and prints, as
+// json, the bits live at each stage boundary inside every element and
+// the header fields carried between consecutive elements
+int main(int argc, char *argv[]) {
+    PacketLayout layout = CommonHdr::default_layout;
+    int argi = 1;
+    if (argc > 2 && std::string(argv[1]) == "--layout") {
+        layout = PacketLayout::LoadFile(argv[2]);
+        argi = 3;
+    }
+    if (argc - argi < 2) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--layout <file>] <ElementName>[,<ElementName>...] <ir_dir> [ir_dir ...]"
+                  << std::endl;
+        return 1;
+    }
+    LLVMStore store;
+    for (int i = argi + 1; i < argc; i++) {
+        store.load_directory(argv[i]);
+    }
+
+    std::vector<std::string> ele_names;
+    std::stringstream ss(argv[argi]);
+    std::string name;
+    while (std::getline(ss, name, ',')) {
+        ele_names.emplace_back(name);
+    }
+
+    auto m = std::make_shared<HIR::Module>();
+    std::vector<HIR::HeaderUsage> usages;
+    std::cout << "{" << std::endl;
+    std::cout << "  \"elements\": [";
+    for (size_t i = 0; i < ele_names.size(); i++) {
+        auto ele = std::make_shared<HIR::Element>(*m, store, ele_names[i]);
+        element_function_inline(*ele);
+        unroll_small_loops(*ele->entry());
+        scalar_replace_aggregates(*ele->module(), *ele->entry());
+        replace_packet_access_op(*ele, layout);
+        remove_unused_phi_entry(*ele->entry());
+
+        split_stateptr_branch(*ele);
+        replace_vector_ops(*ele);
+        replace_map_ops(*ele);
+        replace_fixsized_array_ops(*ele);
+        replace_regular_struct_access(*ele->entry());
+        replace_packet_meta_op(*ele);
+        replace_checksum_update(*ele);
+        remove_redundant_pkt_access(*ele, layout);
+        remove_unused_ops(*ele);
+
+        auto info = HIR::analyze_liveness(*ele->entry(), layout);
+        auto report = HIR::packing_report(*ele->entry(), info);
+        std::cout << (i == 0 ? "" : ",") << std::endl << "    ";
+        HIR::print_packing_json(std::cout, *ele, info, report, "    ");
+        usages.emplace_back(HIR::header_usage_of(*ele->entry()));
+    }
+    std::cout << std::endl << "  ]," << std::endl;
+
+    auto between = HIR::pipeline_live_fields(usages);
+    std::cout << "  \"element_boundaries\": [";
+    for (size_t i = 0; i < between.size(); i++) {
+        std::cout << (i == 0 ? "" : ",") << std::endl;
+        std::cout << "    {\"after\": " << json_str(ele_names[i])
+                  << ", \"bits\": " << HIR::fields_n_bits(layout, between[i])
+                  << ", \"fields\": [";
+        bool first = true;
+        for (auto &f : between[i]) {
+            std::cout << (first ? "" : ", ") << json_str(f);
+            first = false;
+        }
+        std::cout << "]}";
+    }
+    if (!between.empty()) {
+        std::cout << std::endl << "  ";
+    }
+    std::cout << "]" << std::endl;
+    std::cout << "}" << std::endl;
+    return 0;
+}
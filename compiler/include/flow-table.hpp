@@ -0,0 +1,421 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum class TableInsertResult {
+    INSERTED,
+    // the key was there, its value is overwritten
+    UPDATED,
+    // capacity entries are held already
+    FULL,
+};
+
+// a key laid out as the packed bytes of a MatchTable key, e.g. 12 for
+// IPFlowID, compared and hashed as raw bytes
+template <size_t N>
+struct PackedKey {
+    uint8_t bytes[N];
+
+    bool operator==(const PackedKey &o) const { return std::memcmp(bytes, o.bytes, N) == 0; }
+    bool operator!=(const PackedKey &o) const { return !(*this == o); }
+};
+
+template <size_t N>
+struct PackedKeyHash {
+    size_t operator()(const PackedKey<N> &k) const {
+        // 64 bits at a time, multiply and fold
+        uint64_t h = N;
+        size_t i = 0;
+        for (; i + 8 <= N; i += 8) {
+            uint64_t w;
+            std::memcpy(&w, k.bytes + i, 8);
+            h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+            h ^= h >> 32;
+        }
+        if (i < N) {
+            uint64_t w = 0;
+            std::memcpy(&w, k.bytes + i, N - i);
+            h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+            h ^= h >> 32;
+        }
+        return h;
+    }
+};
+
+/* open addressing exact match table with a fixed capacity, the host side
+ * of a MatchTable (hir-table.hpp). slots live in one array and a lookup
+ * probes consecutive slots instead of following a bucket chain, the
+ * slot array is kept at most 3/4 full. erase shifts later entries of the
+ * probe run back, so there are no tombstones and lookups of missing keys
+ * stop at the first empty slot
+ */
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class FlowTable {
+public:
+    using InsertResult = TableInsertResult;
+    using key_type = K;
+    using mapped_type = V;
+
+    explicit FlowTable(size_t capacity, const Hash &hash = Hash(), const Eq &eq = Eq())
+        : capacity_(capacity),
+          hash_(hash),
+          eq_(eq) {
+        assert(capacity > 0);
+        size_t n = 8;
+        while (n * 3 / 4 < capacity) {
+            n *= 2;
+        }
+        mask_ = n - 1;
+        used_.assign(n, false);
+        keys_.resize(n);
+        vals_.resize(n);
+    }
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    size_t num_slots() const { return mask_ + 1; }
+
+    // pointer to the value, nullptr on a miss, like HashMap::findp
+    V *findp(const K &key) {
+        auto slot = find_slot(key);
+        return used_[slot] ? &vals_[slot] : nullptr;
+    }
+
+    const V *findp(const K &key) const {
+        auto slot = find_slot(key);
+        return used_[slot] ? &vals_[slot] : nullptr;
+    }
+
+    // start loading the key's home slot
+    void prefetch(const K &key) const {
+        auto home = home_of(key);
+        __builtin_prefetch(&used_[home]);
+        __builtin_prefetch(&keys_[home]);
+    }
+
+    InsertResult insert(const K &key, const V &val) {
+        auto slot = find_slot(key);
+        if (used_[slot]) {
+            vals_[slot] = val;
+            return InsertResult::UPDATED;
+        }
+        if (size_ == capacity_) {
+            return InsertResult::FULL;
+        }
+        used_[slot] = true;
+        keys_[slot] = key;
+        vals_[slot] = val;
+        size_++;
+        return InsertResult::INSERTED;
+    }
+
+    bool erase(const K &key) {
+        auto hole = find_slot(key);
+        if (!used_[hole]) {
+            return false;
+        }
+        used_[hole] = false;
+        size_--;
+        // move back entries whose probe run passes over the hole
+        for (auto i = next(hole); used_[i]; i = next(i)) {
+            auto home = home_of(keys_[i]);
+            // home not cyclically in (hole, i]
+            if (((i - home) & mask_) >= ((i - hole) & mask_)) {
+                keys_[hole] = std::move(keys_[i]);
+                vals_[hole] = std::move(vals_[i]);
+                used_[hole] = true;
+                used_[i] = false;
+                hole = i;
+            }
+        }
+        return true;
+    }
+
+    void clear() {
+        used_.assign(used_.size(), false);
+        size_ = 0;
+    }
+
+    template <typename F>
+    void for_each(F &&f) const {
+        for (size_t i = 0; i < used_.size(); i++) {
+            if (used_[i]) {
+                f(keys_[i], vals_[i]);
+            }
+        }
+    }
+
+private:
+    size_t capacity_;
+    size_t size_ = 0;
+    size_t mask_;
+    Hash hash_;
+    Eq eq_;
+    std::vector<uint8_t> used_;
+    std::vector<K> keys_;
+    std::vector<V> vals_;
+
+    size_t home_of(const K &key) const { return hash_(key) & mask_; }
+    size_t next(size_t i) const { return (i + 1) & mask_; }
+
+    // the slot holding the key, or the empty slot ending its probe run
+    size_t find_slot(const K &key) const {
+        auto i = home_of(key);
+        while (used_[i] && !eq_(keys_[i], key)) {
+            i = next(i);
+        }
+        return i;
+    }
+};
+
+/* the fast path table: slots are grouped by 16 with a control byte each,
+ * empty, deleted or 7 bits of the key's hash. a lookup compares the tag
+ * against the 16 control bytes of a group at once (one SSE2 compare) and
+ * only looks at keys whose tag matches, so a hit usually costs the miss
+ * on the control bytes and the one on the slot. groups are probed
+ * triangularly and at most 7/8 of the slots are used or deleted, a
+ * lookup stops at the first group with an empty slot. prefetch and
+ * find_batch start the misses of many keys before waiting on any
+ */
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class SwissFlowTable {
+public:
+    using InsertResult = TableInsertResult;
+    using key_type = K;
+    using mapped_type = V;
+    static constexpr size_t GROUP = 16;
+
+    explicit SwissFlowTable(size_t capacity, const Hash &hash = Hash(), const Eq &eq = Eq())
+        : capacity_(capacity),
+          hash_(hash),
+          eq_(eq) {
+        assert(capacity > 0);
+        size_t groups = 1;
+        while (groups * GROUP * 7 / 8 < capacity) {
+            groups *= 2;
+        }
+        group_mask_ = groups - 1;
+        ctrl_.assign(groups * GROUP, EMPTY);
+        slots_.resize(groups * GROUP);
+    }
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    size_t num_slots() const { return slots_.size(); }
+
+    V *findp(const K &key) {
+        auto slot = find_slot(key, hash_of(key));
+        return slot < 0 ? nullptr : &slots_[slot].second;
+    }
+
+    const V *findp(const K &key) const {
+        auto slot = find_slot(key, hash_of(key));
+        return slot < 0 ? nullptr : &slots_[slot].second;
+    }
+
+    // start loading the first group the key probes
+    void prefetch(const K &key) const { prefetch_hash(hash_of(key)); }
+
+    /* out[i] = findp(keys[i]): hashes every key and prefetches its group
+     * before probing any of them, so the misses overlap
+     */
+    void find_batch(const K *keys, size_t n, V **out) {
+        static constexpr size_t BATCH = 32;
+        size_t hashes[BATCH];
+        for (size_t base = 0; base < n; base += BATCH) {
+            auto m = std::min(BATCH, n - base);
+            for (size_t i = 0; i < m; i++) {
+                hashes[i] = hash_of(keys[base + i]);
+                prefetch_hash(hashes[i]);
+            }
+            for (size_t i = 0; i < m; i++) {
+                auto slot = find_slot(keys[base + i], hashes[i]);
+                out[base + i] = slot < 0 ? nullptr : &slots_[slot].second;
+            }
+        }
+    }
+
+    InsertResult insert(const K &key, const V &val) {
+        auto h = hash_of(key);
+        auto slot = find_slot(key, h);
+        if (slot >= 0) {
+            slots_[slot].second = val;
+            return InsertResult::UPDATED;
+        }
+        if (size_ == capacity_) {
+            return InsertResult::FULL;
+        }
+        if ((size_ + deleted_ + 1) * 8 > ctrl_.size() * 7) {
+            // only deleted slots can push us here, clean them out
+            rehash();
+        }
+        auto free = find_free(h);
+        if (ctrl_[free] == DELETED) {
+            deleted_--;
+        }
+        ctrl_[free] = tag_of(h);
+        slots_[free] = {key, val};
+        size_++;
+        return InsertResult::INSERTED;
+    }
+
+    bool erase(const K &key) {
+        auto slot = find_slot(key, hash_of(key));
+        if (slot < 0) {
+            return false;
+        }
+        // a group that never filled up ends every probe through it, its
+        // slots can be emptied, a full one may have pushed keys further
+        auto group = slot / GROUP * GROUP;
+        bool had_empty = false;
+        for (size_t i = 0; i < GROUP; i++) {
+            had_empty = had_empty || ctrl_[group + i] == EMPTY;
+        }
+        if (had_empty) {
+            ctrl_[slot] = EMPTY;
+        } else {
+            ctrl_[slot] = DELETED;
+            deleted_++;
+        }
+        size_--;
+        return true;
+    }
+
+    void clear() {
+        ctrl_.assign(ctrl_.size(), EMPTY);
+        size_ = 0;
+        deleted_ = 0;
+    }
+
+    template <typename F>
+    void for_each(F &&f) const {
+        for (size_t i = 0; i < ctrl_.size(); i++) {
+            if (is_full(ctrl_[i])) {
+                f(slots_[i].first, slots_[i].second);
+            }
+        }
+    }
+
+private:
+    static constexpr uint8_t EMPTY = 0x80;
+    static constexpr uint8_t DELETED = 0xfe;
+
+    size_t capacity_;
+    size_t size_ = 0;
+    size_t deleted_ = 0;
+    size_t group_mask_;
+    Hash hash_;
+    Eq eq_;
+    std::vector<uint8_t> ctrl_;
+    std::vector<std::pair<K, V>> slots_;
+
+    static bool is_full(uint8_t c) { return (c & 0x80) == 0; }
+
+    size_t hash_of(const K &key) const {
+        // spread weak hashes (std::hash of an int is the int)
+        uint64_t h = hash_(key) * 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 29);
+    }
+
+    static uint8_t tag_of(size_t h) { return h & 0x7f; }
+    size_t first_group(size_t h) const { return (h >> 7) & group_mask_; }
+
+    void prefetch_hash(size_t h) const {
+        auto g = first_group(h) * GROUP;
+        __builtin_prefetch(&ctrl_[g]);
+        __builtin_prefetch(&slots_[g]);
+    }
+
+    // bit i set if ctrl byte i of the group equals c
+    uint32_t match(size_t group, uint8_t c) const {
+        auto p = &ctrl_[group * GROUP];
+#ifdef __SSE2__
+        auto ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+#else
+        uint32_t bits = 0;
+        for (size_t i = 0; i < GROUP; i++) {
+            bits |= (uint32_t)(p[i] == c) << i;
+        }
+        return bits;
+#endif
+    }
+
+    // the slot of the key, -1 if it is not in the table
+    ptrdiff_t find_slot(const K &key, size_t h) const {
+        auto tag = tag_of(h);
+        auto g = first_group(h);
+        for (size_t step = 1; step <= group_mask_ + 1; step++) {
+            for (auto bits = match(g, tag); bits != 0; bits &= bits - 1) {
+                auto slot = g * GROUP + __builtin_ctz(bits);
+                if (eq_(slots_[slot].first, key)) {
+                    return slot;
+                }
+            }
+            if (match(g, EMPTY) != 0) {
+                return -1;
+            }
+            g = (g + step) & group_mask_;
+        }
+        return -1;
+    }
+
+    // the first empty or deleted slot on the key's probe sequence
+    size_t find_free(size_t h) const {
+        auto g = first_group(h);
+        for (size_t step = 1;; step++) {
+            auto bits = match(g, EMPTY) | match(g, DELETED);
+            if (bits != 0) {
+                return g * GROUP + __builtin_ctz(bits);
+            }
+            g = (g + step) & group_mask_;
+        }
+    }
+
+    void rehash() {
+        std::vector<std::pair<K, V>> entries;
+        entries.reserve(size_);
+        for_each([&](const K &k, const V &v) { entries.emplace_back(k, v); });
+        clear();
+        for (auto &kv : entries) {
+            auto h = hash_of(kv.first);
+            auto free = find_free(h);
+            ctrl_[free] = tag_of(h);
+            slots_[free] = std::move(kv);
+            size_++;
+        }
+    }
+};
+
+/* the batch mode of a BatchPlan (hir-batch.hpp) over a burst of packets:
+ * key_of(pkt, key) is the key stage, every key is prefetched before the
+ * first lookup, then finish(pkt, key, findp(key)) runs packet by packet.
+ * the lookups themselves still happen in packet order, so an insert made
+ * while finishing one packet is seen by the lookups of the next
+ */
+template <typename Table, typename Pkt, typename KeyOf, typename Finish>
+void lookup_burst(Table &t, Pkt *pkts, size_t n, KeyOf &&key_of, Finish &&finish) {
+    static constexpr size_t BURST = 32;
+    typename Table::key_type keys[BURST];
+    for (size_t base = 0; base < n; base += BURST) {
+        auto m = std::min(BURST, n - base);
+        for (size_t i = 0; i < m; i++) {
+            key_of(pkts[base + i], keys[i]);
+            t.prefetch(keys[i]);
+        }
+        for (size_t i = 0; i < m; i++) {
+            finish(pkts[base + i], keys[i], t.findp(keys[i]));
+        }
+    }
+}
@@ -87,8 +87,7 @@ public:
         }
 
         const E& value() {
-            auto dst  = adj_list_->edge_lists_[src_][curr_idx_].dst;
-            return *adj_list_->get_edge(src_, dst).value();
+            return adj_list_->edge_lists_[src_][curr_idx_].value;
         }
 
         OutEdgeIter operator++() {
@@ -147,7 +146,7 @@ class AdjacencyMatrix {
 public:
     AdjacencyMatrix(int n_vertex)
         : n_vertex_(n_vertex),
-          edge_val_(n_vertex * n_vertex, std::nullopt) {
+          edge_val_((size_t)n_vertex * n_vertex, std::nullopt) {
     }
 
     void set_edge(size_t src, size_t dst, const E& e) {
@@ -346,40 +345,171 @@ public:
         return scc_list;
     }
 
+    // one vertex per scc, edges inside an scc are dropped so the result is a DAG
+    Graph<
+        std::monostate,
+        std::monostate,
+        AdjacencyList<std::monostate>
+    > CondensedGraph(const std::vector<std::vector<size_t>> &scc_list) const {
+        std::vector<std::monostate> scc_vertices(scc_list.size(), std::monostate());
+        AdjacencyList<std::monostate> scc_edges(scc_list.size());
+        std::vector<size_t> idx2sccidx(vertices_.size(), 0);
+        for (size_t i = 0; i < scc_list.size(); i++) {
+            for (auto v : scc_list[i]) {
+                idx2sccidx[v] = i;
+            }
+        }
+        for (size_t i = 0; i < scc_list.size(); i++) {
+            for (auto v : scc_list[i]) {
+                for (auto iter = edges_.out_edge_begin(v); iter != iter.end(); iter++) {
+                    auto dst = idx2sccidx[*iter];
+                    if (dst != i) {
+                        scc_edges.set_edge(i, dst, std::monostate());
+                    }
+                }
+            }
+        }
+        return Graph<
+            std::monostate,
+            std::monostate,
+            AdjacencyList<std::monostate>
+        >(std::move(scc_vertices), std::move(scc_edges));
+    }
+
+    // all vertices reachable from src (src included), one traversal
+    std::vector<bool> ReachableFrom(size_t src) const {
+        std::vector<bool> visited(vertices_.size(), false);
+        std::vector<size_t> stack{src};
+        visited[src] = true;
+        while (!stack.empty()) {
+            auto curr = stack.back();
+            stack.pop_back();
+            for (auto iter = edges_.out_edge_begin(curr); iter != iter.end(); iter++) {
+                if (!visited[*iter]) {
+                    visited[*iter] = true;
+                    stack.emplace_back(*iter);
+                }
+            }
+        }
+        return visited;
+    }
+
+    // immediate dominators (Cooper, Harvey & Kennedy), idom[entry] == entry,
+    // vertices not reachable from entry get n_vertex()
+    std::vector<size_t> ImmediateDominators(size_t entry) const {
+        auto n = vertices_.size();
+        std::vector<bool> visited(n, false);
+        std::vector<size_t> post_order;
+        dfs(visited, post_order, entry);
+
+        std::vector<size_t> post_num(n, n);
+        for (size_t i = 0; i < post_order.size(); i++) {
+            post_num[post_order[i]] = i;
+        }
+        std::vector<std::vector<size_t>> preds(n);
+        for (auto v : post_order) {
+            for (auto iter = edges_.out_edge_begin(v); iter != iter.end(); iter++) {
+                preds[*iter].emplace_back(v);
+            }
+        }
+
+        std::vector<size_t> idom(n, n);
+        idom[entry] = entry;
+        auto intersect = [&idom, &post_num] (size_t a, size_t b) {
+            while (a != b) {
+                while (post_num[a] < post_num[b]) {
+                    a = idom[a];
+                }
+                while (post_num[b] < post_num[a]) {
+                    b = idom[b];
+                }
+            }
+            return a;
+        };
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            // reverse post-order, skipping the entry
+            for (int i = (int)post_order.size() - 2; i >= 0; i--) {
+                auto v = post_order[i];
+                auto new_idom = n;
+                for (auto p : preds[v]) {
+                    if (idom[p] == n) {
+                        continue;
+                    }
+                    new_idom = (new_idom == n) ? p : intersect(p, new_idom);
+                }
+                if (new_idom != idom[v]) {
+                    idom[v] = new_idom;
+                    changed = true;
+                }
+            }
+        }
+        return idom;
+    }
+
+    // iterative, so deep graphs (long CFG chains) do not overflow the stack
     bool HasCycleFrom(std::vector<bool> &visited,
                       std::vector<bool> &visiting,
-                      size_t curr) const {
-        if (visited[curr]) {
+                      size_t start) const {
+        if (visited[start]) {
             return false;
         }
-        if (visiting[curr]) {
-            return true;
-        }
-        visited[curr] = true;
-        visiting[curr] = true;
-        for (auto iter = edges_.out_edge_begin(curr); iter != iter.end(); iter++) {
-            auto neighbor = *iter;
-            auto found_cycle = HasCycleFrom(visited, visiting, neighbor);
-            if (found_cycle) { return true; }
+        std::vector<std::pair<size_t, OutEdgeIterT>> stack;
+        visited[start] = true;
+        visiting[start] = true;
+        stack.emplace_back(start, edges_.out_edge_begin(start));
+        while (!stack.empty()) {
+            auto &iter = stack.back().second;
+            if (iter != iter.end()) {
+                auto neighbor = *iter;
+                iter++;
+                if (visiting[neighbor]) {
+                    return true;
+                }
+                if (!visited[neighbor]) {
+                    visited[neighbor] = true;
+                    visiting[neighbor] = true;
+                    stack.emplace_back(neighbor, edges_.out_edge_begin(neighbor));
+                }
+            } else {
+                visiting[stack.back().first] = false;
+                stack.pop_back();
+            }
         }
-        visiting[curr] = false;
         return false;
     }
 protected:
+    using OutEdgeIterT = decltype(std::declval<const EdgeContainerT&>().out_edge_begin(0));
+
     std::vector<V> vertices_;
     EdgeContainerT edges_;
 
+    // appends vertices in dfs post-order
     void dfs(std::vector<bool> &visited,
              std::vector<size_t> &result,
-             size_t curr) const {
-        if (visited[curr]) {
+             size_t start) const {
+        if (visited[start]) {
             return;
         }
-        visited[curr] = true;
-        for (auto iter = edges_.out_edge_begin(curr); iter != iter.end(); iter++) {
-            dfs(visited, result, *iter);
+        std::vector<std::pair<size_t, OutEdgeIterT>> stack;
+        visited[start] = true;
+        stack.emplace_back(start, edges_.out_edge_begin(start));
+        while (!stack.empty()) {
+            auto &iter = stack.back().second;
+            if (iter != iter.end()) {
+                auto next = *iter;
+                iter++;
+                if (!visited[next]) {
+                    visited[next] = true;
+                    stack.emplace_back(next, edges_.out_edge_begin(next));
+                }
+            } else {
+                result.emplace_back(stack.back().first);
+                stack.pop_back();
+            }
         }
-        result.emplace_back(curr);
     }
 };
 
@@ -46,6 +46,8 @@ namespace HIR {
         std::unordered_map<std::string, std::vector<std::string>> out_connection;
 
         std::shared_ptr<Type> get_int_type(int bitwidth);
+        // a pointer to pointee, made once and kept in types
+        std::shared_ptr<Type> get_ptr_type(Type *pointee);
     };
 
 
@@ -109,10 +111,11 @@ namespace HIR {
         std::string name() const { return element_name_; }
 
         Module *module() const { return module_; }
+        void set_module(Module *m) { module_ = m; }
     protected:
         int entry_func_idx_;
         std::string element_name_;
-        Module *module_;
+        Module *module_ = nullptr;
 
         void create_function_placeholder(
             llvm::Function *f,
@@ -307,6 +310,12 @@ namespace HIR {
             PKT_HDR_STORE,
             PKT_ENCAP,
             PKT_DECAP,
+            // dst = ~(~field + delta) in ones' complement (RFC 1624), stored
+            // back to the checksum field, args: packet, delta
+            PKT_CSUM_UPDATE,
+            // dst = pointer to element args[1] of the fixed capacity array
+            // state args[0], see RegisterArray (hir-table.hpp)
+            STATE_IDX,
             UNREACHABLE,
         };
 
@@ -424,6 +433,12 @@ namespace HIR {
                 case T::PKT_DECAP:
                     return static_cast<DerivedT *>(this)->visitPktDecap(op);
                     break;
+                case T::PKT_CSUM_UPDATE:
+                    return static_cast<DerivedT *>(this)->visitPktCsumUpdate(op);
+                    break;
+                case T::STATE_IDX:
+                    return static_cast<DerivedT *>(this)->visitStateIdx(op);
+                    break;
                 case T::UNREACHABLE:
                     return static_cast<DerivedT *>(this)->visitUnreachable(op);
                     break;
@@ -455,6 +470,8 @@ namespace HIR {
         VISITOR_DEFAULT_IMPL(visitPktStore);
         VISITOR_DEFAULT_IMPL(visitPktEncap);
         VISITOR_DEFAULT_IMPL(visitPktDecap);
+        VISITOR_DEFAULT_IMPL(visitPktCsumUpdate);
+        VISITOR_DEFAULT_IMPL(visitStateIdx);
         VISITOR_DEFAULT_IMPL(visitUnreachable);
 
 #undef VISITOR_DEFAULT_IMPL
@@ -511,6 +528,12 @@ namespace HIR {
                 case T::PKT_DECAP:
                     return static_cast<DerivedT *>(this)->visitPktDecap(op);
                     break;
+                case T::PKT_CSUM_UPDATE:
+                    return static_cast<DerivedT *>(this)->visitPktCsumUpdate(op);
+                    break;
+                case T::STATE_IDX:
+                    return static_cast<DerivedT *>(this)->visitStateIdx(op);
+                    break;
                 case T::UNREACHABLE:
                     return static_cast<DerivedT *>(this)->visitUnreachable(op);
                     break;
@@ -542,6 +565,8 @@ namespace HIR {
         VISITOR_DEFAULT_IMPL(visitPktStore);
         VISITOR_DEFAULT_IMPL(visitPktEncap);
         VISITOR_DEFAULT_IMPL(visitPktDecap);
+        VISITOR_DEFAULT_IMPL(visitPktCsumUpdate);
+        VISITOR_DEFAULT_IMPL(visitStateIdx);
         VISITOR_DEFAULT_IMPL(visitUnreachable);
 
 #undef VISITOR_DEFAULT_IMPL
@@ -578,6 +603,9 @@ namespace HIR {
             BuiltInFunctionStore::get()->register_builtin(f);
         }
     };
+
+    // "map", "vector", "fix_arr" or "state", also the prefix of state names
+    std::string global_state_type_str(Type *t);
 }
 
 #define DEF_HIR_BUILTIN_FUNC(NAME)                                       \
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "highLv-ir.hpp"
+#include "hir-common-pass.hpp"
+
+namespace HIR {
+    struct BatchLookup {
+        const Operation *lookup;
+        // the map state and the key the lookup is made with
+        std::shared_ptr<Var> table;
+        std::shared_ptr<Var> key;
+        // the key is ready at the end of the entry block
+        bool hoisted = false;
+    };
+
+    /* batch mode of an entry function: the entry block of every packet of
+     * a burst runs first (the key stage), then the bucket of every hoisted
+     * lookup is prefetched, then each packet continues from the end of its
+     * entry block and finds its buckets in cache. lookup_burst
+     * (flow-table.hpp) is the host side driver
+     */
+    struct BatchPlan {
+        std::vector<BatchLookup> lookups;
+        // ops moved to the end of the entry block, in order
+        std::vector<std::shared_ptr<Operation>> key_ops;
+        // the entry block only reads the packet and reads and writes
+        // locals, so running it for a whole burst first is not seen by
+        // any packet
+        bool batchable = false;
+    };
+
+    /* moves the computation of map lookup keys into the entry block. a key
+     * is hoisted when every write to it dominates the lookup, the values
+     * written only depend on the packet, params and constants, and nothing
+     * on the way to the lookup writes the packet. a packet that does not
+     * reach the lookup still computes its key from whatever bytes are
+     * there, a target has to make such header reads safe.
+     * works on the entry function after replace_map_ops
+     */
+    BatchPlan batch_map_lookups(Function &f);
+    BatchPlan batch_map_lookups(Element &ele);
+}
@@ -3,6 +3,7 @@
 #include "highLv-ir.hpp"
 #include "graph.hpp"
 #include <unordered_map>
+#include <unordered_set>
 
 
 namespace HIR {
@@ -11,10 +12,42 @@ namespace HIR {
         int op_idx;
     };
 
+    // size limits for inlining, measured in HIR ops
+    struct InlineCostModel {
+        // callees bigger than this (after their own inlining) stay as calls
+        size_t max_callee_size = 4096;
+        // no function body grows past this by inlining
+        size_t max_func_size = 65536;
+    };
+
+    struct InlineSummary {
+        bool is_recursive = false;
+        // not recursive, not built-in and with a single return block
+        bool inlinable = false;
+        size_t self_size = 0;
+        // estimated size once the call sites chosen below are expanded
+        size_t inlined_size = 0;
+    };
+
+    // computed once per element, bottom-up over the call graph scc DAG
+    struct InlinePlan {
+        std::unordered_map<const Function *, InlineSummary> summaries;
+        // call ops (in the original callee bodies) that will be expanded
+        std::unordered_set<const Operation *> inline_sites;
+    };
+
+    InlinePlan plan_inline(const Element &ele, const InlineCostModel &model);
+
     // void element_function_builtin(Function &f);
     void element_function_inline(Element &ele);
+    void element_function_inline(Element &ele, const InlineCostModel &model);
 
     bool has_side_effect(const Operation &op);
+    bool is_builtin_call(const Operation &op, const std::string &name);
+    // writes to an alloca'd local through the pointer or pointers derived
+    // from it (map keys, IPFlowID), false if the pointer goes anywhere that
+    // could write or keep it. needs update_uses
+    bool collect_local_writes(const Var &ptr, std::vector<Operation *> &writes);
 
     void remove_all_meta(Function& f);
     void remove_all_meta(Element& ele);
@@ -22,6 +55,22 @@ namespace HIR {
     void update_uses(Element& ele);
     void remove_unused_ops(Element& ele);
 
+    /* scalar replacement of aggregates: a struct or array alloca only
+     * reached through constant geps and loads and stores of its scalar
+     * fields is split into one alloca per field used (laid out by
+     * struct_info.offsets). a byte pointer to it may go to llvm.memcpy or
+     * llvm.memset of a constant length covering whole fields, the copy
+     * becomes a load and a store per field. a field stored once before all
+     * its loads is replaced by the value stored, one never loaded is
+     * dropped. allocas passed to other calls or indexed by a variable stay
+     * as they are: an IPFlowID built by its constructor (the fields come
+     * from the packet, known only to replace_packet_access_op) or a map
+     * key or entry handed to HashMap findp / insert, as in MyIPRewriter.
+     * run after inlining, before replace_regular_struct_access, returns
+     * the number of allocas split
+     */
+    int scalar_replace_aggregates(Module &m, Function &f);
+
     // find phi-node and select inst regarding to global states
     // and expand them
     // we assume that these ops are not in loops
@@ -32,6 +81,8 @@ namespace HIR {
     void fork_from_bb(Function& f, int bb_idx);
     void remove_unused_phi_entry(Function& f);
     void remove_empty_bb(Function& f);
+    // drop blocks the entry can no longer reach
+    void remove_unreachable_bb(Function& f);
 
     void break_select_op(Function& f, std::shared_ptr<Operation> op);
 
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "highLv-ir.hpp"
+#include "hir-common-pass.hpp"
+#include <array>
+#include <iostream>
+#include <map>
+
+namespace HIR {
+    enum class CostKind {
+        ARITH,
+        PKT_HDR_LOAD,
+        PKT_HDR_STORE,
+        PKT_CSUM_UPDATE,
+        MAP_FIND,
+        MAP_INSERT,
+        // STATE_IDX and Vector::operator[] calls
+        STATE_IDX,
+        // calls not covered by the kinds above
+        FUNC_CALL,
+        // LOAD and STRUCT_GET
+        MEM_LOAD,
+        // STORE and STRUCT_SET
+        MEM_STORE,
+        OTHER,
+
+        NUM_KINDS,
+    };
+
+    const char *cost_kind_name(CostKind k);
+    CostKind cost_kind_of(const Operation &op);
+
+    struct OpCost {
+        std::array<uint64_t, (size_t)CostKind::NUM_KINDS> counts{};
+        // accesses per state, keyed by global_state_idx
+        std::map<size_t, uint64_t> state_accesses;
+
+        uint64_t &operator[](CostKind k) { return counts[(size_t)k]; }
+        uint64_t operator[](CostKind k) const { return counts[(size_t)k]; }
+        uint64_t total() const;
+
+        OpCost &operator+=(const OpCost &other);
+        OpCost operator*(uint64_t n) const;
+        // element-wise maximum
+        void max_with(const OpCost &other);
+    };
+
+    OpCost cost_of_bb(const BasicBlock &bb);
+
+    // one entry-to-exit path through the scc DAG of the control graph
+    struct PathCost {
+        std::vector<std::shared_ptr<BasicBlock>> bbs;
+        bool ends_in_err = false;
+        OpCost cost;
+    };
+
+    struct FunctionCost {
+        // false if some cycle has no known trip count, cycles are then
+        // counted as a single iteration
+        bool bounded = true;
+        // every kind maximised over all paths on its own
+        OpCost worst_case;
+        // the path with the most ops
+        OpCost longest_path;
+        size_t longest_path_bbs = 0;
+        // saturates at UINT64_MAX
+        uint64_t num_paths = 0;
+        std::vector<PathCost> paths;
+        bool paths_truncated = false;
+    };
+
+    struct CostModelOptions {
+        // enumerated paths reported one by one
+        size_t max_paths = 256;
+    };
+
+    FunctionCost analyze_cost(const Function &f, const CostModelOptions &opts);
+    FunctionCost analyze_cost(const Function &f);
+
+    void print_cost_json(std::ostream &os, const Element &ele, const FunctionCost &cost);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "highLv-ir.hpp"
+#include "hir-parsegraph.hpp"
+#include "pkt-layout.hpp"
+#include <iostream>
+#include <set>
+
+namespace HIR {
+    // header fields ("header.field") and vars holding a value still needed
+    struct LiveSet {
+        std::set<std::string> fields;
+        std::unordered_set<Var *> vars;
+
+        bool operator==(const LiveSet &other) const {
+            return fields == other.fields && vars == other.vars;
+        }
+        LiveSet &operator+=(const LiveSet &other);
+    };
+
+    // bits a var takes when carried between stages, pointers to the
+    // packet, states and the element are implicit and take none, an
+    // alloca takes the size of what it allocates
+    size_t var_n_bits(const Var &v);
+
+    // a field is live where a later load reads it before it is stored to.
+    // fields stored to anywhere are live at every return, a target has to
+    // carry them to the deparser
+    struct LivenessInfo {
+        std::unordered_map<const BasicBlock *, LiveSet> live_in;
+        std::unordered_map<const BasicBlock *, LiveSet> live_out;
+        // most bits live at once inside each block
+        std::unordered_map<const BasicBlock *, size_t> max_bits;
+        std::unordered_map<std::string, size_t> field_bits;
+        // "header.bit_field" -> "header.field"
+        std::unordered_map<std::string, std::string> field_container;
+
+        size_t field_n_bits(const LiveSet &s) const;
+        size_t var_n_bits(const LiveSet &s) const;
+        size_t n_bits(const LiveSet &s) const { return field_n_bits(s) + var_n_bits(s); }
+
+        // what has to flow along the edge, phi inputs from "from" included
+        LiveSet live_on_edge(const BasicBlock &from, const BasicBlock &to) const;
+    };
+
+    // works on the entry function after replace_packet_access_op
+    LivenessInfo analyze_liveness(const Function &f, const PacketLayout &layout);
+
+    /* blocks are put in stages by their longest distance from the entry
+     * (loops count as one block), boundary k separates stage k from k + 1
+     * and carries everything live on the edges crossing it
+     */
+    struct StageBoundary {
+        size_t stage;
+        LiveSet live;
+        size_t field_bits = 0;
+        size_t var_bits = 0;
+
+        size_t total_bits() const { return field_bits + var_bits; }
+    };
+
+    struct PackingReport {
+        std::unordered_map<const BasicBlock *, size_t> stage_of;
+        size_t num_stages = 0;
+        std::vector<StageBoundary> boundaries;
+        // the boundary with the most bits, -1 if there is none
+        int max_boundary = -1;
+        // most bits live at any single point, a boundary adds up what is
+        // live on all the paths crossing it so it can be more than this
+        size_t max_bits = 0;
+    };
+
+    PackingReport packing_report(const Function &f, const LivenessInfo &info);
+
+    // fields live between consecutive elements of a pipeline: read by a
+    // later element or written by an earlier one
+    std::vector<std::set<std::string>> pipeline_live_fields(const std::vector<HeaderUsage> &usages);
+    size_t fields_n_bits(const PacketLayout &layout, const std::set<std::string> &fields);
+
+    void print_packing_json(std::ostream &os,
+                            const Element &ele,
+                            const LivenessInfo &info,
+                            const PackingReport &report,
+                            const std::string &indent = "");
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "highLv-ir.hpp"
+#include "hir-common-pass.hpp"
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace HIR {
+    // constant-folds an ARITH op given the values of its args,
+    // nullopt when the result is undefined (e.g. division by zero)
+    std::optional<uint64_t> fold_int_arith(const Operation &op, const std::vector<uint64_t> &args);
+
+    // header phi of the form  i = phi(init, i +/- step)
+    struct InductionVar {
+        std::shared_ptr<Var> phi;
+        // value coming back along the latch
+        std::shared_ptr<Var> next;
+        uint64_t init;
+        int64_t step;
+    };
+
+    // natural loop, found from back edges whose target dominates the source
+    struct Loop {
+        std::shared_ptr<BasicBlock> header;
+        // the only predecessor of header outside the loop, if there is one
+        std::shared_ptr<BasicBlock> preheader;
+        std::vector<std::shared_ptr<BasicBlock>> latches;
+        std::unordered_set<std::shared_ptr<BasicBlock>> blocks;
+        // blocks inside the loop with an edge leaving it
+        std::vector<std::shared_ptr<BasicBlock>> exiting;
+
+        // index into LoopInfo::loops, -1 for outermost loops
+        int parent = -1;
+        int depth = 1;
+        bool has_subloop = false;
+
+        std::vector<InductionVar> induction_vars;
+        // number of times the header runs, when it follows from constants
+        std::optional<uint64_t> trip_count;
+
+        size_t num_ops() const;
+    };
+
+    struct LoopInfo {
+        std::vector<Loop> loops;
+        // innermost loop of each block in a loop
+        std::unordered_map<std::shared_ptr<BasicBlock>, int> loop_of;
+    };
+
+    // trip counts above max_trip_count are reported as unknown
+    LoopInfo analyze_loops(const Function &f, uint64_t max_trip_count);
+    LoopInfo analyze_loops(const Function &f);
+
+    struct UnrollOptions {
+        uint64_t max_trip_count = 16;
+        // ops of the loop body times trip count
+        size_t max_unrolled_size = 2048;
+    };
+
+    // fully unroll innermost loops with a known, small trip count,
+    // returns the number of loops removed
+    int unroll_small_loops(Function &f, const UnrollOptions &opts);
+    int unroll_small_loops(Function &f);
+}
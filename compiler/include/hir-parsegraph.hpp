@@ -0,0 +1,55 @@
+#pragma once
+
+#include "highLv-ir.hpp"
+#include "pkt-layout.hpp"
+#include <iostream>
+#include <map>
+#include <set>
+
+namespace HIR {
+    // header fields read and written by the packet ops of a function
+    struct HeaderUsage {
+        std::map<std::string, std::set<std::string>> reads;
+        std::map<std::string, std::set<std::string>> writes;
+
+        std::set<std::string> headers() const;
+        HeaderUsage &operator+=(const HeaderUsage &other);
+    };
+
+    // works on the entry function after replace_packet_access_op
+    HeaderUsage header_usage_of(const Function &f);
+
+    struct ParseState {
+        std::string header;
+        // extracted more than once on some path, e.g. stacked vlan tags
+        bool is_stack = false;
+        std::string select_field;
+        std::vector<std::pair<uint64_t, std::string>> cases;
+        // empty when parsing stops
+        std::string default_next;
+        // fields of this header the program touches
+        std::set<std::string> fields_used;
+    };
+
+    // the part of a layout's parse graph needed to reach the headers a
+    // program uses, everything else is left unparsed
+    struct ParseGraph {
+        // empty if nothing needs to be parsed
+        std::string start;
+        // in parse order, breadth first from start
+        std::vector<ParseState> states;
+        // used headers the layout's parser can not reach
+        std::vector<std::string> unreachable;
+
+        const ParseState *find(const std::string &header) const;
+        void print(std::ostream &os) const;
+        // P4_16 header types, headers struct and parser
+        void print_p4(std::ostream &os,
+                      const PacketLayout &layout,
+                      const std::string &parser_name,
+                      size_t stack_depth = 2) const;
+    };
+
+    ParseGraph extract_parse_graph(const PacketLayout &layout, const HeaderUsage &usage);
+    ParseGraph extract_parse_graph(const PacketLayout &layout, const Function &f);
+}
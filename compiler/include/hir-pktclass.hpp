@@ -0,0 +1,95 @@
+#pragma once
+
+#include "highLv-ir.hpp"
+#include "hir-common-pass.hpp"
+#include <iostream>
+#include <map>
+
+namespace HIR {
+    class SymExpr;
+    using SymExprPtr = std::shared_ptr<const SymExpr>;
+
+    // value of a var in terms of the input packet's header fields
+    class SymExpr {
+    public:
+        enum class T {
+            CONST,
+            // a PKT_HDR_LOAD of the unmodified packet
+            FIELD,
+            // anything not derived from header fields and constants
+            OPAQUE,
+            ARITH,
+        };
+
+        T type;
+        int bitwidth = 64;
+        uint64_t constant = 0;
+        std::string header;
+        std::string field;
+        std::shared_ptr<Var> var;
+        // the ARITH op this expression mirrors
+        const Operation *op = nullptr;
+        std::vector<SymExprPtr> args;
+
+        bool is_const() const { return type == T::CONST; }
+        std::string str() const;
+    };
+
+    struct PathLiteral {
+        SymExprPtr cond;
+        bool value;
+
+        std::string str() const;
+    };
+
+    // disjunction of conjunctions of branch outcomes
+    struct PathPredicate {
+        std::vector<std::vector<PathLiteral>> conjs;
+        // true when precision was dropped to keep the predicate small,
+        // the predicate then covers more packets than the paths do
+        bool approximate = false;
+
+        bool always_true() const;
+        std::string str() const;
+    };
+
+    struct PacketClass {
+        enum class Action {
+            DROP,
+            OUTPUT,
+            // reaches an error block (assertion failure)
+            ERROR,
+            // not sent on, but stored away by the element (e.g. queued)
+            KEEP,
+        };
+
+        Action action;
+        std::vector<SymExprPtr> out_ports;
+        // "header.field" -> value written
+        std::map<std::string, SymExprPtr> rewrites;
+        PathPredicate pred;
+        uint64_t num_paths = 0;
+
+        bool is_rewrite() const { return !rewrites.empty(); }
+        void print(std::ostream &os) const;
+    };
+
+    struct PacketClassInfo {
+        std::vector<PacketClass> classes;
+        // false if some edge was not followed (back edges of loops)
+        bool complete = true;
+
+        void print(std::ostream &os) const;
+    };
+
+    struct PathExploreOptions {
+        // symbolic states kept per basic block before merging harder
+        size_t max_states_per_bb = 64;
+        // conjunctions kept per predicate
+        size_t max_conjs = 64;
+    };
+
+    // works on the entry function after replace_packet_access_op
+    PacketClassInfo explore_packet_classes(const Function &f, const PathExploreOptions &opts);
+    PacketClassInfo explore_packet_classes(const Function &f);
+}
@@ -9,4 +9,21 @@ namespace HIR {
     // meta or means operations like dropping or sending packet
     void replace_packet_meta_op(Element &ele);
     void replace_packet_access_op(Module &m, const PacketLayout &layout);
+
+    /* after replace_packet_access_op: loads of a field whose value is
+     * already known on every path are replaced by that value (an earlier
+     * load or the value stored to it), stores of the value a field
+     * already holds are dropped, so are stores overwritten on every path
+     * before the field is read or the packet leaves the element
+     */
+    void remove_redundant_pkt_access(Function &f, const PacketLayout &layout);
+    void remove_redundant_pkt_access(Element &ele, const PacketLayout &layout);
+
+    /* after replace_packet_access_op: a checksum patched in place the way
+     * DecIPTTL or click_update_in_cksum do it, ~fold(~sum + ~m + m'),
+     * becomes a pkt_csum_update of the field by the sum of the changes.
+     * full recomputations (click_in_cksum) are left as calls
+     */
+    void replace_checksum_update(Function &f);
+    void replace_checksum_update(Element &ele);
 }
\ No newline at end of file
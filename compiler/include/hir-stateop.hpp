@@ -2,13 +2,138 @@
 
 #include "highLv-ir.hpp"
 #include "hir-common-pass.hpp"
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
 
 namespace HIR
 {
+    struct SplitStatePtrOptions {
+        // ops forking may copy in total, a select or phi of state pointers
+        // past that is predicated instead, see split_stateptr_branch
+        size_t max_fork_ops = 4096;
+    };
+
+    /* makes every state access go to one known state: a select or phi
+     * picking between state pointers forks the code after it, one copy
+     * per candidate. once the copies would exceed max_fork_ops the
+     * accesses are predicated instead, a selector var picks the candidate
+     * and each load or store through the pointer becomes one guarded
+     * access per candidate. a load reads every candidate, a store only
+     * writes the picked one, behind a branch on the selector, so state
+     * shared with other cores is never written back. pointers used other
+     * than by geps, bitcasts, loads and stores are always forked
+     */
+    void split_stateptr_branch(Element &ele, const SplitStatePtrOptions &opts);
     void split_stateptr_branch(Element &ele);
     void replace_vector_ops(Element& ele);
     void replace_map_ops(Element& ele);
+    /* a gep indexing a fixed size array state (fix_arr) becomes STATE_IDX
+     * on the state, with the index the gep uses, constant or not. a gep
+     * going on into the element is split into the STATE_IDX and a gep on
+     * the element pointer. arrays nested in another state stay geps
+     */
     void replace_fixsized_array_ops(Element& ele);
 
     void replace_regular_struct_access(Function& func);
+
+    // what a map key or an array index is built from
+    struct StateKey {
+        // the key pointer or the index
+        std::shared_ptr<Var> var;
+        // "header.field" read from the packet
+        std::set<std::string> pkt_fields;
+        // byte offset in the key each of those is copied to as it is, e.g.
+        // IPFlowID(p, true) puts ipv4.daddr at 0. none for a field mixed
+        // with others or copied to more than one place
+        std::map<std::string, std::optional<size_t>> pkt_field_pos;
+        // other params of the entry function, e.g. the input port
+        std::set<std::string> params;
+        // depends on something else as well, e.g. other state or a call
+        bool opaque = false;
+
+        bool packet_only() const { return !opaque && params.empty(); }
+    };
+
+    struct StateAccess {
+        size_t state_idx;
+        bool read = false;
+        bool written = false;
+        // HashMapInsert, also counted as a write
+        bool inserted = false;
+        // keys of map lookups and inserts, indices into arrays
+        std::vector<StateKey> keys;
+        std::vector<const Operation *> ops;
+    };
+
+    struct PathStateAccess {
+        std::vector<std::shared_ptr<BasicBlock>> bbs;
+        bool ends_in_err = false;
+        // by global_state_idx
+        std::map<size_t, StateAccess> states;
+    };
+
+    /* the element state each entry-to-exit path touches (paths as in
+     * analyze_cost), and all paths merged. states are found through
+     * pointers into the element, register arrays and map values, calls
+     * left in the function are not looked into
+     */
+    struct StateAccessSummary {
+        std::vector<PathStateAccess> paths;
+        bool paths_truncated = false;
+        std::map<size_t, StateAccess> states;
+    };
+
+    struct StateAccessOptions {
+        size_t max_paths = 256;
+    };
+
+    // works on the entry function after replace_regular_struct_access
+    StateAccessSummary summarize_state_access(Element &ele, const StateAccessOptions &opts);
+    StateAccessSummary summarize_state_access(Element &ele);
+
+    enum class ScalarUpdate {
+        // never written on the fast path
+        READ_ONLY,
+        // only incremented by values not derived from it, and neither the
+        // old nor the new value is used: one replica per core, summed
+        // when read elsewhere, see PerCpuCounter (percpu.hpp)
+        COMMUTATIVE,
+        // only incremented, but the value is used too: atomic fetch-add
+        FETCH_ADD,
+        // any other read-modify-write or store: atomic compare-and-swap
+        ATOMIC,
+    };
+
+    const char *scalar_update_str(ScalarUpdate u);
+
+    // an integer field of the element state at a fixed offset
+    struct ScalarState {
+        // the state holding it, with "+<byte offset>" if not its first byte
+        std::string name;
+        size_t state_idx;
+        // byte offset in the element
+        size_t offset;
+        size_t bits;
+        ScalarUpdate update = ScalarUpdate::READ_ONLY;
+        // the loads and stores of it
+        std::vector<const Operation *> ops;
+    };
+
+    /* classifies how the entry function updates each integer field of the
+     * element state it reaches through constant offsets, fields indexed by
+     * a variable are left to register arrays. an increment is a load, an
+     * add or sub of a value not derived from the field, and a store back
+     * in the same block with no other store to the field in between. calls
+     * left in the function are not looked into
+     * works on the entry function after replace_regular_struct_access
+     */
+    std::vector<ScalarState> classify_scalar_state(Element &ele);
+
+    void print_state_access_json(std::ostream &os, const Element &ele, const StateAccessSummary &summary);
+    void print_state_access_json(std::ostream &os,
+                                 const Element &ele,
+                                 const StateAccessSummary &summary,
+                                 const std::vector<ScalarState> &scalars);
 } 
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "highLv-ir.hpp"
+#include "hir-stateop.hpp"
+#include <iostream>
+#include <unordered_map>
+
+namespace HIR {
+    // a leaf of a key or value, "1.0" is field 0 of field 1
+    struct TableField {
+        std::string name;
+        size_t bit_offset;
+        size_t n_bits;
+    };
+
+    /* a HashMap state as an exact match table: a lookup of the whole key
+     * hits and yields the entry's value (findp, written in place through
+     * the pointer) or misses (findp returns null), an insert adds or
+     * overwrites the entry and fails once capacity entries are held.
+     * FlowTable (flow-table.hpp) is the host side implementation
+     */
+    struct MatchTable {
+        std::string name;
+        size_t state_idx;
+        Type *key_t;
+        Type *val_t;
+        std::vector<TableField> key_fields;
+        std::vector<TableField> val_fields;
+        // bits of the leaves, without padding
+        size_t key_bits = 0;
+        size_t val_bits = 0;
+        size_t capacity;
+        // false if a key or value holds pointers or types we can not lay
+        // out, such a table has to stay on the host
+        bool offloadable = true;
+        std::vector<const Operation *> lookups;
+        std::vector<const Operation *> inserts;
+        // split into per-core shards, see shard_tables
+        bool sharded = false;
+    };
+
+    struct MatchTableOptions {
+        // HashMap grows without bound, a table needs a size up front
+        size_t capacity = 65536;
+    };
+
+    // works on the entry function after replace_map_ops
+    std::vector<MatchTable> match_tables(const Element &ele, const MatchTableOptions &opts);
+    std::vector<MatchTable> match_tables(const Element &ele);
+
+    /* an indexed state as a register array: capacity elements of elem_t
+     * laid out back to back, STATE_IDX picks one and struct-get/struct-set
+     * access it in place. nothing is allocated or resized once it is set
+     * up. StateArray (state-array.hpp) is the host side implementation
+     */
+    struct RegisterArray {
+        std::string name;
+        size_t state_idx;
+        Type *elem_t;
+        std::vector<TableField> elem_fields;
+        size_t elem_bits = 0;
+        size_t capacity;
+        // "type" for a fixed size array, for a Vector "config" if given by
+        // RegisterArrayOptions, "default" otherwise
+        std::string capacity_from;
+        bool offloadable = true;
+        std::vector<const Operation *> accesses;
+    };
+
+    struct RegisterArrayOptions {
+        // a Vector has no bound of its own, capacities by state name as the
+        // element's configuration sets them up
+        std::unordered_map<std::string, size_t> capacities;
+        size_t default_capacity = 256;
+    };
+
+    // Vector and fixed size array states, works on the entry function
+    // after replace_vector_ops and replace_fixsized_array_ops
+    std::vector<RegisterArray> register_arrays(const Element &ele, const RegisterArrayOptions &opts);
+    std::vector<RegisterArray> register_arrays(const Element &ele);
+
+    // how packets are spread over cores so that each core owns its shards
+    struct Steering {
+        // packet fields the hash covers, in RSS input order, empty if no
+        // table can be sharded
+        std::vector<std::string> fields;
+        // "ipv4" (addresses) or "ipv4-l4" (addresses and ports)
+        std::string rss_type;
+        // some table is keyed by a flow in both directions, e.g. looked up
+        // by IPFlowID(p) and inserted by IPFlowID(p, true), the NIC needs
+        // a symmetric RSS key (RSS_SYMMETRIC_KEY)
+        bool symmetric = false;
+    };
+
+    /* marks the tables whose every lookup and insert on every path is keyed
+     * by the same packet fields, a superset of the ipv4 addresses, each at
+     * the same place in the key (pkt_field_pos). steering packets by an RSS
+     * hash of fields common to all those keys sends all packets touching
+     * an entry to the same core, that core's shard then is the only one
+     * holding it and needs no lock. keys with the source and destination
+     * swapped are only sharded under a symmetric RSS key, since the reply
+     * would hash elsewhere otherwise. ShardedFlowTable and RssSteering
+     * (rss-steering.hpp) are the host side.
+     * only the entry function is covered, a table that timers or handlers
+     * also walk still needs them to run per shard
+     */
+    Steering shard_tables(std::vector<MatchTable> &tables, const StateAccessSummary &summary);
+
+    void print_tables_json(std::ostream &os, const Element &ele, const std::vector<MatchTable> &tables);
+    void print_tables_json(std::ostream &os,
+                           const Element &ele,
+                           const std::vector<MatchTable> &tables,
+                           const std::vector<RegisterArray> &arrays,
+                           const Steering &steering);
+}
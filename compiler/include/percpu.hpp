@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+/* a COMMUTATIVE scalar (hir-stateop.hpp) as one replica per core. a core
+ * only ever adds to its own replica, with plain loads and stores on a
+ * cache line nobody else writes, and a read sums all of them. the sum is
+ * not a snapshot, adds racing with read() may or may not be counted
+ */
+template <typename T>
+class PerCpuCounter {
+public:
+    explicit PerCpuCounter(size_t n_cores)
+        : n_cores_(n_cores),
+          slots_(new Slot[n_cores]) {
+        assert(n_cores > 0);
+    }
+
+    size_t n_cores() const { return n_cores_; }
+
+    // only from the core owning the replica
+    void add(size_t core, T d) {
+        assert(core < n_cores_);
+        auto &v = slots_[core].v;
+        v.store(v.load(std::memory_order_relaxed) + d, std::memory_order_relaxed);
+    }
+
+    T read() const {
+        T sum = 0;
+        for (size_t i = 0; i < n_cores_; i++) {
+            sum += slots_[i].v.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    // e.g. from a reset handler, adds racing with it may survive
+    void reset() {
+        for (size_t i = 0; i < n_cores_; i++) {
+            slots_[i].v.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<T> v{0};
+    };
+
+    size_t n_cores_;
+    std::unique_ptr<Slot[]> slots_;
+};
+
+// an ATOMIC scalar: applies f to the value until no other core got in
+// between, returns the value stored
+template <typename T, typename F>
+T atomic_update(std::atomic<T> &v, F f) {
+    T old = v.load(std::memory_order_relaxed);
+    T next = f(old);
+    while (!v.compare_exchange_weak(old, next, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+        next = f(old);
+    }
+    return next;
+}
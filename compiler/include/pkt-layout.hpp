@@ -9,38 +9,133 @@
 
 class HeaderLayout {
 public:
+    // a slice of a field, e.g. the IHL in the first byte of ipv4
+    struct BitField {
+        std::string name;
+        size_t n_bits;
+        // counted from the most significant bit of the field in network
+        // order, filled in by the constructor
+        size_t bit_offset = 0;
+    };
+
     struct Entry {
         std::string field_name;
         size_t field_n_bytes;
+        // empty, or slices covering the whole field
+        std::vector<BitField> bit_fields = {};
     };
 
-    std::string name;
-    std::vector<Entry> fields;
+    // headers with options are "field * unit" bytes long, e.g. the IHL
+    // of ipv4 counts 4 byte words, empty field for fixed size headers
+    struct LengthField {
+        std::string field;
+        size_t unit;
+    };
 
     HeaderLayout();
-    HeaderLayout(std::string n, std::vector<Entry> fields);
+    HeaderLayout(std::string n, std::vector<Entry> fields, LengthField length = {});
+
+    const std::string &Name() const { return name_; }
+    const std::vector<Entry> &Fields() const { return fields_; }
+    const LengthField &Length() const { return length_; }
+    bool IsVarLength() const { return !length_.field.empty(); }
+
+    // nullptr if no field starts at the offset
+    const Entry *FindFieldByOffset(size_t offset) const;
+    const Entry *FindFieldByName(const std::string &field_name) const;
+    const BitField *FindBitFieldByName(const std::string &name) const;
+    // the field holding a bit field, or the field itself
+    const Entry *FindContainerByName(const std::string &name) const;
+    // width of a field or bit field, 0 if there is none by that name
+    size_t FieldNBits(const std::string &name) const;
+    size_t HeaderSize() const { return header_size_; }
 
-    std::optional<Entry> FindFieldByOffset(size_t offset) const;
-    size_t HeaderSize() const;
+protected:
+    // everything below is computed by the constructor and never changes,
+    // lookups are done per GEP while recognizing packet accesses
+    std::string name_;
+    std::vector<Entry> fields_;
+    LengthField length_{};
+    size_t header_size_ = 0;
+    // index of the field starting at each byte offset, -1 inside a field
+    std::vector<int> field_at_offset_;
+    std::unordered_map<std::string, int> field_by_name_;
+    std::unordered_map<std::string, std::pair<size_t, size_t>> bit_field_by_name_;
 };
 
+// picks the header following this one by the value of one of its fields
+struct ParseTransition {
+    std::string select_field;
+    std::vector<std::pair<uint64_t, std::string>> cases;
+    // empty when parsing stops
+    std::string default_next;
+};
+
+/* a layout file looks like
+ *
+ *   # comment
+ *   header ether {
+ *       dst        48
+ *       src        48
+ *       ethertype  16
+ *   }
+ *   header vlan {
+ *       tci 16 { pcp 3  dei 1  vid 12 }
+ *       ethertype  16
+ *   }
+ *   header ipv4 length ihl * 4 {
+ *       ...
+ *   }
+ *   parser ether {
+ *       select ethertype
+ *       0x0800  -> ipv4
+ *       default -> accept
+ *   }
+ *   start ether
+ *
+ * field widths are in bits and must be whole bytes, a field can be split
+ * into bit fields listed from its most significant bit, "length" gives
+ * the field a header with options keeps its length in, "accept" ends
+ * parsing
+ */
 class PacketLayout {
 public:
     std::unordered_map<std::string, HeaderLayout> headers;
+    std::unordered_map<std::string, ParseTransition> transitions;
+    std::string start_header;
 
     PacketLayout() {}
     PacketLayout(std::unordered_map<std::string, HeaderLayout> Headers)
     : headers(std::move(Headers)) {}
+    PacketLayout(std::unordered_map<std::string, HeaderLayout> Headers,
+                 std::unordered_map<std::string, ParseTransition> Transitions,
+                 std::string Start)
+    : headers(std::move(Headers)),
+      transitions(std::move(Transitions)),
+      start_header(std::move(Start)) {}
+
+    // empty if the layout is consistent, otherwise what is wrong with it
+    std::string Validate() const;
+
+    // returns nullopt and sets err on syntax or validation errors
+    static std::optional<PacketLayout> Parse(std::istream &is, std::string &err);
+    // prints the error and exits, like LLVMStore::load_ir_file
+    static PacketLayout LoadFile(const std::string &path);
 };
 
 namespace CommonHdr {
     extern HeaderLayout ether_layout;
+    extern HeaderLayout vlan_layout;
 
     extern HeaderLayout ipv4_layout;
+    extern HeaderLayout ipv6_layout;
     extern HeaderLayout arp_layout;
 
     extern HeaderLayout tcp_layout;
     extern HeaderLayout udp_layout;
 
+    extern HeaderLayout gre_layout;
+    extern HeaderLayout vxlan_layout;
+
     extern PacketLayout default_layout;
 }
\ No newline at end of file
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "flow-table.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// the 40 byte key NICs ship with and the RSS verification suite uses
+static const uint8_t RSS_DEFAULT_KEY[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3,
+    0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3,
+    0x80, 0x30, 0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+/* a key repeating every 16 bits hashes a flow and its reply alike, the
+ * addresses and the ports are 32 and 16 bits apart, see Steering::symmetric
+ */
+static const uint8_t RSS_SYMMETRIC_KEY[40] = {
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+};
+
+// Toeplitz hash of len input bytes, the key needs len + 4 bytes
+inline uint32_t toeplitz_hash(const uint8_t *key, size_t key_len, const uint8_t *data, size_t len) {
+    assert(key_len >= len + 4);
+    uint32_t result = 0;
+    uint32_t window = (uint32_t(key[0]) << 24) | (uint32_t(key[1]) << 16) | (uint32_t(key[2]) << 8) | key[3];
+    for (size_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            if (data[i] & (1u << b)) {
+                result ^= window;
+            }
+            window <<= 1;
+            if (key[i + 4] & (1u << b)) {
+                window |= 1;
+            }
+        }
+    }
+    return result;
+}
+
+/* software model of RSS steering as the NIC does it, the host side of
+ * Steering (hir-table.hpp). the hash input is the fields in network byte
+ * order, saddr daddr for "ipv4" followed by sport dport for "ipv4-l4",
+ * the low bits of the hash pick a slot of the indirection table which
+ * names the core. program the NIC with key() and the same table and the
+ * queue a packet lands on is core_of() of it
+ */
+class RssSteering {
+public:
+    static constexpr size_t RETA_SIZE = 128;
+
+    explicit RssSteering(size_t n_cores, const uint8_t *key = RSS_DEFAULT_KEY)
+        : n_cores_(n_cores),
+          reta_(RETA_SIZE) {
+        assert(n_cores > 0);
+        std::copy(key, key + sizeof(key_), key_);
+        for (size_t i = 0; i < RETA_SIZE; i++) {
+            reta_[i] = i % n_cores;
+        }
+    }
+
+    size_t n_cores() const { return n_cores_; }
+    const uint8_t *key() const { return key_; }
+    const std::vector<size_t> &reta() const { return reta_; }
+
+    // addresses and ports already in network byte order, as in the header
+    uint32_t hash_ipv4(uint32_t saddr, uint32_t daddr) const {
+        uint8_t in[8];
+        std::memcpy(in, &saddr, 4);
+        std::memcpy(in + 4, &daddr, 4);
+        return toeplitz_hash(key_, sizeof(key_), in, sizeof(in));
+    }
+
+    uint32_t hash_ipv4_l4(uint32_t saddr, uint32_t daddr, uint16_t sport, uint16_t dport) const {
+        uint8_t in[12];
+        std::memcpy(in, &saddr, 4);
+        std::memcpy(in + 4, &daddr, 4);
+        std::memcpy(in + 8, &sport, 2);
+        std::memcpy(in + 10, &dport, 2);
+        return toeplitz_hash(key_, sizeof(key_), in, sizeof(in));
+    }
+
+    size_t core_of(uint32_t hash) const { return reta_[hash % RETA_SIZE]; }
+
+private:
+    size_t n_cores_;
+    uint8_t key_[40];
+    std::vector<size_t> reta_;
+};
+
+/* a sharded MatchTable, one FlowTable or SwissFlowTable per core. with
+ * packets steered by RssSteering over fields every key contains, an entry
+ * is only ever looked up or inserted by the core owning its shard, so
+ * each core uses shard(core) directly and the fast path takes no lock.
+ * the capacity is split evenly, a shard may fill up before the whole
+ * table does when the hash spreads flows unevenly
+ */
+template <typename Table>
+class ShardedFlowTable {
+public:
+    using key_type = typename Table::key_type;
+    using mapped_type = typename Table::mapped_type;
+
+    ShardedFlowTable(size_t n_shards, size_t capacity) {
+        assert(n_shards > 0);
+        size_t per_shard = (capacity + n_shards - 1) / n_shards;
+        shards_.reserve(n_shards);
+        for (size_t i = 0; i < n_shards; i++) {
+            shards_.emplace_back(per_shard);
+        }
+    }
+
+    size_t n_shards() const { return shards_.size(); }
+
+    Table &shard(size_t core) {
+        assert(core < shards_.size());
+        return shards_[core];
+    }
+
+    const Table &shard(size_t core) const {
+        assert(core < shards_.size());
+        return shards_[core];
+    }
+
+    // entries over all shards, only meaningful while the cores are quiet
+    size_t size() const {
+        size_t n = 0;
+        for (auto &s : shards_) {
+            n += s.size();
+        }
+        return n;
+    }
+
+private:
+    std::vector<Table> shards_;
+};
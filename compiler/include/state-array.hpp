@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+/* fixed capacity array for indexed element state, the host side of a
+ * RegisterArray (hir-table.hpp). the elements are allocated once, back to
+ * back, indexing never allocates and the array never grows, entries past
+ * the configured size simply stay value initialized
+ */
+template <typename T>
+class StateArray {
+public:
+    explicit StateArray(size_t capacity)
+        : capacity_(capacity),
+          data_(new T[capacity]()) {
+        assert(capacity > 0);
+    }
+
+    size_t capacity() const { return capacity_; }
+
+    T &operator[](size_t i) {
+        assert(i < capacity_);
+        return data_[i];
+    }
+
+    const T &operator[](size_t i) const {
+        assert(i < capacity_);
+        return data_[i];
+    }
+
+    // nullptr for an index past the capacity
+    T *ptr(size_t i) { return i < capacity_ ? &data_[i] : nullptr; }
+    const T *ptr(size_t i) const { return i < capacity_ ? &data_[i] : nullptr; }
+
+    void fill(const T &v) {
+        for (size_t i = 0; i < capacity_; i++) {
+            data_[i] = v;
+        }
+    }
+
+    T *begin() { return data_.get(); }
+    T *end() { return data_.get() + capacity_; }
+    const T *begin() const { return data_.get(); }
+    const T *end() const { return data_.get() + capacity_; }
+
+private:
+    size_t capacity_;
+    std::unique_ptr<T[]> data_;
+};
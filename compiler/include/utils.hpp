@@ -24,3 +24,6 @@ public:
 };
 
 bool str_begin_with(const std::string &s, const std::string &prefix);
+
+// quoted and escaped, ready to be written into a json document
+std::string json_str(const std::string &s);
@@ -43,6 +43,19 @@ namespace HIR {
         return int_types[bitwidth];
     }
 
+    std::shared_ptr<Type> Module::get_ptr_type(Type *pointee) {
+        for (auto &t : types) {
+            if (t->type == Type::T::POINTER && t->pointee_type == pointee) {
+                return t;
+            }
+        }
+        auto t = std::make_shared<Type>();
+        t->type = Type::T::POINTER;
+        t->pointee_type = pointee;
+        types.emplace_back(t);
+        return t;
+    }
+
     void BasicBlock::print_branching(std::ostream &os) const {
         if (is_return) {
             if (is_short_circuit) {
@@ -895,29 +908,7 @@ namespace HIR {
         auto scc_list = control_graph.StronglyConnectedComponents();
 
         // Create new graph where each scc is a single vertex
-        std::vector<std::monostate> scc_graph_vertices(scc_list.size(), std::monostate());
-        AdjacencyList<std::monostate> scc_edges(scc_list.size());
-        std::unordered_map<int, int> idx2sccidx;
-        for (int i = 0; i < scc_list.size(); i++) {
-            for (auto j : scc_list[i]) {
-                idx2sccidx[j] = i;
-            }
-        }
-        for (int i = 0; i < scc_list.size(); i++) {
-            auto &scc = scc_list[i];
-            auto &edges = control_graph.edges();
-            for (auto &v : scc) {
-                for (auto it = edges.out_edge_begin(v); it != it.end(); ++it) {
-                    scc_edges.set_edge(i, idx2sccidx[*it], std::monostate());
-                }
-            }
-        }
-
-        Graph<
-            std::monostate,
-            std::monostate,
-            AdjacencyList<std::monostate>
-        > scc_graph(std::move(scc_graph_vertices), std::move(scc_edges));
+        auto scc_graph = control_graph.CondensedGraph(scc_list);
 
         auto topo_order = scc_graph.TopologicalSort();
 
@@ -1301,6 +1292,25 @@ namespace HIR {
             }
         }
 
+        void visitPktCsumUpdate(const Operation &op) {
+            printDstVar(op);
+            os_ << "pkt_csum_update "
+                << op.pkt_op_info.header << " "
+                << op.pkt_op_info.field;
+            for (int i = 0; i < op.args.size(); i++) {
+                os_ << " ";
+                op.args[i]->print(os_);
+            }
+        }
+
+        void visitStateIdx(const Operation &op) {
+            printDstVar(op);
+            os_ << "state-idx ";
+            op.args[0]->print(os_);
+            os_ << " ";
+            op.args[1]->print(os_);
+        }
+
         void visitUnreachable(const Operation &op) {
             os_ << "unreachable";
         }
@@ -0,0 +1,301 @@
+#include "hir-batch.hpp"
+#include "llvm-helpers.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <unordered_set>
+
+namespace HIR {
+    static std::vector<std::shared_ptr<BasicBlock>> successors(const BasicBlock &bb) {
+        std::vector<std::shared_ptr<BasicBlock>> result;
+        auto n_bb = bb.default_next_bb.lock();
+        if (n_bb != nullptr) {
+            result.emplace_back(n_bb);
+        }
+        for (auto &e : bb.branches) {
+            auto n_bb = e.next_bb.lock();
+            if (n_bb != nullptr) {
+                result.emplace_back(n_bb);
+            }
+        }
+        return result;
+    }
+
+    static bool writes_packet(const Operation &op) {
+        switch (op.type) {
+        case Operation::T::PKT_HDR_STORE:
+        case Operation::T::PKT_ENCAP:
+        case Operation::T::PKT_DECAP:
+        case Operation::T::PKT_CSUM_UPDATE:
+            return true;
+        case Operation::T::FUNC_CALL:
+            break;
+        default:
+            return false;
+        }
+        if (is_builtin_call(op, "IPFlowIDConstr")) {
+            return false;
+        }
+        bool passes_packet = false;
+        for (auto &a : op.args) {
+            passes_packet = passes_packet || a->type->type == Type::T::PACKET;
+        }
+        if (!passes_packet) {
+            return false;
+        }
+        // const members of Packet only read it
+        std::string demangled;
+        if (cxx_demangle(op.call_info.func_name, demangled)) {
+            auto is_packet_fn = str_begin_with(demangled, "Packet::")
+                || str_begin_with(demangled, "WritablePacket::");
+            auto is_const = demangled.size() >= 6
+                && demangled.compare(demangled.size() - 6, 6, " const") == 0;
+            return !(is_packet_fn && is_const);
+        }
+        return true;
+    }
+
+    BatchPlan batch_map_lookups(Function &f) {
+        BatchPlan plan;
+        if (f.bbs.empty()) {
+            return plan;
+        }
+        update_uses(f);
+        auto n = f.bbs.size();
+        auto entry_idx = (size_t)f.entry_bb_idx();
+        auto entry = f.bbs[entry_idx];
+        auto idom = control_graph_of_func(f).ImmediateDominators(entry_idx);
+
+        std::unordered_map<const BasicBlock *, size_t> bb_idx;
+        for (size_t i = 0; i < n; i++) {
+            bb_idx[f.bbs[i].get()] = i;
+        }
+        auto dominates = [&idom, n] (size_t a, size_t b) {
+            if (idom[b] == n) {
+                return false;
+            }
+            while (b != a && idom[b] != b) {
+                b = idom[b];
+            }
+            return a == b;
+        };
+        auto dom_depth = [&idom] (size_t b) {
+            size_t d = 0;
+            for (; idom[b] != b; b = idom[b]) {
+                d++;
+            }
+            return d;
+        };
+
+        std::vector<std::vector<size_t>> preds(n);
+        for (size_t i = 0; i < n; i++) {
+            for (auto &s : successors(*f.bbs[i])) {
+                preds[bb_idx[s.get()]].emplace_back(i);
+            }
+        }
+
+        struct OpLoc {
+            std::shared_ptr<Operation> op;
+            size_t bb;
+            size_t idx;
+        };
+        std::unordered_map<const Operation *, OpLoc> loc;
+        for (size_t i = 0; i < n; i++) {
+            if (idom[i] == n) {
+                continue;
+            }
+            auto &ops = f.bbs[i]->ops;
+            for (size_t j = 0; j < ops.size(); j++) {
+                loc[ops[j].get()] = {ops[j], i, j};
+                if (is_builtin_call(*ops[j], "HashMapFindp") && ops[j]->args.size() >= 2
+                    && ops[j]->args[0]->is_global) {
+                    plan.lookups.push_back({ops[j].get(), ops[j]->args[0], ops[j]->args[1]});
+                }
+            }
+        }
+
+        // whether the value is known at the end of the entry block once the
+        // ops it needs are moved there
+        std::function<bool(const std::shared_ptr<Var> &, std::vector<const Operation *> &)> available;
+        available = [&] (const std::shared_ptr<Var> &v, std::vector<const Operation *> &ops) -> bool {
+            if (v->is_constant || v->is_param) {
+                return true;
+            }
+            auto src = v->src_op.lock();
+            if (src == nullptr || loc.find(src.get()) == loc.end()) {
+                return false;
+            }
+            if (loc[src.get()].bb == entry_idx) {
+                return true;
+            }
+            switch (src->type) {
+            case Operation::T::ARITH:
+            case Operation::T::BITCAST:
+            case Operation::T::GEP:
+            case Operation::T::SELECT:
+            case Operation::T::PKT_HDR_LOAD:
+                break;
+            default:
+                return false;
+            }
+            for (auto &a : src->args) {
+                if (!available(a, ops)) {
+                    return false;
+                }
+            }
+            ops.emplace_back(src.get());
+            return true;
+        };
+
+        // no packet write between the end of the entry block and the lookup
+        auto packet_unchanged = [&] (const Operation *lookup) {
+            auto b = loc[lookup].bb;
+            for (size_t j = 0; j < loc[lookup].idx; j++) {
+                if (writes_packet(*f.bbs[b]->ops[j])) {
+                    return false;
+                }
+            }
+            std::vector<bool> visited(n, false);
+            std::vector<size_t> stack(preds[b].begin(), preds[b].end());
+            while (!stack.empty()) {
+                auto curr = stack.back();
+                stack.pop_back();
+                if (visited[curr] || curr == entry_idx) {
+                    continue;
+                }
+                visited[curr] = true;
+                for (auto &op : f.bbs[curr]->ops) {
+                    if (writes_packet(*op)) {
+                        return false;
+                    }
+                }
+                stack.insert(stack.end(), preds[curr].begin(), preds[curr].end());
+            }
+            return true;
+        };
+
+        // the ops computing a key, hoisted only if every lookup with it allows
+        auto key_ops_of = [&] (const std::shared_ptr<Var> &key, std::vector<const Operation *> &ops) {
+            auto alloca = key->src_op.lock();
+            if (alloca == nullptr || alloca->type != Operation::T::ALLOCA
+                || loc.find(alloca.get()) == loc.end() || loc[alloca.get()].bb != entry_idx) {
+                return false;
+            }
+            std::vector<Operation *> writes;
+            if (!collect_local_writes(*key, writes)) {
+                return false;
+            }
+            for (auto &l : plan.lookups) {
+                if (l.key != key) {
+                    continue;
+                }
+                auto b = loc[l.lookup].bb;
+                if (b == entry_idx || !packet_unchanged(l.lookup)) {
+                    return false;
+                }
+                for (auto w : writes) {
+                    auto wb = loc[w].bb;
+                    bool before = wb == b ? loc[w].idx < loc[l.lookup].idx : dominates(wb, b);
+                    if (!before) {
+                        return false;
+                    }
+                }
+            }
+            for (auto w : writes) {
+                for (auto &a : w->args) {
+                    if (!available(a, ops)) {
+                        return false;
+                    }
+                }
+                if (loc[w].bb != entry_idx) {
+                    ops.emplace_back(w);
+                }
+            }
+            return true;
+        };
+
+        std::unordered_map<const Var *, bool> key_hoisted;
+        std::unordered_set<const Operation *> to_move;
+        for (auto &l : plan.lookups) {
+            auto iter = key_hoisted.find(l.key.get());
+            if (iter == key_hoisted.end()) {
+                std::vector<const Operation *> ops;
+                bool ok = key_ops_of(l.key, ops);
+                if (ok) {
+                    to_move.insert(ops.begin(), ops.end());
+                }
+                iter = key_hoisted.emplace(l.key.get(), ok).first;
+            }
+            l.hoisted = iter->second;
+        }
+
+        // every op moved dominates a lookup, those an op depends on sit
+        // higher up the dominator tree or earlier in the same block
+        std::vector<OpLoc> moved;
+        for (auto op : to_move) {
+            moved.emplace_back(loc[op]);
+        }
+        std::sort(moved.begin(), moved.end(), [&](const OpLoc &a, const OpLoc &b) {
+            return std::make_tuple(dom_depth(a.bb), a.bb, a.idx) < std::make_tuple(dom_depth(b.bb), b.bb, b.idx);
+        });
+        for (auto &m : moved) {
+            auto &ops = f.bbs[m.bb]->ops;
+            ops.erase(std::find(ops.begin(), ops.end(), m.op));
+            m.op->parent = entry.get();
+            entry->ops.emplace_back(m.op);
+            plan.key_ops.emplace_back(m.op);
+        }
+        update_uses(f);
+
+        // the key stage may only read and write locals, and read the packet.
+        // state read there would be read for the whole burst before any of
+        // it is written by an earlier packet
+        auto is_local = [] (std::shared_ptr<Var> ptr) {
+            while (true) {
+                auto src = ptr->src_op.lock();
+                if (src == nullptr) {
+                    return false;
+                }
+                if (src->type == Operation::T::ALLOCA) {
+                    return true;
+                }
+                if (src->type != Operation::T::GEP && src->type != Operation::T::BITCAST) {
+                    return false;
+                }
+                ptr = src->args[0];
+            }
+        };
+        plan.batchable = true;
+        for (auto &op : entry->ops) {
+            bool ok = false;
+            switch (op->type) {
+            case Operation::T::ALLOCA:
+                ok = true;
+                break;
+            case Operation::T::LOAD:
+            case Operation::T::STORE:
+            case Operation::T::STRUCT_GET:
+            case Operation::T::STRUCT_SET:
+                ok = is_local(op->args[0]);
+                break;
+            case Operation::T::STATE_IDX:
+                break;
+            case Operation::T::FUNC_CALL:
+                ok = (is_builtin_call(*op, "IPFlowIDConstr") && is_local(op->args[0]))
+                    || !has_side_effect(*op);
+                break;
+            default:
+                ok = !has_side_effect(*op);
+                break;
+            }
+            plan.batchable = plan.batchable && ok;
+        }
+        return plan;
+    }
+
+    BatchPlan batch_map_lookups(Element &ele) {
+        return batch_map_lookups(*ele.entry());
+    }
+}
@@ -2,6 +2,8 @@
 #include "graph.hpp"
 #include "utils.hpp"
 #include "llvm-helpers.hpp"
+#include <algorithm>
+#include <map>
 #include <queue>
 namespace HIR {
     void remove_all_meta(Function& f) {
@@ -80,6 +82,7 @@ namespace HIR {
         case Operation::T::PHINODE:
         case Operation::T::PKT_HDR_LOAD:
         case Operation::T::SELECT:
+        case Operation::T::STATE_IDX:
             ret = false;
             break;
         case Operation::T::FUNC_CALL:
@@ -91,6 +94,57 @@ namespace HIR {
         return ret;
     }
 
+    bool is_builtin_call(const Operation &op, const std::string &name) {
+        if (op.type != Operation::T::FUNC_CALL) {
+            return false;
+        }
+        auto fn = op.call_info.called_function.lock();
+        return fn != nullptr && fn->is_built_in && fn->name == name;
+    }
+
+    bool collect_local_writes(const Var &ptr, std::vector<Operation *> &writes) {
+        for (auto &use : ptr.uses) {
+            if (use.type != Var::Use::T::OP) {
+                return false;
+            }
+            auto op = use.u.op_ptr;
+            switch (op->type) {
+            case Operation::T::LOAD:
+            case Operation::T::STRUCT_GET:
+                break;
+            case Operation::T::STORE:
+            case Operation::T::STRUCT_SET:
+                if (op->args[0].get() != &ptr || op->args[1].get() == &ptr) {
+                    return false;
+                }
+                writes.emplace_back(op);
+                break;
+            case Operation::T::GEP:
+            case Operation::T::BITCAST:
+                if (op->args[0].get() != &ptr || !collect_local_writes(*op->dst_vars[0], writes)) {
+                    return false;
+                }
+                break;
+            case Operation::T::FUNC_CALL:
+                if (is_builtin_call(*op, "IPFlowIDConstr") && op->args[0].get() == &ptr) {
+                    writes.emplace_back(op);
+                } else if (str_begin_with(op->call_info.func_name, "llvm.memcpy")) {
+                    // copied out of it
+                    if (op->args[0].get() == &ptr) {
+                        return false;
+                    }
+                } else if (!(is_builtin_call(*op, "HashMapFindp") || is_builtin_call(*op, "HashMapInsert"))
+                           || op->args[0].get() == &ptr) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
     void remove_unused_ops(Function &func) {
         for (auto &bb : func.bbs) {
             std::vector<std::shared_ptr<Operation>> new_ops;
@@ -255,6 +309,25 @@ namespace HIR {
         assert(found);
     }
 
+    void remove_unreachable_bb(Function& f) {
+        auto entry_bb = f.bbs[f.entry_bb_idx()];
+        auto cfg = control_graph_of_func(f);
+        auto reachable = cfg.ReachableFrom(f.entry_bb_idx());
+        std::vector<std::shared_ptr<BasicBlock>> new_bbs;
+        for (size_t i = 0; i < f.bbs.size(); i++) {
+            if (reachable[i]) {
+                new_bbs.emplace_back(f.bbs[i]);
+            }
+        }
+        f.bbs = std::move(new_bbs);
+        for (int i = 0; i < f.bbs.size(); i++) {
+            if (f.bbs[i] == entry_bb) {
+                f.set_entry_idx(i);
+                break;
+            }
+        }
+    }
+
     void remove_unused_ops(Element &ele) {
         update_uses(ele);
         for (auto &f : ele.funcs) {
@@ -272,63 +345,78 @@ namespace HIR {
         return true;
     }
 
-    bool reachable(
-            const Graph<
-                std::shared_ptr<Function>,
-                std::monostate,
-                AdjacencyList<std::monostate>> &call_graph,
-            size_t v,
-            size_t dst,
-            std::vector<bool> &visited) {
-        if (visited[v]) {
-            return false;
-        }
-        if (v == dst) {
-            return true;
-        }
-
-        visited[v] = true;
-        for (auto iter = call_graph.edges().out_edge_begin(v); iter != iter.end(); iter++) {
-            auto n = *iter;
-            if (reachable(call_graph, n, dst, visited)) {
-                return true;
-            }
+    size_t func_self_size(const Function &f) {
+        size_t sz = 0;
+        for (auto &bb : f.bbs) {
+            sz += bb->ops.size();
         }
-        return false;
+        return sz;
     }
 
-    bool is_recursive(
-            const Graph<
-                std::shared_ptr<Function>,
-                std::monostate,
-                AdjacencyList<std::monostate>> &call_graph,
-            std::shared_ptr<Function> f) {
-        auto vid = 0;
-        bool found = false;
-        for (size_t i = 0; i < call_graph.n_vertex(); i++) {
-            if (call_graph.vertex_ref(i).get() == f.get()) {
-                found = true;
-                vid = i;
-                break;
+    InlinePlan plan_inline(const Element &ele, const InlineCostModel &model) {
+        InlinePlan plan;
+        auto call_graph = call_graph_of_ele(ele);
+        auto scc_list = call_graph.StronglyConnectedComponents();
+        auto scc_graph = call_graph.CondensedGraph(scc_list);
+
+        // topological order of the condensed graph lists callees before callers,
+        // so every callee summary is final when its callers are visited
+        auto bottom_up = scc_graph.TopologicalSort();
+        for (auto scc_idx : bottom_up) {
+            auto &scc = scc_list[scc_idx];
+            assert(scc.size() > 0);
+            bool recursive = scc.size() > 1
+                || call_graph.edges().have_edge(scc[0], scc[0]);
+            for (auto v : scc) {
+                auto &f = call_graph.vertex_ref(v);
+                auto &summary = plan.summaries[f.get()];
+                int num_return_bb = 0;
+                for (auto &bb : f->bbs) {
+                    if (bb->is_return) {
+                        num_return_bb++;
+                    }
+                }
+                summary.is_recursive = recursive;
+                summary.inlinable = !recursive && !f->is_built_in && num_return_bb == 1;
+                summary.self_size = func_self_size(*f);
+                summary.inlined_size = summary.self_size;
             }
-        }
-        assert(found);
-        std::vector<bool> visited(call_graph.n_vertex(), false);
-        for (auto iter = call_graph.edges().out_edge_begin(vid); iter != iter.end(); iter++) {
-            auto n = *iter;
-            if (reachable(call_graph, n, vid, visited)) {
-                return true;
+            if (recursive) {
+                // calls inside a recursive scc are never expanded
+                continue;
+            }
+            auto &f = call_graph.vertex_ref(scc[0]);
+            auto &summary = plan.summaries[f.get()];
+            for (auto &bb : f->bbs) {
+                for (auto &op : bb->ops) {
+                    if (!should_try_inline(*op)) {
+                        continue;
+                    }
+                    auto callee = op->call_info.called_function.lock();
+                    assert(plan.summaries.find(callee.get()) != plan.summaries.end());
+                    auto &callee_summary = plan.summaries[callee.get()];
+                    if (!callee_summary.inlinable) {
+                        continue;
+                    }
+                    if (callee_summary.inlined_size > model.max_callee_size) {
+                        continue;
+                    }
+                    // the call op itself goes away once the body is spliced in
+                    auto grown = summary.inlined_size + callee_summary.inlined_size - 1;
+                    if (grown > model.max_func_size) {
+                        continue;
+                    }
+                    summary.inlined_size = grown;
+                    plan.inline_sites.insert(op.get());
+                }
             }
         }
-        return false;
+        return plan;
     }
 
     std::vector<std::shared_ptr<BasicBlock>>
     generate_inline_bbs(
-            const Graph<
-                std::shared_ptr<Function>,
-                std::monostate,
-                AdjacencyList<std::monostate>> &call_graph,
+            const InlinePlan &plan,
             const Function &func,
             const std::vector<std::shared_ptr<Var>> &args) {
         std::vector<std::shared_ptr<BasicBlock>> bbs;
@@ -371,7 +459,7 @@ namespace HIR {
             new_bb->name = NameFactory::get()(NameFactory::get().base(bb->name));
             for (int j = 0; j < bb->ops.size(); j++) {
                 auto &op = bb->ops[j];
-                if (!should_try_inline(*op) || is_recursive(call_graph, op->call_info.called_function.lock())) {
+                if (plan.inline_sites.find(op.get()) == plan.inline_sites.end()) {
                     auto new_op = std::make_shared<Operation>(*op);
                     //  create new dst arg
                     std::vector<std::shared_ptr<Var>> new_dst_vars;
@@ -413,7 +501,7 @@ namespace HIR {
                             new_args.emplace_back(var_mapping[a.get()]);
                         }
                     }
-                    auto inlined_bbs = generate_inline_bbs(call_graph, *inline_f, new_args);
+                    auto inlined_bbs = generate_inline_bbs(plan, *inline_f, new_args);
                     // create two basic blocks for this bb
                     // insert all but the last block
                     assert(inlined_bbs.size() >= 1);
@@ -545,6 +633,7 @@ namespace HIR {
             bb_copy->name = NameFactory::get()(NameFactory::get().base(bb->name));
             for (int i = 0; i < bb->ops.size(); i++) {
                 bb_copy->ops[i] = std::make_shared<Operation>(*bb->ops[i]);
+                bb_copy->ops[i]->parent = bb_copy.get();
             }
         }
 
@@ -558,6 +647,7 @@ namespace HIR {
                 for (auto& d : op->dst_vars) {
                     auto nd = std::make_shared<Var>(*d);
                     nd->name = NameFactory::get()(NameFactory::get().base(d->name));
+                    nd->src_op = op_dup;
                     var_mapping[d] = nd;
                     op_dup->dst_vars.emplace_back(nd);
                 }
@@ -595,6 +685,9 @@ namespace HIR {
             for (int i = 0; i < bb->branches.size(); i++) {
                 auto& e = bb->branches[i];
                 auto n_bb = e.next_bb.lock();
+                if (var_mapping.find(e.cond_var) != var_mapping.end()) {
+                    bb_dup->branches[i].cond_var = var_mapping[e.cond_var];
+                }
                 if (result.find(n_bb) != result.end()) {
                     bb_dup->branches[i].next_bb = result[n_bb];
                 } else {
@@ -631,7 +724,8 @@ namespace HIR {
     // fork from f[bb_idx], if there exists multiple prepositive bb pointed to it 
     void fork_from_bb(Function& f, int bb_idx) {
         assert(0 <= bb_idx && bb_idx < f.bbs.size());
-        auto& start_bb = f.bbs[bb_idx];
+        // a copy, f.bbs grows below
+        auto start_bb = f.bbs[bb_idx];
         std::unordered_set<std::shared_ptr<BasicBlock>> from;
         for (auto& bb : f.bbs) {
             if (bb == start_bb) {
@@ -691,7 +785,7 @@ namespace HIR {
             auto bb = *iter;
             if (*iter != entry_bb && (from.find(*iter) == from.end() || from[*iter].size() == 0)) {
                 iter = f.bbs.erase(iter);
-            } else if (bb->ops.size() == 0 && bb->branches.size() == 0 && !bb->is_return && !bb->is_err) {
+            } else if (*iter != entry_bb && bb->ops.size() == 0 && bb->branches.size() == 0 && !bb->is_return && !bb->is_err) {
                 auto prev_bbs = from[bb];
                 auto n_bb = bb->default_next_bb.lock();
                 assert(n_bb != nullptr);
@@ -897,10 +991,14 @@ namespace HIR {
     }
 
     void element_function_inline(Element &ele) {
+        element_function_inline(ele, InlineCostModel());
+    }
+
+    void element_function_inline(Element &ele, const InlineCostModel &model) {
         // we only need to inline the entry function
         auto entry_func = ele.entry();
-        auto call_graph = call_graph_of_ele(ele);
-        auto bbs = generate_inline_bbs(call_graph, *entry_func, entry_func->args);
+        auto plan = plan_inline(ele, model);
+        auto bbs = generate_inline_bbs(plan, *entry_func, entry_func->args);
 
         entry_func->bbs.swap(bbs);
 
@@ -913,12 +1011,9 @@ namespace HIR {
         auto new_call_graph = call_graph_of_ele(ele);
 
         std::unordered_set<Function *> to_remove;
+        auto reachable = new_call_graph.ReachableFrom(ele.entry_func_idx());
         for (int i = 0; i < new_call_graph.n_vertex(); i++) {
-            if (i == ele.entry_func_idx()) {
-                continue;
-            }
-            std::vector<bool> visited(new_call_graph.n_vertex(), false);
-            if (!reachable(new_call_graph, ele.entry_func_idx(), i, visited)) {
+            if (!reachable[i]) {
                 to_remove.insert(ele.funcs[i].get());
             }
         }
@@ -986,30 +1081,388 @@ namespace HIR {
                 std::shared_ptr<BasicBlock>,
                 std::monostate,
                 AdjacencyList<std::monostate>>& ctl_graph) {
-        std::vector<std::monostate> scc_graph_vertices(scc_list.size(), std::monostate());
-        AdjacencyList<std::monostate> scc_edges(scc_list.size());
-        std::unordered_map<int, int> idx2sccidx;
-        for (int i = 0; i < scc_list.size(); i++) {
-            for (auto j : scc_list[i]) {
-                idx2sccidx[j] = i;
+        return ctl_graph.CondensedGraph(scc_list);
+    }
+
+    // a scalar field of an aggregate alloca and the loads and stores of it
+    struct AllocaLeaf {
+        Type *t = nullptr;
+        Type *ptr_t = nullptr;
+        std::vector<Operation *> accesses;
+    };
+
+    static bool same_scalar_type(const Type *a, const Type *b) {
+        if (a->type == Type::T::INT && b->type == Type::T::INT) {
+            return a->bitwidth == b->bitwidth;
+        }
+        return a == b || (a->type == Type::T::POINTER && b->type == Type::T::POINTER);
+    }
+
+    // an llvm.memcpy or llvm.memset of a byte pointer to the alloca, over
+    // whole fields starting at byte off of it
+    struct AllocaCopy {
+        Operation *op = nullptr;
+        size_t off = 0;
+        // the alloca is written, not read
+        bool into = false;
+    };
+
+    // the scalar fields of t, at byte off, lying within [begin, end). false
+    // if one lies across an end
+    static bool scalar_fields_in(Type *t, size_t off, size_t begin, size_t end, std::map<size_t, Type *> &fields) {
+        auto n = t->num_bytes();
+        if (off + n <= begin || off >= end) {
+            return true;
+        }
+        if (t->type == Type::T::INT || t->type == Type::T::POINTER) {
+            if (off < begin || off + n > end) {
+                return false;
+            }
+            fields[off] = t;
+            return true;
+        } else if (t->type == Type::T::STRUCT) {
+            for (size_t i = 0; i < t->struct_info.fields.size(); i++) {
+                if (!scalar_fields_in(t->struct_info.fields[i], off + t->struct_info.offsets[i], begin, end, fields)) {
+                    return false;
+                }
+            }
+            return true;
+        } else if (t->type == Type::T::ARRAY) {
+            auto elem_t = t->array_info.element_type;
+            for (size_t i = 0; i < t->array_info.num_element; i++) {
+                if (!scalar_fields_in(elem_t, off + i * elem_t->num_bytes(), begin, end, fields)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    static bool collect_alloca_copies(
+            Module &m,
+            const std::shared_ptr<Var> &bytes,
+            Type *t,
+            size_t off,
+            std::map<size_t, AllocaLeaf> &leaves,
+            std::vector<AllocaCopy> &copies) {
+        for (auto &u : bytes->uses) {
+            if (u.type != Var::Use::T::OP) {
+                return false;
+            }
+            auto op = u.u.op_ptr;
+            if (op->type != Operation::T::FUNC_CALL || op->args.size() < 3 || !op->args[2]->is_constant) {
+                return false;
+            }
+            auto &fn = op->call_info.func_name;
+            bool is_set = str_begin_with(fn, "llvm.memset");
+            if (is_set) {
+                if (op->args[0] != bytes || !op->args[1]->is_constant) {
+                    return false;
+                }
+            } else if (!str_begin_with(fn, "llvm.memcpy") || (op->args[0] == bytes) == (op->args[1] == bytes)) {
+                return false;
+            }
+            // a copy within the alloca
+            for (auto &c : copies) {
+                if (c.op == op) {
+                    return false;
+                }
+            }
+            std::map<size_t, Type *> fields;
+            if (!scalar_fields_in(t, off, off, off + op->args[2]->constant, fields)) {
+                return false;
+            }
+            for (auto &kv : fields) {
+                auto field_t = kv.second;
+                if (is_set && field_t->type == Type::T::POINTER && op->args[1]->constant != 0) {
+                    return false;
+                }
+                auto &leaf = leaves[kv.first];
+                if (leaf.t != nullptr && !same_scalar_type(leaf.t, field_t)) {
+                    return false;
+                }
+                if (leaf.t == nullptr) {
+                    leaf.t = field_t;
+                    leaf.ptr_t = m.get_ptr_type(field_t).get();
+                }
+            }
+            copies.push_back({op, off, op->args[0] == bytes});
+        }
+        return true;
+    }
+
+    // false if ptr, pointing to t at byte off of the alloca, is used other
+    // than by constant geps, loads and stores of scalar fields and byte
+    // copies of whole fields
+    static bool collect_alloca_leaves(
+            Module &m,
+            const std::shared_ptr<Var> &ptr,
+            Type *t,
+            size_t off,
+            std::map<size_t, AllocaLeaf> &leaves,
+            std::vector<Operation *> &geps,
+            std::vector<AllocaCopy> &copies) {
+        for (auto &u : ptr->uses) {
+            if (u.type != Var::Use::T::OP) {
+                return false;
+            }
+            auto op = u.u.op_ptr;
+            if (op->type == Operation::T::GEP && op->args[0] == ptr) {
+                // the first index steps over the pointer, it stays on this one
+                if (op->args.size() < 2 || !op->args[1]->is_constant || op->args[1]->constant != 0) {
+                    return false;
+                }
+                auto field_t = t;
+                auto field_off = off;
+                for (size_t i = 2; i < op->args.size(); i++) {
+                    auto &a = op->args[i];
+                    if (!a->is_constant) {
+                        return false;
+                    }
+                    if (field_t->type == Type::T::STRUCT && a->constant < field_t->struct_info.fields.size()) {
+                        field_off += field_t->struct_info.offsets[a->constant];
+                        field_t = field_t->struct_info.fields[a->constant];
+                    } else if (field_t->type == Type::T::ARRAY && a->constant < field_t->array_info.num_element) {
+                        field_t = field_t->array_info.element_type;
+                        field_off += field_t->num_bytes() * a->constant;
+                    } else {
+                        return false;
+                    }
+                }
+                geps.emplace_back(op);
+                if (!collect_alloca_leaves(m, op->dst_vars[0], field_t, field_off, leaves, geps, copies)) {
+                    return false;
+                }
+            } else if ((op->type == Operation::T::LOAD && op->args[0] == ptr)
+                       || (op->type == Operation::T::STORE && op->args[0] == ptr && op->args[1] != ptr)) {
+                if (t->type != Type::T::INT && t->type != Type::T::POINTER) {
+                    return false;
+                }
+                auto &leaf = leaves[off];
+                if (leaf.t != nullptr && !same_scalar_type(leaf.t, t)) {
+                    return false;
+                }
+                leaf.t = t;
+                leaf.ptr_t = ptr->type;
+                leaf.accesses.emplace_back(op);
+            } else if (op->type == Operation::T::BITCAST && op->args[0] == ptr) {
+                geps.emplace_back(op);
+                if (!collect_alloca_copies(m, op->dst_vars[0], t, off, leaves, copies)) {
+                    return false;
+                }
+            } else {
+                return false;
             }
         }
-        for (int i = 0; i < scc_list.size(); i++) {
-            auto &scc = scc_list[i];
-            auto &edges = ctl_graph.edges();
-            for (auto &v : scc) {
-                for (auto it = edges.out_edge_begin(v); it != it.end(); ++it) {
-                    scc_edges.set_edge(i, idx2sccidx[*it], std::monostate());
+        return true;
+    }
+
+    /* the copy, in place, as a load and a store per field. the access on
+     * the alloca side goes through the byte pointer for now, it is moved
+     * to the field's own alloca with the other accesses of it
+     */
+    static void expand_alloca_copy(Module &m, const AllocaCopy &copy, std::map<size_t, AllocaLeaf> &leaves) {
+        auto call = copy.op;
+        auto bb = call->parent;
+        std::vector<std::shared_ptr<Operation>> ops;
+        auto emit = [&](Operation::T t, std::vector<std::shared_ptr<Var>> args, Type *dst_type) {
+            auto op = std::make_shared<Operation>();
+            op->type = t;
+            op->args = std::move(args);
+            op->parent = bb;
+            ops.emplace_back(op);
+            if (dst_type != nullptr) {
+                auto dst = std::make_shared<Var>();
+                dst->type = dst_type;
+                dst->src_op = op;
+                op->dst_vars.emplace_back(dst);
+            }
+            return op.get();
+        };
+        auto constant = [](Type *t, uint64_t c) {
+            auto v = std::make_shared<Var>();
+            v->type = t;
+            v->is_constant = true;
+            v->constant = c;
+            return v;
+        };
+
+        bool is_set = str_begin_with(call->call_info.func_name, "llvm.memset");
+        auto &bytes = call->args[copy.into ? 0 : 1];
+        auto &other = call->args[copy.into ? 1 : 0];
+        auto end = copy.off + call->args[2]->constant;
+        for (auto iter = leaves.lower_bound(copy.off); iter != leaves.end() && iter->first < end; iter++) {
+            auto &leaf = iter->second;
+            std::shared_ptr<Var> v;
+            if (is_set) {
+                uint64_t c = 0;
+                for (size_t i = 0; i < leaf.t->num_bytes(); i++) {
+                    c = (c << 8) | (other->constant & 0xff);
                 }
+                leaf.accesses.emplace_back(emit(Operation::T::STORE, {bytes, constant(leaf.t, c)}, nullptr));
+                continue;
+            }
+            // the field on the other side
+            auto ptr = other;
+            if (iter->first != copy.off) {
+                auto gep = emit(Operation::T::GEP,
+                                {ptr, constant(m.get_int_type(64).get(), iter->first - copy.off)},
+                                ptr->type);
+                ptr = gep->dst_vars[0];
+            }
+            ptr = emit(Operation::T::BITCAST, {ptr}, leaf.ptr_t)->dst_vars[0];
+            if (copy.into) {
+                v = emit(Operation::T::LOAD, {ptr}, leaf.t)->dst_vars[0];
+                leaf.accesses.emplace_back(emit(Operation::T::STORE, {bytes, v}, nullptr));
+            } else {
+                auto load = emit(Operation::T::LOAD, {bytes}, leaf.t);
+                leaf.accesses.emplace_back(load);
+                emit(Operation::T::STORE, {ptr, load->dst_vars[0]}, nullptr);
             }
         }
 
-        Graph<
-            std::monostate,
-            std::monostate,
-            AdjacencyList<std::monostate>
-        > scc_graph(std::move(scc_graph_vertices), std::move(scc_edges));
-        return scc_graph;
+        auto pos = std::find_if(bb->ops.begin(), bb->ops.end(), [call](auto &op) { return op.get() == call; });
+        pos = bb->ops.erase(pos);
+        bb->ops.insert(pos, ops.begin(), ops.end());
     }
 
+    int scalar_replace_aggregates(Module &m, Function &f) {
+        if (f.bbs.empty()) {
+            return 0;
+        }
+        update_uses(f);
+        auto n = f.bbs.size();
+        auto idom = control_graph_of_func(f).ImmediateDominators(f.entry_bb_idx());
+        std::unordered_map<const BasicBlock *, size_t> bb_idx;
+        for (size_t i = 0; i < n; i++) {
+            bb_idx[f.bbs[i].get()] = i;
+        }
+        // a before b, both ops of f
+        auto dominates = [&](const Operation *a, const Operation *b) {
+            auto ia = bb_idx[a->parent];
+            auto ib = bb_idx[b->parent];
+            if (ia == ib) {
+                auto &ops = a->parent->ops;
+                for (auto &op : ops) {
+                    if (op.get() == a) {
+                        return true;
+                    } else if (op.get() == b) {
+                        return false;
+                    }
+                }
+                return false;
+            }
+            if (idom[ib] == n) {
+                return false;
+            }
+            while (ib != ia && idom[ib] != ib) {
+                ib = idom[ib];
+            }
+            return ia == ib;
+        };
+
+        int num_split = 0;
+        std::unordered_set<const Operation *> to_remove;
+        std::unordered_map<const Operation *, std::vector<std::shared_ptr<Operation>>> replace_with;
+        // loads promoted to the value stored
+        std::unordered_map<std::shared_ptr<Var>, std::shared_ptr<Var>> var_replace;
+        // copies are expanded within the blocks, the allocas are taken first
+        std::vector<std::shared_ptr<Operation>> aggregates;
+        for (auto &bb : f.bbs) {
+            for (auto &op : bb->ops) {
+                if (op->type == Operation::T::ALLOCA
+                    && (op->alloca_type->type == Type::T::STRUCT || op->alloca_type->type == Type::T::ARRAY)) {
+                    aggregates.emplace_back(op);
+                }
+            }
+        }
+        for (auto &op : aggregates) {
+            std::map<size_t, AllocaLeaf> leaves;
+            std::vector<Operation *> geps;
+            std::vector<AllocaCopy> copies;
+            if (!collect_alloca_leaves(m, op->dst_vars[0], op->alloca_type, 0, leaves, geps, copies)) {
+                continue;
+            }
+            num_split++;
+            to_remove.insert(geps.begin(), geps.end());
+            for (auto &copy : copies) {
+                expand_alloca_copy(m, copy, leaves);
+            }
+            if (!copies.empty()) {
+                // the other end of a copy sees the loads and stores now
+                update_uses(f);
+            }
+            auto &new_allocas = replace_with[op.get()];
+            for (auto &kv : leaves) {
+                auto &leaf = kv.second;
+                std::vector<Operation *> loads;
+                std::vector<Operation *> stores;
+                for (auto a : leaf.accesses) {
+                    (a->type == Operation::T::LOAD ? loads : stores).emplace_back(a);
+                }
+                // one store seen by every load: the loads are its value
+                if (stores.size() == 1 && !loads.empty()
+                    && std::all_of(loads.begin(), loads.end(), [&](const Operation *l) {
+                           return dominates(stores[0], l);
+                       })) {
+                    for (auto l : loads) {
+                        var_replace[l->dst_vars[0]] = stores[0]->args[1];
+                        to_remove.insert(l);
+                    }
+                    to_remove.insert(stores[0]);
+                    continue;
+                } else if (loads.empty()) {
+                    to_remove.insert(stores.begin(), stores.end());
+                    continue;
+                }
+                auto alloca = std::make_shared<Operation>();
+                alloca->type = Operation::T::ALLOCA;
+                alloca->alloca_type = leaf.t;
+                alloca->parent = op->parent;
+                auto dst = std::make_shared<Var>();
+                dst->type = leaf.ptr_t;
+                dst->name = NameFactory::get()(NameFactory::get().base(op->dst_vars[0]->name));
+                dst->src_op = alloca;
+                alloca->dst_vars.emplace_back(dst);
+                for (auto a : leaf.accesses) {
+                    a->args[0] = dst;
+                }
+                new_allocas.emplace_back(alloca);
+            }
+        }
+
+        auto resolve = [&var_replace](std::shared_ptr<Var> v) {
+            auto iter = var_replace.find(v);
+            while (iter != var_replace.end()) {
+                v = iter->second;
+                iter = var_replace.find(v);
+            }
+            return v;
+        };
+        for (auto &bb : f.bbs) {
+            std::vector<std::shared_ptr<Operation>> new_ops;
+            for (auto &op : bb->ops) {
+                auto iter = replace_with.find(op.get());
+                if (iter != replace_with.end()) {
+                    new_ops.insert(new_ops.end(), iter->second.begin(), iter->second.end());
+                } else if (to_remove.find(op.get()) == to_remove.end()) {
+                    new_ops.emplace_back(op);
+                }
+            }
+            bb->ops = std::move(new_ops);
+            for (auto &op : bb->ops) {
+                for (auto &a : op->args) {
+                    a = resolve(a);
+                }
+            }
+            for (auto &e : bb->branches) {
+                if (e.cond_var != nullptr) {
+                    e.cond_var = resolve(e.cond_var);
+                }
+            }
+        }
+        update_uses(f);
+        return num_split;
+    }
 }
@@ -0,0 +1,336 @@
+#include "hir-cost.hpp"
+#include "hir-loop.hpp"
+#include "utils.hpp"
+#include <limits>
+
+namespace HIR {
+    const char *cost_kind_name(CostKind k) {
+        switch (k) {
+        case CostKind::ARITH:
+            return "arith";
+        case CostKind::PKT_HDR_LOAD:
+            return "pkt_hdr_load";
+        case CostKind::PKT_HDR_STORE:
+            return "pkt_hdr_store";
+        case CostKind::PKT_CSUM_UPDATE:
+            return "pkt_csum_update";
+        case CostKind::MAP_FIND:
+            return "map_find";
+        case CostKind::MAP_INSERT:
+            return "map_insert";
+        case CostKind::STATE_IDX:
+            return "state_idx";
+        case CostKind::FUNC_CALL:
+            return "func_call";
+        case CostKind::MEM_LOAD:
+            return "mem_load";
+        case CostKind::MEM_STORE:
+            return "mem_store";
+        case CostKind::OTHER:
+            return "other";
+        default:
+            assert(false && "unknown cost kind");
+        }
+        return "";
+    }
+
+    CostKind cost_kind_of(const Operation &op) {
+        using T = Operation::T;
+        switch (op.type) {
+        case T::ARITH:
+            return CostKind::ARITH;
+        case T::PKT_HDR_LOAD:
+            return CostKind::PKT_HDR_LOAD;
+        case T::PKT_HDR_STORE:
+            return CostKind::PKT_HDR_STORE;
+        case T::PKT_CSUM_UPDATE:
+            return CostKind::PKT_CSUM_UPDATE;
+        case T::STATE_IDX:
+            return CostKind::STATE_IDX;
+        case T::LOAD:
+        case T::STRUCT_GET:
+            return CostKind::MEM_LOAD;
+        case T::STORE:
+        case T::STRUCT_SET:
+            return CostKind::MEM_STORE;
+        case T::FUNC_CALL: {
+            auto fn = op.call_info.called_function.lock();
+            if (fn != nullptr && fn->is_built_in) {
+                if (fn->name == "HashMapFindp") {
+                    return CostKind::MAP_FIND;
+                } else if (fn->name == "HashMapInsert") {
+                    return CostKind::MAP_INSERT;
+                } else if (fn->name == "VectorIdxOp") {
+                    return CostKind::STATE_IDX;
+                }
+            }
+            return CostKind::FUNC_CALL;
+        }
+        default:
+            return CostKind::OTHER;
+        }
+    }
+
+    static uint64_t sat_add(uint64_t a, uint64_t b) {
+        if (a > std::numeric_limits<uint64_t>::max() - b) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        return a + b;
+    }
+
+    static uint64_t sat_mul(uint64_t a, uint64_t b) {
+        if (a != 0 && b > std::numeric_limits<uint64_t>::max() / a) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        return a * b;
+    }
+
+    uint64_t OpCost::total() const {
+        uint64_t result = 0;
+        for (auto c : counts) {
+            result = sat_add(result, c);
+        }
+        return result;
+    }
+
+    OpCost &OpCost::operator+=(const OpCost &other) {
+        for (size_t i = 0; i < counts.size(); i++) {
+            counts[i] = sat_add(counts[i], other.counts[i]);
+        }
+        for (auto &kv : other.state_accesses) {
+            auto &c = state_accesses[kv.first];
+            c = sat_add(c, kv.second);
+        }
+        return *this;
+    }
+
+    OpCost OpCost::operator*(uint64_t n) const {
+        OpCost result;
+        for (size_t i = 0; i < counts.size(); i++) {
+            result.counts[i] = sat_mul(counts[i], n);
+        }
+        for (auto &kv : state_accesses) {
+            result.state_accesses[kv.first] = sat_mul(kv.second, n);
+        }
+        return result;
+    }
+
+    void OpCost::max_with(const OpCost &other) {
+        for (size_t i = 0; i < counts.size(); i++) {
+            counts[i] = std::max(counts[i], other.counts[i]);
+        }
+        for (auto &kv : other.state_accesses) {
+            auto &c = state_accesses[kv.first];
+            c = std::max(c, kv.second);
+        }
+    }
+
+    OpCost cost_of_bb(const BasicBlock &bb) {
+        OpCost result;
+        for (auto &op : bb.ops) {
+            result[cost_kind_of(*op)]++;
+            std::unordered_set<size_t> states;
+            for (auto &a : op->args) {
+                if (a->is_global) {
+                    states.insert(a->global_state_idx);
+                }
+            }
+            for (auto s : states) {
+                result.state_accesses[s]++;
+            }
+        }
+        return result;
+    }
+
+    FunctionCost analyze_cost(const Function &f) {
+        return analyze_cost(f, CostModelOptions());
+    }
+
+    FunctionCost analyze_cost(const Function &f, const CostModelOptions &opts) {
+        FunctionCost result;
+        if (f.bbs.empty()) {
+            return result;
+        }
+        auto cfg = control_graph_of_func(f);
+        auto scc_list = cfg.StronglyConnectedComponents();
+        auto dag = cfg.CondensedGraph(scc_list);
+        std::vector<size_t> scc_of(f.bbs.size(), 0);
+        for (size_t i = 0; i < scc_list.size(); i++) {
+            for (auto v : scc_list[i]) {
+                scc_of[v] = i;
+            }
+        }
+        std::vector<std::vector<size_t>> succs(scc_list.size());
+        for (size_t s = 0; s < scc_list.size(); s++) {
+            for (auto iter = dag.edges().out_edge_begin(s); iter != iter.end(); iter++) {
+                succs[s].emplace_back(*iter);
+            }
+        }
+
+        // blocks inside a cycle run once per iteration of every loop around them
+        auto loops = analyze_loops(f);
+        std::vector<OpCost> weight(scc_list.size());
+        for (size_t s = 0; s < scc_list.size(); s++) {
+            bool cyclic = scc_list[s].size() > 1
+                || cfg.edges().have_edge(scc_list[s][0], scc_list[s][0]);
+            for (auto v : scc_list[s]) {
+                auto &bb = f.bbs[v];
+                uint64_t mult = 1;
+                auto iter = loops.loop_of.find(bb);
+                if (iter != loops.loop_of.end()) {
+                    for (int l = iter->second; l >= 0; l = loops.loops[l].parent) {
+                        auto &trip = loops.loops[l].trip_count;
+                        if (trip.has_value()) {
+                            mult = sat_mul(mult, trip.value());
+                        } else {
+                            result.bounded = false;
+                        }
+                    }
+                } else if (cyclic) {
+                    // irreducible
+                    result.bounded = false;
+                }
+                weight[s] += cost_of_bb(*bb) * mult;
+            }
+        }
+
+        // longest paths, sinks first
+        std::vector<OpCost> worst(scc_list.size());
+        std::vector<OpCost> longest(scc_list.size());
+        std::vector<size_t> longest_bbs(scc_list.size(), 0);
+        std::vector<uint64_t> num_paths(scc_list.size(), 0);
+        for (auto s : dag.TopologicalSort()) {
+            OpCost best_worst;
+            int best_succ = -1;
+            uint64_t n = succs[s].empty() ? 1 : 0;
+            for (auto d : succs[s]) {
+                best_worst.max_with(worst[d]);
+                if (best_succ < 0 || longest[d].total() > longest[best_succ].total()) {
+                    best_succ = d;
+                }
+                n = sat_add(n, num_paths[d]);
+            }
+            worst[s] = weight[s];
+            worst[s] += best_worst;
+            longest[s] = weight[s];
+            longest_bbs[s] = scc_list[s].size();
+            if (best_succ >= 0) {
+                longest[s] += longest[best_succ];
+                longest_bbs[s] += longest_bbs[best_succ];
+            }
+            num_paths[s] = n;
+        }
+        auto entry = scc_of[f.entry_bb_idx()];
+        result.worst_case = worst[entry];
+        result.longest_path = longest[entry];
+        result.longest_path_bbs = longest_bbs[entry];
+        result.num_paths = num_paths[entry];
+
+        // enumerate paths one by one, up to max_paths
+        struct Frame {
+            size_t scc;
+            size_t next_succ;
+            OpCost cost;
+        };
+        std::vector<Frame> stack;
+        stack.push_back({entry, 0, weight[entry]});
+        while (!stack.empty()) {
+            auto &top = stack.back();
+            if (succs[top.scc].empty()) {
+                if (result.paths.size() >= opts.max_paths) {
+                    result.paths_truncated = true;
+                    break;
+                }
+                PathCost path;
+                path.cost = top.cost;
+                for (auto &fr : stack) {
+                    for (auto v : scc_list[fr.scc]) {
+                        path.bbs.emplace_back(f.bbs[v]);
+                        path.ends_in_err = path.ends_in_err || f.bbs[v]->is_err;
+                    }
+                }
+                result.paths.emplace_back(std::move(path));
+                stack.pop_back();
+                continue;
+            }
+            if (top.next_succ == succs[top.scc].size()) {
+                stack.pop_back();
+                continue;
+            }
+            auto d = succs[top.scc][top.next_succ++];
+            auto cost = top.cost;
+            cost += weight[d];
+            stack.push_back({d, 0, std::move(cost)});
+        }
+        return result;
+    }
+
+    static void print_op_cost_json(
+            std::ostream &os,
+            const OpCost &cost,
+            const std::unordered_map<size_t, std::string> &state_names,
+            const std::string &indent) {
+        os << "{" << std::endl;
+        for (size_t i = 0; i < (size_t)CostKind::NUM_KINDS; i++) {
+            os << indent << "  " << json_str(cost_kind_name((CostKind)i))
+               << ": " << cost.counts[i] << "," << std::endl;
+        }
+        os << indent << "  \"total\": " << cost.total() << "," << std::endl;
+        os << indent << "  \"state_accesses\": {";
+        bool first = true;
+        for (auto &kv : cost.state_accesses) {
+            auto iter = state_names.find(kv.first);
+            auto name = (iter != state_names.end()) ? iter->second : std::to_string(kv.first);
+            os << (first ? "" : ",") << std::endl;
+            os << indent << "    " << json_str(name) << ": " << kv.second;
+            first = false;
+        }
+        if (!first) {
+            os << std::endl << indent << "  ";
+        }
+        os << "}" << std::endl;
+        os << indent << "}";
+    }
+
+    void print_cost_json(std::ostream &os, const Element &ele, const FunctionCost &cost) {
+        std::unordered_map<size_t, std::string> state_names;
+        for (auto &kv : ele.states) {
+            state_names[kv.second->global_state_idx] = kv.second->name;
+        }
+        os << "{" << std::endl;
+        os << "  \"element\": " << json_str(ele.name()) << "," << std::endl;
+        os << "  \"function\": " << json_str(ele.entry()->name) << "," << std::endl;
+        os << "  \"bounded\": " << (cost.bounded ? "true" : "false") << "," << std::endl;
+        os << "  \"num_paths\": " << cost.num_paths << "," << std::endl;
+        os << "  \"worst_case\": ";
+        print_op_cost_json(os, cost.worst_case, state_names, "  ");
+        os << "," << std::endl;
+        os << "  \"longest_path\": {" << std::endl;
+        os << "    \"bbs\": " << cost.longest_path_bbs << "," << std::endl;
+        os << "    \"ops\": ";
+        print_op_cost_json(os, cost.longest_path, state_names, "    ");
+        os << std::endl << "  }," << std::endl;
+        os << "  \"paths_truncated\": " << (cost.paths_truncated ? "true" : "false") << "," << std::endl;
+        os << "  \"paths\": [";
+        for (size_t i = 0; i < cost.paths.size(); i++) {
+            auto &p = cost.paths[i];
+            os << (i == 0 ? "" : ",") << std::endl;
+            os << "    {" << std::endl;
+            os << "      \"exit\": " << json_str(p.bbs.back()->name) << "," << std::endl;
+            os << "      \"is_err\": " << (p.ends_in_err ? "true" : "false") << "," << std::endl;
+            os << "      \"bbs\": [";
+            for (size_t j = 0; j < p.bbs.size(); j++) {
+                os << (j == 0 ? "" : ", ") << json_str(p.bbs[j]->name);
+            }
+            os << "]," << std::endl;
+            os << "      \"ops\": ";
+            print_op_cost_json(os, p.cost, state_names, "      ");
+            os << std::endl << "    }";
+        }
+        if (!cost.paths.empty()) {
+            os << std::endl << "  ";
+        }
+        os << "]" << std::endl;
+        os << "}" << std::endl;
+    }
+}
@@ -0,0 +1,385 @@
+#include "hir-liveness.hpp"
+#include "hir-common-pass.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace HIR {
+    LiveSet &LiveSet::operator+=(const LiveSet &other) {
+        fields.insert(other.fields.begin(), other.fields.end());
+        vars.insert(other.vars.begin(), other.vars.end());
+        return *this;
+    }
+
+    size_t var_n_bits(const Var &v) {
+        auto t = v.type;
+        auto src_op = v.src_op.lock();
+        if (src_op != nullptr && src_op->type == Operation::T::ALLOCA) {
+            // a local struct is carried, not the pointer to it
+            auto a = src_op->alloca_type;
+            return a->sized() ? a->num_bytes() * 8 : 0;
+        }
+        // pointers into a local struct are free as well
+        auto base = src_op;
+        while (base != nullptr && (base->type == Operation::T::BITCAST || base->type == Operation::T::GEP)) {
+            auto &b = base->args[0];
+            if (b->is_constant || b->is_param || b->is_global) {
+                break;
+            }
+            base = b->src_op.lock();
+            if (base != nullptr && base->type == Operation::T::ALLOCA) {
+                return 0;
+            }
+        }
+        switch (t->type) {
+        case Type::T::INT:
+        case Type::T::FLOAT:
+            return t->bitwidth;
+        case Type::T::POINTER: {
+            if (v.is_param) {
+                return 0;
+            }
+            auto p = t->pointee_type;
+            if (p != nullptr) {
+                switch (p->type) {
+                case Type::T::PACKET:
+                case Type::T::STATE_PTR:
+                case Type::T::ELEMENT_BASE:
+                case Type::T::VECTOR:
+                case Type::T::MAP:
+                    return 0;
+                default:
+                    break;
+                }
+            }
+            return 64;
+        }
+        case Type::T::STRUCT:
+        case Type::T::ARRAY:
+            return t->sized() ? t->num_bytes() * 8 : 0;
+        default:
+            return 0;
+        }
+    }
+
+    static bool is_tracked(const Var &v) {
+        return !v.is_constant && !v.is_global;
+    }
+
+    // "header.bit_field" -> "header.field" for every split field
+    static std::unordered_map<std::string, std::string> bit_field_containers(const PacketLayout &layout) {
+        std::unordered_map<std::string, std::string> result;
+        for (auto &kv : layout.headers) {
+            for (auto &e : kv.second.Fields()) {
+                for (auto &bf : e.bit_fields) {
+                    result[kv.first + "." + bf.name] = kv.first + "." + e.field_name;
+                }
+            }
+        }
+        return result;
+    }
+
+    static size_t field_n_bits_of(const PacketLayout &layout, const std::string &key) {
+        auto dot = key.find('.');
+        auto iter = layout.headers.find(key.substr(0, dot));
+        if (dot == std::string::npos || iter == layout.headers.end()) {
+            return 0;
+        }
+        return iter->second.FieldNBits(key.substr(dot + 1));
+    }
+
+    // a bit field costs nothing more when its whole field is live too
+    static size_t dedup_field_bits(
+            const std::set<std::string> &fields,
+            const std::unordered_map<std::string, std::string> &containers,
+            const std::function<size_t(const std::string &)> &bits_of) {
+        size_t result = 0;
+        for (auto &f : fields) {
+            auto iter = containers.find(f);
+            if (iter != containers.end() && fields.find(iter->second) != fields.end()) {
+                continue;
+            }
+            result += bits_of(f);
+        }
+        return result;
+    }
+
+    size_t LivenessInfo::field_n_bits(const LiveSet &s) const {
+        return dedup_field_bits(s.fields, field_container, [&](const std::string &f) {
+            auto iter = field_bits.find(f);
+            return iter == field_bits.end() ? 0 : iter->second;
+        });
+    }
+
+    size_t LivenessInfo::var_n_bits(const LiveSet &s) const {
+        size_t result = 0;
+        for (auto v : s.vars) {
+            result += HIR::var_n_bits(*v);
+        }
+        return result;
+    }
+
+    LiveSet LivenessInfo::live_on_edge(const BasicBlock &from, const BasicBlock &to) const {
+        LiveSet result;
+        auto iter = live_in.find(&to);
+        if (iter != live_in.end()) {
+            result = iter->second;
+        }
+        for (auto &op : to.ops) {
+            if (op->type != Operation::T::PHINODE) {
+                continue;
+            }
+            for (size_t i = 0; i < op->args.size() && i < op->phi_info.from.size(); i++) {
+                if (op->phi_info.from[i].lock().get() == &from && is_tracked(*op->args[i])) {
+                    result.vars.insert(op->args[i].get());
+                }
+            }
+        }
+        return result;
+    }
+
+    static std::vector<const BasicBlock *> successors(const BasicBlock &bb) {
+        std::vector<const BasicBlock *> result;
+        for (auto &br : bb.branches) {
+            result.emplace_back(br.next_bb.lock().get());
+        }
+        auto next = bb.default_next_bb.lock();
+        if (next != nullptr) {
+            result.emplace_back(next.get());
+        }
+        return result;
+    }
+
+    static void kill_field(LiveSet &live,
+                           const std::string &key,
+                           const std::unordered_map<std::string, std::string> &containers) {
+        live.fields.erase(key);
+        for (auto &kv : containers) {
+            if (kv.second == key) {
+                live.fields.erase(kv.first);
+            }
+        }
+    }
+
+    // walks bb backwards from live_out, returns live_in and the most bits
+    // live at once in between
+    static std::pair<LiveSet, size_t> transfer(const BasicBlock &bb,
+                                               const LiveSet &live_out,
+                                               const LivenessInfo &info) {
+        LiveSet live = live_out;
+        for (auto &br : bb.branches) {
+            if (is_tracked(*br.cond_var)) {
+                live.vars.insert(br.cond_var.get());
+            }
+        }
+        if (bb.is_return && bb.return_val != nullptr && is_tracked(*bb.return_val)) {
+            live.vars.insert(bb.return_val.get());
+        }
+        size_t max_bits = info.n_bits(live);
+        for (auto iter = bb.ops.rbegin(); iter != bb.ops.rend(); iter++) {
+            auto &op = *iter;
+            for (auto &d : op->dst_vars) {
+                live.vars.erase(d.get());
+            }
+            auto key = op->pkt_op_info.header + "." + op->pkt_op_info.field;
+            if (op->type == Operation::T::PKT_HDR_STORE) {
+                kill_field(live, key, info.field_container);
+            }
+            // phi inputs are live on the incoming edges only
+            if (op->type != Operation::T::PHINODE) {
+                for (auto &a : op->args) {
+                    if (is_tracked(*a)) {
+                        live.vars.insert(a.get());
+                    }
+                }
+            }
+            if (op->type == Operation::T::PKT_HDR_LOAD || op->type == Operation::T::PKT_CSUM_UPDATE) {
+                live.fields.insert(key);
+            }
+            max_bits = std::max(max_bits, info.n_bits(live));
+        }
+        return {std::move(live), max_bits};
+    }
+
+    LivenessInfo analyze_liveness(const Function &f, const PacketLayout &layout) {
+        LivenessInfo info;
+        info.field_container = bit_field_containers(layout);
+
+        std::set<std::string> written;
+        for (auto &bb : f.bbs) {
+            for (auto &op : bb->ops) {
+                if (op->type != Operation::T::PKT_HDR_LOAD && op->type != Operation::T::PKT_HDR_STORE
+                    && op->type != Operation::T::PKT_CSUM_UPDATE) {
+                    continue;
+                }
+                auto key = op->pkt_op_info.header + "." + op->pkt_op_info.field;
+                if (info.field_bits.find(key) == info.field_bits.end()) {
+                    info.field_bits[key] = field_n_bits_of(layout, key);
+                }
+                if (op->type != Operation::T::PKT_HDR_LOAD) {
+                    written.insert(key);
+                }
+            }
+        }
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto iter = f.bbs.rbegin(); iter != f.bbs.rend(); iter++) {
+                auto &bb = **iter;
+                LiveSet out;
+                if (bb.is_return) {
+                    out.fields = written;
+                }
+                for (auto s : successors(bb)) {
+                    out += info.live_on_edge(bb, *s);
+                }
+                auto in = transfer(bb, out, info).first;
+                if (!(info.live_in[&bb] == in) || !(info.live_out[&bb] == out)) {
+                    changed = true;
+                    info.live_in[&bb] = std::move(in);
+                    info.live_out[&bb] = std::move(out);
+                }
+            }
+        }
+        for (auto &bb : f.bbs) {
+            info.max_bits[bb.get()] = transfer(*bb, info.live_out[bb.get()], info).second;
+        }
+        return info;
+    }
+
+    PackingReport packing_report(const Function &f, const LivenessInfo &info) {
+        PackingReport report;
+        if (f.bbs.empty()) {
+            return report;
+        }
+        auto cfg = control_graph_of_func(f);
+        auto scc_list = cfg.StronglyConnectedComponents();
+        auto dag = cfg.CondensedGraph(scc_list);
+
+        // longest distance from the entry, sources first
+        auto order = dag.TopologicalSort();
+        std::reverse(order.begin(), order.end());
+        std::vector<size_t> level(scc_list.size(), 0);
+        for (auto s : order) {
+            for (auto iter = dag.edges().out_edge_begin(s); iter != iter.end(); iter++) {
+                level[*iter] = std::max(level[*iter], level[s] + 1);
+            }
+            report.num_stages = std::max(report.num_stages, level[s] + 1);
+        }
+        for (size_t s = 0; s < scc_list.size(); s++) {
+            for (auto v : scc_list[s]) {
+                report.stage_of[f.bbs[v].get()] = level[s];
+            }
+        }
+
+        for (size_t k = 0; k + 1 < report.num_stages; k++) {
+            StageBoundary b;
+            b.stage = k;
+            report.boundaries.emplace_back(std::move(b));
+        }
+        for (auto &bb : f.bbs) {
+            auto from = report.stage_of[bb.get()];
+            for (auto s : successors(*bb)) {
+                auto to = report.stage_of[s];
+                if (to <= from) {
+                    continue;
+                }
+                auto live = info.live_on_edge(*bb, *s);
+                for (auto k = from; k < to; k++) {
+                    report.boundaries[k].live += live;
+                }
+            }
+        }
+        for (size_t k = 0; k < report.boundaries.size(); k++) {
+            auto &b = report.boundaries[k];
+            b.field_bits = info.field_n_bits(b.live);
+            b.var_bits = info.var_n_bits(b.live);
+            if (report.max_boundary < 0 || b.total_bits() > report.boundaries[report.max_boundary].total_bits()) {
+                report.max_boundary = k;
+            }
+        }
+        for (auto &kv : info.max_bits) {
+            report.max_bits = std::max(report.max_bits, kv.second);
+        }
+        return report;
+    }
+
+    std::vector<std::set<std::string>> pipeline_live_fields(const std::vector<HeaderUsage> &usages) {
+        std::vector<std::set<std::string>> result;
+        std::set<std::string> written;
+        for (size_t i = 0; i + 1 < usages.size(); i++) {
+            for (auto &kv : usages[i].writes) {
+                for (auto &f : kv.second) {
+                    written.insert(kv.first + "." + f);
+                }
+            }
+            auto live = written;
+            for (size_t j = i + 1; j < usages.size(); j++) {
+                for (auto &kv : usages[j].reads) {
+                    for (auto &f : kv.second) {
+                        live.insert(kv.first + "." + f);
+                    }
+                }
+            }
+            result.emplace_back(std::move(live));
+        }
+        return result;
+    }
+
+    size_t fields_n_bits(const PacketLayout &layout, const std::set<std::string> &fields) {
+        return dedup_field_bits(fields, bit_field_containers(layout), [&](const std::string &f) {
+            return field_n_bits_of(layout, f);
+        });
+    }
+
+    static void print_names_json(std::ostream &os, std::vector<std::string> names) {
+        std::sort(names.begin(), names.end());
+        os << "[";
+        for (size_t i = 0; i < names.size(); i++) {
+            os << (i == 0 ? "" : ", ") << json_str(names[i]);
+        }
+        os << "]";
+    }
+
+    void print_packing_json(std::ostream &os,
+                            const Element &ele,
+                            const LivenessInfo &info,
+                            const PackingReport &report,
+                            const std::string &indent) {
+        os << "{" << std::endl;
+        os << indent << "  \"element\": " << json_str(ele.name()) << "," << std::endl;
+        os << indent << "  \"function\": " << json_str(ele.entry()->name) << "," << std::endl;
+        os << indent << "  \"num_stages\": " << report.num_stages << "," << std::endl;
+        os << indent << "  \"max_live_bits\": " << report.max_bits << "," << std::endl;
+        os << indent << "  \"max_boundary\": " << report.max_boundary << "," << std::endl;
+        os << indent << "  \"boundaries\": [";
+        for (size_t k = 0; k < report.boundaries.size(); k++) {
+            auto &b = report.boundaries[k];
+            os << (k == 0 ? "" : ",") << std::endl;
+            os << indent << "    {" << std::endl;
+            os << indent << "      \"stage\": " << b.stage << "," << std::endl;
+            os << indent << "      \"field_bits\": " << b.field_bits << "," << std::endl;
+            os << indent << "      \"var_bits\": " << b.var_bits << "," << std::endl;
+            os << indent << "      \"total_bits\": " << b.total_bits() << "," << std::endl;
+            os << indent << "      \"fields\": ";
+            print_names_json(os, std::vector<std::string>(b.live.fields.begin(), b.live.fields.end()));
+            os << "," << std::endl;
+            std::vector<std::string> vars;
+            for (auto v : b.live.vars) {
+                if (var_n_bits(*v) > 0) {
+                    vars.emplace_back(v->name);
+                }
+            }
+            os << indent << "      \"vars\": ";
+            print_names_json(os, vars);
+            os << std::endl << indent << "    }";
+        }
+        if (!report.boundaries.empty()) {
+            os << std::endl << indent << "  ";
+        }
+        os << "]" << std::endl;
+        os << indent << "}";
+    }
+}
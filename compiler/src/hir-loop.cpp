@@ -0,0 +1,700 @@
+#include "hir-loop.hpp"
+#include "utils.hpp"
+#include <map>
+#include <queue>
+
+namespace HIR {
+    static int bitwidth_of(const Var &v) {
+        if (v.type == nullptr || v.type->type != Type::T::INT) {
+            return 64;
+        }
+        return v.type->bitwidth;
+    }
+
+    static uint64_t mask_to(uint64_t v, int bw) {
+        if (bw >= 64) {
+            return v;
+        }
+        return v & ((uint64_t(1) << bw) - 1);
+    }
+
+    static int64_t sext_from(uint64_t v, int bw) {
+        if (bw >= 64) {
+            return (int64_t)v;
+        }
+        auto shift = 64 - bw;
+        return ((int64_t)(v << shift)) >> shift;
+    }
+
+    std::optional<uint64_t> fold_int_arith(const Operation &op, const std::vector<uint64_t> &args) {
+        if (op.type != Operation::T::ARITH || op.dst_vars.size() != 1) {
+            return std::nullopt;
+        }
+        assert(args.size() == op.args.size());
+        int dst_bw = bitwidth_of(*op.dst_vars[0]);
+        std::vector<int> bw;
+        for (auto &a : op.args) {
+            bw.emplace_back(bitwidth_of(*a));
+        }
+
+        if (op.arith_info.t == ArithType::INT_CMP) {
+            assert(args.size() == 2);
+            auto a = mask_to(args[0], bw[0]);
+            auto b = mask_to(args[1], bw[1]);
+            auto sa = sext_from(a, bw[0]);
+            auto sb = sext_from(b, bw[1]);
+            switch (op.arith_info.u.icmp_t) {
+            case IntCmpType::EQ:
+                return a == b;
+            case IntCmpType::NE:
+                return a != b;
+            case IntCmpType::ULE:
+                return a <= b;
+            case IntCmpType::ULT:
+                return a < b;
+            case IntCmpType::SLE:
+                return sa <= sb;
+            case IntCmpType::SLT:
+                return sa < sb;
+            }
+            return std::nullopt;
+        }
+
+        using IA = IntArithType;
+        auto t = op.arith_info.u.iarith_t;
+        switch (t) {
+        case IA::INT_NOT:
+            return mask_to(~args[0], dst_bw);
+        case IA::INT_TRUNC:
+            return mask_to(args[0], dst_bw);
+        case IA::INT_ZEXT:
+            return mask_to(args[0], bw[0]);
+        case IA::INT_SEXT:
+            return mask_to((uint64_t)sext_from(args[0], bw[0]), dst_bw);
+        default:
+            break;
+        }
+
+        assert(args.size() == 2);
+        auto a = mask_to(args[0], bw[0]);
+        auto b = mask_to(args[1], bw[1]);
+        auto sa = sext_from(a, bw[0]);
+        auto sb = sext_from(b, bw[1]);
+        switch (t) {
+        case IA::INT_ADD:
+            return mask_to(a + b, dst_bw);
+        case IA::INT_SUB:
+            return mask_to(a - b, dst_bw);
+        case IA::INT_MUL:
+            return mask_to(a * b, dst_bw);
+        case IA::INT_DIV:
+            if (sb == 0 || (sb == -1 && sa == INT64_MIN)) {
+                return std::nullopt;
+            }
+            return mask_to((uint64_t)(sa / sb), dst_bw);
+        case IA::INT_MOD:
+            if (sb == 0 || (sb == -1 && sa == INT64_MIN)) {
+                return std::nullopt;
+            }
+            return mask_to((uint64_t)(sa % sb), dst_bw);
+        case IA::INT_UDIV:
+            if (b == 0) {
+                return std::nullopt;
+            }
+            return mask_to(a / b, dst_bw);
+        case IA::INT_UMOD:
+            if (b == 0) {
+                return std::nullopt;
+            }
+            return mask_to(a % b, dst_bw);
+        case IA::INT_AND:
+            return mask_to(a & b, dst_bw);
+        case IA::INT_OR:
+            return mask_to(a | b, dst_bw);
+        case IA::INT_XOR:
+            return mask_to(a ^ b, dst_bw);
+        case IA::INT_SHL:
+            if (b >= (uint64_t)dst_bw) {
+                return std::nullopt;
+            }
+            return mask_to(a << b, dst_bw);
+        case IA::INT_LSHR:
+            if (b >= (uint64_t)bw[0]) {
+                return std::nullopt;
+            }
+            return mask_to(a >> b, dst_bw);
+        case IA::INT_ASHR:
+            if (b >= (uint64_t)bw[0]) {
+                return std::nullopt;
+            }
+            return mask_to((uint64_t)(sa >> b), dst_bw);
+        default:
+            break;
+        }
+        return std::nullopt;
+    }
+
+    size_t Loop::num_ops() const {
+        size_t result = 0;
+        for (auto &bb : blocks) {
+            result += bb->ops.size();
+        }
+        return result;
+    }
+
+    static std::vector<std::shared_ptr<BasicBlock>> successors(const BasicBlock &bb) {
+        std::vector<std::shared_ptr<BasicBlock>> result;
+        auto n_bb = bb.default_next_bb.lock();
+        if (n_bb != nullptr) {
+            result.emplace_back(n_bb);
+        }
+        for (auto &e : bb.branches) {
+            auto n_bb = e.next_bb.lock();
+            if (n_bb != nullptr) {
+                result.emplace_back(n_bb);
+            }
+        }
+        return result;
+    }
+
+    // evaluates the values a loop exit condition depends on, one iteration
+    // at a time. header phis carry the state between iterations, everything
+    // else has to fold from them and constants
+    class LoopEvaluator {
+    public:
+        LoopEvaluator(const Loop &loop) : loop_(loop) {}
+
+        std::optional<uint64_t> eval(const std::shared_ptr<Var> &v, int depth = 0) {
+            if (v->is_constant) {
+                return v->constant;
+            }
+            if (v->is_param || v->is_global || v->is_undef || depth > max_depth) {
+                return std::nullopt;
+            }
+            auto iter = cur_.find(v);
+            if (iter != cur_.end()) {
+                return iter->second;
+            }
+            auto op = v->src_op.lock();
+            if (op == nullptr || op->type != Operation::T::ARITH) {
+                return std::nullopt;
+            }
+            std::vector<uint64_t> args;
+            for (auto &a : op->args) {
+                auto r = eval(a, depth + 1);
+                if (!r.has_value()) {
+                    return std::nullopt;
+                }
+                args.emplace_back(r.value());
+            }
+            auto r = fold_int_arith(*op, args);
+            if (r.has_value()) {
+                cur_[v] = r.value();
+            }
+            return r;
+        }
+
+        // header phi values of the first iteration
+        void start() {
+            cur_.clear();
+            std::unordered_map<std::shared_ptr<Var>, uint64_t> phi_vals;
+            for (auto &op : loop_.header->ops) {
+                if (op->type != Operation::T::PHINODE) {
+                    continue;
+                }
+                auto v = eval(phi_arg(*op, loop_.preheader));
+                // phis that do not fold only matter if the exit depends on them
+                if (v.has_value()) {
+                    phi_vals[op->dst_vars[0]] = v.value();
+                }
+            }
+            cur_ = std::move(phi_vals);
+        }
+
+        // move the header phis along the latch
+        void next() {
+            std::unordered_map<std::shared_ptr<Var>, uint64_t> phi_vals;
+            for (auto &op : loop_.header->ops) {
+                if (op->type != Operation::T::PHINODE) {
+                    continue;
+                }
+                auto v = eval(phi_arg(*op, loop_.latches[0]));
+                // phis that do not fold only matter if the exit depends on them
+                if (v.has_value()) {
+                    phi_vals[op->dst_vars[0]] = v.value();
+                }
+            }
+            cur_ = std::move(phi_vals);
+        }
+
+        static std::shared_ptr<Var> phi_arg(const Operation &phi, const std::shared_ptr<BasicBlock> &from) {
+            for (size_t i = 0; i < phi.phi_info.from.size(); i++) {
+                if (phi.phi_info.from[i].lock() == from) {
+                    return phi.args[i];
+                }
+            }
+            return nullptr;
+        }
+
+    protected:
+        static constexpr int max_depth = 64;
+        const Loop &loop_;
+        std::unordered_map<std::shared_ptr<Var>, uint64_t> cur_;
+    };
+
+    // header phis with exactly the preheader and latch as incoming blocks
+    static bool header_phis_simple(const Loop &loop) {
+        if (loop.preheader == nullptr || loop.latches.size() != 1) {
+            return false;
+        }
+        for (auto &op : loop.header->ops) {
+            if (op->type != Operation::T::PHINODE) {
+                continue;
+            }
+            if (op->args.size() != 2) {
+                return false;
+            }
+            if (LoopEvaluator::phi_arg(*op, loop.preheader) == nullptr
+                    || LoopEvaluator::phi_arg(*op, loop.latches[0]) == nullptr) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void find_induction_vars(Loop &loop) {
+        if (!header_phis_simple(loop)) {
+            return;
+        }
+        for (auto &op : loop.header->ops) {
+            if (op->type != Operation::T::PHINODE) {
+                continue;
+            }
+            auto phi = op->dst_vars[0];
+            auto init = LoopEvaluator::phi_arg(*op, loop.preheader);
+            auto next = LoopEvaluator::phi_arg(*op, loop.latches[0]);
+            if (!init->is_constant) {
+                continue;
+            }
+            auto next_op = next->src_op.lock();
+            if (next_op == nullptr
+                    || next_op->type != Operation::T::ARITH
+                    || next_op->arith_info.t != ArithType::INT_ARITH) {
+                continue;
+            }
+            auto t = next_op->arith_info.u.iarith_t;
+            if (t != IntArithType::INT_ADD && t != IntArithType::INT_SUB) {
+                continue;
+            }
+            auto &a = next_op->args;
+            std::shared_ptr<Var> step;
+            if (a[0] == phi && a[1]->is_constant) {
+                step = a[1];
+            } else if (t == IntArithType::INT_ADD && a[1] == phi && a[0]->is_constant) {
+                step = a[0];
+            } else {
+                continue;
+            }
+            InductionVar iv;
+            iv.phi = phi;
+            iv.next = next;
+            iv.init = init->constant;
+            iv.step = sext_from(step->constant, bitwidth_of(*step));
+            if (t == IntArithType::INT_SUB) {
+                iv.step = -iv.step;
+            }
+            loop.induction_vars.emplace_back(iv);
+        }
+    }
+
+    // the block exiting the loop and the successor taken when it does;
+    // nullptr unless the loop has one exit edge out of a block that runs
+    // every iteration and ends in a single conditional branch
+    static std::shared_ptr<BasicBlock> single_exit(
+            const Loop &loop,
+            const std::vector<size_t> &idom,
+            const std::unordered_map<std::shared_ptr<BasicBlock>, size_t> &bb_idx,
+            std::shared_ptr<BasicBlock> &exit_bb) {
+        if (loop.exiting.size() != 1 || loop.latches.size() != 1) {
+            return nullptr;
+        }
+        auto exiting = loop.exiting[0];
+        if (exiting->branches.size() != 1 || !exiting->branches[0].is_conditional) {
+            return nullptr;
+        }
+        auto t_bb = exiting->branches[0].next_bb.lock();
+        auto f_bb = exiting->default_next_bb.lock();
+        bool t_in = loop.blocks.find(t_bb) != loop.blocks.end();
+        bool f_in = loop.blocks.find(f_bb) != loop.blocks.end();
+        if (t_in == f_in) {
+            return nullptr;
+        }
+        exit_bb = t_in ? f_bb : t_bb;
+
+        // the exiting block has to dominate the latch
+        auto target = bb_idx.at(exiting);
+        auto v = bb_idx.at(loop.latches[0]);
+        while (v != target && idom[v] != v) {
+            v = idom[v];
+        }
+        if (v != target) {
+            return nullptr;
+        }
+
+        for (auto &bb : loop.blocks) {
+            if (bb->is_return || bb->is_err) {
+                return nullptr;
+            }
+        }
+        return exiting;
+    }
+
+    static void compute_trip_count(Loop &loop, std::shared_ptr<BasicBlock> exiting,
+                                   std::shared_ptr<BasicBlock> exit_bb, uint64_t max_trip_count) {
+        if (exiting == nullptr || !header_phis_simple(loop)) {
+            return;
+        }
+        auto &br = exiting->branches[0];
+        bool exit_on_true = (br.next_bb.lock() == exit_bb);
+
+        LoopEvaluator evaluator(loop);
+        evaluator.start();
+        for (uint64_t k = 1; k <= max_trip_count; k++) {
+            auto c = evaluator.eval(br.cond_var);
+            if (!c.has_value()) {
+                return;
+            }
+            if ((c.value() != 0) == exit_on_true) {
+                loop.trip_count = k;
+                return;
+            }
+            evaluator.next();
+        }
+    }
+
+    LoopInfo analyze_loops(const Function &f) {
+        return analyze_loops(f, 1 << 16);
+    }
+
+    LoopInfo analyze_loops(const Function &f, uint64_t max_trip_count) {
+        LoopInfo result;
+        if (f.bbs.empty()) {
+            return result;
+        }
+        auto cfg = control_graph_of_func(f);
+        size_t n = f.bbs.size();
+        size_t entry = f.entry_bb_idx();
+        auto idom = cfg.ImmediateDominators(entry);
+
+        std::unordered_map<std::shared_ptr<BasicBlock>, size_t> bb_idx;
+        for (size_t i = 0; i < n; i++) {
+            bb_idx[f.bbs[i]] = i;
+        }
+        auto dominates = [&idom, n] (size_t a, size_t b) {
+            if (idom[b] == n) {
+                return false;
+            }
+            while (b != a && idom[b] != b) {
+                b = idom[b];
+            }
+            return a == b;
+        };
+
+        std::vector<std::vector<size_t>> preds(n);
+        std::map<size_t, std::vector<size_t>> back_edges;
+        for (size_t v = 0; v < n; v++) {
+            if (idom[v] == n) {
+                continue;
+            }
+            for (auto &s : successors(*f.bbs[v])) {
+                auto h = bb_idx[s];
+                preds[h].emplace_back(v);
+                if (dominates(h, v)) {
+                    back_edges[h].emplace_back(v);
+                }
+            }
+        }
+
+        for (auto &kv : back_edges) {
+            Loop loop;
+            auto h = kv.first;
+            loop.header = f.bbs[h];
+            loop.blocks.insert(loop.header);
+            std::queue<size_t> q;
+            for (auto t : kv.second) {
+                loop.latches.emplace_back(f.bbs[t]);
+                if (loop.blocks.insert(f.bbs[t]).second) {
+                    q.push(t);
+                }
+            }
+            // walk backwards from the latches, the header stops the walk
+            while (!q.empty()) {
+                auto v = q.front();
+                q.pop();
+                for (auto p : preds[v]) {
+                    if (loop.blocks.insert(f.bbs[p]).second) {
+                        q.push(p);
+                    }
+                }
+            }
+
+            std::vector<size_t> outside_preds;
+            for (auto p : preds[h]) {
+                if (loop.blocks.find(f.bbs[p]) == loop.blocks.end()) {
+                    outside_preds.emplace_back(p);
+                }
+            }
+            if (outside_preds.size() == 1) {
+                loop.preheader = f.bbs[outside_preds[0]];
+            }
+            for (size_t v = 0; v < n; v++) {
+                if (loop.blocks.find(f.bbs[v]) == loop.blocks.end()) {
+                    continue;
+                }
+                for (auto &s : successors(*f.bbs[v])) {
+                    if (loop.blocks.find(s) == loop.blocks.end()) {
+                        loop.exiting.emplace_back(f.bbs[v]);
+                        break;
+                    }
+                }
+            }
+            result.loops.emplace_back(std::move(loop));
+        }
+
+        // nesting: the parent is the smallest other loop holding our header
+        auto &loops = result.loops;
+        for (size_t i = 0; i < loops.size(); i++) {
+            for (size_t j = 0; j < loops.size(); j++) {
+                if (i == j || loops[j].blocks.find(loops[i].header) == loops[j].blocks.end()) {
+                    continue;
+                }
+                auto p = loops[i].parent;
+                if (p < 0 || loops[j].blocks.size() < loops[p].blocks.size()) {
+                    loops[i].parent = j;
+                }
+            }
+        }
+        for (size_t i = 0; i < loops.size(); i++) {
+            for (auto p = loops[i].parent; p >= 0; p = loops[p].parent) {
+                loops[i].depth++;
+                loops[p].has_subloop = true;
+            }
+            for (auto &bb : loops[i].blocks) {
+                auto iter = result.loop_of.find(bb);
+                if (iter == result.loop_of.end()
+                        || loops[i].blocks.size() < loops[iter->second].blocks.size()) {
+                    result.loop_of[bb] = i;
+                }
+            }
+        }
+
+        for (auto &loop : loops) {
+            find_induction_vars(loop);
+            std::shared_ptr<BasicBlock> exit_bb;
+            auto exiting = single_exit(loop, idom, bb_idx, exit_bb);
+            compute_trip_count(loop, exiting, exit_bb, max_trip_count);
+        }
+        return result;
+    }
+
+    // replaces loop by trip_count straight-line copies of its body
+    static void unroll_loop(Function &f, const Loop &loop, std::shared_ptr<BasicBlock> exiting,
+                            std::shared_ptr<BasicBlock> exit_bb) {
+        using VarMap = std::unordered_map<std::shared_ptr<Var>, std::shared_ptr<Var>>;
+        using BBMap = std::unordered_map<std::shared_ptr<BasicBlock>, std::shared_ptr<BasicBlock>>;
+        auto n_iter = loop.trip_count.value();
+        auto latch = loop.latches[0];
+        auto entry_bb = f.bbs[f.entry_bb_idx()];
+
+        auto map_var = [] (const VarMap &m, const std::shared_ptr<Var> &v) {
+            auto iter = m.find(v);
+            return iter == m.end() ? v : iter->second;
+        };
+
+        std::vector<BBMap> bb_maps(n_iter);
+        std::vector<VarMap> var_maps(n_iter);
+        for (uint64_t k = 0; k < n_iter; k++) {
+            auto &bb_map = bb_maps[k];
+            auto &var_map = var_maps[k];
+            for (auto &bb : loop.blocks) {
+                auto bb_copy = std::make_shared<BasicBlock>(*bb);
+                bb_copy->name = NameFactory::get()(NameFactory::get().base(bb->name));
+                bb_copy->ops.clear();
+                bb_map[bb] = bb_copy;
+            }
+            // header phis become the value flowing in from the preheader or
+            // from the previous copy of the latch
+            for (auto &op : loop.header->ops) {
+                if (op->type != Operation::T::PHINODE) {
+                    continue;
+                }
+                std::shared_ptr<Var> v;
+                if (k == 0) {
+                    v = LoopEvaluator::phi_arg(*op, loop.preheader);
+                } else {
+                    v = map_var(var_maps[k - 1], LoopEvaluator::phi_arg(*op, latch));
+                }
+                var_map[op->dst_vars[0]] = v;
+            }
+            for (auto &bb : loop.blocks) {
+                for (auto &op : bb->ops) {
+                    if (bb == loop.header && op->type == Operation::T::PHINODE) {
+                        continue;
+                    }
+                    auto op_copy = std::make_shared<Operation>(*op);
+                    op_copy->dst_vars.clear();
+                    for (auto &d : op->dst_vars) {
+                        auto nd = std::make_shared<Var>(*d);
+                        nd->name = NameFactory::get()(NameFactory::get().base(d->name));
+                        nd->uses.clear();
+                        nd->src_op = op_copy;
+                        var_map[d] = nd;
+                        op_copy->dst_vars.emplace_back(nd);
+                    }
+                    bb_map[bb]->append_operation(op_copy);
+                }
+            }
+        }
+
+        for (uint64_t k = 0; k < n_iter; k++) {
+            auto &bb_map = bb_maps[k];
+            auto &var_map = var_maps[k];
+            for (auto &bb : loop.blocks) {
+                auto &bb_copy = bb_map[bb];
+                for (auto &op : bb_copy->ops) {
+                    for (auto &a : op->args) {
+                        a = map_var(var_map, a);
+                    }
+                    if (op->type == Operation::T::PHINODE) {
+                        for (auto &from : op->phi_info.from) {
+                            auto from_bb = from.lock();
+                            if (bb_map.find(from_bb) != bb_map.end()) {
+                                from = bb_map[from_bb];
+                            }
+                        }
+                    }
+                }
+                for (auto &e : bb_copy->branches) {
+                    e.cond_var = map_var(var_map, e.cond_var);
+                }
+
+                auto target_of = [&] (std::shared_ptr<BasicBlock> n_bb) {
+                    if (n_bb == loop.header) {
+                        // the back edge of the last copy is never taken
+                        return (k + 1 < n_iter) ? bb_maps[k + 1][n_bb] : bb_map[n_bb];
+                    }
+                    if (bb_map.find(n_bb) != bb_map.end()) {
+                        return bb_map[n_bb];
+                    }
+                    return n_bb;
+                };
+
+                if (bb == exiting) {
+                    // the exit is decided at compile time
+                    auto t_bb = bb->branches[0].next_bb.lock();
+                    auto f_bb = bb->default_next_bb.lock();
+                    auto stay_bb = (t_bb == exit_bb) ? f_bb : t_bb;
+                    bb_copy->branches.clear();
+                    bb_copy->default_next_bb = (k + 1 < n_iter) ? target_of(stay_bb) : exit_bb;
+                    continue;
+                }
+                auto n_bb = bb->default_next_bb.lock();
+                assert(n_bb != nullptr);
+                bb_copy->default_next_bb = target_of(n_bb);
+                for (size_t i = 0; i < bb->branches.size(); i++) {
+                    bb_copy->branches[i].next_bb = target_of(bb->branches[i].next_bb.lock());
+                }
+            }
+        }
+
+        // values leaving the loop are the ones of the last iteration
+        auto &last_vars = var_maps[n_iter - 1];
+        auto last_exiting = bb_maps[n_iter - 1][exiting];
+        for (auto &bb : f.bbs) {
+            if (loop.blocks.find(bb) != loop.blocks.end()) {
+                continue;
+            }
+            for (auto &op : bb->ops) {
+                for (auto &a : op->args) {
+                    a = map_var(last_vars, a);
+                }
+                if (op->type == Operation::T::PHINODE) {
+                    for (auto &from : op->phi_info.from) {
+                        if (from.lock() == exiting) {
+                            from = last_exiting;
+                        }
+                    }
+                }
+            }
+            for (auto &e : bb->branches) {
+                e.cond_var = map_var(last_vars, e.cond_var);
+            }
+            if (bb->return_val != nullptr) {
+                bb->return_val = map_var(last_vars, bb->return_val);
+            }
+        }
+        replace_next_bb(loop.preheader, loop.header, bb_maps[0][loop.header]);
+
+        std::vector<std::shared_ptr<BasicBlock>> new_bbs;
+        for (auto &bb : f.bbs) {
+            if (loop.blocks.find(bb) == loop.blocks.end()) {
+                new_bbs.emplace_back(bb);
+            }
+        }
+        for (auto &bb_map : bb_maps) {
+            for (auto &kv : bb_map) {
+                new_bbs.emplace_back(kv.second);
+            }
+        }
+        if (loop.blocks.find(entry_bb) != loop.blocks.end()) {
+            entry_bb = bb_maps[0][entry_bb];
+        }
+        f.bbs = std::move(new_bbs);
+        for (size_t i = 0; i < f.bbs.size(); i++) {
+            if (f.bbs[i] == entry_bb) {
+                f.set_entry_idx(i);
+            }
+        }
+    }
+
+    int unroll_small_loops(Function &f) {
+        return unroll_small_loops(f, UnrollOptions());
+    }
+
+    int unroll_small_loops(Function &f, const UnrollOptions &opts) {
+        int num_unrolled = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            auto info = analyze_loops(f, opts.max_trip_count);
+            auto cfg = control_graph_of_func(f);
+            auto idom = cfg.ImmediateDominators(f.entry_bb_idx());
+            std::unordered_map<std::shared_ptr<BasicBlock>, size_t> bb_idx;
+            for (size_t i = 0; i < f.bbs.size(); i++) {
+                bb_idx[f.bbs[i]] = i;
+            }
+            for (auto &loop : info.loops) {
+                if (loop.has_subloop || !loop.trip_count.has_value()
+                        || loop.trip_count.value() > opts.max_trip_count
+                        || loop.num_ops() * loop.trip_count.value() > opts.max_unrolled_size) {
+                    continue;
+                }
+                std::shared_ptr<BasicBlock> exit_bb;
+                auto exiting = single_exit(loop, idom, bb_idx, exit_bb);
+                if (exiting == nullptr || !header_phis_simple(loop)) {
+                    continue;
+                }
+                // one loop per round, the analysis is stale afterwards
+                unroll_loop(f, loop, exiting, exit_bb);
+                remove_unreachable_bb(f);
+                update_uses(f);
+                remove_unused_phi_entry(f);
+                update_uses(f);
+                num_unrolled++;
+                changed = true;
+                break;
+            }
+        }
+        return num_unrolled;
+    }
+}
@@ -0,0 +1,377 @@
+#include "hir-parsegraph.hpp"
+#include "graph.hpp"
+
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+
+namespace HIR {
+    std::set<std::string> HeaderUsage::headers() const {
+        std::set<std::string> result;
+        for (auto &kv : reads) {
+            result.insert(kv.first);
+        }
+        for (auto &kv : writes) {
+            result.insert(kv.first);
+        }
+        return result;
+    }
+
+    HeaderUsage &HeaderUsage::operator+=(const HeaderUsage &other) {
+        for (auto &kv : other.reads) {
+            reads[kv.first].insert(kv.second.begin(), kv.second.end());
+        }
+        for (auto &kv : other.writes) {
+            writes[kv.first].insert(kv.second.begin(), kv.second.end());
+        }
+        return *this;
+    }
+
+    HeaderUsage header_usage_of(const Function &f) {
+        HeaderUsage result;
+        for (auto &bb : f.bbs) {
+            for (auto &op : bb->ops) {
+                auto &info = op->pkt_op_info;
+                switch (op->type) {
+                case Operation::T::PKT_HDR_LOAD:
+                    result.reads[info.header].insert(info.field);
+                    break;
+                case Operation::T::PKT_HDR_STORE:
+                    result.writes[info.header].insert(info.field);
+                    break;
+                case Operation::T::PKT_CSUM_UPDATE:
+                    result.reads[info.header].insert(info.field);
+                    result.writes[info.header].insert(info.field);
+                    break;
+                // accesses replace_packet_access_op traced to a field but
+                // could not turn into field ops (e.g. width mismatch)
+                case Operation::T::LOAD:
+                    if (!info.header.empty()) {
+                        result.reads[info.header].insert(info.field);
+                    }
+                    break;
+                case Operation::T::STORE:
+                    if (!info.header.empty()) {
+                        result.writes[info.header].insert(info.field);
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        return result;
+    }
+
+    const ParseState *ParseGraph::find(const std::string &header) const {
+        for (auto &s : states) {
+            if (s.header == header) {
+                return &s;
+            }
+        }
+        return nullptr;
+    }
+
+    static std::vector<std::string> next_headers(const PacketLayout &layout, const std::string &hdr) {
+        std::vector<std::string> result;
+        auto iter = layout.transitions.find(hdr);
+        if (iter == layout.transitions.end()) {
+            return result;
+        }
+        for (auto &c : iter->second.cases) {
+            result.emplace_back(c.second);
+        }
+        if (!iter->second.default_next.empty()) {
+            result.emplace_back(iter->second.default_next);
+        }
+        return result;
+    }
+
+    struct ParseSubgraph {
+        std::set<std::string> headers;
+        std::set<std::pair<std::string, std::string>> edges;
+    };
+
+    /* the transitions needed to reach the used headers.
+     * transitions back towards the start (decapsulating a gre or vxlan
+     * tunnel) are not followed, the program sees the outermost headers.
+     * if a used header can come before another used one, the latter is
+     * only reached through the former, so "ipv4 and tcp" does not parse
+     * the tcp after an ipv6 header. layouts are a handful of headers,
+     * the paths are simply enumerated
+     */
+    static ParseSubgraph transitions_to_parse(
+            const PacketLayout &layout,
+            const std::set<std::string> &used) {
+        ParseSubgraph result;
+        auto &start = layout.start_header;
+        if (start.empty() || layout.headers.find(start) == layout.headers.end()) {
+            return result;
+        }
+        std::unordered_map<std::string, size_t> depth{{start, 0}};
+        std::deque<std::string> queue{start};
+        while (!queue.empty()) {
+            auto hdr = queue.front();
+            queue.pop_front();
+            for (auto &n : next_headers(layout, hdr)) {
+                if (depth.emplace(n, depth[hdr] + 1).second) {
+                    queue.emplace_back(n);
+                }
+            }
+        }
+        auto forward = [&](const std::string &from) {
+            std::vector<std::string> next;
+            for (auto &n : next_headers(layout, from)) {
+                if (depth[n] >= depth[from]) {
+                    next.emplace_back(n);
+                }
+            }
+            return next;
+        };
+        auto can_precede = [&](const std::string &from, const std::string &to) {
+            std::set<std::string> visited{from};
+            std::vector<std::string> stack{from};
+            while (!stack.empty()) {
+                auto hdr = stack.back();
+                stack.pop_back();
+                for (auto &n : forward(hdr)) {
+                    if (n == to) {
+                        return true;
+                    }
+                    if (visited.insert(n).second) {
+                        stack.emplace_back(n);
+                    }
+                }
+            }
+            return false;
+        };
+
+        for (auto &target : used) {
+            std::set<std::string> before;
+            for (auto &u : used) {
+                if (u != target && can_precede(u, target)) {
+                    before.insert(u);
+                }
+            }
+            std::vector<std::string> path;
+            std::set<std::string> on_path;
+            std::function<void(const std::string &)> dfs = [&](const std::string &hdr) {
+                path.emplace_back(hdr);
+                on_path.insert(hdr);
+                if (hdr == target) {
+                    bool through_before = before.empty();
+                    for (auto &h : path) {
+                        through_before = through_before || before.find(h) != before.end();
+                    }
+                    if (through_before) {
+                        result.headers.insert(path.begin(), path.end());
+                        for (size_t i = 0; i + 1 < path.size(); i++) {
+                            result.edges.emplace(path[i], path[i + 1]);
+                        }
+                    }
+                } else {
+                    for (auto &n : forward(hdr)) {
+                        if (on_path.find(n) == on_path.end()) {
+                            dfs(n);
+                        }
+                    }
+                }
+                on_path.erase(hdr);
+                path.pop_back();
+            };
+            dfs(start);
+        }
+
+        // stacked headers (vlan in vlan) keep their self loop
+        for (auto &h : result.headers) {
+            for (auto &n : next_headers(layout, h)) {
+                if (n == h) {
+                    result.edges.emplace(h, h);
+                }
+            }
+        }
+        return result;
+    }
+
+    ParseGraph extract_parse_graph(const PacketLayout &layout, const HeaderUsage &usage) {
+        ParseGraph result;
+        auto used = usage.headers();
+        auto sub = transitions_to_parse(layout, used);
+        auto &kept = sub.headers;
+        for (auto &h : used) {
+            if (kept.find(h) == kept.end()) {
+                result.unreachable.emplace_back(h);
+            }
+        }
+        if (kept.empty()) {
+            return result;
+        }
+        result.start = layout.start_header;
+        auto needed = [&](const std::string &from, const std::string &to) {
+            return sub.edges.find({from, to}) != sub.edges.end();
+        };
+
+        // breadth first over the needed transitions
+        std::deque<std::string> queue{result.start};
+        std::set<std::string> visited{result.start};
+        while (!queue.empty()) {
+            auto hdr = queue.front();
+            queue.pop_front();
+            ParseState state;
+            state.header = hdr;
+            auto r = usage.reads.find(hdr);
+            if (r != usage.reads.end()) {
+                state.fields_used.insert(r->second.begin(), r->second.end());
+            }
+            auto w = usage.writes.find(hdr);
+            if (w != usage.writes.end()) {
+                state.fields_used.insert(w->second.begin(), w->second.end());
+            }
+            auto t = layout.transitions.find(hdr);
+            if (t != layout.transitions.end()) {
+                for (auto &c : t->second.cases) {
+                    if (needed(hdr, c.second)) {
+                        state.cases.emplace_back(c);
+                    }
+                }
+                if (!t->second.default_next.empty() && needed(hdr, t->second.default_next)) {
+                    state.default_next = t->second.default_next;
+                }
+                if (!state.cases.empty()) {
+                    state.select_field = t->second.select_field;
+                }
+            }
+            for (auto &n : next_headers(layout, hdr)) {
+                if (needed(hdr, n) && visited.insert(n).second) {
+                    queue.emplace_back(n);
+                }
+            }
+            result.states.emplace_back(std::move(state));
+        }
+
+        // headers on a cycle can show up more than once in a packet
+        std::unordered_map<std::string, size_t> idx;
+        std::vector<std::string> names;
+        for (auto &s : result.states) {
+            idx[s.header] = names.size();
+            names.emplace_back(s.header);
+        }
+        AdjacencyList<std::monostate> edges(names.size());
+        for (size_t i = 0; i < result.states.size(); i++) {
+            auto &s = result.states[i];
+            for (auto &c : s.cases) {
+                edges.set_edge(i, idx[c.second], std::monostate());
+            }
+            if (!s.default_next.empty()) {
+                edges.set_edge(i, idx[s.default_next], std::monostate());
+            }
+        }
+        Graph<std::string, std::monostate, AdjacencyList<std::monostate>> g(names, std::move(edges));
+        for (auto &scc : g.StronglyConnectedComponents()) {
+            for (auto v : scc) {
+                if (scc.size() > 1 || g.edges().have_edge(v, v)) {
+                    result.states[v].is_stack = true;
+                }
+            }
+        }
+        return result;
+    }
+
+    ParseGraph extract_parse_graph(const PacketLayout &layout, const Function &f) {
+        return extract_parse_graph(layout, header_usage_of(f));
+    }
+
+    static std::string hex_str(uint64_t v) {
+        std::stringstream ss;
+        ss << "0x" << std::hex << std::setfill('0') << std::setw(4) << v;
+        return ss.str();
+    }
+
+    void ParseGraph::print(std::ostream &os) const {
+        os << "start " << (start.empty() ? "accept" : start) << std::endl;
+        for (auto &s : states) {
+            os << s.header << (s.is_stack ? " (stack)" : "") << " :";
+            for (auto &f : s.fields_used) {
+                os << " " << f;
+            }
+            os << std::endl;
+            for (auto &c : s.cases) {
+                os << "  " << s.select_field << " == " << hex_str(c.first)
+                   << " -> " << c.second << std::endl;
+            }
+            os << "  default -> " << (s.default_next.empty() ? "accept" : s.default_next) << std::endl;
+        }
+        for (auto &h : unreachable) {
+            os << "unreachable " << h << std::endl;
+        }
+    }
+
+    void ParseGraph::print_p4(
+            std::ostream &os,
+            const PacketLayout &layout,
+            const std::string &parser_name,
+            size_t stack_depth) const {
+        for (auto &h : unreachable) {
+            os << "// " << h << " is used but not reachable from the start header" << std::endl;
+        }
+        for (auto &s : states) {
+            auto &hdr = layout.headers.at(s.header);
+            os << "header " << hdr.Name() << " {" << std::endl;
+            for (auto &e : hdr.Fields()) {
+                if (e.bit_fields.empty()) {
+                    os << "    bit<" << e.field_n_bytes * 8 << "> " << e.field_name << ";" << std::endl;
+                }
+                for (auto &bf : e.bit_fields) {
+                    os << "    bit<" << bf.n_bits << "> " << bf.name << ";" << std::endl;
+                }
+            }
+            os << "}" << std::endl << std::endl;
+        }
+
+        os << "struct headers_t {" << std::endl;
+        for (auto &s : states) {
+            os << "    " << layout.headers.at(s.header).Name();
+            if (s.is_stack) {
+                os << "[" << stack_depth << "]";
+            }
+            os << " " << s.header << ";" << std::endl;
+        }
+        os << "}" << std::endl << std::endl;
+
+        os << "parser " << parser_name << "(packet_in pkt, out headers_t hdr) {" << std::endl;
+        os << "    state start {" << std::endl;
+        os << "        transition " << (start.empty() ? "accept" : "parse_" + start) << ";" << std::endl;
+        os << "    }" << std::endl;
+        for (auto &s : states) {
+            auto ref = "hdr." + s.header;
+            os << std::endl;
+            os << "    state parse_" << s.header << " {" << std::endl;
+            os << "        pkt.extract(" << ref << (s.is_stack ? ".next" : "") << ");" << std::endl;
+            auto default_state = s.default_next.empty() ? "accept" : "parse_" + s.default_next;
+            if (s.cases.empty()) {
+                os << "        transition " << default_state << ";" << std::endl;
+                os << "    }" << std::endl;
+                continue;
+            }
+            // split fields are selected on as the concatenation of their bits
+            auto field_ref = ref + (s.is_stack ? ".last." : ".");
+            auto select = layout.headers.at(s.header).FindFieldByName(s.select_field);
+            std::string select_expr;
+            if (select->bit_fields.empty()) {
+                select_expr = field_ref + s.select_field;
+            }
+            for (auto &bf : select->bit_fields) {
+                select_expr += (select_expr.empty() ? "" : " ++ ") + field_ref + bf.name;
+            }
+            os << "        transition select(" << select_expr << ") {" << std::endl;
+            for (auto &c : s.cases) {
+                os << "            " << hex_str(c.first) << ": parse_" << c.second << ";" << std::endl;
+            }
+            os << "            default: " << default_state << ";" << std::endl;
+            os << "        }" << std::endl;
+            os << "    }" << std::endl;
+        }
+        os << "}" << std::endl;
+    }
+}
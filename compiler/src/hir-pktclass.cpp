@@ -0,0 +1,798 @@
+#include "hir-pktclass.hpp"
+#include "hir-loop.hpp"
+#include <algorithm>
+#include <limits>
+#include <set>
+
+namespace HIR {
+    static const char *arith_op_str(const Operation &op) {
+        if (op.arith_info.t == ArithType::INT_CMP) {
+            switch (op.arith_info.u.icmp_t) {
+            case IntCmpType::EQ:
+                return "==";
+            case IntCmpType::NE:
+                return "!=";
+            case IntCmpType::ULE:
+                return "u<=";
+            case IntCmpType::ULT:
+                return "u<";
+            case IntCmpType::SLE:
+                return "s<=";
+            case IntCmpType::SLT:
+                return "s<";
+            }
+            return "?";
+        }
+        using IA = IntArithType;
+        switch (op.arith_info.u.iarith_t) {
+        case IA::INT_ADD:
+            return "+";
+        case IA::INT_SUB:
+            return "-";
+        case IA::INT_MUL:
+            return "*";
+        case IA::INT_DIV:
+            return "/";
+        case IA::INT_MOD:
+            return "%";
+        case IA::INT_UDIV:
+            return "u/";
+        case IA::INT_UMOD:
+            return "u%";
+        case IA::INT_AND:
+            return "&";
+        case IA::INT_OR:
+            return "|";
+        case IA::INT_XOR:
+            return "^";
+        case IA::INT_SHL:
+            return "<<";
+        case IA::INT_LSHR:
+            return ">>";
+        case IA::INT_ASHR:
+            return "s>>";
+        case IA::INT_NOT:
+            return "~";
+        case IA::INT_TRUNC:
+            return "trunc";
+        case IA::INT_ZEXT:
+            return "zext";
+        case IA::INT_SEXT:
+            return "sext";
+        }
+        return "?";
+    }
+
+    std::string SymExpr::str() const {
+        switch (type) {
+        case T::CONST:
+            return std::to_string(constant);
+        case T::FIELD:
+            return header + "." + field;
+        case T::OPAQUE:
+            return var != nullptr ? var->name : "?";
+        case T::ARITH:
+            break;
+        }
+        assert(op != nullptr);
+        if (args.size() == 1) {
+            auto t = op->arith_info.u.iarith_t;
+            if (t == IntArithType::INT_NOT) {
+                return "~" + args[0]->str();
+            }
+            return std::string(arith_op_str(*op)) + std::to_string(bitwidth) + "(" + args[0]->str() + ")";
+        }
+        assert(args.size() == 2);
+        return "(" + args[0]->str() + " " + arith_op_str(*op) + " " + args[1]->str() + ")";
+    }
+
+    static bool is_cmp(const SymExpr &e, IntCmpType t) {
+        return e.type == SymExpr::T::ARITH
+            && e.op->arith_info.t == ArithType::INT_CMP
+            && e.op->arith_info.u.icmp_t == t;
+    }
+
+    std::string PathLiteral::str() const {
+        if (value) {
+            return cond->str();
+        }
+        if (is_cmp(*cond, IntCmpType::EQ) || is_cmp(*cond, IntCmpType::NE)) {
+            auto neg = is_cmp(*cond, IntCmpType::EQ) ? " != " : " == ";
+            return "(" + cond->args[0]->str() + neg + cond->args[1]->str() + ")";
+        }
+        return "!" + cond->str();
+    }
+
+    bool PathPredicate::always_true() const {
+        for (auto &c : conjs) {
+            if (c.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string PathPredicate::str() const {
+        if (conjs.empty()) {
+            return "false";
+        }
+        if (always_true()) {
+            return "true";
+        }
+        std::string result;
+        for (size_t i = 0; i < conjs.size(); i++) {
+            std::string c;
+            for (size_t j = 0; j < conjs[i].size(); j++) {
+                c += (j == 0 ? "" : " && ") + conjs[i][j].str();
+            }
+            if (conjs.size() > 1 && conjs[i].size() > 1) {
+                c = "(" + c + ")";
+            }
+            result += (i == 0 ? "" : " || ") + c;
+        }
+        return result;
+    }
+
+    void PacketClass::print(std::ostream &os) const {
+        switch (action) {
+        case Action::DROP:
+            os << "drop";
+            break;
+        case Action::ERROR:
+            os << "error";
+            break;
+        case Action::KEEP:
+            os << "keep";
+            break;
+        case Action::OUTPUT:
+            os << "output";
+            for (auto &p : out_ports) {
+                os << " " << p->str();
+            }
+            break;
+        }
+        for (auto &kv : rewrites) {
+            os << std::endl << "  rewrite " << kv.first << " = " << kv.second->str();
+        }
+        os << std::endl << "  when " << (pred.approximate ? "(approx) " : "") << pred.str();
+        os << std::endl << "  paths " << num_paths << std::endl;
+    }
+
+    void PacketClassInfo::print(std::ostream &os) const {
+        for (size_t i = 0; i < classes.size(); i++) {
+            os << "class " << i << " : ";
+            classes[i].print(os);
+        }
+        if (!complete) {
+            os << "(incomplete: back edges not followed)" << std::endl;
+        }
+    }
+
+    static uint64_t bit_mask(int bw) {
+        return bw >= 64 ? std::numeric_limits<uint64_t>::max() : ((uint64_t(1) << bw) - 1);
+    }
+
+    static int bitwidth_of(const Var &v) {
+        if (v.type == nullptr || v.type->type != Type::T::INT) {
+            return 64;
+        }
+        return v.type->bitwidth;
+    }
+
+    static SymExprPtr make_const(uint64_t c, int bw) {
+        auto e = std::make_shared<SymExpr>();
+        e->type = SymExpr::T::CONST;
+        e->bitwidth = bw;
+        e->constant = c & bit_mask(bw);
+        return e;
+    }
+
+    static SymExprPtr make_opaque(std::shared_ptr<Var> v) {
+        auto e = std::make_shared<SymExpr>();
+        e->type = SymExpr::T::OPAQUE;
+        e->bitwidth = bitwidth_of(*v);
+        e->var = v;
+        return e;
+    }
+
+    // packet state along one (or several merged) paths
+    struct SymState {
+        PathPredicate pred;
+        // vars whose value depends on the path: phis and loads of fields
+        // written earlier on the path
+        std::unordered_map<std::shared_ptr<Var>, SymExprPtr> env;
+        std::map<std::string, SymExprPtr> stores;
+        std::vector<SymExprPtr> outputs;
+        bool killed = false;
+        bool kept = false;
+        uint64_t num_paths = 1;
+    };
+
+    static SymExprPtr sym_of(const SymState &s, const std::shared_ptr<Var> &v, int depth = 0) {
+        static constexpr int max_depth = 16;
+        if (v->is_constant) {
+            return make_const(v->constant, bitwidth_of(*v));
+        }
+        auto iter = s.env.find(v);
+        if (iter != s.env.end()) {
+            return iter->second;
+        }
+        auto op = v->src_op.lock();
+        if (v->is_param || v->is_global || v->is_undef || op == nullptr || depth > max_depth) {
+            return make_opaque(v);
+        }
+        if (op->type == Operation::T::PKT_HDR_LOAD) {
+            auto e = std::make_shared<SymExpr>();
+            e->type = SymExpr::T::FIELD;
+            e->bitwidth = bitwidth_of(*v);
+            e->header = op->pkt_op_info.header;
+            e->field = op->pkt_op_info.field;
+            return e;
+        }
+        if (op->type != Operation::T::ARITH) {
+            return make_opaque(v);
+        }
+        std::vector<SymExprPtr> args;
+        std::vector<uint64_t> consts;
+        bool all_const = true;
+        for (auto &a : op->args) {
+            auto e = sym_of(s, a, depth + 1);
+            all_const = all_const && e->is_const();
+            consts.emplace_back(e->constant);
+            args.emplace_back(e);
+        }
+        if (all_const) {
+            auto r = fold_int_arith(*op, consts);
+            if (r.has_value()) {
+                return make_const(r.value(), bitwidth_of(*v));
+            }
+        }
+        auto e = std::make_shared<SymExpr>();
+        e->type = SymExpr::T::ARITH;
+        e->bitwidth = bitwidth_of(*v);
+        e->op = op.get();
+        e->args = std::move(args);
+        return e;
+    }
+
+    // constraints collected for one expression compared against constants
+    struct ValueRange {
+        uint64_t lo = 0;
+        uint64_t hi = std::numeric_limits<uint64_t>::max();
+        std::optional<uint64_t> eq;
+        std::set<uint64_t> ne;
+    };
+
+    static bool conj_feasible(const std::vector<PathLiteral> &conj) {
+        std::unordered_map<std::string, bool> seen;
+        std::unordered_map<std::string, ValueRange> ranges;
+        for (auto &lit : conj) {
+            auto key = lit.cond->str();
+            auto iter = seen.find(key);
+            if (iter != seen.end()) {
+                if (iter->second != lit.value) {
+                    return false;
+                }
+                continue;
+            }
+            seen[key] = lit.value;
+
+            auto &c = *lit.cond;
+            if (c.type != SymExpr::T::ARITH || c.op->arith_info.t != ArithType::INT_CMP) {
+                continue;
+            }
+            bool lhs_const = c.args[0]->is_const();
+            bool rhs_const = c.args[1]->is_const();
+            if (lhs_const == rhs_const) {
+                continue;
+            }
+            auto e = lhs_const ? c.args[1] : c.args[0];
+            auto k = lhs_const ? c.args[0]->constant : c.args[1]->constant;
+            auto t = c.op->arith_info.u.icmp_t;
+            bool v = lit.value;
+            // put the expression on the left
+            if (lhs_const) {
+                if (t == IntCmpType::ULT) {
+                    t = IntCmpType::ULE;
+                    v = !v;
+                } else if (t == IntCmpType::ULE) {
+                    t = IntCmpType::ULT;
+                    v = !v;
+                }
+            }
+            if (t == IntCmpType::NE) {
+                t = IntCmpType::EQ;
+                v = !v;
+            }
+
+            auto &r = ranges[e->str()];
+            r.hi = std::min(r.hi, bit_mask(e->bitwidth));
+            switch (t) {
+            case IntCmpType::EQ:
+                if (v) {
+                    if (r.eq.has_value() && r.eq.value() != k) {
+                        return false;
+                    }
+                    r.eq = k;
+                } else {
+                    r.ne.insert(k);
+                }
+                break;
+            case IntCmpType::ULT:
+                if (v) {
+                    if (k == 0) {
+                        return false;
+                    }
+                    r.hi = std::min(r.hi, k - 1);
+                } else {
+                    r.lo = std::max(r.lo, k);
+                }
+                break;
+            case IntCmpType::ULE:
+                if (v) {
+                    r.hi = std::min(r.hi, k);
+                } else {
+                    if (k == std::numeric_limits<uint64_t>::max()) {
+                        return false;
+                    }
+                    r.lo = std::max(r.lo, k + 1);
+                }
+                break;
+            default:
+                // signed compares are kept but not checked
+                break;
+            }
+        }
+        for (auto &kv : ranges) {
+            auto &r = kv.second;
+            if (r.lo > r.hi) {
+                return false;
+            }
+            if (r.eq.has_value()) {
+                auto e = r.eq.value();
+                if (e < r.lo || e > r.hi || r.ne.count(e) > 0) {
+                    return false;
+                }
+            } else if (r.lo == r.hi && r.ne.count(r.lo) > 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct EqFact {
+        std::string expr;
+        uint64_t constant;
+        bool equal;
+    };
+
+    // literals of the form  e == c  or  e != c
+    static std::optional<EqFact> as_eq_fact(const PathLiteral &lit) {
+        auto &c = *lit.cond;
+        bool is_eq = is_cmp(c, IntCmpType::EQ);
+        if (!is_eq && !is_cmp(c, IntCmpType::NE)) {
+            return std::nullopt;
+        }
+        bool lhs_const = c.args[0]->is_const();
+        if (lhs_const == c.args[1]->is_const()) {
+            return std::nullopt;
+        }
+        auto &e = lhs_const ? c.args[1] : c.args[0];
+        auto k = lhs_const ? c.args[0]->constant : c.args[1]->constant;
+        return EqFact{e->str(), k, is_eq == lit.value};
+    }
+
+    // e != c is redundant next to e == c' with c' != c
+    static bool implied_by(const PathLiteral &lit, const PathLiteral &other) {
+        auto a = as_eq_fact(lit);
+        auto b = as_eq_fact(other);
+        return a.has_value() && b.has_value()
+            && !a->equal && b->equal
+            && a->expr == b->expr && a->constant != b->constant;
+    }
+
+    // s && (cond == value), false if nothing feasible is left
+    static bool add_literal(SymState &s, SymExprPtr cond, bool value) {
+        PathLiteral lit{cond, value};
+        auto key = cond->str();
+        std::vector<std::vector<PathLiteral>> conjs;
+        for (auto &c : s.pred.conjs) {
+            std::vector<PathLiteral> new_c;
+            bool present = false;
+            for (auto &l : c) {
+                if ((l.value == value && l.cond->str() == key) || implied_by(lit, l)) {
+                    present = true;
+                }
+                if (!implied_by(l, lit)) {
+                    new_c.emplace_back(l);
+                }
+            }
+            if (!present) {
+                new_c.emplace_back(lit);
+            }
+            if (conj_feasible(new_c)) {
+                conjs.emplace_back(std::move(new_c));
+            }
+        }
+        s.pred.conjs = std::move(conjs);
+        return !s.pred.conjs.empty();
+    }
+
+    static std::string conj_key(const std::vector<PathLiteral> &conj) {
+        std::vector<std::string> lits;
+        for (auto &l : conj) {
+            lits.emplace_back((l.value ? "+" : "-") + l.cond->str());
+        }
+        std::sort(lits.begin(), lits.end());
+        std::string result;
+        for (auto &l : lits) {
+            result += l + ";";
+        }
+        return result;
+    }
+
+    // keep only the literals every conjunction agrees on
+    static void approximate(PathPredicate &pred) {
+        std::vector<PathLiteral> common;
+        for (auto &l : pred.conjs[0]) {
+            auto key = conj_key({l});
+            bool in_all = true;
+            for (size_t i = 1; i < pred.conjs.size() && in_all; i++) {
+                bool found = false;
+                for (auto &o : pred.conjs[i]) {
+                    if (conj_key({o}) == key) {
+                        found = true;
+                        break;
+                    }
+                }
+                in_all = found;
+            }
+            if (in_all) {
+                common.emplace_back(l);
+            }
+        }
+        pred.conjs = {common};
+        pred.approximate = true;
+    }
+
+    // dedupe, then merge conjunctions that differ in the sign of one literal
+    static void simplify(PathPredicate &pred, size_t max_conjs) {
+        // the pairwise merge is quadratic, give up early on huge predicates
+        if (pred.conjs.size() > 4 * max_conjs) {
+            approximate(pred);
+            return;
+        }
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            std::vector<std::vector<PathLiteral>> conjs;
+            std::set<std::string> keys;
+            for (auto &c : pred.conjs) {
+                if (keys.insert(conj_key(c)).second) {
+                    conjs.emplace_back(c);
+                }
+            }
+            for (size_t i = 0; i < conjs.size() && !changed; i++) {
+                for (size_t j = i + 1; j < conjs.size() && !changed; j++) {
+                    if (conjs[i].size() != conjs[j].size()) {
+                        continue;
+                    }
+                    for (size_t k = 0; k < conjs[i].size(); k++) {
+                        auto reduced = conjs[i];
+                        auto flipped = reduced[k];
+                        flipped.value = !flipped.value;
+                        reduced.erase(reduced.begin() + k);
+                        auto with_flip = reduced;
+                        with_flip.emplace_back(flipped);
+                        if (conj_key(with_flip) == conj_key(conjs[j])) {
+                            conjs[i] = std::move(reduced);
+                            conjs.erase(conjs.begin() + j);
+                            changed = true;
+                            break;
+                        }
+                    }
+                }
+            }
+            pred.conjs = std::move(conjs);
+        }
+        if (pred.always_true()) {
+            pred.conjs = {{}};
+            return;
+        }
+
+        if (pred.conjs.size() > max_conjs) {
+            approximate(pred);
+        }
+    }
+
+    static std::string effect_key(const SymState &s) {
+        std::string result = s.killed ? "killed;" : "";
+        result += s.kept ? "kept;" : "";
+        for (auto &o : s.outputs) {
+            result += "out " + o->str() + ";";
+        }
+        for (auto &kv : s.stores) {
+            result += kv.first + "=" + kv.second->str() + ";";
+        }
+        return result;
+    }
+
+    static std::string env_key(const SymState &s) {
+        std::vector<std::string> entries;
+        for (auto &kv : s.env) {
+            entries.emplace_back(kv.first->name + "=" + kv.second->str());
+        }
+        std::sort(entries.begin(), entries.end());
+        std::string result;
+        for (auto &e : entries) {
+            result += e + ";";
+        }
+        return result;
+    }
+
+    static void merge_into(SymState &dst, const SymState &src) {
+        for (auto &c : src.pred.conjs) {
+            dst.pred.conjs.emplace_back(c);
+        }
+        dst.pred.approximate = dst.pred.approximate || src.pred.approximate;
+        dst.num_paths += src.num_paths;
+        // env entries that disagree are no longer known
+        for (auto &kv : dst.env) {
+            auto iter = src.env.find(kv.first);
+            if (iter == src.env.end() || iter->second->str() != kv.second->str()) {
+                kv.second = make_opaque(kv.first);
+            }
+        }
+        for (auto &kv : src.env) {
+            if (dst.env.find(kv.first) == dst.env.end()) {
+                dst.env[kv.first] = make_opaque(kv.first);
+            }
+        }
+    }
+
+    static std::vector<SymState> merge_states(
+            std::vector<SymState> states,
+            const PathExploreOptions &opts) {
+        // states with the same effects and the same path dependent values
+        // only differ in how they got here
+        std::vector<SymState> merged;
+        std::unordered_map<std::string, size_t> by_key;
+        for (auto &s : states) {
+            auto key = effect_key(s) + "|" + env_key(s);
+            auto iter = by_key.find(key);
+            if (iter == by_key.end()) {
+                by_key[key] = merged.size();
+                merged.emplace_back(std::move(s));
+            } else {
+                merge_into(merged[iter->second], s);
+            }
+        }
+        if (merged.size() > opts.max_states_per_bb) {
+            // too many, forget the path dependent values
+            std::vector<SymState> coarse;
+            std::unordered_map<std::string, size_t> by_effect;
+            for (auto &s : merged) {
+                auto key = effect_key(s);
+                auto iter = by_effect.find(key);
+                if (iter == by_effect.end()) {
+                    by_effect[key] = coarse.size();
+                    coarse.emplace_back(std::move(s));
+                } else {
+                    merge_into(coarse[iter->second], s);
+                }
+            }
+            merged = std::move(coarse);
+        }
+        for (auto &s : merged) {
+            simplify(s.pred, opts.max_conjs);
+        }
+        return merged;
+    }
+
+    PacketClassInfo explore_packet_classes(const Function &f) {
+        return explore_packet_classes(f, PathExploreOptions());
+    }
+
+    PacketClassInfo explore_packet_classes(const Function &f, const PathExploreOptions &opts) {
+        PacketClassInfo result;
+        if (f.bbs.empty()) {
+            return result;
+        }
+
+        // visit blocks in topological order of the scc DAG
+        auto cfg = control_graph_of_func(f);
+        auto scc_list = cfg.StronglyConnectedComponents();
+        auto scc_order = cfg.CondensedGraph(scc_list).TopologicalSort();
+        std::vector<std::shared_ptr<BasicBlock>> order;
+        for (auto iter = scc_order.rbegin(); iter != scc_order.rend(); iter++) {
+            for (auto v : scc_list[*iter]) {
+                order.emplace_back(f.bbs[v]);
+            }
+        }
+        std::unordered_map<const BasicBlock *, size_t> pos;
+        for (size_t i = 0; i < order.size(); i++) {
+            pos[order[i].get()] = i;
+        }
+
+        // position of the last block using each var, the env forgets vars after it
+        std::unordered_map<const Var *, size_t> last_use;
+        auto note_use = [&last_use] (const std::shared_ptr<Var> &v, size_t p) {
+            auto &u = last_use[v.get()];
+            u = std::max(u, p);
+        };
+        for (auto &bb : order) {
+            auto p = pos[bb.get()];
+            for (auto &op : bb->ops) {
+                for (auto &a : op->args) {
+                    note_use(a, p);
+                }
+            }
+            for (auto &e : bb->branches) {
+                note_use(e.cond_var, p);
+            }
+            if (bb->return_val != nullptr) {
+                note_use(bb->return_val, p);
+            }
+        }
+
+        std::vector<std::vector<SymState>> pending(order.size());
+        std::vector<SymState> finished;
+        std::vector<bool> finished_err;
+
+        auto send = [&] (const SymState &s, const BasicBlock *from, std::shared_ptr<BasicBlock> to) {
+            auto p = pos[to.get()];
+            if (p <= pos[from]) {
+                result.complete = false;
+                return;
+            }
+            SymState next = s;
+            std::vector<std::pair<std::shared_ptr<Var>, SymExprPtr>> phi_vals;
+            for (auto &op : to->ops) {
+                if (op->type != Operation::T::PHINODE) {
+                    continue;
+                }
+                for (size_t i = 0; i < op->phi_info.from.size(); i++) {
+                    if (op->phi_info.from[i].lock().get() == from) {
+                        phi_vals.emplace_back(op->dst_vars[0], sym_of(s, op->args[i]));
+                        break;
+                    }
+                }
+            }
+            for (auto &kv : phi_vals) {
+                next.env[kv.first] = kv.second;
+            }
+            pending[p].emplace_back(std::move(next));
+        };
+
+        // the input packet, Element::push(int, Packet*)
+        auto pkt = (f.args.size() == 3) ? f.args[2] : nullptr;
+
+        SymState init;
+        init.pred.conjs = {{}};
+        pending[pos[f.bbs[f.entry_bb_idx()].get()]].emplace_back(std::move(init));
+
+        for (size_t k = 0; k < order.size(); k++) {
+            if (pending[k].empty()) {
+                continue;
+            }
+            auto &bb = order[k];
+            for (auto &s : pending[k]) {
+                for (auto iter = s.env.begin(); iter != s.env.end();) {
+                    auto u = last_use.find(iter->first.get());
+                    if (u == last_use.end() || u->second < k) {
+                        iter = s.env.erase(iter);
+                    } else {
+                        iter++;
+                    }
+                }
+            }
+            auto states = merge_states(std::move(pending[k]), opts);
+            pending[k].clear();
+
+            for (auto &s : states) {
+                for (auto &op : bb->ops) {
+                    if (op->type == Operation::T::PKT_HDR_STORE) {
+                        auto key = op->pkt_op_info.header + "." + op->pkt_op_info.field;
+                        s.stores[key] = sym_of(s, op->args[1]);
+                    } else if (op->type == Operation::T::PKT_CSUM_UPDATE) {
+                        auto key = op->pkt_op_info.header + "." + op->pkt_op_info.field;
+                        s.stores[key] = make_opaque(op->dst_vars[0]);
+                    } else if (op->type == Operation::T::PKT_HDR_LOAD) {
+                        auto key = op->pkt_op_info.header + "." + op->pkt_op_info.field;
+                        auto iter = s.stores.find(key);
+                        if (iter != s.stores.end()) {
+                            s.env[op->dst_vars[0]] = iter->second;
+                        }
+                    } else if (op->type == Operation::T::STORE) {
+                        if (pkt != nullptr && op->args[1] == pkt) {
+                            s.kept = true;
+                        }
+                    } else if (op->type == Operation::T::FUNC_CALL) {
+                        auto fn = op->call_info.called_function.lock();
+                        if (fn == nullptr || !fn->is_built_in) {
+                            continue;
+                        }
+                        if (fn->name == "PushPktFn") {
+                            s.outputs.emplace_back(sym_of(s, op->args[1]));
+                        } else if (fn->name == "PacketKillFn") {
+                            s.killed = true;
+                        }
+                    }
+                }
+
+                if (bb->is_return || bb->is_err) {
+                    finished.emplace_back(s);
+                    finished_err.emplace_back(bb->is_err);
+                    continue;
+                }
+
+                // branches are tried in order, the default edge is taken if none holds
+                SymState cur = s;
+                bool fallthrough = true;
+                for (auto &e : bb->branches) {
+                    auto c = sym_of(cur, e.cond_var);
+                    if (c->is_const()) {
+                        if (c->constant != 0) {
+                            send(cur, bb.get(), e.next_bb.lock());
+                            fallthrough = false;
+                            break;
+                        }
+                        continue;
+                    }
+                    SymState taken = cur;
+                    if (add_literal(taken, c, true)) {
+                        send(taken, bb.get(), e.next_bb.lock());
+                    }
+                    if (!add_literal(cur, c, false)) {
+                        fallthrough = false;
+                        break;
+                    }
+                }
+                if (fallthrough) {
+                    send(cur, bb.get(), bb->default_next_bb.lock());
+                }
+            }
+        }
+
+        // group the end states into classes
+        std::unordered_map<std::string, size_t> class_idx;
+        for (size_t i = 0; i < finished.size(); i++) {
+            auto &s = finished[i];
+            PacketClass c;
+            if (finished_err[i]) {
+                c.action = PacketClass::Action::ERROR;
+            } else if (s.killed) {
+                c.action = PacketClass::Action::DROP;
+            } else if (s.outputs.empty()) {
+                c.action = s.kept ? PacketClass::Action::KEEP : PacketClass::Action::DROP;
+            } else {
+                c.action = PacketClass::Action::OUTPUT;
+                c.out_ports = s.outputs;
+            }
+            // what happened to a dropped packet does not matter
+            std::string key = std::to_string((int)c.action);
+            if (c.action == PacketClass::Action::OUTPUT) {
+                c.rewrites = s.stores;
+                key += "|" + effect_key(s);
+            }
+            auto iter = class_idx.find(key);
+            if (iter == class_idx.end()) {
+                c.pred = s.pred;
+                c.num_paths = s.num_paths;
+                class_idx[key] = result.classes.size();
+                result.classes.emplace_back(std::move(c));
+            } else {
+                auto &dst = result.classes[iter->second];
+                for (auto &conj : s.pred.conjs) {
+                    dst.pred.conjs.emplace_back(conj);
+                }
+                dst.pred.approximate = dst.pred.approximate || s.pred.approximate;
+                dst.num_paths += s.num_paths;
+            }
+        }
+        for (auto &c : result.classes) {
+            simplify(c.pred, opts.max_conjs);
+        }
+        return result;
+    }
+}
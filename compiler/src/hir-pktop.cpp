@@ -1,7 +1,13 @@
 #include "hir-common-pass.hpp"
 #include "hir-pktop.hpp"
 #include "llvm-helpers.hpp"
+#include "utils.hpp"
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <optional>
+#include <set>
 #include <unordered_set>
 
 namespace HIR {
@@ -12,6 +18,9 @@ namespace HIR {
             PKT_HEADER_PTR,
             PKT_FIELD_PTR,
             PKT_W_OFFSET,
+            // offset bytes past the end of a variable length header, the
+            // header after it depends on the path (see resolve_header_end)
+            PKT_HDR_END,
         };
 
         PacketOpInfo() : type(T::OTHER) {}
@@ -26,6 +35,8 @@ namespace HIR {
         std::string field_name;
         uint64_t offset;
         size_t field_size;
+        // for PKT_PTR, data() is known to point at the layout's start header
+        bool data_at_start = false;
 
         bool operator==(const PacketOpInfo& o) {
             if (type != o.type) {
@@ -44,6 +55,10 @@ namespace HIR {
                     && field_name == o.field_name;
             case T::PKT_W_OFFSET:
                 return pkt_obj == o.pkt_obj && offset == o.offset;
+            case T::PKT_HDR_END:
+                return pkt_obj == o.pkt_obj
+                    && header_name == o.header_name
+                    && offset == o.offset;
             default:
                 return false;
             }
@@ -55,12 +70,212 @@ namespace HIR {
         }
     };
 
+    // bit i of a value derived from a header field load holds bit
+    // bits[i] of the field, counted from its lsb in network order,
+    // or is known to be zero if bits[i] is -1
+    using FieldBits = std::vector<int>;
+
+    // loads are little endian, byte j of the value is byte j of the field
+    static FieldBits field_bits_of_load(size_t field_n_bytes, size_t n_bytes_loaded) {
+        FieldBits result(n_bytes_loaded * 8);
+        for (size_t j = 0; j < n_bytes_loaded; j++) {
+            for (size_t b = 0; b < 8; b++) {
+                result[j * 8 + b] = (field_n_bytes - 1 - j) * 8 + b;
+            }
+        }
+        return result;
+    }
+
+    // where the bits of op's result come from, given that v holds in
+    static std::optional<FieldBits> field_bits_through(
+            const Operation &op,
+            const Var *v,
+            const FieldBits &in) {
+        if (op.dst_vars.size() != 1 || op.dst_vars[0]->type->type != Type::T::INT) {
+            return std::nullopt;
+        }
+        size_t width = op.dst_vars[0]->type->bitwidth;
+        FieldBits out(width, -1);
+        if (op.type == Operation::T::FUNC_CALL) {
+            if (!str_begin_with(op.call_info.func_name, "llvm.bswap.")
+                || op.args.size() != 1 || width != in.size() || width % 8 != 0) {
+                return std::nullopt;
+            }
+            for (size_t i = 0; i < width; i++) {
+                out[i] = in[(width / 8 - 1 - i / 8) * 8 + i % 8];
+            }
+            return out;
+        }
+        if (op.type != Operation::T::ARITH || op.arith_info.t != ArithType::INT_ARITH) {
+            return std::nullopt;
+        }
+        auto t = op.arith_info.u.iarith_t;
+        if (t == IntArithType::INT_ZEXT || t == IntArithType::INT_TRUNC) {
+            for (size_t i = 0; i < width && i < in.size(); i++) {
+                out[i] = in[i];
+            }
+            return out;
+        }
+        if (op.args.size() != 2 || width != in.size()) {
+            return std::nullopt;
+        }
+        if (t == IntArithType::INT_AND) {
+            auto &c = (op.args[0].get() == v) ? op.args[1] : op.args[0];
+            if (!c->is_constant || width > 64) {
+                return std::nullopt;
+            }
+            for (size_t i = 0; i < width; i++) {
+                out[i] = ((c->constant >> i) & 1) ? in[i] : -1;
+            }
+            return out;
+        }
+        if (t != IntArithType::INT_LSHR && t != IntArithType::INT_SHL) {
+            return std::nullopt;
+        }
+        if (op.args[0].get() != v || !op.args[1]->is_constant) {
+            return std::nullopt;
+        }
+        size_t sh = op.args[1]->constant;
+        for (size_t i = 0; i < width; i++) {
+            if (t == IntArithType::INT_LSHR && i + sh < width) {
+                out[i] = in[i + sh];
+            } else if (t == IntArithType::INT_SHL && i >= sh) {
+                out[i] = in[i - sh];
+            }
+        }
+        return out;
+    }
+
     PacketOpInfo pkt_access_trace(
         const PacketLayout &layout,
         std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> &info_cache, 
         std::shared_ptr<Var> v
     );
 
+    // the header field bits v holds, and the field they are from, if v
+    // is computed from a single header field load
+    static std::optional<FieldBits> traced_field_bits(
+            const PacketLayout &layout,
+            std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> &info_cache,
+            const std::shared_ptr<Var> &v,
+            PacketOpInfo &field_info) {
+        if (v->is_constant || v->is_param || v->is_global || v->type->type != Type::T::INT) {
+            return std::nullopt;
+        }
+        auto op = v->src_op.lock();
+        if (op == nullptr) {
+            return std::nullopt;
+        }
+        if (op->type == Operation::T::LOAD) {
+            auto info = pkt_access_trace(layout, info_cache, op->args[0]);
+            if (info.type == PacketOpInfo::T::PKT_HEADER_PTR) {
+                auto first = layout.headers.at(info.header_name).FindFieldByOffset(0);
+                info.type = PacketOpInfo::T::PKT_FIELD_PTR;
+                info.field_name = first->field_name;
+                info.field_size = first->field_n_bytes;
+            }
+            size_t bitwidth = v->type->bitwidth;
+            if (info.type != PacketOpInfo::T::PKT_FIELD_PTR
+                || bitwidth % 8 != 0 || bitwidth > info.field_size * 8) {
+                return std::nullopt;
+            }
+            field_info = info;
+            return field_bits_of_load(info.field_size, bitwidth / 8);
+        }
+        // loads already turned into field ops by replace_packet_access_op
+        if (op->type == Operation::T::PKT_HDR_LOAD) {
+            auto hdr = layout.headers.find(op->pkt_op_info.header);
+            if (hdr == layout.headers.end()) {
+                return std::nullopt;
+            }
+            auto field = hdr->second.FindFieldByName(op->pkt_op_info.field);
+            if (field == nullptr || static_cast<size_t>(v->type->bitwidth) != field->field_n_bytes * 8) {
+                return std::nullopt;
+            }
+            field_info.type = PacketOpInfo::T::PKT_FIELD_PTR;
+            field_info.pkt_obj = op->args[0];
+            field_info.header_name = op->pkt_op_info.header;
+            field_info.field_name = field->field_name;
+            field_info.field_size = field->field_n_bytes;
+            return field_bits_of_load(field->field_n_bytes, field->field_n_bytes);
+        }
+        std::shared_ptr<Var> from;
+        for (auto &a : op->args) {
+            if (a->is_constant) {
+                continue;
+            }
+            if (from != nullptr) {
+                return std::nullopt;
+            }
+            from = a;
+        }
+        if (from == nullptr) {
+            return std::nullopt;
+        }
+        auto in = traced_field_bits(layout, info_cache, from, field_info);
+        if (!in.has_value()) {
+            return std::nullopt;
+        }
+        // sign extending a value with a known zero top bit
+        if (op->type == Operation::T::ARITH && op->arith_info.t == ArithType::INT_ARITH
+            && op->arith_info.u.iarith_t == IntArithType::INT_SEXT) {
+            if (in->empty() || in->back() != -1) {
+                return std::nullopt;
+            }
+            in->resize(v->type->bitwidth, -1);
+            return in;
+        }
+        return field_bits_through(*op, from.get(), in.value());
+    }
+
+    /* whether idx * scale is the length of the header base points to,
+     * the length field times its unit. the bits of idx have to be exactly
+     * those of the length field moved up by log2(unit / scale)
+     */
+    static bool is_header_length(
+            const PacketLayout &layout,
+            std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> &info_cache,
+            const PacketOpInfo &base,
+            const std::shared_ptr<Var> &idx,
+            size_t scale) {
+        auto &hdr = layout.headers.at(base.header_name);
+        if (!hdr.IsVarLength() || scale == 0 || hdr.Length().unit % scale != 0) {
+            return false;
+        }
+        size_t mult = hdr.Length().unit / scale;
+        if ((mult & (mult - 1)) != 0) {
+            return false;
+        }
+        int sh = 0;
+        while ((1u << sh) < mult) {
+            sh++;
+        }
+        auto &len_field = hdr.Length().field;
+        auto container = hdr.FindContainerByName(len_field);
+        int n = hdr.FieldNBits(len_field);
+        int lo = 0;
+        if (auto bf = hdr.FindBitFieldByName(len_field)) {
+            lo = container->field_n_bytes * 8 - bf->bit_offset - bf->n_bits;
+        }
+
+        PacketOpInfo field_info;
+        auto bits = traced_field_bits(layout, info_cache, idx, field_info);
+        if (!bits.has_value()
+            || field_info.pkt_obj != base.pkt_obj
+            || field_info.header_name != base.header_name
+            || field_info.field_name != container->field_name
+            || (int)bits->size() < sh + n) {
+            return false;
+        }
+        for (int i = 0; i < (int)bits->size(); i++) {
+            int expected = (i >= sh && i < sh + n) ? lo + i - sh : -1;
+            if ((*bits)[i] != expected) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     class PktAccOpTraceVisitor : public OperationConstVisitor<PktAccOpTraceVisitor> {
     public:
         std::unordered_map<std::shared_ptr<Var>, PacketOpInfo>& info_cache;
@@ -99,7 +314,8 @@ namespace HIR {
 
             // calculate offset
             auto const_off = 0;
-            bool symbolic_offset = false;
+            std::shared_ptr<Var> symbolic_idx;
+            size_t symbolic_scale = 0;
             auto gep_ptr_type = ptr_var->type;
             assert(gep_ptr_type->type == Type::T::POINTER);
             for (int i = 1; i < op.args.size(); i++) {
@@ -126,13 +342,31 @@ namespace HIR {
                     }
                     const_off += off;
                 } else {
-                    // symbolic offset
-                    symbolic_offset = true;
-                    break;
+                    // symbolic offset, only a header length is understood
+                    if (symbolic_idx != nullptr) {
+                        return;
+                    }
+                    if (gep_ptr_type->type == Type::T::POINTER && gep_ptr_type->pointee_type->sized()) {
+                        gep_ptr_type = gep_ptr_type->pointee_type;
+                    } else if (gep_ptr_type->type == Type::T::ARRAY) {
+                        gep_ptr_type = gep_ptr_type->array_info.element_type;
+                    } else {
+                        return;
+                    }
+                    symbolic_idx = op.args[i];
+                    symbolic_scale = gep_ptr_type->num_bytes();
                 }
             }
-            if (symbolic_offset) {
-                result.type = PacketOpInfo::T::OTHER;
+            if (symbolic_idx != nullptr) {
+                // "(uint8_t *)ip + (ip->ip_hl << 2)" is where the header after ip starts
+                if (base_ptr_info.type == PacketOpInfo::T::PKT_HEADER_PTR
+                    && is_header_length(layout, info_cache, base_ptr_info, symbolic_idx, symbolic_scale)) {
+                    result.type = PacketOpInfo::T::PKT_HDR_END;
+                    result.pkt_obj = base_ptr_info.pkt_obj;
+                    result.header_name = base_ptr_info.header_name;
+                    result.offset = const_off;
+                }
+                return;
             }
             switch (base_ptr_info.type) {
             case PacketOpInfo::T::PKT_PTR:
@@ -148,19 +382,22 @@ namespace HIR {
                 break;
             case PacketOpInfo::T::PKT_HEADER_PTR:
                 {
-                    assert(layout.headers.find(base_ptr_info.header_name) != layout.headers.end());
-                    auto &hdr = layout.headers.find(base_ptr_info.header_name)->second;
-                    auto maybe_field = hdr.FindFieldByOffset(const_off);
-                    if (maybe_field.has_value()) {
-                        auto &field = maybe_field.value();
+                    auto hdr_iter = layout.headers.find(base_ptr_info.header_name);
+                    assert(hdr_iter != layout.headers.end());
+                    auto field = hdr_iter->second.FindFieldByOffset(const_off);
+                    if (field != nullptr) {
                         result.type = PacketOpInfo::T::PKT_FIELD_PTR;
                         result.pkt_obj = base_ptr_info.pkt_obj;
                         result.header_name = base_ptr_info.header_name;
-                        result.field_name = field.field_name;
-                        result.field_size = maybe_field->field_n_bytes;
+                        result.field_name = field->field_name;
+                        result.field_size = field->field_n_bytes;
                     }
                 }
                 break;
+            case PacketOpInfo::T::PKT_HDR_END:
+                result = base_ptr_info;
+                result.offset = base_ptr_info.offset + const_off;
+                break;
             default:
                 break;
             }
@@ -181,19 +418,40 @@ namespace HIR {
                     || demangled_fn == "Packet::ip_header() const") {
                     auto base = pkt_access_trace(layout, info_cache, op.args[0]);
                     assert(base.type == PacketOpInfo::T::PKT_PTR);
-                    result.pkt_obj = base.pkt_obj;
-                    result.type = PacketOpInfo::T::PKT_HEADER_PTR;
-                    result.header_name = "ipv4";
+                    if (layout.headers.find("ipv4") != layout.headers.end()) {
+                        result.pkt_obj = base.pkt_obj;
+                        result.type = PacketOpInfo::T::PKT_HEADER_PTR;
+                        result.header_name = "ipv4";
+                    }
                 } else if (demangled_fn == "Packet::transport_header() const") {
                     auto base = pkt_access_trace(layout, info_cache, op.args[0]);
                     assert(base.type == PacketOpInfo::T::PKT_PTR);
-                    result.pkt_obj = base.pkt_obj;
-                    result.type = PacketOpInfo::T::PKT_HEADER_PTR;
-                    result.header_name = "tcp";
-                } else if (demangled_fn == "Packet::uniqueify()") {
+                    if (layout.headers.find("tcp") != layout.headers.end()) {
+                        result.pkt_obj = base.pkt_obj;
+                        result.type = PacketOpInfo::T::PKT_HEADER_PTR;
+                        result.header_name = "tcp";
+                    }
+                } else if (demangled_fn == "WritablePacket::data() const"
+                           || demangled_fn == "Packet::data() const") {
+                    // otherwise data() is somewhere in the packet, as any
+                    // other pointer we can not name
+                    auto base = pkt_access_trace(layout, info_cache, op.args[0]);
+                    if (base.type == PacketOpInfo::T::PKT_PTR && base.data_at_start
+                        && layout.headers.find(layout.start_header) != layout.headers.end()) {
+                        result.pkt_obj = base.pkt_obj;
+                        result.type = PacketOpInfo::T::PKT_HEADER_PTR;
+                        result.header_name = layout.start_header;
+                    }
+                } else if (demangled_fn == "Packet::uniqueify()"
+                           || demangled_fn == "Packet::push(unsigned int)"
+                           || demangled_fn == "Packet::push_mac_header(unsigned int)") {
+                    // same packet, with room made for new headers for push
                     auto base = pkt_access_trace(layout, info_cache, op.args[0]);
                     assert(base.type == PacketOpInfo::T::PKT_PTR);
                     result = base;
+                    if (demangled_fn != "Packet::uniqueify()") {
+                        result.data_at_start = false;
+                    }
                 }
             }
         }
@@ -222,12 +480,715 @@ namespace HIR {
         }
     }
 
+    struct BitFieldSeed {
+        std::shared_ptr<Operation> load;
+        std::shared_ptr<Var> pkt_obj;
+        std::string header;
+        const HeaderLayout::Entry *field;
+        size_t n_bytes_loaded;
+    };
+
+    static bool only_compared_with_zero(const Var &v) {
+        if (v.uses.empty()) {
+            return false;
+        }
+        for (auto &u : v.uses) {
+            if (u.type != Var::Use::T::OP) {
+                return false;
+            }
+            auto &op = *u.u.op_ptr;
+            if (op.type != Operation::T::ARITH || op.arith_info.t != ArithType::INT_CMP) {
+                return false;
+            }
+            auto cmp = op.arith_info.u.icmp_t;
+            if (cmp != IntCmpType::EQ && cmp != IntCmpType::NE) {
+                return false;
+            }
+            auto &other = (op.args[0].get() == &v) ? op.args[1] : op.args[0];
+            if (!other->is_constant || other->constant != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* the bit field a value is, if any:
+     * the value is exactly the bit field when its bits are the field's
+     * bits in order starting from bit 0, it is as good as the bit field
+     * when it holds exactly the field's bits and is only compared with 0
+     */
+    static const HeaderLayout::BitField *match_bit_field(
+            const HeaderLayout::Entry &field,
+            const FieldBits &bits,
+            const Var &v) {
+        int lo = -1;
+        for (auto b : bits) {
+            if (b >= 0 && (lo < 0 || b < lo)) {
+                lo = b;
+            }
+        }
+        if (lo < 0) {
+            return nullptr;
+        }
+        int w = field.field_n_bytes * 8;
+        for (auto &bf : field.bit_fields) {
+            int n = bf.n_bits;
+            if (w - (int)bf.bit_offset - n != lo) {
+                continue;
+            }
+            int n_set = 0;
+            bool in_order = true;
+            for (size_t i = 0; i < bits.size(); i++) {
+                if (bits[i] < 0) {
+                    continue;
+                }
+                if (bits[i] >= lo + n) {
+                    return nullptr;
+                }
+                n_set++;
+                in_order = in_order && (bits[i] == lo + (int)i);
+            }
+            if (n_set != n) {
+                return nullptr;
+            }
+            if (in_order || only_compared_with_zero(v)) {
+                return &bf;
+            }
+            return nullptr;
+        }
+        return nullptr;
+    }
+
+    /* turn mask-and-shift ops on a loaded header field into loads of its
+     * bit fields, e.g. "(vihl & 15)" becomes "pkt_load ipv4 ihl".
+     * the new load is placed right after the original one so it reads
+     * the same packet, the original is left for remove_unused_ops
+     */
+    static void replace_bit_field_access(Function &f, const std::vector<BitFieldSeed> &seeds) {
+        std::unordered_map<Operation *, std::vector<std::shared_ptr<Operation>>> new_loads;
+        std::unordered_set<Operation *> replaced;
+        for (auto &seed : seeds) {
+            std::vector<std::pair<Var *, FieldBits>> worklist;
+            auto dst = seed.load->dst_vars[0].get();
+            worklist.emplace_back(dst, field_bits_of_load(seed.field->field_n_bytes, seed.n_bytes_loaded));
+            while (!worklist.empty()) {
+                auto v = worklist.back().first;
+                auto bits = std::move(worklist.back().second);
+                worklist.pop_back();
+                for (auto &u : v->uses) {
+                    if (u.type != Var::Use::T::OP) {
+                        continue;
+                    }
+                    auto op = u.u.op_ptr;
+                    if (replaced.find(op) != replaced.end()) {
+                        continue;
+                    }
+                    auto out = field_bits_through(*op, v, bits);
+                    if (!out.has_value()) {
+                        continue;
+                    }
+                    auto &op_dst = op->dst_vars[0];
+                    auto bf = match_bit_field(*seed.field, out.value(), *op_dst);
+                    if (bf == nullptr) {
+                        worklist.emplace_back(op_dst.get(), std::move(out.value()));
+                        continue;
+                    }
+                    auto new_op = std::make_shared<Operation>();
+                    new_op->type = Operation::T::PKT_HDR_LOAD;
+                    new_op->pkt_op_info.header = seed.header;
+                    new_op->pkt_op_info.field = bf->name;
+                    new_op->args.emplace_back(seed.pkt_obj);
+                    new_op->dst_vars.emplace_back(op_dst);
+                    new_loads[seed.load.get()].emplace_back(new_op);
+                    replaced.insert(op);
+                }
+            }
+        }
+        if (replaced.empty()) {
+            return;
+        }
+        for (auto &bb : f.bbs) {
+            std::vector<std::shared_ptr<Operation>> new_ops;
+            for (auto &op : bb->ops) {
+                if (replaced.find(op.get()) != replaced.end()) {
+                    continue;
+                }
+                new_ops.emplace_back(op);
+                auto iter = new_loads.find(op.get());
+                if (iter == new_loads.end()) {
+                    continue;
+                }
+                for (auto &l : iter->second) {
+                    l->parent = bb.get();
+                    l->dst_vars[0]->src_op = l;
+                    new_ops.emplace_back(l);
+                }
+            }
+            bb->ops = std::move(new_ops);
+        }
+    }
+
+    // value of a header's select field known on every path, per packet
+    using SelectFacts = std::map<std::pair<Var *, std::string>, uint64_t>;
+    using SelectFact = std::pair<std::pair<Var *, std::string>, uint64_t>;
+
+    // cond is "select field == value" (or != when is_eq is false)
+    static bool select_test(
+            const PacketLayout &layout,
+            std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> &info_cache,
+            const std::shared_ptr<Var> &cond,
+            SelectFact &fact,
+            bool &is_eq) {
+        auto op = cond->src_op.lock();
+        if (op == nullptr || op->type != Operation::T::ARITH || op->arith_info.t != ArithType::INT_CMP) {
+            return false;
+        }
+        auto cmp = op->arith_info.u.icmp_t;
+        if ((cmp != IntCmpType::EQ && cmp != IntCmpType::NE) || op->args.size() != 2) {
+            return false;
+        }
+        auto &c = op->args[0]->is_constant ? op->args[0] : op->args[1];
+        auto &x = op->args[0]->is_constant ? op->args[1] : op->args[0];
+        if (!c->is_constant || x->is_constant) {
+            return false;
+        }
+        PacketOpInfo field_info;
+        auto bits = traced_field_bits(layout, info_cache, x, field_info);
+        if (!bits.has_value()) {
+            return false;
+        }
+        auto t = layout.transitions.find(field_info.header_name);
+        if (t == layout.transitions.end() || t->second.select_field != field_info.field_name) {
+            return false;
+        }
+        // the whole field, in order
+        for (int i = 0; i < (int)bits->size(); i++) {
+            int expected = (i < (int)field_info.field_size * 8) ? i : -1;
+            if ((*bits)[i] != expected) {
+                return false;
+            }
+        }
+        if ((int)bits->size() < (int)field_info.field_size * 8) {
+            return false;
+        }
+        fact = {{field_info.pkt_obj.get(), field_info.header_name}, c->constant};
+        is_eq = (cmp == IntCmpType::EQ);
+        return true;
+    }
+
+    // a store to a header's select field, before or after it became a
+    // pkt_hdr_store, makes the case of that header unknown again
+    static void kill_select_facts(
+            const PacketLayout &layout,
+            std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> &info_cache,
+            const Operation &op,
+            SelectFacts &facts) {
+        Var *pkt_obj = nullptr;
+        std::string header;
+        std::string field;
+        if (op.type == Operation::T::STORE) {
+            auto info = pkt_access_trace(layout, info_cache, op.args[0]);
+            if (info.type != PacketOpInfo::T::PKT_FIELD_PTR) {
+                return;
+            }
+            pkt_obj = info.pkt_obj.get();
+            header = info.header_name;
+            field = info.field_name;
+        } else if (op.type == Operation::T::PKT_HDR_STORE) {
+            pkt_obj = op.args[0].get();
+            header = op.pkt_op_info.header;
+            field = op.pkt_op_info.field;
+        } else {
+            return;
+        }
+        auto t = layout.transitions.find(header);
+        if (t != layout.transitions.end() && t->second.select_field == field) {
+            facts.erase({pkt_obj, header});
+        }
+    }
+
+    /* which case of its header's parser each packet took, known from the
+     * branches on the select field dominating a block, e.g. the blocks
+     * under "if (ip->ip_p == IP_PROTO_TCP)" have (ipv4, 6). these hold on
+     * entry to the block, users walk its ops in order through
+     * kill_select_facts
+     */
+    static std::unordered_map<const BasicBlock *, SelectFacts> select_facts_of(
+            const Function &f,
+            const PacketLayout &layout,
+            std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> &info_cache) {
+        struct Edge {
+            const BasicBlock *from;
+            std::optional<SelectFact> fact;
+        };
+        std::unordered_map<const BasicBlock *, std::vector<Edge>> in_edges;
+        for (auto &bb : f.bbs) {
+            std::optional<SelectFact> default_fact;
+            for (auto &br : bb->branches) {
+                Edge e{bb.get(), std::nullopt};
+                SelectFact fact;
+                bool is_eq = false;
+                if (br.is_conditional && select_test(layout, info_cache, br.cond_var, fact, is_eq)) {
+                    if (is_eq) {
+                        e.fact = fact;
+                    } else if (bb->branches.size() == 1) {
+                        default_fact = fact;
+                    }
+                }
+                in_edges[br.next_bb.lock().get()].push_back(e);
+            }
+            auto next = bb->default_next_bb.lock();
+            if (next != nullptr) {
+                in_edges[next.get()].push_back({bb.get(), default_fact});
+            }
+        }
+
+        auto kill = [&](const BasicBlock &bb, SelectFacts &facts) {
+            for (auto &op : bb.ops) {
+                kill_select_facts(layout, info_cache, *op, facts);
+            }
+        };
+
+        auto entry = f.bbs[f.entry_bb_idx()].get();
+        std::unordered_map<const BasicBlock *, SelectFacts> facts_in;
+        std::unordered_map<const BasicBlock *, SelectFacts> facts_out;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto &bb : f.bbs) {
+                if (bb.get() != entry && in_edges[bb.get()].empty()) {
+                    continue;
+                }
+                // edges from blocks not visited yet do not constrain the meet
+                std::optional<SelectFacts> in;
+                if (bb.get() == entry) {
+                    in = SelectFacts();
+                }
+                for (auto &e : in_edges[bb.get()]) {
+                    auto out = facts_out.find(e.from);
+                    if (out == facts_out.end()) {
+                        continue;
+                    }
+                    auto on_edge = out->second;
+                    if (e.fact.has_value()) {
+                        on_edge[e.fact->first] = e.fact->second;
+                    }
+                    if (!in.has_value()) {
+                        in = std::move(on_edge);
+                        continue;
+                    }
+                    for (auto iter = in->begin(); iter != in->end();) {
+                        auto o = on_edge.find(iter->first);
+                        if (o == on_edge.end() || o->second != iter->second) {
+                            iter = in->erase(iter);
+                        } else {
+                            iter++;
+                        }
+                    }
+                }
+                if (!in.has_value()) {
+                    continue;
+                }
+                auto out = in.value();
+                kill(*bb, out);
+                auto old = facts_out.find(bb.get());
+                if (old == facts_out.end() || old->second != out || facts_in[bb.get()] != in.value()) {
+                    facts_in[bb.get()] = std::move(in.value());
+                    facts_out[bb.get()] = std::move(out);
+                    changed = true;
+                }
+            }
+        }
+        return facts_in;
+    }
+
+    /* the header after a variable length one is the case of its parser
+     * the path took, or its only possible next header. accesses are
+     * left as they are if it is not known
+     */
+    static PacketOpInfo resolve_header_end(
+            const PacketLayout &layout,
+            const SelectFacts &facts,
+            const PacketOpInfo &info) {
+        PacketOpInfo result;
+        auto t = layout.transitions.find(info.header_name);
+        if (t == layout.transitions.end()) {
+            return result;
+        }
+        std::string next;
+        auto fact = facts.find({info.pkt_obj.get(), info.header_name});
+        if (fact != facts.end()) {
+            next = t->second.default_next;
+            for (auto &c : t->second.cases) {
+                if (c.first == fact->second) {
+                    next = c.second;
+                }
+            }
+        } else {
+            std::set<std::string> all;
+            for (auto &c : t->second.cases) {
+                all.insert(c.second);
+            }
+            if (!t->second.default_next.empty()) {
+                all.insert(t->second.default_next);
+            }
+            if (all.size() == 1) {
+                next = *all.begin();
+            }
+        }
+        if (next.empty()) {
+            return result;
+        }
+        result.pkt_obj = info.pkt_obj;
+        result.header_name = next;
+        if (info.offset == 0) {
+            result.type = PacketOpInfo::T::PKT_HEADER_PTR;
+            return result;
+        }
+        auto field = layout.headers.at(next).FindFieldByOffset(info.offset);
+        if (field == nullptr) {
+            return PacketOpInfo();
+        }
+        result.type = PacketOpInfo::T::PKT_FIELD_PTR;
+        result.field_name = field->field_name;
+        result.field_size = field->field_n_bytes;
+        return result;
+    }
+
+    /* the headers making up n bytes at the front of a packet: a path of
+     * the layout's parser from its start header, otherwise (unless only
+     * paths are allowed) the single header of n bytes closest to the
+     * start, e.g. the vlan tag VLANDecap pulls from behind the ethernet
+     * addresses. empty if there is none or it is ambiguous
+     */
+    static std::vector<std::string> headers_of_size(
+            const PacketLayout &layout,
+            size_t n,
+            bool path_only) {
+        auto &start = layout.start_header;
+        if (n == 0 || start.empty() || layout.headers.find(start) == layout.headers.end()) {
+            return {};
+        }
+        auto next_of = [&](const std::string &hdr) {
+            std::vector<std::string> next;
+            auto t = layout.transitions.find(hdr);
+            if (t != layout.transitions.end()) {
+                for (auto &c : t->second.cases) {
+                    next.emplace_back(c.second);
+                }
+                if (!t->second.default_next.empty()) {
+                    next.emplace_back(t->second.default_next);
+                }
+            }
+            return next;
+        };
+
+        // breadth first, the shortest path wins
+        std::deque<std::pair<std::vector<std::string>, size_t>> queue;
+        queue.push_back({{start}, layout.headers.at(start).HeaderSize()});
+        while (!queue.empty()) {
+            auto path = std::move(queue.front());
+            queue.pop_front();
+            if (path.second == n) {
+                return path.first;
+            }
+            for (auto &next : next_of(path.first.back())) {
+                auto sz = path.second + layout.headers.at(next).HeaderSize();
+                if (sz <= n) {
+                    auto p = path.first;
+                    p.emplace_back(next);
+                    queue.push_back({std::move(p), sz});
+                }
+            }
+        }
+        if (path_only) {
+            return {};
+        }
+
+        std::unordered_map<std::string, size_t> depth{{start, 0}};
+        std::deque<std::string> bfs{start};
+        while (!bfs.empty()) {
+            auto hdr = bfs.front();
+            bfs.pop_front();
+            for (auto &next : next_of(hdr)) {
+                if (depth.emplace(next, depth[hdr] + 1).second) {
+                    bfs.push_back(next);
+                }
+            }
+        }
+        std::vector<std::string> best;
+        size_t best_depth = 0;
+        for (auto &kv : depth) {
+            if (layout.headers.at(kv.first).HeaderSize() != n) {
+                continue;
+            }
+            if (best.empty() || kv.second < best_depth) {
+                best = {kv.first};
+                best_depth = kv.second;
+            } else if (kv.second == best_depth) {
+                best.emplace_back(kv.first);
+            }
+        }
+        if (best.size() != 1) {
+            return {};
+        }
+        return best;
+    }
+
+    /* Packet::push, push_mac_header and pull of a constant number of
+     * bytes become pkt_encap / pkt_decap ops, one per header, outermost
+     * first, so a target can set or clear header valid bits instead of
+     * moving the packet. push keeps its result (the same packet) on the
+     * first op, calls that can not be named stay calls
+     */
+    static void replace_encap_decap_calls(
+            Function &f,
+            const PacketLayout &layout,
+            std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> &info_cache) {
+        for (auto &bb : f.bbs) {
+            std::vector<std::shared_ptr<Operation>> new_ops;
+            for (auto &op : bb->ops) {
+                if (op->type != Operation::T::FUNC_CALL || op->args.size() != 2 || !op->args[1]->is_constant) {
+                    new_ops.emplace_back(op);
+                    continue;
+                }
+                auto fn = cxx_try_demangle(op->call_info.func_name);
+                bool is_push = (fn == "Packet::push(unsigned int)");
+                bool is_mac_push = (fn == "Packet::push_mac_header(unsigned int)");
+                bool is_pull = (fn == "Packet::pull(unsigned int)");
+                auto base = pkt_access_trace(layout, info_cache, op->args[0]);
+                if (!(is_push || is_mac_push || is_pull) || base.type != PacketOpInfo::T::PKT_PTR) {
+                    new_ops.emplace_back(op);
+                    continue;
+                }
+                auto hdrs = headers_of_size(layout, op->args[1]->constant, is_mac_push);
+                if (hdrs.empty()) {
+                    new_ops.emplace_back(op);
+                    continue;
+                }
+                for (size_t i = 0; i < hdrs.size(); i++) {
+                    auto new_op = std::make_shared<Operation>();
+                    new_op->type = is_pull ? Operation::T::PKT_DECAP : Operation::T::PKT_ENCAP;
+                    new_op->pkt_op_info.header = hdrs[i];
+                    new_op->args.emplace_back(base.pkt_obj);
+                    new_op->parent = bb.get();
+                    if (i == 0) {
+                        new_op->dst_vars = op->dst_vars;
+                        for (auto &d : new_op->dst_vars) {
+                            d->src_op = new_op;
+                            info_cache[d] = base;
+                        }
+                    }
+                    new_ops.emplace_back(new_op);
+                }
+            }
+            bb->ops = std::move(new_ops);
+        }
+    }
+
+    // one side of a memcpy: bytes of a header, or a plain byte pointer
+    struct CopyEnd {
+        bool in_pkt = false;
+        std::shared_ptr<Var> pkt_obj;
+        const HeaderLayout *hdr = nullptr;
+        std::string header_name;
+        size_t offset = 0;
+        std::shared_ptr<Var> ptr;
+    };
+
+    static std::optional<CopyEnd> copy_end_of(
+            const PacketLayout &layout,
+            std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> &info_cache,
+            const SelectFacts &facts,
+            std::shared_ptr<Var> ptr) {
+        auto info = pkt_access_trace(layout, info_cache, ptr);
+        if (info.type == PacketOpInfo::T::PKT_HDR_END) {
+            info = resolve_header_end(layout, facts, info);
+        }
+        CopyEnd end;
+        if (info.type == PacketOpInfo::T::PKT_HEADER_PTR || info.type == PacketOpInfo::T::PKT_FIELD_PTR) {
+            end.in_pkt = true;
+            end.pkt_obj = info.pkt_obj;
+            end.header_name = info.header_name;
+            end.hdr = &layout.headers.at(info.header_name);
+            if (info.type == PacketOpInfo::T::PKT_FIELD_PTR) {
+                for (auto &field : end.hdr->Fields()) {
+                    if (field.field_name == info.field_name) {
+                        break;
+                    }
+                    end.offset += field.field_n_bytes;
+                }
+            }
+            return end;
+        }
+        if (info.type != PacketOpInfo::T::OTHER) {
+            // somewhere in the packet we can not name
+            return std::nullopt;
+        }
+        auto t = ptr->type;
+        if (t->type != Type::T::POINTER || t->pointee_type->type != Type::T::INT
+            || t->pointee_type->bitwidth != 8) {
+            return std::nullopt;
+        }
+        end.ptr = ptr;
+        return end;
+    }
+
+    // sizes of the whole fields making up n bytes from the offset
+    static std::optional<std::vector<const HeaderLayout::Entry *>> fields_in_range(
+            const HeaderLayout &hdr,
+            size_t offset,
+            size_t n) {
+        std::vector<const HeaderLayout::Entry *> result;
+        auto end = offset + n;
+        while (offset < end) {
+            auto field = hdr.FindFieldByOffset(offset);
+            if (field == nullptr || offset + field->field_n_bytes > end) {
+                return std::nullopt;
+            }
+            result.emplace_back(field);
+            offset += field->field_n_bytes;
+        }
+        return result;
+    }
+
+    /* llvm.memcpy of a constant length to or from whole header fields,
+     * e.g. EtherMirror swapping the ethernet addresses, becomes a load and
+     * a store per field: pkt_hdr_load / pkt_hdr_store on the packet side,
+     * gep + bitcast + load / store on a byte pointer (a local buffer or
+     * state) on the other. copies not lining up with fields stay calls
+     */
+    static void replace_memcpy_calls(
+            Module &m,
+            Function &f,
+            const PacketLayout &layout,
+            std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> &info_cache,
+            std::unordered_map<const BasicBlock *, SelectFacts> &select_facts) {
+        for (auto &bb : f.bbs) {
+            std::vector<std::shared_ptr<Operation>> new_ops;
+            auto emit = [&](Operation::T t,
+                            std::vector<std::shared_ptr<Var>> args,
+                            Type *dst_type) -> std::shared_ptr<Var> {
+                auto op = std::make_shared<Operation>();
+                op->type = t;
+                op->args = std::move(args);
+                op->parent = bb.get();
+                new_ops.emplace_back(op);
+                if (dst_type == nullptr) {
+                    return nullptr;
+                }
+                auto dst = std::make_shared<Var>();
+                dst->type = dst_type;
+                dst->src_op = op;
+                op->dst_vars.emplace_back(dst);
+                return dst;
+            };
+            auto byte_ptr = [&](std::shared_ptr<Var> ptr, size_t off, size_t bits) {
+                if (off != 0) {
+                    auto idx = std::make_shared<Var>();
+                    idx->type = m.get_int_type(64).get();
+                    idx->is_constant = true;
+                    idx->constant = off;
+                    ptr = emit(Operation::T::GEP, {ptr, idx}, ptr->type);
+                }
+                return emit(Operation::T::BITCAST, {ptr}, m.get_ptr_type(m.get_int_type(bits).get()).get());
+            };
+
+            // the facts at each op, after the stores before it
+            auto facts = select_facts[bb.get()];
+            size_t n_seen = 0;
+            for (auto &op : bb->ops) {
+                for (; n_seen < new_ops.size(); n_seen++) {
+                    kill_select_facts(layout, info_cache, *new_ops[n_seen], facts);
+                }
+                if (op->type != Operation::T::FUNC_CALL
+                    || !str_begin_with(op->call_info.func_name, "llvm.memcpy")
+                    || op->args.size() < 3 || !op->args[2]->is_constant) {
+                    new_ops.emplace_back(op);
+                    continue;
+                }
+                auto dst = copy_end_of(layout, info_cache, facts, op->args[0]);
+                auto src = copy_end_of(layout, info_cache, facts, op->args[1]);
+                size_t n = op->args[2]->constant;
+                std::optional<std::vector<const HeaderLayout::Entry *>> fields;
+                if (dst.has_value() && src.has_value() && (dst->in_pkt || src->in_pkt)) {
+                    auto &pkt_end = dst->in_pkt ? *dst : *src;
+                    fields = fields_in_range(*pkt_end.hdr, pkt_end.offset, n);
+                    if (fields.has_value() && dst->in_pkt && src->in_pkt) {
+                        auto src_fields = fields_in_range(*src->hdr, src->offset, n);
+                        if (!src_fields.has_value() || src_fields->size() != fields->size()) {
+                            fields = std::nullopt;
+                        } else {
+                            for (size_t i = 0; i < fields->size(); i++) {
+                                if ((*fields)[i]->field_n_bytes != (*src_fields)[i]->field_n_bytes) {
+                                    fields = std::nullopt;
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+                if (!fields.has_value()) {
+                    new_ops.emplace_back(op);
+                    continue;
+                }
+
+                size_t rel = 0;
+                for (auto field : *fields) {
+                    auto bits = field->field_n_bytes * 8;
+                    auto t = m.get_int_type(bits).get();
+                    std::shared_ptr<Var> v;
+                    if (src->in_pkt) {
+                        auto src_field = src->hdr->FindFieldByOffset(src->offset + rel);
+                        v = emit(Operation::T::PKT_HDR_LOAD, {src->pkt_obj}, t);
+                        auto load = v->src_op.lock();
+                        load->pkt_op_info.header = src->header_name;
+                        load->pkt_op_info.field = src_field->field_name;
+                    } else {
+                        v = emit(Operation::T::LOAD, {byte_ptr(src->ptr, rel, bits)}, t);
+                    }
+                    if (dst->in_pkt) {
+                        auto dst_field = dst->hdr->FindFieldByOffset(dst->offset + rel);
+                        emit(Operation::T::PKT_HDR_STORE, {dst->pkt_obj, v}, nullptr);
+                        new_ops.back()->pkt_op_info.header = dst->header_name;
+                        new_ops.back()->pkt_op_info.field = dst_field->field_name;
+                    } else {
+                        emit(Operation::T::STORE, {byte_ptr(dst->ptr, rel, bits), v}, nullptr);
+                    }
+                    rel += field->field_n_bytes;
+                }
+            }
+            bb->ops = std::move(new_ops);
+        }
+    }
+
+    /* the packet an element gets starts at the layout's start header, a
+     * pull or push anywhere in the function moves its data, so data() is
+     * not known to point there on any path
+     */
+    static bool moves_pkt_data(const Function &f) {
+        for (auto &bb : f.bbs) {
+            for (auto &op : bb->ops) {
+                if (op->type != Operation::T::FUNC_CALL) {
+                    continue;
+                }
+                auto fn = cxx_try_demangle(op->call_info.func_name);
+                if (fn == "Packet::pull(unsigned int)" || fn == "Packet::push(unsigned int)"
+                    || fn == "Packet::push_mac_header(unsigned int)") {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
     void replace_packet_access_op(Element &ele, const PacketLayout &layout) {
         auto &f = *ele.entry();
         std::unordered_map<std::shared_ptr<Var>, PacketOpInfo> info_cache;
         /* we only need to do this on the very top level :
          * starting from the entry function, don't need to go into other functions
-         * since that function must be either built-in or recursive
+         * since that function must be either built-in, recursive or over the
+         * inline budget
          */
         assert(f.args.size() == 3);
         PacketOpInfo other_info;
@@ -236,12 +1197,20 @@ namespace HIR {
         PacketOpInfo input_pkt_info;
         input_pkt_info.type = PacketOpInfo::T::PKT_PTR;
         input_pkt_info.pkt_obj = f.args[2];
+        input_pkt_info.data_at_start = !moves_pkt_data(f);
         info_cache[f.args[2]] = input_pkt_info;
+        std::vector<BitFieldSeed> bit_field_seeds;
+        auto select_facts = select_facts_of(f, layout, info_cache);
 
         for (auto &bb : f.bbs) {
+            auto facts = select_facts[bb.get()];
             for (auto &op : bb->ops) {
                 if (op->type == Operation::T::LOAD || op->type == Operation::T::STORE) {
                     auto ptr_info = pkt_access_trace(layout, info_cache, op->args[0]);
+                    if (ptr_info.type == PacketOpInfo::T::PKT_HDR_END) {
+                        ptr_info = resolve_header_end(layout, facts, ptr_info);
+                    }
+                    kill_select_facts(layout, info_cache, *op, facts);
                     if (ptr_info.type == PacketOpInfo::T::PKT_FIELD_PTR
                         || ptr_info.type == PacketOpInfo::T::PKT_HEADER_PTR) {
                         op->pkt_op_info.header = ptr_info.header_name;
@@ -249,10 +1218,10 @@ namespace HIR {
                             op->pkt_op_info.field = ptr_info.field_name;
                         } else {
                             auto &hdr = layout.headers.find(ptr_info.header_name)->second;
-                            auto maybe_field = hdr.FindFieldByOffset(0);
-                            assert(maybe_field.has_value());
-                            ptr_info.field_size = maybe_field->field_n_bytes;
-                            op->pkt_op_info.field = maybe_field->field_name;
+                            auto field = hdr.FindFieldByOffset(0);
+                            assert(field != nullptr);
+                            ptr_info.field_size = field->field_n_bytes;
+                            op->pkt_op_info.field = field->field_name;
                         }
 
                         Type* t = nullptr;
@@ -264,17 +1233,28 @@ namespace HIR {
                         if (t->type != Type::T::INT) {
                             continue;
                         }
-                        if (t->bitwidth != ptr_info.field_size * 8) {
+                        auto &hdr = layout.headers.find(ptr_info.header_name)->second;
+                        auto field = hdr.FindFieldByName(op->pkt_op_info.field);
+                        assert(field != nullptr);
+                        size_t bitwidth = t->bitwidth;
+                        if (op->type == Operation::T::LOAD && !field->bit_fields.empty()
+                            && bitwidth % 8 == 0 && bitwidth <= ptr_info.field_size * 8) {
+                            bit_field_seeds.push_back({
+                                op, ptr_info.pkt_obj, ptr_info.header_name,
+                                field, bitwidth / 8});
+                        }
+                        if (bitwidth != ptr_info.field_size * 8) {
                             continue;
                         }
 
+                        auto old_args = std::move(op->args);
                         op->args.clear();
                         op->args.emplace_back(ptr_info.pkt_obj);
                         if (op->type == Operation::T::LOAD) {
                             op->type = Operation::T::PKT_HDR_LOAD;
                         } else {
                             op->type = Operation::T::PKT_HDR_STORE;
-                            op->args.emplace_back(op->args[1]);
+                            op->args.emplace_back(old_args[1]);
                         }
                         assert(ptr_info.pkt_obj != nullptr);
                     }
@@ -282,6 +1262,10 @@ namespace HIR {
             }
         }
 
+        assert(ele.module() != nullptr);
+        replace_memcpy_calls(*ele.module(), f, layout, info_cache, select_facts);
+        replace_encap_decap_calls(f, layout, info_cache);
+
         for (auto& bb : f.bbs) {
             for (auto& op : bb->ops) {
                 for (auto& a : op->args) {
@@ -297,6 +1281,9 @@ namespace HIR {
             }
         }
         update_uses(ele);
+
+        replace_bit_field_access(f, bit_field_seeds);
+        update_uses(ele);
     }
 
     void replace_packet_meta_op(Element &ele) {
@@ -318,4 +1305,714 @@ namespace HIR {
     }
 
     void replace_packet_access_op(Module &m, const PacketLayout &layout) {}
-}
\ No newline at end of file
+
+    // a field of one packet object, "header.field"
+    using PktFieldKey = std::pair<Var *, std::string>;
+
+    static PktFieldKey pkt_field_key(const Operation &op) {
+        return {op.args[0].get(), op.pkt_op_info.header + "." + op.pkt_op_info.field};
+    }
+
+    // "header.bit_field" and "header.field" share the bits of "header.field"
+    static std::string field_container_key(const PacketLayout &layout, const std::string &key) {
+        auto dot = key.find('.');
+        auto hdr = layout.headers.find(key.substr(0, dot));
+        if (dot == std::string::npos || hdr == layout.headers.end()) {
+            return key;
+        }
+        auto field = key.substr(dot + 1);
+        for (auto &e : hdr->second.Fields()) {
+            for (auto &bf : e.bit_fields) {
+                if (bf.name == field) {
+                    return hdr->first + "." + e.field_name;
+                }
+            }
+        }
+        return key;
+    }
+
+    // loads and stores that replace_packet_access_op traced to a header
+    // but left as raw memory accesses, they may cover any of its fields
+    static bool raw_header_access(const Operation &op) {
+        return (op.type == Operation::T::LOAD || op.type == Operation::T::STORE)
+            && !op.pkt_op_info.header.empty();
+    }
+
+    static bool same_value_type(const Var &a, const Var &b) {
+        if (a.type == b.type) {
+            return true;
+        }
+        return a.type->type == Type::T::INT && b.type->type == Type::T::INT
+            && a.type->bitwidth == b.type->bitwidth;
+    }
+
+    enum class PktEffect {
+        NONE,
+        READ,
+        WRITE,
+    };
+
+    class PktAccessContext {
+    public:
+        PktAccessContext(const PacketLayout &l, const Function &f) : layout_(l) {
+            for (auto &bb : f.bbs) {
+                for (auto &op : bb->ops) {
+                    if (op->type == Operation::T::PKT_HDR_LOAD || op->type == Operation::T::PKT_HDR_STORE) {
+                        pkt_objs_.insert(op->args[0].get());
+                    }
+                }
+            }
+        }
+
+        const std::string &container(const std::string &key) {
+            auto iter = cache_.find(key);
+            if (iter == cache_.end()) {
+                iter = cache_.emplace(key, field_container_key(layout_, key)).first;
+            }
+            return iter->second;
+        }
+
+        // same field bits, on any packet object since they may alias
+        bool overlaps(const std::string &a, const std::string &b) {
+            return container(a) == container(b);
+        }
+
+        static bool in_header(const std::string &key, const std::string &header) {
+            return key.compare(0, header.size() + 1, header + ".") == 0;
+        }
+
+        /* what an op may do to packet bytes besides field ops. a call can
+         * only reach the packet through its args: the packet object itself
+         * or a pointer we can not show to point elsewhere (a local, a
+         * global, the element or its states). a memory access through such
+         * a pointer may hit any field
+         */
+        PktEffect effect_of(const Operation &op) const {
+            switch (op.type) {
+            case Operation::T::PKT_ENCAP:
+            case Operation::T::PKT_DECAP:
+                return PktEffect::WRITE;
+            case Operation::T::LOAD:
+            case Operation::T::STRUCT_GET:
+                return points_outside_packet(*op.args[0]) ? PktEffect::NONE : PktEffect::READ;
+            case Operation::T::STORE:
+            case Operation::T::STRUCT_SET:
+                return points_outside_packet(*op.args[0]) ? PktEffect::NONE : PktEffect::WRITE;
+            case Operation::T::FUNC_CALL:
+                break;
+            default:
+                return PktEffect::NONE;
+            }
+            auto &fn = op.call_info.func_name;
+            if (fn.rfind("llvm.", 0) == 0 && fn.rfind("llvm.mem", 0) != 0) {
+                return PktEffect::NONE;
+            }
+            bool passes_pkt = false;
+            bool passes_unknown = false;
+            for (auto &a : op.args) {
+                if (pkt_objs_.find(a.get()) != pkt_objs_.end()) {
+                    passes_pkt = true;
+                } else if (!points_outside_packet(*a)) {
+                    passes_unknown = true;
+                }
+            }
+            if (passes_unknown) {
+                return PktEffect::WRITE;
+            }
+            if (!passes_pkt) {
+                return PktEffect::NONE;
+            }
+            // Packet methods declared const and functions taking a
+            // "Packet const*" only read it
+            auto demangled = cxx_try_demangle(fn);
+            bool const_method = (demangled.rfind("Packet::", 0) == 0 || demangled.rfind("WritablePacket::", 0) == 0)
+                && demangled.size() >= 6 && demangled.compare(demangled.size() - 6, 6, " const") == 0;
+            if (const_method || demangled.find("Packet const*") != std::string::npos) {
+                return PktEffect::READ;
+            }
+            return PktEffect::WRITE;
+        }
+
+    private:
+        bool points_outside_packet(const Var &v) const {
+            if (v.type->type != Type::T::POINTER) {
+                return true;
+            }
+            auto p = v.type->pointee_type;
+            if (p != nullptr) {
+                switch (p->type) {
+                case Type::T::STATE_PTR:
+                case Type::T::ELEMENT_BASE:
+                case Type::T::VECTOR:
+                case Type::T::MAP:
+                    return true;
+                default:
+                    break;
+                }
+            }
+            const Var *base = &v;
+            while (true) {
+                if (base->is_constant || base->is_global) {
+                    return true;
+                }
+                if (base->is_param) {
+                    return pkt_objs_.find(const_cast<Var *>(base)) == pkt_objs_.end();
+                }
+                auto src_op = base->src_op.lock();
+                if (src_op == nullptr) {
+                    return false;
+                }
+                if (src_op->type == Operation::T::ALLOCA || src_op->type == Operation::T::STATE_IDX) {
+                    return true;
+                }
+                if (src_op->type != Operation::T::BITCAST && src_op->type != Operation::T::GEP) {
+                    return false;
+                }
+                base = src_op->args[0].get();
+            }
+        }
+
+        const PacketLayout &layout_;
+        std::unordered_map<std::string, std::string> cache_;
+        std::unordered_set<Var *> pkt_objs_;
+    };
+
+    // field -> var holding its current value, on every path reaching here
+    using AvailFields = std::map<PktFieldKey, std::shared_ptr<Var>>;
+
+    template <typename M, typename Pred>
+    static void erase_keys_if(M &m, Pred pred) {
+        for (auto iter = m.begin(); iter != m.end();) {
+            if (pred(*iter)) {
+                iter = m.erase(iter);
+            } else {
+                iter++;
+            }
+        }
+    }
+
+    struct PktAccessRewrite {
+        // dst of a removed load -> the var it is replaced with
+        std::unordered_map<Var *, std::shared_ptr<Var>> replace;
+        std::unordered_set<const Operation *> removed;
+
+        std::shared_ptr<Var> resolve(std::shared_ptr<Var> v) const {
+            auto iter = replace.find(v.get());
+            while (iter != replace.end()) {
+                v = iter->second;
+                iter = replace.find(v.get());
+            }
+            return v;
+        }
+    };
+
+    static void avail_transfer(const BasicBlock &bb,
+                               AvailFields &avail,
+                               PktAccessContext &ctx,
+                               PktAccessRewrite *rewrite) {
+        auto resolve = [&](const std::shared_ptr<Var> &v) {
+            return rewrite == nullptr ? v : rewrite->resolve(v);
+        };
+        for (auto &op : bb.ops) {
+            if (op->type == Operation::T::PKT_HDR_LOAD) {
+                auto key = pkt_field_key(*op);
+                auto &dst = op->dst_vars[0];
+                auto iter = avail.find(key);
+                if (iter != avail.end() && same_value_type(*iter->second, *dst)) {
+                    if (rewrite != nullptr) {
+                        rewrite->replace[dst.get()] = iter->second;
+                        rewrite->removed.insert(op.get());
+                    }
+                } else {
+                    avail[key] = dst;
+                }
+            } else if (op->type == Operation::T::PKT_HDR_STORE) {
+                auto key = pkt_field_key(*op);
+                auto val = resolve(op->args[1]);
+                auto iter = avail.find(key);
+                if (iter != avail.end() && resolve(iter->second) == val) {
+                    // writes back what the field already holds
+                    if (rewrite != nullptr) {
+                        rewrite->removed.insert(op.get());
+                    }
+                    continue;
+                }
+                erase_keys_if(avail, [&](const AvailFields::value_type &kv) {
+                    return ctx.overlaps(kv.first.second, key.second);
+                });
+                avail[key] = val;
+            } else if (op->type == Operation::T::PKT_CSUM_UPDATE) {
+                auto key = pkt_field_key(*op);
+                erase_keys_if(avail, [&](const AvailFields::value_type &kv) {
+                    return ctx.overlaps(kv.first.second, key.second);
+                });
+                avail[key] = op->dst_vars[0];
+            } else if (op->type == Operation::T::STORE && raw_header_access(*op)) {
+                erase_keys_if(avail, [&](const AvailFields::value_type &kv) {
+                    return PktAccessContext::in_header(kv.first.second, op->pkt_op_info.header);
+                });
+            } else if (ctx.effect_of(*op) == PktEffect::WRITE) {
+                avail.clear();
+            }
+        }
+    }
+
+    static std::vector<BasicBlock *> bb_successors(const BasicBlock &bb) {
+        std::vector<BasicBlock *> result;
+        for (auto &br : bb.branches) {
+            result.emplace_back(br.next_bb.lock().get());
+        }
+        auto next = bb.default_next_bb.lock();
+        if (next != nullptr) {
+            result.emplace_back(next.get());
+        }
+        return result;
+    }
+
+    /* available field analysis: a load of a field whose value is already
+     * in a var on every path (an earlier load or store of the same field
+     * of the same packet) is dropped for that var, and a store of the
+     * value the field already holds is dropped. the var then dominates the
+     * load, since it is defined on every path from the entry
+     */
+    static void forward_pkt_fields(Function &f, PktAccessContext &ctx, PktAccessRewrite &rewrite) {
+        std::unordered_map<const BasicBlock *, std::vector<BasicBlock *>> preds;
+        for (auto &bb : f.bbs) {
+            for (auto s : bb_successors(*bb)) {
+                preds[s].emplace_back(bb.get());
+            }
+        }
+        auto entry = f.bbs[f.entry_bb_idx()].get();
+        // blocks not reached yet have no out set, they do not constrain the meet
+        std::unordered_map<const BasicBlock *, AvailFields> avail_out;
+        auto avail_in = [&](const BasicBlock *bb) {
+            AvailFields in;
+            if (bb == entry) {
+                return in;
+            }
+            bool first = true;
+            for (auto p : preds[bb]) {
+                auto iter = avail_out.find(p);
+                if (iter == avail_out.end()) {
+                    continue;
+                }
+                if (first) {
+                    in = iter->second;
+                    first = false;
+                    continue;
+                }
+                erase_keys_if(in, [&](const AvailFields::value_type &kv) {
+                    auto o = iter->second.find(kv.first);
+                    return o == iter->second.end() || o->second != kv.second;
+                });
+            }
+            return in;
+        };
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto &bb : f.bbs) {
+                if (bb.get() != entry && preds[bb.get()].empty()) {
+                    continue;
+                }
+                auto out = avail_in(bb.get());
+                avail_transfer(*bb, out, ctx, nullptr);
+                auto iter = avail_out.find(bb.get());
+                if (iter == avail_out.end() || iter->second != out) {
+                    avail_out[bb.get()] = std::move(out);
+                    changed = true;
+                }
+            }
+        }
+        for (auto &bb : f.bbs) {
+            if (avail_out.find(bb.get()) == avail_out.end()) {
+                continue;
+            }
+            auto in = avail_in(bb.get());
+            avail_transfer(*bb, in, ctx, &rewrite);
+        }
+    }
+
+    // fields stored to again on every path before anything reads them
+    using OverwrittenFields = std::set<PktFieldKey>;
+
+    static void overwritten_transfer(const BasicBlock &bb,
+                                     OverwrittenFields &over,
+                                     PktAccessContext &ctx,
+                                     PktAccessRewrite *rewrite) {
+        for (auto iter = bb.ops.rbegin(); iter != bb.ops.rend(); iter++) {
+            auto &op = *iter;
+            if (op->type == Operation::T::PKT_HDR_STORE) {
+                auto key = pkt_field_key(*op);
+                if (over.find(key) != over.end()) {
+                    if (rewrite != nullptr) {
+                        rewrite->removed.insert(op.get());
+                    }
+                    continue;
+                }
+                over.insert(key);
+            } else if (op->type == Operation::T::PKT_HDR_LOAD || op->type == Operation::T::PKT_CSUM_UPDATE) {
+                auto key = pkt_field_key(*op).second;
+                erase_keys_if(over, [&](const PktFieldKey &k) {
+                    return ctx.overlaps(k.second, key);
+                });
+            } else if (raw_header_access(*op)) {
+                erase_keys_if(over, [&](const PktFieldKey &k) {
+                    return PktAccessContext::in_header(k.second, op->pkt_op_info.header);
+                });
+            } else if (ctx.effect_of(*op) != PktEffect::NONE) {
+                // packets are sent or freed by calls as well
+                over.clear();
+            }
+        }
+    }
+
+    /* dead store elimination: a store is dead if the same field is stored
+     * to again on every path before any read. the packet leaves the
+     * element at returns so nothing is overwritten there
+     */
+    static void remove_dead_pkt_stores(Function &f, PktAccessContext &ctx, PktAccessRewrite &rewrite) {
+        // no entry means "everything", the meet over no paths
+        std::unordered_map<const BasicBlock *, OverwrittenFields> over_in;
+        auto over_out = [&](const BasicBlock *bb) {
+            OverwrittenFields out;
+            auto succs = bb_successors(*bb);
+            if (bb->is_return || succs.empty()) {
+                return out;
+            }
+            bool first = true;
+            for (auto s : succs) {
+                auto iter = over_in.find(s);
+                if (iter == over_in.end()) {
+                    continue;
+                }
+                if (first) {
+                    out = iter->second;
+                    first = false;
+                    continue;
+                }
+                erase_keys_if(out, [&](const PktFieldKey &k) {
+                    return iter->second.find(k) == iter->second.end();
+                });
+            }
+            return out;
+        };
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto iter = f.bbs.rbegin(); iter != f.bbs.rend(); iter++) {
+                auto bb = iter->get();
+                auto in = over_out(bb);
+                overwritten_transfer(*bb, in, ctx, nullptr);
+                auto old = over_in.find(bb);
+                if (old == over_in.end() || old->second != in) {
+                    over_in[bb] = std::move(in);
+                    changed = true;
+                }
+            }
+        }
+        for (auto &bb : f.bbs) {
+            auto out = over_out(bb.get());
+            overwritten_transfer(*bb, out, ctx, &rewrite);
+        }
+    }
+
+    void remove_redundant_pkt_access(Function &f, const PacketLayout &layout) {
+        if (f.bbs.empty()) {
+            return;
+        }
+        PktAccessContext ctx(layout, f);
+        PktAccessRewrite rewrite;
+        auto apply = [&]() {
+            for (auto &bb : f.bbs) {
+                std::vector<std::shared_ptr<Operation>> new_ops;
+                for (auto &op : bb->ops) {
+                    if (rewrite.removed.find(op.get()) != rewrite.removed.end()) {
+                        continue;
+                    }
+                    for (auto &a : op->args) {
+                        a = rewrite.resolve(a);
+                    }
+                    new_ops.emplace_back(op);
+                }
+                bb->ops = std::move(new_ops);
+                for (auto &br : bb->branches) {
+                    br.cond_var = rewrite.resolve(br.cond_var);
+                }
+                if (bb->return_val != nullptr) {
+                    bb->return_val = rewrite.resolve(bb->return_val);
+                }
+            }
+            bool changed = !rewrite.removed.empty();
+            rewrite.replace.clear();
+            rewrite.removed.clear();
+            return changed;
+        };
+        // a forwarded load makes the stores of its value recognizable as
+        // writing back what the field holds, which in turn keeps the field
+        // available past them, so this runs until nothing changes
+        do {
+            forward_pkt_fields(f, ctx, rewrite);
+        } while (apply());
+        // forwarded loads no longer separate stores to the same field
+        remove_dead_pkt_stores(f, ctx, rewrite);
+        apply();
+        update_uses(f);
+    }
+
+    void remove_redundant_pkt_access(Element &ele, const PacketLayout &layout) {
+        remove_redundant_pkt_access(*ele.entry(), layout);
+    }
+
+    static std::shared_ptr<Operation> int_arith_src(const std::shared_ptr<Var> &v, IntArithType t) {
+        auto op = v->src_op.lock();
+        if (op == nullptr || op->type != Operation::T::ARITH
+            || op->arith_info.t != ArithType::INT_ARITH || op->arith_info.u.iarith_t != t) {
+            return nullptr;
+        }
+        return op;
+    }
+
+    static uint64_t bits_mask(int bitwidth) {
+        return bitwidth >= 64 ? ~0ull : ((1ull << bitwidth) - 1);
+    }
+
+    static bool is_const_of(const Var &v, uint64_t c) {
+        if (!v.is_constant || v.type->type != Type::T::INT) {
+            return false;
+        }
+        auto mask = bits_mask(v.type->bitwidth);
+        return (v.constant & mask) == (c & mask);
+    }
+
+    // the other arg of a binary op with a constant arg c, nullptr if none
+    static std::shared_ptr<Var> arg_beside_const(const Operation &op, uint64_t c) {
+        if (op.args.size() != 2) {
+            return nullptr;
+        }
+        if (is_const_of(*op.args[1], c)) {
+            return op.args[0];
+        }
+        if (is_const_of(*op.args[0], c)) {
+            return op.args[1];
+        }
+        return nullptr;
+    }
+
+    // x for ~x, either "xor x, -1" or "not x"
+    static std::shared_ptr<Var> not_of(const std::shared_ptr<Var> &v) {
+        if (auto op = int_arith_src(v, IntArithType::INT_XOR)) {
+            return arg_beside_const(*op, ~0ull);
+        }
+        if (auto op = int_arith_src(v, IntArithType::INT_NOT)) {
+            return op->args[0];
+        }
+        return nullptr;
+    }
+
+    static std::shared_ptr<Var> bswap16_of(const std::shared_ptr<Var> &v) {
+        auto op = v->src_op.lock();
+        if (op == nullptr || op->type != Operation::T::FUNC_CALL
+            || !str_begin_with(op->call_info.func_name, "llvm.bswap.i16")) {
+            return nullptr;
+        }
+        return op->args[0];
+    }
+
+    // x for "x + (x >> 16)" or "(x & 0xffff) + (x >> 16)", the carry fold
+    static std::shared_ptr<Var> unfold_carry(const std::shared_ptr<Var> &v) {
+        auto add = int_arith_src(v, IntArithType::INT_ADD);
+        if (add == nullptr) {
+            return nullptr;
+        }
+        for (int i = 0; i < 2; i++) {
+            auto shr = int_arith_src(add->args[i], IntArithType::INT_LSHR);
+            if (shr == nullptr || !is_const_of(*shr->args[1], 16)) {
+                continue;
+            }
+            auto x = shr->args[0];
+            auto other = add->args[1 - i];
+            if (other == x) {
+                return x;
+            }
+            auto mask = int_arith_src(other, IntArithType::INT_AND);
+            if (mask != nullptr && arg_beside_const(*mask, 0xffff) == x) {
+                return x;
+            }
+        }
+        return nullptr;
+    }
+
+    // ~fold(~field + terms + const_sum), swapped if summed in host order
+    struct CsumPatch {
+        bool swapped = false;
+        std::shared_ptr<Var> sum;
+        std::vector<std::shared_ptr<Var>> terms;
+        uint64_t const_sum = 0;
+    };
+
+    static void collect_sum_terms(const std::shared_ptr<Var> &v, CsumPatch &patch) {
+        if (v->is_constant) {
+            patch.const_sum += v->constant & bits_mask(v->type->bitwidth);
+        } else if (auto add = int_arith_src(v, IntArithType::INT_ADD)) {
+            collect_sum_terms(add->args[0], patch);
+            collect_sum_terms(add->args[1], patch);
+        } else {
+            patch.terms.emplace_back(v);
+        }
+    }
+
+    // whether the term is the complement of the field the store writes
+    static bool is_inverted_field(std::shared_ptr<Var> v, const Operation &store, bool swapped) {
+        int nots = 0;
+        int swaps = 0;
+        while (true) {
+            if (auto zext = int_arith_src(v, IntArithType::INT_ZEXT)) {
+                v = zext->args[0];
+            } else if (auto mask = int_arith_src(v, IntArithType::INT_AND)) {
+                auto x = arg_beside_const(*mask, 0xffff);
+                if (x == nullptr) {
+                    return false;
+                }
+                v = x;
+            } else if (auto x = not_of(v)) {
+                nots++;
+                v = x;
+            } else if (auto x = bswap16_of(v)) {
+                swaps++;
+                v = x;
+            } else {
+                break;
+            }
+        }
+        auto op = v->src_op.lock();
+        return op != nullptr && op->type == Operation::T::PKT_HDR_LOAD
+            && op->args[0] == store.args[0]
+            && op->pkt_op_info.header == store.pkt_op_info.header
+            && op->pkt_op_info.field == store.pkt_op_info.field
+            && nots == 1 && swaps == (swapped ? 1 : 0);
+    }
+
+    static std::optional<CsumPatch> match_csum_patch(const Operation &store) {
+        auto v = store.args[1];
+        if (v->type->type != Type::T::INT || v->type->bitwidth != 16) {
+            return std::nullopt;
+        }
+        CsumPatch patch;
+        if (auto x = bswap16_of(v)) {
+            patch.swapped = true;
+            v = x;
+        }
+        v = not_of(v);
+        if (v == nullptr) {
+            return std::nullopt;
+        }
+        if (auto trunc = int_arith_src(v, IntArithType::INT_TRUNC)) {
+            v = trunc->args[0];
+        }
+        int folds = 0;
+        while (auto x = unfold_carry(v)) {
+            v = x;
+            folds++;
+        }
+        if (folds == 0) {
+            return std::nullopt;
+        }
+        patch.sum = v;
+        collect_sum_terms(v, patch);
+        auto field = std::find_if(patch.terms.begin(), patch.terms.end(), [&](const std::shared_ptr<Var> &t) {
+            return is_inverted_field(t, store, patch.swapped);
+        });
+        if (field == patch.terms.end()) {
+            return std::nullopt;
+        }
+        patch.terms.erase(field);
+        // host order sums are only taken when they are constant
+        if (patch.swapped && !patch.terms.empty()) {
+            return std::nullopt;
+        }
+        return patch;
+    }
+
+    static uint64_t fold_csum16(uint64_t x) {
+        while (x >> 16) {
+            x = (x & 0xffff) + (x >> 16);
+        }
+        return x;
+    }
+
+    void replace_checksum_update(Function &f) {
+        auto constant = [](Type *t, uint64_t c) {
+            auto v = std::make_shared<Var>();
+            v->type = t;
+            v->is_constant = true;
+            v->constant = c;
+            return v;
+        };
+        for (auto &bb : f.bbs) {
+            std::vector<std::shared_ptr<Operation>> new_ops;
+            for (auto &op : bb->ops) {
+                std::optional<CsumPatch> patch;
+                if (op->type == Operation::T::PKT_HDR_STORE) {
+                    patch = match_csum_patch(*op);
+                }
+                if (!patch.has_value()) {
+                    new_ops.emplace_back(op);
+                    continue;
+                }
+
+                auto field_t = op->args[1]->type;
+                std::shared_ptr<Var> delta;
+                if (patch->terms.empty()) {
+                    // a ones' complement sum does not depend on the byte
+                    // order (RFC 1071), a host order constant is swapped back
+                    auto c = fold_csum16(patch->const_sum);
+                    if (patch->swapped) {
+                        c = ((c & 0xff) << 8) | (c >> 8);
+                    }
+                    delta = constant(field_t, c);
+                } else {
+                    auto sum_t = patch->sum->type;
+                    delta = patch->terms[0];
+                    auto add = [&](std::shared_ptr<Var> b) {
+                        auto add_op = std::make_shared<Operation>();
+                        add_op->type = Operation::T::ARITH;
+                        add_op->arith_info.t = ArithType::INT_ARITH;
+                        add_op->arith_info.u.iarith_t = IntArithType::INT_ADD;
+                        add_op->args = {delta, b};
+                        add_op->parent = bb.get();
+                        auto dst = std::make_shared<Var>();
+                        dst->type = sum_t;
+                        dst->src_op = add_op;
+                        add_op->dst_vars.emplace_back(dst);
+                        new_ops.emplace_back(add_op);
+                        delta = dst;
+                    };
+                    for (size_t i = 1; i < patch->terms.size(); i++) {
+                        add(patch->terms[i]);
+                    }
+                    if (patch->const_sum != 0) {
+                        add(constant(sum_t, patch->const_sum));
+                    }
+                }
+
+                auto pkt = op->args[0];
+                op->type = Operation::T::PKT_CSUM_UPDATE;
+                op->args = {pkt, delta};
+                auto dst = std::make_shared<Var>();
+                dst->type = field_t;
+                dst->src_op = op;
+                op->dst_vars = {dst};
+                new_ops.emplace_back(op);
+            }
+            bb->ops = std::move(new_ops);
+        }
+        update_uses(f);
+    }
+
+    void replace_checksum_update(Element &ele) {
+        replace_checksum_update(*ele.entry());
+    }
+}
@@ -1,8 +1,12 @@
 #include "hir-stateop.hpp"
 #include "hir-common-pass.hpp"
+#include "hir-cost.hpp"
 #include "llvm-helpers.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <functional>
+
 namespace HIR {
     struct StatePtrInfo {
         bool is_state_ptr;
@@ -120,7 +124,357 @@ namespace HIR {
         cache[entry_f->args[0]].is_state_ptr = true;
     }
 
-    void split_stateptr_branch(Element &ele) {
+    static std::shared_ptr<Var> int_constant(Module &m, int bits, uint64_t c) {
+        auto v = std::make_shared<Var>();
+        v->type = m.get_int_type(bits).get();
+        v->is_constant = true;
+        v->constant = c;
+        return v;
+    }
+
+    static std::shared_ptr<Operation> make_op(
+            BasicBlock *bb,
+            Operation::T type,
+            std::vector<std::shared_ptr<Var>> args,
+            Type *dst_type,
+            const std::string &name_like) {
+        auto op = std::make_shared<Operation>();
+        op->type = type;
+        op->parent = bb;
+        op->args = std::move(args);
+        if (dst_type != nullptr) {
+            auto dst = std::make_shared<Var>();
+            dst->type = dst_type;
+            // named after the var it stands for, "pred" for constants
+            auto base = name_like.empty() ? "pred" : NameFactory::get().base(name_like);
+            dst->name = NameFactory::get()(base);
+            dst->src_op = op;
+            op->dst_vars.emplace_back(dst);
+        }
+        return op;
+    }
+
+    static bool is_traceable_stateptr(InfoCacheT &info_cache, const std::shared_ptr<Var> &v) {
+        if (v->is_constant || v->is_global || (v->is_param && info_cache.find(v) == info_cache.end())) {
+            return false;
+        }
+        return stateptr_trace(info_cache, v).is_state_ptr;
+    }
+
+    // a pointer computed from params and constants only, it can be
+    // computed again anywhere
+    static bool can_rematerialize(const std::shared_ptr<Var> &v) {
+        if (v->is_param || v->is_constant || v->is_global) {
+            return true;
+        }
+        auto src = v->src_op.lock();
+        if (src == nullptr || (src->type != Operation::T::GEP && src->type != Operation::T::BITCAST)) {
+            return false;
+        }
+        for (auto &a : src->args) {
+            if (!can_rematerialize(a)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static std::shared_ptr<Var> rematerialize(
+            const std::shared_ptr<Var> &v,
+            BasicBlock *bb,
+            std::vector<std::shared_ptr<Operation>> &out) {
+        if (v->is_param || v->is_constant || v->is_global) {
+            return v;
+        }
+        auto src = v->src_op.lock();
+        std::vector<std::shared_ptr<Var>> args;
+        for (auto &a : src->args) {
+            args.emplace_back(rematerialize(a, bb, out));
+        }
+        auto op = make_op(bb, src->type, std::move(args), v->type, v->name);
+        out.emplace_back(op);
+        return op->dst_vars[0];
+    }
+
+    // loads and stores through v, also through geps and bitcasts of it
+    static bool only_accessed(const std::shared_ptr<Var> &v) {
+        for (auto &u : v->uses) {
+            if (u.type != Var::Use::T::OP) {
+                return false;
+            }
+            auto op = u.u.op_ptr;
+            switch (op->type) {
+            case Operation::T::GEP:
+            case Operation::T::BITCAST:
+                for (size_t i = 1; i < op->args.size(); i++) {
+                    if (op->args[i] == v) {
+                        return false;
+                    }
+                }
+                if (!only_accessed(op->dst_vars[0])) {
+                    return false;
+                }
+                break;
+            case Operation::T::LOAD:
+                break;
+            case Operation::T::STORE:
+                if (op->args[1] == v) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* predicates the accesses through the state pointer a select or phi
+     * picks: every load and store through it becomes one access per
+     * candidate, guarded by a selector, the select condition or a phi of
+     * the candidate's index. a load reads all candidates and selects. a
+     * store must not touch the candidates not picked, even by writing
+     * back their old value, since another core may update them in
+     * between, so its block is split around one store per candidate and
+     * a branch on the selector picks the store to run. the rest of the
+     * control flow is left as it is. false, with nothing changed, if the
+     * pointer is used other than by geps, bitcasts, loads and stores
+     */
+    static bool predicate_stateptr(Module &m, Function &f, InfoCacheT &info_cache, const std::shared_ptr<Operation> &pick) {
+        update_uses(f);
+        auto pick_bb = pick->parent;
+        bool is_select = pick->type == Operation::T::SELECT;
+        std::vector<std::shared_ptr<Var>> candidates;
+        if (is_select) {
+            candidates = {pick->args[1], pick->args[2]};
+        } else {
+            candidates = pick->args;
+        }
+        for (auto &c : candidates) {
+            if (!is_traceable_stateptr(info_cache, c) || (!is_select && !can_rematerialize(c))) {
+                return false;
+            }
+        }
+        auto ptr = pick->dst_vars[0];
+        if (!only_accessed(ptr)) {
+            return false;
+        }
+
+        // ops going in right after the phis of pick_bb
+        std::vector<std::shared_ptr<Operation>> head_ops;
+        std::shared_ptr<Operation> selector_phi = nullptr;
+        // is_picked[k]: true iff candidate k is picked, for a select the
+        // condition picks 0
+        std::vector<std::shared_ptr<Var>> is_picked;
+        if (is_select) {
+            is_picked = {pick->args[0]};
+        } else {
+            std::vector<std::shared_ptr<Var>> idx;
+            for (size_t k = 0; k < candidates.size(); k++) {
+                idx.emplace_back(int_constant(m, 32, k));
+            }
+            selector_phi = make_op(pick_bb, Operation::T::PHINODE, idx, m.get_int_type(32).get(), "sel");
+            selector_phi->phi_info = pick->phi_info;
+            for (size_t k = 0; k < candidates.size(); k++) {
+                auto eq = make_op(pick_bb, Operation::T::ARITH,
+                                  {selector_phi->dst_vars[0], int_constant(m, 32, k)},
+                                  m.get_int_type(1).get(), "sel");
+                eq->arith_info.t = ArithType::INT_CMP;
+                eq->arith_info.u.icmp_t = IntCmpType::EQ;
+                head_ops.emplace_back(eq);
+                is_picked.emplace_back(eq->dst_vars[0]);
+            }
+            for (auto &c : candidates) {
+                c = rematerialize(c, pick_bb, head_ops);
+            }
+        }
+        // value if candidate k is picked, else otherwise
+        auto guarded = [&](BasicBlock *bb, size_t k, std::shared_ptr<Var> value, std::shared_ptr<Var> otherwise,
+                           std::shared_ptr<Var> dst) {
+            auto op = make_op(bb, Operation::T::SELECT, {}, dst == nullptr ? value->type : nullptr, value->name);
+            if (is_select) {
+                op->args = {is_picked[0], k == 0 ? value : otherwise, k == 0 ? otherwise : value};
+            } else {
+                op->args = {is_picked[k], value, otherwise};
+            }
+            if (dst != nullptr) {
+                dst->src_op = op;
+                op->dst_vars.emplace_back(dst);
+            }
+            return op;
+        };
+
+        std::unordered_map<const Operation *, std::vector<std::shared_ptr<Operation>>> replace_with;
+        // first of the per candidate stores of each store
+        std::unordered_set<const Operation *> guarded_stores;
+        std::function<void(const std::shared_ptr<Var> &, const std::vector<std::shared_ptr<Var>> &)> rewrite;
+        rewrite = [&](const std::shared_ptr<Var> &v, const std::vector<std::shared_ptr<Var>> &per_candidate) {
+            for (auto &u : v->uses) {
+                auto op = u.u.op_ptr;
+                if (replace_with.find(op) != replace_with.end()) {
+                    continue;
+                }
+                auto &seq = replace_with[op];
+                auto bb = op->parent;
+                if (op->type == Operation::T::GEP || op->type == Operation::T::BITCAST) {
+                    std::vector<std::shared_ptr<Var>> derived;
+                    for (auto &c : per_candidate) {
+                        auto args = op->args;
+                        args[0] = c;
+                        auto clone = make_op(bb, op->type, args, op->dst_vars[0]->type, op->dst_vars[0]->name);
+                        seq.emplace_back(clone);
+                        derived.emplace_back(clone->dst_vars[0]);
+                    }
+                    rewrite(op->dst_vars[0], derived);
+                } else if (op->type == Operation::T::LOAD) {
+                    auto dst = op->dst_vars[0];
+                    std::vector<std::shared_ptr<Var>> vals;
+                    for (auto &c : per_candidate) {
+                        auto load = make_op(bb, Operation::T::LOAD, {c}, dst->type, dst->name);
+                        seq.emplace_back(load);
+                        vals.emplace_back(load->dst_vars[0]);
+                    }
+                    if (is_select) {
+                        seq.emplace_back(guarded(bb, 0, vals[0], vals[1], dst));
+                    } else {
+                        auto acc = vals[0];
+                        for (size_t k = 1; k < vals.size(); k++) {
+                            auto sel = guarded(bb, k, vals[k], acc, k + 1 == vals.size() ? dst : nullptr);
+                            seq.emplace_back(sel);
+                            acc = sel->dst_vars[0];
+                        }
+                    }
+                } else {
+                    assert(op->type == Operation::T::STORE);
+                    for (auto &c : per_candidate) {
+                        seq.emplace_back(make_op(bb, Operation::T::STORE, {c, op->args[1]}, nullptr, ""));
+                    }
+                    guarded_stores.emplace(seq.front().get());
+                }
+            }
+        };
+        rewrite(ptr, candidates);
+
+        for (auto &bb : f.bbs) {
+            std::vector<std::shared_ptr<Operation>> new_ops;
+            bool in_phis = bb.get() == pick_bb;
+            for (auto &op : bb->ops) {
+                if (in_phis && op->type != Operation::T::PHINODE) {
+                    new_ops.insert(new_ops.end(), head_ops.begin(), head_ops.end());
+                    in_phis = false;
+                }
+                if (op == pick) {
+                    if (selector_phi != nullptr) {
+                        new_ops.emplace_back(selector_phi);
+                    }
+                    continue;
+                }
+                auto iter = replace_with.find(op.get());
+                if (iter != replace_with.end()) {
+                    new_ops.insert(new_ops.end(), iter->second.begin(), iter->second.end());
+                } else {
+                    new_ops.emplace_back(op);
+                }
+            }
+            if (in_phis) {
+                new_ops.insert(new_ops.end(), head_ops.begin(), head_ops.end());
+            }
+            bb->ops = std::move(new_ops);
+        }
+
+        // bb: ... br is_picked[0] s_0, ..., is_picked[n - 2] s_(n - 2), s_(n - 1)
+        // s_k: store to candidate k, then on to the rest of bb
+        for (size_t i = 0; i < f.bbs.size(); i++) {
+            auto bb = f.bbs[i];
+            auto iter = std::find_if(bb->ops.begin(), bb->ops.end(), [&](const std::shared_ptr<Operation> &op) {
+                return guarded_stores.count(op.get()) > 0;
+            });
+            if (iter == bb->ops.end()) {
+                continue;
+            }
+            guarded_stores.erase(iter->get());
+            auto first = iter - bb->ops.begin();
+            auto rest = std::make_shared<BasicBlock>(*bb);
+            rest->name = NameFactory::get()(NameFactory::get().base(bb->name));
+            rest->ops.assign(bb->ops.begin() + first + candidates.size(), bb->ops.end());
+            for (auto &op : rest->ops) {
+                op->parent = rest.get();
+            }
+            for (auto &other : f.bbs) {
+                for (auto &op : other->ops) {
+                    if (op->type != Operation::T::PHINODE) {
+                        continue;
+                    }
+                    for (auto &from : op->phi_info.from) {
+                        if (from.lock() == bb) {
+                            from = rest;
+                        }
+                    }
+                }
+            }
+
+            std::vector<std::shared_ptr<BasicBlock>> stores;
+            for (size_t k = 0; k < candidates.size(); k++) {
+                auto store_bb = std::make_shared<BasicBlock>();
+                store_bb->name = NameFactory::get()(NameFactory::get().base(bb->name));
+                store_bb->parent = bb->parent;
+                auto store = bb->ops[first + k];
+                store->parent = store_bb.get();
+                store_bb->ops.emplace_back(store);
+                store_bb->default_next_bb = rest;
+                stores.emplace_back(store_bb);
+            }
+            bb->ops.resize(first);
+            bb->branches.clear();
+            bb->is_return = false;
+            bb->is_short_circuit = false;
+            bb->is_err = false;
+            bb->return_val = nullptr;
+            for (size_t k = 0; k + 1 < candidates.size(); k++) {
+                BasicBlock::BranchEntry e;
+                e.is_conditional = true;
+                e.cond_var = is_picked[k];
+                e.next_bb = stores[k];
+                bb->branches.emplace_back(e);
+            }
+            bb->default_next_bb = stores.back();
+            f.bbs.insert(f.bbs.end(), stores.begin(), stores.end());
+            // later stores of the block
+            f.bbs.emplace_back(rest);
+        }
+        update_uses(f);
+        return true;
+    }
+
+    // ops in bb from op_idx on and in all blocks reachable from it
+    static size_t ops_reachable_from(const BasicBlock *bb, size_t op_idx) {
+        size_t n = bb->ops.size() - std::min(op_idx, bb->ops.size());
+        std::unordered_set<const BasicBlock *> visited = {bb};
+        std::vector<const BasicBlock *> stack = {bb};
+        while (!stack.empty()) {
+            auto cur = stack.back();
+            stack.pop_back();
+            std::vector<std::shared_ptr<BasicBlock>> next;
+            if (auto n_bb = cur->default_next_bb.lock()) {
+                next.emplace_back(n_bb);
+            }
+            for (auto &e : cur->branches) {
+                if (auto n_bb = e.next_bb.lock()) {
+                    next.emplace_back(n_bb);
+                }
+            }
+            for (auto &n_bb : next) {
+                if (visited.insert(n_bb.get()).second) {
+                    n += n_bb->ops.size();
+                    stack.emplace_back(n_bb.get());
+                }
+            }
+        }
+        return n;
+    }
+
+    void split_stateptr_branch(Element &ele, const SplitStatePtrOptions &opts) {
+        assert(ele.module() != nullptr);
         auto entry_f = ele.entry();
         auto ctl_graph = control_graph_of_func(*entry_f);
         auto scc_list = ctl_graph.StronglyConnectedComponents();
@@ -143,7 +497,7 @@ namespace HIR {
             }
             auto& bb = ctl_graph.vertex_ref(scc[0]);
             assert(bb == entry_f->bbs[scc[0]]);
-            bool should_split = false;
+            std::shared_ptr<Operation> split_phi = nullptr;
             for (int j = 0; j < bb->ops.size(); j++) {
                 auto& op = bb->ops[j];
                 if (op->type == Operation::T::SELECT) {
@@ -154,28 +508,50 @@ namespace HIR {
                         pt.op = op;
                         to_split.emplace_back(pt);
                     }
-                } else if (op->type == Operation::T::PHINODE) {
-                    std::vector<StatePtrInfo> info_list;
+                } else if (op->type == Operation::T::PHINODE && split_phi == nullptr) {
                     for (auto& a : op->args) {
-                        info_list.emplace_back(stateptr_trace(info_cache, op->dst_vars[0]));
-                    }
-                    for (auto& info : info_list) {
-                        if (info.is_state_ptr) {
-                            should_split = true;
+                        if (is_traceable_stateptr(info_cache, a)) {
+                            split_phi = op;
                             break;
                         }
                     }
                 }
             }
-            if (should_split) {
+            if (split_phi != nullptr) {
                 SplitPoint pt;
                 pt.bb = bb;
+                pt.op = split_phi;
                 to_split.emplace_back(pt);
             }
         }
 
+        // ops the forks added so far
+        size_t forked = 0;
         for (auto& loc : to_split) {
-            if (loc.op == nullptr) {
+            size_t cost = 0;
+            if (loc.bb != nullptr) {
+                size_t n_from = 0;
+                for (auto& bb : entry_f->bbs) {
+                    if (bb->default_next_bb.lock() == loc.bb) {
+                        n_from++;
+                    }
+                    for (auto& e : bb->branches) {
+                        if (e.next_bb.lock() == loc.bb) {
+                            n_from++;
+                        }
+                    }
+                }
+                cost = n_from > 1 ? (n_from - 1) * ops_reachable_from(loc.bb.get(), 0) : 0;
+            } else {
+                auto bb = loc.op->parent;
+                auto iter = std::find(bb->ops.begin(), bb->ops.end(), loc.op);
+                cost = ops_reachable_from(bb, iter - bb->ops.begin() + 1);
+            }
+            if (forked + cost > opts.max_fork_ops && predicate_stateptr(*ele.module(), *entry_f, info_cache, loc.op)) {
+                continue;
+            }
+            forked += cost;
+            if (loc.bb != nullptr) {
                 // split basic block
                 // find bb idx
                 int idx = -1;
@@ -195,6 +571,10 @@ namespace HIR {
         update_uses(ele);
     }
 
+    void split_stateptr_branch(Element &ele) {
+        split_stateptr_branch(ele, SplitStatePtrOptions());
+    }
+
     void replace_vector_ops(Element& ele) {
         auto entry_f = ele.entry();
         InfoCacheT info_cache;
@@ -214,7 +594,11 @@ namespace HIR {
                     assert(ele.states.find(base_info.state_offset) != ele.states.end());
                     auto state_var = ele.states[base_info.state_offset];
                     assert(state_var->type->type == Type::T::VECTOR);
-                    op->args[0] = state_var;
+                    // a register array of the vector's capacity
+                    op->type = Operation::T::STATE_IDX;
+                    op->args = {state_var, op->args[1]};
+                    op->call_info.func_name.clear();
+                    op->call_info.called_function.reset();
                 }
             }
         }
@@ -252,7 +636,130 @@ namespace HIR {
         }
     }
 
+    // a gep stepping into a fixed size array state
+    struct ArrayGep {
+        std::shared_ptr<Operation> op;
+        std::shared_ptr<Var> state;
+        // position of the array index in op->args
+        size_t idx_pos;
+    };
+
+    // the array state index of the gep steps over, if any
+    static bool find_array_gep(
+            const std::unordered_map<size_t, std::shared_ptr<Var>> &arrays,
+            InfoCacheT &info_cache,
+            const std::shared_ptr<Operation> &op,
+            ArrayGep &result) {
+        auto &base = op->args[0];
+        if (base->is_global || base->is_constant
+            || (base->is_param && info_cache.find(base) == info_cache.end())) {
+            return false;
+        }
+        auto base_info = stateptr_trace(info_cache, base);
+        if (!base_info.is_state_ptr || base_info.offset_var != nullptr) {
+            return false;
+        }
+        auto off = base_info.state_offset;
+        auto t = base->type;
+        for (size_t i = 1; i < op->args.size(); i++) {
+            auto &a = op->args[i];
+            if (t->type == Type::T::ARRAY) {
+                auto iter = arrays.find(off);
+                if (iter != arrays.end()
+                    && iter->second->type->array_info.num_element == t->array_info.num_element) {
+                    result.op = op;
+                    result.state = iter->second;
+                    result.idx_pos = i;
+                    return true;
+                }
+            }
+            if (!a->is_constant) {
+                return false;
+            }
+            if (t->type == Type::T::POINTER) {
+                if (i != 1 || !t->pointee_type->sized()) {
+                    return false;
+                }
+                off += t->pointee_type->num_bytes() * a->constant;
+                t = t->pointee_type;
+            } else if (t->type == Type::T::STRUCT && a->constant < t->struct_info.fields.size()) {
+                off += t->struct_info.offsets[a->constant];
+                t = t->struct_info.fields[a->constant];
+            } else if (t->type == Type::T::ARRAY) {
+                off += t->array_info.element_type->num_bytes() * a->constant;
+                t = t->array_info.element_type;
+            } else {
+                return false;
+            }
+        }
+        return false;
+    }
+
     void replace_fixsized_array_ops(Element &ele) {
+        auto entry_f = ele.entry();
+        InfoCacheT info_cache;
+        init_stateptr_info_cache(ele, info_cache);
+        std::unordered_map<size_t, std::shared_ptr<Var>> arrays;
+        for (auto &kv : ele.states) {
+            if (kv.second->type->type == Type::T::ARRAY) {
+                arrays[kv.first] = kv.second;
+            }
+        }
+        if (arrays.empty()) {
+            return;
+        }
+        assert(ele.module() != nullptr);
+        auto &m = *ele.module();
+
+        // find all of them first, the rewrite changes what the trace sees
+        std::unordered_map<const Operation *, ArrayGep> geps;
+        for (auto &bb : entry_f->bbs) {
+            for (auto &op : bb->ops) {
+                ArrayGep g;
+                if (op->type == Operation::T::GEP && find_array_gep(arrays, info_cache, op, g)) {
+                    geps[op.get()] = g;
+                }
+            }
+        }
+
+        for (auto &bb : entry_f->bbs) {
+            std::vector<std::shared_ptr<Operation>> new_ops;
+            for (auto &op : bb->ops) {
+                auto iter = geps.find(op.get());
+                if (iter == geps.end()) {
+                    new_ops.emplace_back(op);
+                    continue;
+                }
+                auto &g = iter->second;
+                auto idx = op->args[g.idx_pos];
+                if (g.idx_pos + 1 == op->args.size()) {
+                    // the gep ends at the element, it becomes the index op
+                    op->type = Operation::T::STATE_IDX;
+                    op->args = {g.state, idx};
+                    new_ops.emplace_back(op);
+                    continue;
+                }
+                // index, then the rest of the gep within the element
+                auto elem_t = g.state->type->array_info.element_type;
+                auto idx_op = std::make_shared<Operation>();
+                idx_op->type = Operation::T::STATE_IDX;
+                idx_op->parent = bb.get();
+                idx_op->args = {g.state, idx};
+                auto elem_ptr = std::make_shared<Var>();
+                elem_ptr->type = m.get_ptr_type(elem_t).get();
+                elem_ptr->name = NameFactory::get()(NameFactory::get().base(op->dst_vars[0]->name));
+                elem_ptr->src_op = idx_op;
+                idx_op->dst_vars.emplace_back(elem_ptr);
+                new_ops.emplace_back(idx_op);
+
+                std::vector<std::shared_ptr<Var>> args = {elem_ptr, int_constant(m, 64, 0)};
+                args.insert(args.end(), op->args.begin() + g.idx_pos + 1, op->args.end());
+                op->args = std::move(args);
+                new_ops.emplace_back(op);
+            }
+            bb->ops = std::move(new_ops);
+        }
+        update_uses(*entry_f);
     }
 
     struct StructTraceInfo {
@@ -338,6 +845,12 @@ namespace HIR {
             }
         }
 
+        void visitStateIdx(const Operation& op) {
+            info.is_struct_ptr = true;
+            info.have_write_back = true;
+            info.struct_obj = op.dst_vars[0];
+        }
+
         void visitFuncCall(const Operation& op) {
             auto fn = op.call_info.func_name;
             std::string func_name;
@@ -384,6 +897,7 @@ namespace HIR {
                     auto ptr_info = trace_struct_info(info_cache, op->args[0]);
                     if (ptr_info.is_struct_ptr) {
                         auto new_op = std::make_shared<Operation>();
+                        new_op->parent = bb.get();
                         new_op->args.clear();
                         new_op->args.emplace_back(ptr_info.struct_obj);
                         assert(ptr_info.offsets.size() > 1);
@@ -393,6 +907,7 @@ namespace HIR {
                         if (op->type == Operation::T::LOAD) {
                             new_op->type = Operation::T::STRUCT_GET;
                             new_op->dst_vars.emplace_back(op->dst_vars[0]);
+                            op->dst_vars[0]->src_op = new_op;
                         } else {
                             new_op->type = Operation::T::STRUCT_SET;
                             new_op->args.emplace_back(op->args[1]);
@@ -406,4 +921,657 @@ namespace HIR {
         update_uses(func);
     }
 
-}
\ No newline at end of file
+    // the state a pointer points into, nullptr if it is not one
+    static std::shared_ptr<Var> state_of_ptr(
+            Element &ele,
+            InfoCacheT &info_cache,
+            const std::unordered_map<const Var *, std::shared_ptr<Var>> &ptr_state,
+            std::shared_ptr<Var> v) {
+        while (true) {
+            if (v->is_global) {
+                return v;
+            }
+            auto iter = ptr_state.find(v.get());
+            if (iter != ptr_state.end()) {
+                return iter->second;
+            }
+            if (v->is_constant || (v->is_param && info_cache.find(v) == info_cache.end())) {
+                return nullptr;
+            }
+            auto info = stateptr_trace(info_cache, v);
+            if (info.is_state_ptr) {
+                // the state whose field holds the offset
+                std::shared_ptr<Var> result = nullptr;
+                size_t result_off = 0;
+                for (auto &kv : ele.states) {
+                    if (kv.first <= info.state_offset && (result == nullptr || kv.first >= result_off)) {
+                        result = kv.second;
+                        result_off = kv.first;
+                    }
+                }
+                return result;
+            }
+            auto src = v->src_op.lock();
+            if (src == nullptr || (src->type != Operation::T::GEP && src->type != Operation::T::BITCAST)) {
+                return nullptr;
+            }
+            v = src->args[0];
+        }
+    }
+
+    // byte offset of a pointer from the local it points into, through
+    // geps with constant indices and bitcasts
+    static std::optional<size_t> offset_in_local(std::shared_ptr<Var> ptr, const Var &local) {
+        size_t off = 0;
+        while (ptr.get() != &local) {
+            auto src = ptr->src_op.lock();
+            if (src == nullptr || (src->type != Operation::T::GEP && src->type != Operation::T::BITCAST)) {
+                return std::nullopt;
+            }
+            auto t = src->args[0]->type;
+            for (size_t i = 1; src->type == Operation::T::GEP && i < src->args.size(); i++) {
+                auto &a = src->args[i];
+                if (!a->is_constant) {
+                    return std::nullopt;
+                }
+                if (i == 1 && t->type == Type::T::POINTER && t->pointee_type->sized()) {
+                    off += t->pointee_type->num_bytes() * a->constant;
+                    t = t->pointee_type;
+                } else if (t->type == Type::T::STRUCT && a->constant < t->struct_info.fields.size()) {
+                    off += t->struct_info.offsets[a->constant];
+                    t = t->struct_info.fields[a->constant];
+                } else if (t->type == Type::T::ARRAY) {
+                    t = t->array_info.element_type;
+                    off += t->num_bytes() * a->constant;
+                } else {
+                    return std::nullopt;
+                }
+            }
+            ptr = src->args[0];
+        }
+        return off;
+    }
+
+    // where a store or struct_set into a local writes, from its start
+    static std::optional<size_t> write_offset(const Operation &w, const Var &local) {
+        auto off = offset_in_local(w.args[0], local);
+        if (!off.has_value() || w.type != Operation::T::STRUCT_SET) {
+            return off;
+        }
+        auto t = w.args[0]->type->pointee_type;
+        for (auto idx : w.struct_ref_info) {
+            if (t == nullptr || t->type != Type::T::STRUCT || idx < 0 || (size_t)idx >= t->struct_info.fields.size()) {
+                return std::nullopt;
+            }
+            *off += t->struct_info.offsets[idx];
+            t = t->struct_info.fields[idx];
+        }
+        return off;
+    }
+
+    static void place_key_field(StateKey &key, const std::string &field, std::optional<size_t> pos) {
+        key.pkt_fields.insert(field);
+        auto iter = key.pkt_field_pos.find(field);
+        if (iter == key.pkt_field_pos.end()) {
+            key.pkt_field_pos.emplace(field, pos);
+        } else if (iter->second != pos) {
+            iter->second = std::nullopt;
+        }
+    }
+
+    using KeyVisited = std::set<std::pair<const Var *, std::optional<size_t>>>;
+
+    // pos is where v ends up in the key, none once it is mixed with others
+    static void collect_key_inputs(std::shared_ptr<Var> v,
+                                   std::optional<size_t> pos,
+                                   StateKey &key,
+                                   KeyVisited &visited) {
+        if (!visited.insert({v.get(), pos}).second || v->is_constant) {
+            return;
+        }
+        if (v->is_global) {
+            key.opaque = true;
+            return;
+        }
+        if (v->is_param) {
+            if (v->type->type != Type::T::PACKET) {
+                key.params.insert(v->name);
+            }
+            return;
+        }
+        auto src = v->src_op.lock();
+        if (src == nullptr) {
+            key.opaque = true;
+            return;
+        }
+        switch (src->type) {
+        case Operation::T::PKT_HDR_LOAD:
+            place_key_field(key, src->pkt_op_info.header + "." + src->pkt_op_info.field, pos);
+            break;
+        case Operation::T::ALLOCA: {
+            std::vector<Operation *> writes;
+            if (!collect_local_writes(*v, writes)) {
+                key.opaque = true;
+                break;
+            }
+            for (auto w : writes) {
+                auto off = write_offset(*w, *v);
+                std::optional<size_t> at;
+                if (pos.has_value() && off.has_value()) {
+                    at = *pos + *off;
+                }
+                if (w->type == Operation::T::FUNC_CALL) {
+                    /* IPFlowID(p, reverse): saddr, daddr, sport, dport of
+                     * the packet, or of the reply to it when reverse is
+                     * set. udp ports sit where the tcp ones do
+                     */
+                    std::vector<std::string> fields = {"ipv4.saddr", "ipv4.daddr", "tcp.source", "tcp.dest"};
+                    assert(w->args.size() == 3);
+                    auto &reverse = w->args[2];
+                    if (reverse->is_constant && reverse->constant != 0) {
+                        fields = {"ipv4.daddr", "ipv4.saddr", "tcp.dest", "tcp.source"};
+                    } else if (!reverse->is_constant) {
+                        at = std::nullopt;
+                    }
+                    const size_t field_off[] = {0, 4, 8, 10};
+                    for (size_t i = 0; i < fields.size(); i++) {
+                        std::optional<size_t> field_at;
+                        if (at.has_value()) {
+                            field_at = *at + field_off[i];
+                        }
+                        place_key_field(key, fields[i], field_at);
+                    }
+                } else {
+                    collect_key_inputs(w->args[1], at, key, visited);
+                }
+            }
+            break;
+        }
+        case Operation::T::LOAD:
+        case Operation::T::STRUCT_GET: {
+            // a copy out of a local
+            auto root = src->args[0];
+            for (auto r = root->src_op.lock();
+                 r != nullptr && (r->type == Operation::T::GEP || r->type == Operation::T::BITCAST);
+                 r = root->src_op.lock()) {
+                root = r->args[0];
+            }
+            auto root_src = root->src_op.lock();
+            if (root_src != nullptr && root_src->type == Operation::T::ALLOCA) {
+                collect_key_inputs(root, std::nullopt, key, visited);
+            } else {
+                key.opaque = true;
+            }
+            break;
+        }
+        case Operation::T::BITCAST:
+            collect_key_inputs(src->args[0], pos, key, visited);
+            break;
+        case Operation::T::ARITH:
+        case Operation::T::GEP:
+        case Operation::T::SELECT:
+        case Operation::T::PHINODE:
+            for (auto &a : src->args) {
+                collect_key_inputs(a, std::nullopt, key, visited);
+            }
+            break;
+        default:
+            key.opaque = true;
+            break;
+        }
+    }
+
+    static void merge_access(std::map<size_t, StateAccess> &into, const StateAccess &a) {
+        auto iter = into.find(a.state_idx);
+        if (iter == into.end()) {
+            into.emplace(a.state_idx, a);
+            return;
+        }
+        auto &m = iter->second;
+        m.read = m.read || a.read;
+        m.written = m.written || a.written;
+        m.inserted = m.inserted || a.inserted;
+        for (auto &k : a.keys) {
+            bool seen = false;
+            for (auto &mk : m.keys) {
+                seen = seen || mk.var == k.var;
+            }
+            if (!seen) {
+                m.keys.emplace_back(k);
+            }
+        }
+        m.ops.insert(m.ops.end(), a.ops.begin(), a.ops.end());
+    }
+
+    StateAccessSummary summarize_state_access(Element &ele, const StateAccessOptions &opts) {
+        StateAccessSummary summary;
+        auto entry_f = ele.entry();
+        update_uses(*entry_f);
+        InfoCacheT info_cache;
+        init_stateptr_info_cache(ele, info_cache);
+
+        // pointers to a map value or an array element
+        std::unordered_map<const Var *, std::shared_ptr<Var>> ptr_state;
+        for (auto &bb : entry_f->bbs) {
+            for (auto &op : bb->ops) {
+                if ((op->type == Operation::T::STATE_IDX || is_builtin_call(*op, "HashMapFindp"))
+                    && op->args[0]->is_global && !op->dst_vars.empty()) {
+                    ptr_state[op->dst_vars[0].get()] = op->args[0];
+                }
+            }
+        }
+
+        std::unordered_map<const Operation *, std::vector<StateAccess>> op_access;
+        auto access = [&](const Operation &op, const std::shared_ptr<Var> &state) -> StateAccess & {
+            auto &list = op_access[&op];
+            list.emplace_back();
+            list.back().state_idx = state->global_state_idx;
+            list.back().ops.emplace_back(&op);
+            return list.back();
+        };
+        auto key_of = [](std::shared_ptr<Var> v) {
+            StateKey key;
+            key.var = v;
+            KeyVisited visited;
+            collect_key_inputs(v, 0, key, visited);
+            return key;
+        };
+        auto state_of = [&](std::shared_ptr<Var> v) {
+            return state_of_ptr(ele, info_cache, ptr_state, v);
+        };
+        for (auto &bb : entry_f->bbs) {
+            for (auto &op : bb->ops) {
+                switch (op->type) {
+                case Operation::T::FUNC_CALL:
+                    if (is_builtin_call(*op, "HashMapFindp") && op->args[0]->is_global) {
+                        auto &a = access(*op, op->args[0]);
+                        a.read = true;
+                        a.keys.emplace_back(key_of(op->args[1]));
+                    } else if (is_builtin_call(*op, "HashMapInsert") && op->args[0]->is_global) {
+                        auto &a = access(*op, op->args[0]);
+                        a.written = true;
+                        a.inserted = true;
+                        a.keys.emplace_back(key_of(op->args[1]));
+                    } else if (str_begin_with(op->call_info.func_name, "llvm.memcpy")) {
+                        if (auto s = state_of(op->args[0])) {
+                            access(*op, s).written = true;
+                        }
+                        if (auto s = state_of(op->args[1])) {
+                            access(*op, s).read = true;
+                        }
+                    }
+                    break;
+                case Operation::T::STATE_IDX:
+                    access(*op, op->args[0]).keys.emplace_back(key_of(op->args[1]));
+                    break;
+                case Operation::T::LOAD:
+                case Operation::T::STRUCT_GET:
+                    if (auto s = state_of(op->args[0])) {
+                        access(*op, s).read = true;
+                    }
+                    break;
+                case Operation::T::STORE:
+                case Operation::T::STRUCT_SET:
+                    if (auto s = state_of(op->args[0])) {
+                        access(*op, s).written = true;
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+
+        for (auto &bb : entry_f->bbs) {
+            for (auto &op : bb->ops) {
+                for (auto &a : op_access[op.get()]) {
+                    merge_access(summary.states, a);
+                }
+            }
+        }
+        CostModelOptions cost_opts;
+        cost_opts.max_paths = opts.max_paths;
+        auto cost = analyze_cost(*entry_f, cost_opts);
+        summary.paths_truncated = cost.paths_truncated;
+        for (auto &p : cost.paths) {
+            PathStateAccess path;
+            path.bbs = p.bbs;
+            path.ends_in_err = p.ends_in_err;
+            for (auto &bb : p.bbs) {
+                for (auto &op : bb->ops) {
+                    for (auto &a : op_access[op.get()]) {
+                        merge_access(path.states, a);
+                    }
+                }
+            }
+            summary.paths.emplace_back(std::move(path));
+        }
+        return summary;
+    }
+
+    StateAccessSummary summarize_state_access(Element &ele) {
+        return summarize_state_access(ele, StateAccessOptions());
+    }
+
+    const char *scalar_update_str(ScalarUpdate u) {
+        switch (u) {
+        case ScalarUpdate::READ_ONLY:
+            return "read_only";
+        case ScalarUpdate::COMMUTATIVE:
+            return "commutative";
+        case ScalarUpdate::FETCH_ADD:
+            return "fetch_add";
+        case ScalarUpdate::ATOMIC:
+            return "atomic";
+        }
+        return "";
+    }
+
+    // true if v is computed from the result of one of the loads
+    static bool depends_on(const std::shared_ptr<Var> &v,
+                           const std::unordered_set<const Operation *> &loads,
+                           std::unordered_set<const Var *> &visited) {
+        if (!visited.insert(v.get()).second) {
+            return false;
+        }
+        auto src = v->src_op.lock();
+        if (src == nullptr) {
+            return false;
+        }
+        if (loads.count(src.get()) > 0) {
+            return true;
+        }
+        for (auto &a : src->args) {
+            if (depends_on(a, loads, visited)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the load the store increments, nullptr if it is not an increment
+    static const Operation *increment_load(const Operation &store,
+                                           const std::unordered_set<const Operation *> &loads,
+                                           const std::unordered_set<const Operation *> &stores) {
+        auto src = store.args[1]->src_op.lock();
+        if (src == nullptr || src->type != Operation::T::ARITH || src->arith_info.t != ArithType::INT_ARITH) {
+            return nullptr;
+        }
+        auto arith_t = src->arith_info.u.iarith_t;
+        if (arith_t != IntArithType::INT_ADD && arith_t != IntArithType::INT_SUB) {
+            return nullptr;
+        }
+        // x - d only, d - x is not commutative
+        int n_candidates = arith_t == IntArithType::INT_ADD ? 2 : 1;
+        for (int i = 0; i < n_candidates; i++) {
+            auto load = src->args[i]->src_op.lock();
+            if (load == nullptr || loads.count(load.get()) == 0 || load->parent != store.parent) {
+                continue;
+            }
+            std::unordered_set<const Var *> visited;
+            if (depends_on(src->args[1 - i], loads, visited)) {
+                continue;
+            }
+            // the load comes first and nothing else stores in between
+            bool after_load = false;
+            bool ok = false;
+            for (auto &op : store.parent->ops) {
+                if (op.get() == load.get()) {
+                    after_load = true;
+                } else if (op.get() == &store) {
+                    ok = after_load;
+                    break;
+                } else if (after_load && stores.count(op.get()) > 0) {
+                    break;
+                }
+            }
+            if (ok) {
+                return load.get();
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<ScalarState> classify_scalar_state(Element &ele) {
+        auto entry_f = ele.entry();
+        update_uses(*entry_f);
+        InfoCacheT info_cache;
+        init_stateptr_info_cache(ele, info_cache);
+
+        struct Cell {
+            ScalarState scalar;
+            std::unordered_set<const Operation *> loads;
+            std::unordered_set<const Operation *> stores;
+            // used other than loaded from or stored to
+            bool escaped = false;
+        };
+        // by offset in the element
+        std::map<size_t, Cell> cells;
+        for (auto &bb : entry_f->bbs) {
+            for (auto &op : bb->ops) {
+                if (op->type != Operation::T::GEP || op->dst_vars.empty()) {
+                    continue;
+                }
+                auto ptr = op->dst_vars[0];
+                auto &base = op->args[0];
+                if (ptr->type->type != Type::T::POINTER || ptr->type->pointee_type == nullptr
+                    || ptr->type->pointee_type->type != Type::T::INT) {
+                    continue;
+                }
+                if (base->is_global || base->is_constant
+                    || (base->is_param && info_cache.find(base) == info_cache.end())) {
+                    continue;
+                }
+                auto info = stateptr_trace(info_cache, ptr);
+                if (!info.is_state_ptr || info.offset_var != nullptr) {
+                    continue;
+                }
+                std::shared_ptr<Var> state = nullptr;
+                size_t state_off = 0;
+                for (auto &kv : ele.states) {
+                    if (kv.first <= info.state_offset && (state == nullptr || kv.first >= state_off)) {
+                        state = kv.second;
+                        state_off = kv.first;
+                    }
+                }
+                if (state == nullptr || state->type->type == Type::T::MAP
+                    || state->type->type == Type::T::VECTOR) {
+                    continue;
+                }
+
+                auto bits = ptr->type->pointee_type->bitwidth;
+                auto &c = cells[info.state_offset];
+                if (c.scalar.name.empty()) {
+                    c.scalar.name = state->name;
+                    if (info.state_offset != state_off) {
+                        c.scalar.name += "+" + std::to_string(info.state_offset - state_off);
+                    }
+                    c.scalar.state_idx = state->global_state_idx;
+                    c.scalar.offset = info.state_offset;
+                    c.scalar.bits = bits;
+                } else if (c.scalar.bits != bits) {
+                    // the same bytes as another width
+                    c.escaped = true;
+                }
+                for (auto &u : ptr->uses) {
+                    if (u.type != Var::Use::T::OP) {
+                        c.escaped = true;
+                        continue;
+                    }
+                    auto user = u.u.op_ptr;
+                    if (user->type == Operation::T::LOAD && user->args[0] == ptr) {
+                        c.loads.insert(user);
+                    } else if (user->type == Operation::T::STORE && user->args[0] == ptr && user->args[1] != ptr) {
+                        c.stores.insert(user);
+                    } else {
+                        c.escaped = true;
+                    }
+                }
+            }
+        }
+
+        std::vector<ScalarState> result;
+        for (auto &kv : cells) {
+            auto &c = kv.second;
+            bool all_increments = true;
+            bool value_used = false;
+            std::unordered_set<const Operation *> inc_loads;
+            for (auto store : c.stores) {
+                auto load = increment_load(*store, c.loads, c.stores);
+                if (load == nullptr) {
+                    all_increments = false;
+                    break;
+                }
+                inc_loads.insert(load);
+                if (store->args[1]->uses.size() != 1 || load->dst_vars[0]->uses.size() != 1) {
+                    value_used = true;
+                }
+            }
+            auto &s = c.scalar;
+            if (c.escaped) {
+                s.update = ScalarUpdate::ATOMIC;
+            } else if (c.stores.empty()) {
+                s.update = ScalarUpdate::READ_ONLY;
+            } else if (!all_increments) {
+                s.update = ScalarUpdate::ATOMIC;
+            } else if (value_used || inc_loads.size() != c.loads.size()) {
+                s.update = ScalarUpdate::FETCH_ADD;
+            } else {
+                s.update = ScalarUpdate::COMMUTATIVE;
+            }
+            for (auto &bb : entry_f->bbs) {
+                for (auto &op : bb->ops) {
+                    if (c.loads.count(op.get()) > 0 || c.stores.count(op.get()) > 0) {
+                        s.ops.emplace_back(op.get());
+                    }
+                }
+            }
+            result.emplace_back(std::move(s));
+        }
+        return result;
+    }
+
+    static void print_str_set_json(std::ostream &os, const std::set<std::string> &strs) {
+        os << "[";
+        bool first = true;
+        for (auto &s : strs) {
+            os << (first ? "" : ", ") << json_str(s);
+            first = false;
+        }
+        os << "]";
+    }
+
+    static void print_state_accesses_json(
+            std::ostream &os,
+            const std::map<size_t, StateAccess> &states,
+            const std::unordered_map<size_t, std::shared_ptr<Var>> &state_vars,
+            const std::string &indent) {
+        os << "[";
+        bool first = true;
+        for (auto &kv : states) {
+            auto &a = kv.second;
+            auto &v = state_vars.at(a.state_idx);
+            os << (first ? "" : ",") << std::endl;
+            first = false;
+            os << indent << "  {" << std::endl;
+            os << indent << "    \"name\": " << json_str(v->name) << "," << std::endl;
+            os << indent << "    \"state_idx\": " << a.state_idx << "," << std::endl;
+            os << indent << "    \"type\": " << json_str(global_state_type_str(v->type)) << "," << std::endl;
+            os << indent << "    \"read\": " << (a.read ? "true" : "false") << "," << std::endl;
+            os << indent << "    \"written\": " << (a.written ? "true" : "false") << "," << std::endl;
+            os << indent << "    \"inserted\": " << (a.inserted ? "true" : "false") << "," << std::endl;
+            os << indent << "    \"keys\": [";
+            for (size_t i = 0; i < a.keys.size(); i++) {
+                auto &k = a.keys[i];
+                os << (i == 0 ? "" : ",") << std::endl;
+                auto var = k.var->is_constant ? std::to_string(k.var->constant) : k.var->name;
+                os << indent << "      {\"var\": " << json_str(var)
+                   << ", \"packet_fields\": ";
+                print_str_set_json(os, k.pkt_fields);
+                os << ", \"packet_field_pos\": {";
+                bool first_pos = true;
+                for (auto &kv : k.pkt_field_pos) {
+                    os << (first_pos ? "" : ", ") << json_str(kv.first) << ": ";
+                    if (kv.second.has_value()) {
+                        os << *kv.second;
+                    } else {
+                        os << "null";
+                    }
+                    first_pos = false;
+                }
+                os << "}, \"params\": ";
+                print_str_set_json(os, k.params);
+                os << ", \"opaque\": " << (k.opaque ? "true" : "false") << "}";
+            }
+            if (!a.keys.empty()) {
+                os << std::endl << indent << "    ";
+            }
+            os << "]" << std::endl;
+            os << indent << "  }";
+        }
+        if (!first) {
+            os << std::endl << indent;
+        }
+        os << "]";
+    }
+
+    static void print_state_access_json(std::ostream &os,
+                                        const Element &ele,
+                                        const StateAccessSummary &summary,
+                                        const std::vector<ScalarState> *scalars) {
+        std::unordered_map<size_t, std::shared_ptr<Var>> state_vars;
+        for (auto &kv : ele.states) {
+            state_vars[kv.second->global_state_idx] = kv.second;
+        }
+        os << "{" << std::endl;
+        os << "  \"element\": " << json_str(ele.name()) << "," << std::endl;
+        os << "  \"function\": " << json_str(ele.entry()->name) << "," << std::endl;
+        os << "  \"states\": ";
+        print_state_accesses_json(os, summary.states, state_vars, "  ");
+        os << "," << std::endl;
+        if (scalars != nullptr) {
+            os << "  \"scalars\": [";
+            for (size_t i = 0; i < scalars->size(); i++) {
+                auto &s = (*scalars)[i];
+                os << (i == 0 ? "" : ",") << std::endl;
+                os << "    {\"name\": " << json_str(s.name)
+                   << ", \"state_idx\": " << s.state_idx
+                   << ", \"offset\": " << s.offset
+                   << ", \"bits\": " << s.bits
+                   << ", \"update\": " << json_str(scalar_update_str(s.update)) << "}";
+            }
+            if (!scalars->empty()) {
+                os << std::endl << "  ";
+            }
+            os << "]," << std::endl;
+        }
+        os << "  \"paths_truncated\": " << (summary.paths_truncated ? "true" : "false") << "," << std::endl;
+        os << "  \"paths\": [";
+        for (size_t i = 0; i < summary.paths.size(); i++) {
+            auto &p = summary.paths[i];
+            os << (i == 0 ? "" : ",") << std::endl;
+            os << "    {" << std::endl;
+            os << "      \"exit\": " << json_str(p.bbs.back()->name) << "," << std::endl;
+            os << "      \"is_err\": " << (p.ends_in_err ? "true" : "false") << "," << std::endl;
+            os << "      \"states\": ";
+            print_state_accesses_json(os, p.states, state_vars, "      ");
+            os << std::endl << "    }";
+        }
+        if (!summary.paths.empty()) {
+            os << std::endl << "  ";
+        }
+        os << "]" << std::endl;
+        os << "}" << std::endl;
+    }
+
+    void print_state_access_json(std::ostream &os, const Element &ele, const StateAccessSummary &summary) {
+        print_state_access_json(os, ele, summary, nullptr);
+    }
+
+    void print_state_access_json(std::ostream &os,
+                                 const Element &ele,
+                                 const StateAccessSummary &summary,
+                                 const std::vector<ScalarState> &scalars) {
+        print_state_access_json(os, ele, summary, &scalars);
+    }
+}
@@ -0,0 +1,375 @@
+#include "hir-table.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace HIR {
+    // leaves of t placed byte_off bytes into the key or value, false if
+    // some part can not be matched on by a target
+    static bool flatten_fields(Type *t,
+                               size_t byte_off,
+                               const std::string &path,
+                               std::vector<TableField> &out) {
+        auto child = [&](size_t i) {
+            return path + (path.empty() ? "" : ".") + std::to_string(i);
+        };
+        switch (t->type) {
+        case Type::T::INT:
+            out.push_back({path, byte_off * 8, (size_t)t->bitwidth});
+            return true;
+        case Type::T::STRUCT: {
+            bool ok = true;
+            for (size_t i = 0; i < t->struct_info.fields.size(); i++) {
+                ok = flatten_fields(t->struct_info.fields[i],
+                                    byte_off + t->struct_info.offsets[i],
+                                    child(i), out) && ok;
+            }
+            return ok;
+        }
+        case Type::T::ARRAY: {
+            auto elem = t->array_info.element_type;
+            if (!elem->sized()) {
+                return false;
+            }
+            bool ok = true;
+            for (size_t i = 0; i < t->array_info.num_element; i++) {
+                ok = flatten_fields(elem, byte_off + i * elem->num_bytes(), child(i), out) && ok;
+            }
+            return ok;
+        }
+        case Type::T::POINTER:
+            // still laid out, the value is meaningless off the host
+            out.push_back({path, byte_off * 8, 64});
+            return false;
+        default:
+            return false;
+        }
+    }
+
+    static size_t leaf_bits(const std::vector<TableField> &fields) {
+        size_t bits = 0;
+        for (auto &f : fields) {
+            bits += f.n_bits;
+        }
+        return bits;
+    }
+
+    std::vector<MatchTable> match_tables(const Element &ele, const MatchTableOptions &opts) {
+        std::vector<MatchTable> result;
+        std::unordered_map<const Var *, size_t> table_of;
+        std::vector<std::shared_ptr<Var>> maps;
+        for (auto &kv : ele.states) {
+            if (kv.second->type->type == Type::T::MAP) {
+                maps.emplace_back(kv.second);
+            }
+        }
+        std::sort(maps.begin(), maps.end(), [](const std::shared_ptr<Var> &a, const std::shared_ptr<Var> &b) {
+            return a->global_state_idx < b->global_state_idx;
+        });
+        for (auto &v : maps) {
+            MatchTable t;
+            t.name = v->name;
+            t.state_idx = v->global_state_idx;
+            t.key_t = v->type->map_info.key_t;
+            t.val_t = v->type->map_info.val_t;
+            t.capacity = opts.capacity;
+            bool key_ok = flatten_fields(t.key_t, 0, "", t.key_fields);
+            bool val_ok = flatten_fields(t.val_t, 0, "", t.val_fields);
+            t.offloadable = key_ok && val_ok;
+            t.key_bits = leaf_bits(t.key_fields);
+            t.val_bits = leaf_bits(t.val_fields);
+            table_of[v.get()] = result.size();
+            result.emplace_back(std::move(t));
+        }
+
+        for (auto &bb : ele.entry()->bbs) {
+            for (auto &op : bb->ops) {
+                if (op->type != Operation::T::FUNC_CALL || op->args.empty()) {
+                    continue;
+                }
+                auto fn = op->call_info.called_function.lock();
+                auto iter = table_of.find(op->args[0].get());
+                if (fn == nullptr || !fn->is_built_in || iter == table_of.end()) {
+                    continue;
+                }
+                auto &t = result[iter->second];
+                if (fn->name == "HashMapFindp") {
+                    t.lookups.emplace_back(op.get());
+                } else if (fn->name == "HashMapInsert") {
+                    t.inserts.emplace_back(op.get());
+                }
+            }
+        }
+        return result;
+    }
+
+    std::vector<MatchTable> match_tables(const Element &ele) {
+        return match_tables(ele, MatchTableOptions());
+    }
+
+    std::vector<RegisterArray> register_arrays(const Element &ele, const RegisterArrayOptions &opts) {
+        std::vector<RegisterArray> result;
+        std::unordered_map<const Var *, size_t> array_of;
+        std::vector<std::shared_ptr<Var>> indexed;
+        for (auto &kv : ele.states) {
+            if (kv.second->type->type == Type::T::VECTOR || kv.second->type->type == Type::T::ARRAY) {
+                indexed.emplace_back(kv.second);
+            }
+        }
+        std::sort(indexed.begin(), indexed.end(), [](const std::shared_ptr<Var> &a, const std::shared_ptr<Var> &b) {
+            return a->global_state_idx < b->global_state_idx;
+        });
+        for (auto &v : indexed) {
+            RegisterArray a;
+            a.name = v->name;
+            a.state_idx = v->global_state_idx;
+            a.elem_t = v->type->type == Type::T::ARRAY ? v->type->array_info.element_type
+                                                       : v->type->vector_info.element_type;
+            a.offloadable = flatten_fields(a.elem_t, 0, "", a.elem_fields);
+            a.elem_bits = leaf_bits(a.elem_fields);
+            auto iter = opts.capacities.find(v->name);
+            if (v->type->type == Type::T::ARRAY) {
+                a.capacity = v->type->array_info.num_element;
+                a.capacity_from = "type";
+            } else if (iter != opts.capacities.end()) {
+                a.capacity = iter->second;
+                a.capacity_from = "config";
+            } else {
+                a.capacity = opts.default_capacity;
+                a.capacity_from = "default";
+            }
+            array_of[v.get()] = result.size();
+            result.emplace_back(std::move(a));
+        }
+
+        for (auto &bb : ele.entry()->bbs) {
+            for (auto &op : bb->ops) {
+                if (op->type != Operation::T::STATE_IDX) {
+                    continue;
+                }
+                auto iter = array_of.find(op->args[0].get());
+                if (iter != array_of.end()) {
+                    result[iter->second].accesses.emplace_back(op.get());
+                }
+            }
+        }
+        return result;
+    }
+
+    std::vector<RegisterArray> register_arrays(const Element &ele) {
+        return register_arrays(ele, RegisterArrayOptions());
+    }
+
+    // udp ports sit where the tcp ones do, RSS hashes either the same way
+    static std::string port_alias(const std::string &field) {
+        if (field == "udp.src") {
+            return "tcp.source";
+        } else if (field == "udp.dest") {
+            return "tcp.dest";
+        }
+        return field;
+    }
+
+    using KeyFieldPos = std::map<std::string, std::optional<size_t>>;
+
+    /* how the key lines up the fields a hash covers with another key: 0 if
+     * at the same places, 1 if only with each address or port pair
+     * swapped (the same under a symmetric RSS key), 2 otherwise
+     */
+    static int key_pos_mismatch(const KeyFieldPos &a, const KeyFieldPos &b, const std::vector<std::string> &fields) {
+        int result = 0;
+        for (size_t i = 0; i + 1 < fields.size(); i += 2) {
+            auto a0 = a.at(fields[i]);
+            auto a1 = a.at(fields[i + 1]);
+            auto b0 = b.at(fields[i]);
+            auto b1 = b.at(fields[i + 1]);
+            if (a0 == b0 && a1 == b1) {
+                continue;
+            } else if (a0 == b1 && a1 == b0) {
+                result = 1;
+            } else {
+                return 2;
+            }
+        }
+        return result;
+    }
+
+    Steering shard_tables(std::vector<MatchTable> &tables, const StateAccessSummary &summary) {
+        static const std::vector<std::string> l3_fields = {"ipv4.saddr", "ipv4.daddr"};
+        static const std::vector<std::string> l4_fields = {"ipv4.saddr", "ipv4.daddr", "tcp.source", "tcp.dest"};
+        bool any = false;
+        bool all_l4 = true;
+        bool l3_symmetric = false;
+        bool l4_symmetric = false;
+        for (auto &t : tables) {
+            auto iter = summary.states.find(t.state_idx);
+            if (iter == summary.states.end() || iter->second.keys.empty()) {
+                continue;
+            }
+            auto &keys = iter->second.keys;
+            // fields every key holds at a place of their own
+            std::vector<KeyFieldPos> key_pos;
+            std::set<std::string> common;
+            bool packet_only = true;
+            for (size_t i = 0; i < keys.size(); i++) {
+                auto &k = keys[i];
+                packet_only = packet_only && k.packet_only();
+                KeyFieldPos pos;
+                for (auto &kv : k.pkt_field_pos) {
+                    pos[port_alias(kv.first)] = kv.second;
+                }
+                std::set<std::string> fields;
+                for (auto &kv : pos) {
+                    if (!kv.second.has_value()) {
+                        continue;
+                    }
+                    bool shared = false;
+                    for (auto &other : pos) {
+                        shared = shared || (other.first != kv.first && other.second == kv.second);
+                    }
+                    if (!shared) {
+                        fields.insert(kv.first);
+                    }
+                }
+                key_pos.emplace_back(std::move(pos));
+                if (i == 0) {
+                    common = std::move(fields);
+                } else {
+                    std::set<std::string> both;
+                    std::set_intersection(common.begin(), common.end(), fields.begin(), fields.end(),
+                                          std::inserter(both, both.begin()));
+                    common = std::move(both);
+                }
+            }
+            // 0, 1 or 2 as in key_pos_mismatch, over every key
+            auto mismatch = [&](const std::vector<std::string> &fields) {
+                bool covered = std::all_of(fields.begin(), fields.end(), [&common](const std::string &f) {
+                    return common.count(f) > 0;
+                });
+                if (!covered) {
+                    return 2;
+                }
+                int result = 0;
+                for (auto &pos : key_pos) {
+                    result = std::max(result, key_pos_mismatch(key_pos[0], pos, fields));
+                }
+                return result;
+            };
+            auto l3 = mismatch(l3_fields);
+            if (!packet_only || l3 == 2) {
+                continue;
+            }
+            auto l4 = mismatch(l4_fields);
+            t.sharded = true;
+            any = true;
+            all_l4 = all_l4 && l4 != 2;
+            l3_symmetric = l3_symmetric || l3 == 1;
+            l4_symmetric = l4_symmetric || l4 == 1;
+        }
+        Steering result;
+        if (any) {
+            result.fields = all_l4 ? l4_fields : l3_fields;
+            result.rss_type = all_l4 ? "ipv4-l4" : "ipv4";
+            result.symmetric = all_l4 ? l4_symmetric : l3_symmetric;
+        }
+        return result;
+    }
+
+    static void print_fields_json(std::ostream &os, const std::vector<TableField> &fields, const std::string &indent) {
+        os << "[";
+        for (size_t i = 0; i < fields.size(); i++) {
+            auto &f = fields[i];
+            os << (i == 0 ? "" : ",") << std::endl;
+            os << indent << "  {\"name\": " << json_str(f.name)
+               << ", \"bit_offset\": " << f.bit_offset
+               << ", \"n_bits\": " << f.n_bits << "}";
+        }
+        if (!fields.empty()) {
+            os << std::endl << indent;
+        }
+        os << "]";
+    }
+
+    static void print_ops_json(std::ostream &os, const std::vector<const Operation *> &ops) {
+        os << "[";
+        for (size_t i = 0; i < ops.size(); i++) {
+            auto &dst = ops[i]->dst_vars;
+            os << (i == 0 ? "" : ", ") << json_str(dst.empty() ? "" : dst[0]->name);
+        }
+        os << "]";
+    }
+
+    void print_tables_json(std::ostream &os, const Element &ele, const std::vector<MatchTable> &tables) {
+        print_tables_json(os, ele, tables, {}, Steering());
+    }
+
+    void print_tables_json(std::ostream &os,
+                           const Element &ele,
+                           const std::vector<MatchTable> &tables,
+                           const std::vector<RegisterArray> &arrays,
+                           const Steering &steering) {
+        os << "{" << std::endl;
+        os << "  \"element\": " << json_str(ele.name()) << "," << std::endl;
+        os << "  \"tables\": [";
+        for (size_t i = 0; i < tables.size(); i++) {
+            auto &t = tables[i];
+            os << (i == 0 ? "" : ",") << std::endl;
+            os << "    {" << std::endl;
+            os << "      \"name\": " << json_str(t.name) << "," << std::endl;
+            os << "      \"state_idx\": " << t.state_idx << "," << std::endl;
+            os << "      \"match\": \"exact\"," << std::endl;
+            os << "      \"capacity\": " << t.capacity << "," << std::endl;
+            os << "      \"offloadable\": " << (t.offloadable ? "true" : "false") << "," << std::endl;
+            os << "      \"sharded\": " << (t.sharded ? "true" : "false") << "," << std::endl;
+            os << "      \"key_bits\": " << t.key_bits << "," << std::endl;
+            // PackedKey<key_bytes> in flow-table.hpp
+            os << "      \"key_bytes\": " << (t.key_bits + 7) / 8 << "," << std::endl;
+            os << "      \"key\": ";
+            print_fields_json(os, t.key_fields, "      ");
+            os << "," << std::endl;
+            os << "      \"value_bits\": " << t.val_bits << "," << std::endl;
+            os << "      \"value\": ";
+            print_fields_json(os, t.val_fields, "      ");
+            os << "," << std::endl;
+            os << "      \"lookups\": ";
+            print_ops_json(os, t.lookups);
+            os << "," << std::endl;
+            os << "      \"inserts\": ";
+            print_ops_json(os, t.inserts);
+            os << std::endl << "    }";
+        }
+        if (!tables.empty()) {
+            os << std::endl << "  ";
+        }
+        os << "]," << std::endl;
+        os << "  \"steering\": {\"rss_type\": " << json_str(steering.rss_type) << ", \"fields\": [";
+        for (size_t i = 0; i < steering.fields.size(); i++) {
+            os << (i == 0 ? "" : ", ") << json_str(steering.fields[i]);
+        }
+        os << "], \"symmetric\": " << (steering.symmetric ? "true" : "false") << "}," << std::endl;
+        os << "  \"register_arrays\": [";
+        for (size_t i = 0; i < arrays.size(); i++) {
+            auto &a = arrays[i];
+            os << (i == 0 ? "" : ",") << std::endl;
+            os << "    {" << std::endl;
+            os << "      \"name\": " << json_str(a.name) << "," << std::endl;
+            os << "      \"state_idx\": " << a.state_idx << "," << std::endl;
+            os << "      \"capacity\": " << a.capacity << "," << std::endl;
+            os << "      \"capacity_from\": " << json_str(a.capacity_from) << "," << std::endl;
+            os << "      \"offloadable\": " << (a.offloadable ? "true" : "false") << "," << std::endl;
+            os << "      \"elem_bits\": " << a.elem_bits << "," << std::endl;
+            os << "      \"elem\": ";
+            print_fields_json(os, a.elem_fields, "      ");
+            os << "," << std::endl;
+            os << "      \"accesses\": ";
+            print_ops_json(os, a.accesses);
+            os << std::endl << "    }";
+        }
+        if (!arrays.empty()) {
+            os << std::endl << "  ";
+        }
+        os << "]" << std::endl;
+        os << "}" << std::endl;
+    }
+}
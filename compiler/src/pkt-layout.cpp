@@ -1,35 +1,423 @@
 #include "pkt-layout.hpp"
 
+#include <cctype>
+#include <fstream>
+
 HeaderLayout::HeaderLayout() {}
 
-HeaderLayout::HeaderLayout(std::string n, std::vector<Entry> fs)
-    : name(std::move(n)),
-      fields(std::move(fs)) {
+HeaderLayout::HeaderLayout(std::string n, std::vector<Entry> fs, LengthField length)
+    : name_(std::move(n)),
+      fields_(std::move(fs)),
+      length_(std::move(length)) {
+    for (auto &e : fields_) {
+        header_size_ += e.field_n_bytes;
+    }
+    field_at_offset_.resize(header_size_, -1);
+    size_t off = 0;
+    for (size_t i = 0; i < fields_.size(); i++) {
+        size_t bit_off = 0;
+        for (size_t j = 0; j < fields_[i].bit_fields.size(); j++) {
+            auto &bf = fields_[i].bit_fields[j];
+            bf.bit_offset = bit_off;
+            bit_off += bf.n_bits;
+            bit_field_by_name_.emplace(bf.name, std::make_pair(i, j));
+        }
+        if (fields_[i].field_n_bytes > 0) {
+            field_at_offset_[off] = i;
+        }
+        off += fields_[i].field_n_bytes;
+        // first one wins, duplicates are reported by PacketLayout::Validate
+        field_by_name_.emplace(fields_[i].field_name, i);
+    }
 }
 
 // find an Entry with given offset
-std::optional<HeaderLayout::Entry>
-HeaderLayout::FindFieldByOffset(size_t offset) const {
-    auto off = 0;
-    for (auto i = 0; i < fields.size(); i++) {
-        if (off == offset) {
-            return fields[i];
+const HeaderLayout::Entry *HeaderLayout::FindFieldByOffset(size_t offset) const {
+    if (offset >= field_at_offset_.size() || field_at_offset_[offset] < 0) {
+        return nullptr;
+    }
+    return &fields_[field_at_offset_[offset]];
+}
+
+const HeaderLayout::Entry *HeaderLayout::FindFieldByName(const std::string &field_name) const {
+    auto iter = field_by_name_.find(field_name);
+    if (iter == field_by_name_.end()) {
+        return nullptr;
+    }
+    return &fields_[iter->second];
+}
+
+const HeaderLayout::BitField *HeaderLayout::FindBitFieldByName(const std::string &name) const {
+    auto iter = bit_field_by_name_.find(name);
+    if (iter == bit_field_by_name_.end()) {
+        return nullptr;
+    }
+    return &fields_[iter->second.first].bit_fields[iter->second.second];
+}
+
+const HeaderLayout::Entry *HeaderLayout::FindContainerByName(const std::string &name) const {
+    if (auto e = FindFieldByName(name)) {
+        return e;
+    }
+    auto iter = bit_field_by_name_.find(name);
+    if (iter == bit_field_by_name_.end()) {
+        return nullptr;
+    }
+    return &fields_[iter->second.first];
+}
+
+size_t HeaderLayout::FieldNBits(const std::string &name) const {
+    if (auto e = FindFieldByName(name)) {
+        return e->field_n_bytes * 8;
+    } else if (auto bf = FindBitFieldByName(name)) {
+        return bf->n_bits;
+    }
+    return 0;
+}
+
+std::string PacketLayout::Validate() const {
+    for (auto &kv : headers) {
+        auto &hdr = kv.second;
+        if (hdr.Fields().empty()) {
+            return "header " + kv.first + " has no fields";
+        }
+        std::unordered_set<std::string> names;
+        for (auto &e : hdr.Fields()) {
+            if (e.field_n_bytes == 0) {
+                return "field " + kv.first + "." + e.field_name + " is empty";
+            }
+            if (!names.insert(e.field_name).second) {
+                return "duplicate field " + kv.first + "." + e.field_name;
+            }
+            if (e.bit_fields.empty()) {
+                continue;
+            }
+            size_t n_bits = 0;
+            for (auto &bf : e.bit_fields) {
+                if (bf.n_bits == 0) {
+                    return "bit field " + kv.first + "." + bf.name + " is empty";
+                }
+                if (!names.insert(bf.name).second) {
+                    return "duplicate field " + kv.first + "." + bf.name;
+                }
+                n_bits += bf.n_bits;
+            }
+            if (n_bits != e.field_n_bytes * 8) {
+                return "bit fields of " + kv.first + "." + e.field_name
+                    + " do not add up to its width";
+            }
+        }
+        auto &len = hdr.Length();
+        if (hdr.IsVarLength()) {
+            if (hdr.FieldNBits(len.field) == 0) {
+                return "length of " + kv.first + " is in unknown field " + len.field;
+            }
+            if (len.unit == 0) {
+                return "length unit of " + kv.first + " is 0";
+            }
+        }
+    }
+    if (!start_header.empty() && headers.find(start_header) == headers.end()) {
+        return "unknown start header " + start_header;
+    }
+    for (auto &kv : transitions) {
+        auto hdr_iter = headers.find(kv.first);
+        if (hdr_iter == headers.end()) {
+            return "parser for unknown header " + kv.first;
+        }
+        auto &t = kv.second;
+        auto select = hdr_iter->second.FindFieldByName(t.select_field);
+        if (select == nullptr && !t.cases.empty()) {
+            return "parser " + kv.first + " selects on unknown field " + t.select_field;
         }
-        if (off > offset) {
-            break;
+        std::unordered_set<uint64_t> values;
+        for (auto &c : t.cases) {
+            if (select->field_n_bytes > 8) {
+                return "parser " + kv.first + " selects on "
+                    + t.select_field + " which is wider than 64 bits";
+            }
+            if (select->field_n_bytes < 8 && (c.first >> (select->field_n_bytes * 8)) != 0) {
+                return "parser " + kv.first + ": value " + std::to_string(c.first)
+                    + " does not fit in " + t.select_field;
+            }
+            if (!values.insert(c.first).second) {
+                return "parser " + kv.first + ": duplicate case " + std::to_string(c.first);
+            }
+            if (headers.find(c.second) == headers.end()) {
+                return "parser " + kv.first + ": unknown next header " + c.second;
+            }
+        }
+        if (!t.default_next.empty() && headers.find(t.default_next) == headers.end()) {
+            return "parser " + kv.first + ": unknown next header " + t.default_next;
         }
-        off += fields[i].field_n_bytes;
     }
-    return std::nullopt;
+    return "";
 }
 
-// calculate the whole packet size
-size_t HeaderLayout::HeaderSize() const {
-    auto sz = 0;
-    for (auto &e : fields) {
-        sz += e.field_n_bytes;
+namespace {
+    struct Token {
+        std::string str;
+        int line;
+    };
+
+    std::vector<Token> tokenize(std::istream &is) {
+        std::vector<Token> result;
+        std::string line;
+        int line_no = 0;
+        while (std::getline(is, line)) {
+            line_no++;
+            auto comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.resize(comment);
+            }
+            std::string cur;
+            auto flush = [&]() {
+                if (!cur.empty()) {
+                    result.push_back({cur, line_no});
+                    cur.clear();
+                }
+            };
+            for (size_t i = 0; i < line.size(); i++) {
+                char c = line[i];
+                if (isspace(c)) {
+                    flush();
+                } else if (c == '{' || c == '}' || c == '*') {
+                    flush();
+                    result.push_back({std::string(1, c), line_no});
+                } else if (c == '-' && i + 1 < line.size() && line[i + 1] == '>') {
+                    flush();
+                    result.push_back({"->", line_no});
+                    i++;
+                } else {
+                    cur += c;
+                }
+            }
+            flush();
+        }
+        return result;
     }
-    return sz;
+
+    bool parse_uint(const std::string &s, uint64_t &result) {
+        if (s.empty() || !isdigit(s[0])) {
+            return false;
+        }
+        size_t pos = 0;
+        try {
+            result = std::stoull(s, &pos, 0);
+        } catch (const std::exception &e) {
+            return false;
+        }
+        return pos == s.size();
+    }
+
+    bool is_ident(const std::string &s) {
+        if (s.empty() || !(isalpha(s[0]) || s[0] == '_')) {
+            return false;
+        }
+        for (auto c : s) {
+            if (!(isalnum(c) || c == '_')) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+std::optional<PacketLayout> PacketLayout::Parse(std::istream &is, std::string &err) {
+    auto tokens = tokenize(is);
+    size_t pos = 0;
+    int last_line = tokens.empty() ? 0 : tokens.back().line;
+
+    std::unordered_map<std::string, HeaderLayout> headers;
+    std::unordered_map<std::string, ParseTransition> transitions;
+    std::string start;
+
+    auto fail = [&](const std::string &msg) {
+        int line = pos < tokens.size() ? tokens[pos].line : last_line;
+        err = "line " + std::to_string(line) + ": " + msg;
+        return std::nullopt;
+    };
+    auto at_end = [&]() { return pos >= tokens.size(); };
+    auto peek = [&]() -> const std::string& { return tokens[pos].str; };
+
+    while (!at_end()) {
+        auto kw = peek();
+        pos++;
+        if (kw == "start") {
+            if (at_end() || !is_ident(peek())) {
+                return fail("expecting header name after start");
+            }
+            if (!start.empty()) {
+                return fail("start given twice");
+            }
+            start = peek();
+            pos++;
+        } else if (kw == "header") {
+            if (at_end() || !is_ident(peek())) {
+                return fail("expecting header name");
+            }
+            auto name = peek();
+            if (headers.find(name) != headers.end()) {
+                return fail("duplicate header " + name);
+            }
+            pos++;
+            HeaderLayout::LengthField length{};
+            if (!at_end() && peek() == "length") {
+                pos++;
+                if (at_end() || !is_ident(peek())) {
+                    return fail("expecting length field of " + name);
+                }
+                length.field = peek();
+                pos++;
+                if (at_end() || peek() != "*") {
+                    return fail("expecting *");
+                }
+                pos++;
+                uint64_t unit = 0;
+                if (at_end() || !parse_uint(peek(), unit)) {
+                    return fail("expecting length unit of " + name);
+                }
+                length.unit = unit;
+                pos++;
+            }
+            if (at_end() || peek() != "{") {
+                return fail("expecting {");
+            }
+            pos++;
+            std::vector<HeaderLayout::Entry> fields;
+            while (!at_end() && peek() != "}") {
+                if (!is_ident(peek())) {
+                    return fail("expecting field name, got " + peek());
+                }
+                auto field = peek();
+                pos++;
+                uint64_t bits = 0;
+                if (at_end() || !parse_uint(peek(), bits)) {
+                    return fail("expecting bit width of " + name + "." + field);
+                }
+                // sub-byte fields are bit fields of a whole-byte field
+                if (bits == 0 || bits % 8 != 0) {
+                    return fail("width of " + name + "." + field + " is not a whole number of bytes");
+                }
+                pos++;
+                std::vector<HeaderLayout::BitField> bit_fields;
+                if (!at_end() && peek() == "{") {
+                    pos++;
+                    while (!at_end() && peek() != "}") {
+                        if (!is_ident(peek())) {
+                            return fail("expecting bit field name, got " + peek());
+                        }
+                        auto bit_field = peek();
+                        pos++;
+                        uint64_t n_bits = 0;
+                        if (at_end() || !parse_uint(peek(), n_bits)) {
+                            return fail("expecting bit width of " + name + "." + bit_field);
+                        }
+                        pos++;
+                        bit_fields.push_back({bit_field, n_bits});
+                    }
+                    if (at_end()) {
+                        return fail("missing } for field " + name + "." + field);
+                    }
+                    pos++;
+                }
+                fields.push_back({field, bits / 8, std::move(bit_fields)});
+            }
+            if (at_end()) {
+                return fail("missing } for header " + name);
+            }
+            pos++;
+            headers.emplace(name, HeaderLayout(name + "_hdr_t", std::move(fields), std::move(length)));
+        } else if (kw == "parser") {
+            if (at_end() || !is_ident(peek())) {
+                return fail("expecting header name");
+            }
+            auto name = peek();
+            if (transitions.find(name) != transitions.end()) {
+                return fail("duplicate parser " + name);
+            }
+            pos++;
+            if (at_end() || peek() != "{") {
+                return fail("expecting {");
+            }
+            pos++;
+            ParseTransition t;
+            bool has_default = false;
+            while (!at_end() && peek() != "}") {
+                auto tok = peek();
+                pos++;
+                if (tok == "select") {
+                    if (at_end() || !is_ident(peek())) {
+                        return fail("expecting field name after select");
+                    }
+                    t.select_field = peek();
+                    pos++;
+                    continue;
+                }
+                uint64_t value = 0;
+                bool is_default = (tok == "default");
+                if (!is_default && !parse_uint(tok, value)) {
+                    pos--;
+                    return fail("expecting case value, got " + tok);
+                }
+                if (at_end() || peek() != "->") {
+                    return fail("expecting ->");
+                }
+                pos++;
+                if (at_end() || !is_ident(peek())) {
+                    return fail("expecting next header");
+                }
+                auto next = peek();
+                pos++;
+                if (is_default) {
+                    if (has_default) {
+                        return fail("duplicate default in parser " + name);
+                    }
+                    has_default = true;
+                    t.default_next = (next == "accept") ? "" : next;
+                } else {
+                    if (t.select_field.empty()) {
+                        return fail("case before select in parser " + name);
+                    }
+                    if (next == "accept") {
+                        return fail("accept is only allowed as default");
+                    }
+                    t.cases.emplace_back(value, next);
+                }
+            }
+            if (at_end()) {
+                return fail("missing } for parser " + name);
+            }
+            pos++;
+            transitions.emplace(name, std::move(t));
+        } else {
+            pos--;
+            return fail("unexpected " + kw);
+        }
+    }
+
+    PacketLayout result(std::move(headers), std::move(transitions), std::move(start));
+    auto msg = result.Validate();
+    if (!msg.empty()) {
+        err = msg;
+        return std::nullopt;
+    }
+    return result;
+}
+
+PacketLayout PacketLayout::LoadFile(const std::string &path) {
+    std::ifstream ifs(path);
+    if (!ifs) {
+        std::cerr << "could not open layout file " << path << std::endl;
+        exit(-1);
+    }
+    std::string err;
+    auto result = Parse(ifs, err);
+    if (!result.has_value()) {
+        std::cerr << path << ": " << err << std::endl;
+        exit(-1);
+    }
+    return std::move(result.value());
 }
 
 namespace CommonHdr {
@@ -41,18 +429,37 @@ namespace CommonHdr {
         }
     };
 
+    HeaderLayout vlan_layout{
+        "vlan_hdr_t",
+        {{"tci",       2, {{"pcp", 3}, {"dei", 1}, {"vid", 12}}},
+        {"ethertype", 2},
+        }
+    };
+
     HeaderLayout ipv4_layout{
         "ipv4_hdr_t",
-        {{"vihl",     1}, // Version + Header Lenhtj
-        {"tos",      1},  // Type of Service
+        {{"vihl",     1, {{"version", 4}, {"ihl", 4}}}, // Version + Header Lenhtj
+        {"tos",      1, {{"dscp", 6}, {"ecn", 2}}},    // Type of Service
         {"tot_len",  2},  // Total Length
         {"id",       2},  // Identifier
-        {"frag_off", 2},  // Flags + Fragmented Offset
+        {"frag_off", 2, {{"rf", 1}, {"df", 1}, {"mf", 1}, {"frag_offset", 13}}}, // Flags + Fragmented Offset
         {"ttl",      1},  // TTL
         {"protocol", 1},  // Protocol
         {"check",    2},  // Header Checksum
         {"saddr",    4},  // source Addr
         {"daddr",    4},  // destination Addr
+        },
+        {"ihl", 4}
+    };
+
+    HeaderLayout ipv6_layout{
+        "ipv6_hdr_t",
+        {{"vtc_flow",    4, {{"version", 4}, {"traffic_class", 8}, {"flow_label", 20}}},
+        {"payload_len", 2},
+        {"next_hdr",    1},
+        {"hop_limit",   1},
+        {"saddr",       16},
+        {"daddr",       16},
         }
     };
 
@@ -76,11 +483,14 @@ namespace CommonHdr {
         {"dest",    2},
         {"seq",     4},
         {"ack_seq", 4},
-        {"flags",   2},
+        {"flags",   2, {{"doff", 4}, {"res", 3}, {"ns", 1},
+                        {"cwr", 1}, {"ece", 1}, {"urg", 1}, {"ack", 1},
+                        {"psh", 1}, {"rst", 1}, {"syn", 1}, {"fin", 1}}},
         {"window",  2},
         {"check",   2},
         {"urg_ptr", 2},
-        }
+        },
+        {"doff", 4}
     };
 
     HeaderLayout udp_layout{
@@ -92,11 +502,63 @@ namespace CommonHdr {
         }
     };
 
+    HeaderLayout gre_layout{
+        "gre_hdr_t",
+        {{"flags_ver", 2, {{"c", 1}, {"r", 1}, {"k", 1}, {"s", 1}, {"reserved0", 9}, {"ver", 3}}},
+        {"protocol",  2},
+        }
+    };
+
+    HeaderLayout vxlan_layout{
+        "vxlan_hdr_t",
+        {{"flags",     1},
+        {"reserved1", 3},
+        {"vni",       3},
+        {"reserved2", 1},
+        }
+    };
+
+    // keep in sync with layouts/default.layout
+    static ParseTransition l2_transition{
+        "ethertype",
+        {{0x0800, "ipv4"},
+        {0x86dd, "ipv6"},
+        {0x8100, "vlan"},
+        {0x0806, "arp"},
+        },
+        ""
+    };
+
+    static ParseTransition l3_transition(const std::string &proto_field) {
+        return {
+            proto_field,
+            {{6,  "tcp"},
+            {17, "udp"},
+            {47, "gre"},
+            },
+            ""
+        };
+    }
+
     PacketLayout default_layout{
         {{"ether", ether_layout},
+        {"vlan",  vlan_layout},
+        {"arp",   arp_layout},
         {"ipv4",  ipv4_layout},
+        {"ipv6",  ipv6_layout},
         {"tcp",   tcp_layout},
         {"udp",   udp_layout},
-        }
+        {"gre",   gre_layout},
+        {"vxlan", vxlan_layout},
+        },
+        {{"ether", l2_transition},
+        {"vlan",  l2_transition},
+        {"ipv4",  l3_transition("protocol")},
+        {"ipv6",  l3_transition("next_hdr")},
+        {"udp",   {"dest", {{4789, "vxlan"}}, ""}},
+        {"vxlan", {"", {}, "ether"}},
+        {"gre",   {"protocol", {{0x0800, "ipv4"}, {0x86dd, "ipv6"}, {0x6558, "ether"}}, ""}},
+        },
+        "ether"
     };
 }
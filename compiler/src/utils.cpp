@@ -1,6 +1,7 @@
 #include "utils.hpp"
 #include <cassert>
 #include <cxxabi.h>
+#include <cstdio>
 
 std::unique_ptr<NameFactory> NameFactory::instance_ = nullptr;
 
@@ -37,3 +38,32 @@ std::string NameFactory::base(const std::string &name) {
 bool str_begin_with(const std::string &s, const std::string &prefix) {
     return s.find(prefix) == 0;
 }
+
+std::string json_str(const std::string &s) {
+    std::string result = "\"";
+    for (char c : s) {
+        switch (c) {
+        case '"':
+            result += "\\\"";
+            break;
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                result += buf;
+            } else {
+                result += c;
+            }
+        }
+    }
+    return result + "\"";
+}
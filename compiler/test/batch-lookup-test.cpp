@@ -0,0 +1,155 @@
+#include "flow-table.hpp"
+#include "hir-batch.hpp"
+#include "hir-test.hpp"
+
+using namespace HIR;
+
+// entry checks the protocol, key_bb builds the IPFlowID and looks it up
+class BatchLookupTest : public HirTest {
+protected:
+    std::shared_ptr<Var> pkt;
+    std::shared_ptr<Var> map;
+    std::shared_ptr<Var> key;
+    std::shared_ptr<BasicBlock> entry;
+    std::shared_ptr<BasicBlock> key_bb;
+    std::shared_ptr<BasicBlock> out_bb;
+    std::shared_ptr<BasicBlock> drop_bb;
+    Type *i1 = int_type(1);
+    Type *i8 = int_type(8);
+    Type *i16 = int_type(16);
+
+    void SetUp() override {
+        pkt = arg(new_type(Type::T::PACKET));
+
+        map = std::make_shared<Var>();
+        map->type = new_type(Type::T::MAP);
+        map->is_global = true;
+        map->name = "map";
+
+        entry = new_bb();
+        key_bb = new_bb();
+        out_bb = new_bb();
+        drop_bb = new_bb();
+        f->set_entry_idx(0);
+        out_bb->is_return = true;
+        drop_bb->is_return = true;
+
+        auto flow = struct_type({i16, i16}, {0, 2}, 4);
+        key = add_op(entry, Operation::T::ALLOCA, {}, ptr_type(flow))->dst_vars[0];
+        auto proto = pkt_load(entry, pkt, "ipv4", "protocol", i8)->dst_vars[0];
+        branch(entry, cmp(entry, IntCmpType::EQ, proto, constant(i8, 6)), key_bb, drop_bb);
+        branch(key_bb, nullptr, out_bb);
+    }
+
+    std::shared_ptr<Operation> flow_constr(std::shared_ptr<BasicBlock> bb) {
+        return builtin_call(bb, "IPFlowIDConstr", {key, pkt, constant(i1, 0)}, nullptr);
+    }
+
+    std::shared_ptr<Operation> struct_set(std::shared_ptr<BasicBlock> bb, int field, std::shared_ptr<Var> v) {
+        auto op = add_op(bb, Operation::T::STRUCT_SET, {key, v}, nullptr);
+        op->struct_ref_info = {field};
+        return op;
+    }
+
+    std::shared_ptr<Operation> lookup(std::shared_ptr<BasicBlock> bb) {
+        return builtin_call(bb, "HashMapFindp", {map, key}, i16);
+    }
+};
+
+TEST_F(BatchLookupTest, hoists_key_into_entry) {
+    auto ctor = flow_constr(key_bb);
+    auto port = pkt_load(key_bb, pkt, "tcp", "source", i16)->dst_vars[0];
+    auto set = struct_set(key_bb, 1, port);
+    auto l = lookup(key_bb);
+
+    auto plan = batch_map_lookups(*f);
+    ASSERT_EQ(plan.lookups.size(), 1);
+    ASSERT_EQ(plan.lookups[0].lookup, l.get());
+    ASSERT_EQ(plan.lookups[0].table, map);
+    ASSERT_TRUE(plan.lookups[0].hoisted);
+    ASSERT_TRUE(plan.batchable);
+    ASSERT_EQ(plan.key_ops.size(), 3);
+    ASSERT_EQ(plan.key_ops[0], ctor);
+    ASSERT_EQ(plan.key_ops[2], set);
+    // the key is written in order at the end of the entry block
+    ASSERT_EQ(entry->ops.size(), 6);
+    ASSERT_EQ(entry->ops[3], ctor);
+    ASSERT_EQ(entry->ops[4], port->src_op.lock());
+    ASSERT_EQ(entry->ops[5], set);
+    ASSERT_EQ(set->parent, entry.get());
+    ASSERT_EQ(key_bb->ops.size(), 1);
+    ASSERT_EQ(key_bb->ops[0], l);
+}
+
+TEST_F(BatchLookupTest, packet_written_before_lookup) {
+    flow_constr(key_bb);
+    pkt_store(key_bb, pkt, "ipv4", "ttl", constant(i8, 64));
+    lookup(key_bb);
+
+    auto plan = batch_map_lookups(*f);
+    ASSERT_FALSE(plan.lookups[0].hoisted);
+    ASSERT_TRUE(plan.key_ops.empty());
+    ASSERT_EQ(key_bb->ops.size(), 3);
+}
+
+TEST_F(BatchLookupTest, key_written_after_lookup) {
+    // the second lookup sees a key the first one does not
+    flow_constr(key_bb);
+    lookup(key_bb);
+    struct_set(key_bb, 0, constant(i16, 0));
+    lookup(key_bb);
+
+    auto plan = batch_map_lookups(*f);
+    ASSERT_EQ(plan.lookups.size(), 2);
+    ASSERT_FALSE(plan.lookups[0].hoisted);
+    ASSERT_FALSE(plan.lookups[1].hoisted);
+    ASSERT_EQ(entry->ops.size(), 3);
+}
+
+TEST_F(BatchLookupTest, state_written_in_entry) {
+    auto counter = std::make_shared<Var>();
+    counter->type = i16;
+    counter->is_global = true;
+    auto set = add_op(entry, Operation::T::STRUCT_SET, {counter, constant(i16, 1)}, nullptr);
+    set->struct_ref_info = {0};
+    flow_constr(key_bb);
+    lookup(key_bb);
+
+    auto plan = batch_map_lookups(*f);
+    ASSERT_TRUE(plan.lookups[0].hoisted);
+    ASSERT_FALSE(plan.batchable);
+}
+
+TEST_F(BatchLookupTest, state_read_in_entry) {
+    // an earlier packet of the burst may have written it
+    auto counter = std::make_shared<Var>();
+    counter->type = ptr_type(i16);
+    counter->is_global = true;
+    load(entry, counter);
+    flow_constr(key_bb);
+    lookup(key_bb);
+
+    auto plan = batch_map_lookups(*f);
+    ASSERT_TRUE(plan.lookups[0].hoisted);
+    ASSERT_FALSE(plan.batchable);
+}
+
+TEST(LookupBurstTest, inserts_seen_by_later_packets) {
+    SwissFlowTable<uint32_t, uint32_t> t(64);
+    std::vector<uint32_t> pkts;
+    for (uint32_t i = 0; i < 100; i++) {
+        pkts.emplace_back(i % 10);
+    }
+    size_t hits = 0;
+    lookup_burst(t, pkts.data(), pkts.size(),
+                 [](uint32_t p, uint32_t &key) { key = p; },
+                 [&](uint32_t p, const uint32_t &key, uint32_t *v) {
+                     if (v == nullptr) {
+                         t.insert(key, p);
+                     } else {
+                         hits++;
+                     }
+                 });
+    ASSERT_EQ(hits, 90);
+    ASSERT_EQ(t.size(), 10);
+}
@@ -137,4 +137,137 @@ TEST_F(GraphTest, topo_sort_test) {
         ASSERT_EQ(topo_order[i], correct_topo_order[i]);
     }
     graph_ = nullptr;
-}
\ No newline at end of file
+}
+TEST_F(GraphTest, condensed_graph_test) {
+    AdjacencyMatrix<int> edges(5);
+    edges.set_edge(0, 2, 0);
+    edges.set_edge(2, 1, 0);
+    edges.set_edge(1, 0, 0);
+    edges.set_edge(0, 3, 0);
+    edges.set_edge(3, 4, 0);
+    edges.set_edge(4, 4, 0);
+
+    std::vector<int> vertices(5, 0);
+
+    graph_ = std::make_unique<Graph<int, int>>(std::move(vertices), std::move(edges));
+
+    auto scc_list = graph_->StronglyConnectedComponents();
+    auto scc_graph = graph_->CondensedGraph(scc_list);
+    ASSERT_EQ(scc_graph.n_vertex(), scc_list.size());
+
+    int n_edges = 0;
+    for (size_t i = 0; i < scc_graph.n_vertex(); i++) {
+        for (auto iter = scc_graph.edges().out_edge_begin(i); iter != iter.end(); iter++) {
+            ASSERT_NE(*iter, i);
+            n_edges++;
+        }
+    }
+    ASSERT_EQ(n_edges, 2);
+
+    // callees before callers: scc {3} must come after {4} and before {0, 1, 2}
+    auto topo_order = scc_graph.TopologicalSort();
+    ASSERT_EQ(topo_order.size(), scc_list.size());
+    std::vector<size_t> pos(scc_list.size());
+    for (size_t i = 0; i < topo_order.size(); i++) {
+        pos[topo_order[i]] = i;
+    }
+    std::vector<size_t> scc_of(5);
+    for (size_t i = 0; i < scc_list.size(); i++) {
+        for (auto v : scc_list[i]) {
+            scc_of[v] = i;
+        }
+    }
+    ASSERT_LT(pos[scc_of[4]], pos[scc_of[3]]);
+    ASSERT_LT(pos[scc_of[3]], pos[scc_of[0]]);
+    graph_ = nullptr;
+}
+
+TEST_F(GraphTest, reachable_test) {
+    AdjacencyMatrix<int> edges(6);
+    edges.set_edge(0, 2, 0);
+    edges.set_edge(2, 1, 0);
+    edges.set_edge(1, 0, 0);
+    edges.set_edge(3, 4, 0);
+    edges.set_edge(4, 5, 0);
+
+    std::vector<int> vertices(6, 0);
+
+    graph_ = std::make_unique<Graph<int, int>>(std::move(vertices), std::move(edges));
+
+    auto from_0 = graph_->ReachableFrom(0);
+    std::vector<bool> expect_0 = {true, true, true, false, false, false};
+    ASSERT_EQ(from_0, expect_0);
+
+    auto from_4 = graph_->ReachableFrom(4);
+    std::vector<bool> expect_4 = {false, false, false, false, true, true};
+    ASSERT_EQ(from_4, expect_4);
+    graph_ = nullptr;
+}
+
+TEST_F(GraphTest, acyclic_test) {
+    AdjacencyMatrix<int> edges(4);
+    edges.set_edge(0, 1, 0);
+    edges.set_edge(1, 2, 0);
+    edges.set_edge(0, 2, 0);
+    edges.set_edge(2, 3, 0);
+
+    std::vector<int> vertices(4, 0);
+    graph_ = std::make_unique<Graph<int, int>>(vertices, edges);
+    ASSERT_TRUE(graph_->IsAcyclic());
+
+    edges.set_edge(3, 1, 0);
+    graph_ = std::make_unique<Graph<int, int>>(vertices, edges);
+    ASSERT_FALSE(graph_->IsAcyclic());
+
+    AdjacencyMatrix<int> self_loop(2);
+    self_loop.set_edge(0, 1, 0);
+    self_loop.set_edge(1, 1, 0);
+    graph_ = std::make_unique<Graph<int, int>>(std::vector<int>(2, 0), std::move(self_loop));
+    ASSERT_FALSE(graph_->IsAcyclic());
+    graph_ = nullptr;
+}
+
+// a long chain would overflow the stack with recursive dfs
+TEST(GraphScaleTest, long_chain) {
+    size_t n = 1000000;
+    AdjacencyList<std::monostate> edges(n);
+    for (size_t i = 0; i + 1 < n; i++) {
+        edges.set_edge(i, i + 1, std::monostate());
+    }
+    Graph<
+        std::monostate,
+        std::monostate,
+        AdjacencyList<std::monostate>
+    > graph(std::vector<std::monostate>(n), std::move(edges));
+
+    ASSERT_TRUE(graph.IsAcyclic());
+    auto topo_order = graph.TopologicalSort();
+    ASSERT_EQ(topo_order.size(), n);
+    ASSERT_EQ(topo_order.front(), n - 1);
+    ASSERT_EQ(topo_order.back(), 0);
+
+    auto scc_list = graph.StronglyConnectedComponents();
+    ASSERT_EQ(scc_list.size(), n);
+    ASSERT_EQ(graph.ReachableFrom(0)[n - 1], true);
+}
+
+TEST_F(GraphTest, dominator_test) {
+    // 0 -> 1 -> 2 -> 4, 1 -> 3 -> 4, 4 -> 1 (loop back), 5 unreachable
+    AdjacencyMatrix<int> edges(6);
+    edges.set_edge(0, 1, 0);
+    edges.set_edge(1, 2, 0);
+    edges.set_edge(1, 3, 0);
+    edges.set_edge(2, 4, 0);
+    edges.set_edge(3, 4, 0);
+    edges.set_edge(4, 1, 0);
+    edges.set_edge(5, 4, 0);
+
+    std::vector<int> vertices(6, 0);
+
+    graph_ = std::make_unique<Graph<int, int>>(std::move(vertices), std::move(edges));
+
+    auto idom = graph_->ImmediateDominators(0);
+    std::vector<size_t> expect = {0, 0, 1, 1, 1, 6};
+    ASSERT_EQ(idom, expect);
+    graph_ = nullptr;
+}
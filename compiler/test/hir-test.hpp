@@ -0,0 +1,258 @@
+#pragma once
+
+#include "highLv-ir.hpp"
+#include "gtest/gtest.h"
+
+#include <cassert>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* base fixture for tests building HIR by hand, the way the front end would
+ * have translated it. the fixture owns every Type it creates, f is the
+ * function under test, with_element() makes it the entry of ele
+ */
+class HirTest : public ::testing::Test {
+protected:
+    using Function = HIR::Function;
+    using BasicBlock = HIR::BasicBlock;
+    using Operation = HIR::Operation;
+    using Type = HIR::Type;
+    using Var = HIR::Var;
+
+    HIR::Module module;
+    HIR::Element ele;
+    std::shared_ptr<Function> f = std::make_shared<Function>();
+    std::vector<std::unique_ptr<Type>> types;
+    std::vector<std::shared_ptr<Function>> builtins;
+
+    void with_element(Type *element_type) {
+        ele.element_type = element_type;
+        ele.set_module(&module);
+        ele.funcs.emplace_back(f);
+        ele.set_entry_func_idx(0);
+    }
+
+    Type *new_type(Type::T t) {
+        types.emplace_back(new Type());
+        types.back()->type = t;
+        return types.back().get();
+    }
+
+    Type *int_type(int bitwidth) {
+        auto t = new_type(Type::T::INT);
+        t->bitwidth = bitwidth;
+        return t;
+    }
+
+    Type *ptr_type(Type *pointee) {
+        auto t = new_type(Type::T::POINTER);
+        t->pointee_type = pointee;
+        return t;
+    }
+
+    Type *struct_type(std::vector<Type *> fields, std::vector<size_t> offsets, size_t size) {
+        auto t = new_type(Type::T::STRUCT);
+        t->struct_info.fields = std::move(fields);
+        t->struct_info.offsets = std::move(offsets);
+        t->set_size(size);
+        return t;
+    }
+
+    Type *array_type(Type *element_type, uint64_t n) {
+        auto t = new_type(Type::T::ARRAY);
+        t->array_info.element_type = element_type;
+        t->array_info.num_element = n;
+        t->set_size(n * element_type->num_bytes());
+        return t;
+    }
+
+    // a state of ele at byte offset off, named the way the front end does
+    std::shared_ptr<Var> state(Type *t, size_t off, size_t idx) {
+        auto v = std::make_shared<Var>();
+        v->type = t;
+        v->is_global = true;
+        v->global_state_idx = idx;
+        v->name = HIR::global_state_type_str(t) + "_" + std::to_string(idx);
+        ele.states[off] = v;
+        return v;
+    }
+
+    std::shared_ptr<Var> param(Type *t, const std::string &name = "") {
+        auto v = std::make_shared<Var>();
+        v->type = t;
+        v->is_param = true;
+        v->name = name;
+        return v;
+    }
+
+    // a param appended to f's arguments
+    std::shared_ptr<Var> arg(Type *t, const std::string &name = "") {
+        auto v = param(t, name);
+        f->args.emplace_back(v);
+        return v;
+    }
+
+    std::shared_ptr<Var> constant(Type *t, uint64_t c) {
+        auto v = std::make_shared<Var>();
+        v->type = t;
+        v->is_constant = true;
+        v->constant = c;
+        return v;
+    }
+
+    std::shared_ptr<BasicBlock> new_bb(const std::string &name = "") {
+        auto bb = std::make_shared<BasicBlock>();
+        bb->parent = f.get();
+        bb->name = name;
+        f->bbs.emplace_back(bb);
+        return bb;
+    }
+
+    std::shared_ptr<Operation> add_op(const std::shared_ptr<BasicBlock> &bb,
+                                      Operation::T type,
+                                      std::vector<std::shared_ptr<Var>> args,
+                                      Type *dst_type) {
+        auto op = std::make_shared<Operation>();
+        op->type = type;
+        op->parent = bb.get();
+        op->args = std::move(args);
+        bb->ops.emplace_back(op);
+        if (dst_type != nullptr) {
+            auto dst = std::make_shared<Var>();
+            dst->type = dst_type;
+            dst->name = "v_0";
+            dst->src_op = op;
+            op->dst_vars.emplace_back(dst);
+        }
+        return op;
+    }
+
+    std::shared_ptr<Var> arith(const std::shared_ptr<BasicBlock> &bb,
+                               HIR::IntArithType t,
+                               std::vector<std::shared_ptr<Var>> args,
+                               Type *dst_type) {
+        auto op = add_op(bb, Operation::T::ARITH, std::move(args), dst_type);
+        op->arith_info.t = HIR::ArithType::INT_ARITH;
+        op->arith_info.u.iarith_t = t;
+        return op->dst_vars[0];
+    }
+
+    std::shared_ptr<Var> cmp(const std::shared_ptr<BasicBlock> &bb,
+                             HIR::IntCmpType t,
+                             std::shared_ptr<Var> a,
+                             std::shared_ptr<Var> b) {
+        auto op = add_op(bb, Operation::T::ARITH, {a, b}, int_type(1));
+        op->arith_info.t = HIR::ArithType::INT_CMP;
+        op->arith_info.u.icmp_t = t;
+        return op->dst_vars[0];
+    }
+
+    std::shared_ptr<Var> load(const std::shared_ptr<BasicBlock> &bb, std::shared_ptr<Var> ptr) {
+        auto t = ptr->type->pointee_type;
+        return add_op(bb, Operation::T::LOAD, {ptr}, t)->dst_vars[0];
+    }
+
+    std::shared_ptr<Operation> store(const std::shared_ptr<BasicBlock> &bb,
+                                     std::shared_ptr<Var> ptr,
+                                     std::shared_ptr<Var> v) {
+        return add_op(bb, Operation::T::STORE, {ptr, v}, nullptr);
+    }
+
+    // a call by name only, as to an external function
+    std::shared_ptr<Operation> call(const std::shared_ptr<BasicBlock> &bb,
+                                    const std::string &fn,
+                                    std::vector<std::shared_ptr<Var>> args,
+                                    Type *dst_type) {
+        auto op = add_op(bb, Operation::T::FUNC_CALL, std::move(args), dst_type);
+        op->call_info.func_name = fn;
+        return op;
+    }
+
+    // a call to the builtin registered under name, e.g. "HashMapFindp"
+    std::shared_ptr<Operation> builtin_call(const std::shared_ptr<BasicBlock> &bb,
+                                            const std::string &name,
+                                            std::vector<std::shared_ptr<Var>> args,
+                                            Type *dst_type) {
+        auto fn = std::make_shared<Function>();
+        fn->name = name;
+        fn->is_built_in = true;
+        builtins.emplace_back(fn);
+        auto op = call(bb, name, std::move(args), dst_type);
+        op->call_info.called_function = fn;
+        return op;
+    }
+
+    std::shared_ptr<Operation> pkt_load(const std::shared_ptr<BasicBlock> &bb,
+                                        std::shared_ptr<Var> pkt,
+                                        const std::string &header,
+                                        const std::string &field,
+                                        Type *t) {
+        auto op = add_op(bb, Operation::T::PKT_HDR_LOAD, {pkt}, t);
+        op->pkt_op_info.header = header;
+        op->pkt_op_info.field = field;
+        return op;
+    }
+
+    std::shared_ptr<Operation> pkt_store(const std::shared_ptr<BasicBlock> &bb,
+                                         std::shared_ptr<Var> pkt,
+                                         const std::string &header,
+                                         const std::string &field,
+                                         std::shared_ptr<Var> v) {
+        auto op = add_op(bb, Operation::T::PKT_HDR_STORE, {pkt, v}, nullptr);
+        op->pkt_op_info.header = header;
+        op->pkt_op_info.field = field;
+        return op;
+    }
+
+    // a conditional branch to t, else e, or a jump to t without cond
+    void branch(const std::shared_ptr<BasicBlock> &from,
+                std::shared_ptr<Var> cond,
+                const std::shared_ptr<BasicBlock> &t,
+                const std::shared_ptr<BasicBlock> &e = nullptr) {
+        if (cond == nullptr) {
+            from->default_next_bb = t;
+            return;
+        }
+        BasicBlock::BranchEntry br;
+        br.is_conditional = true;
+        br.cond_var = cond;
+        br.next_bb = t;
+        from->branches.emplace_back(br);
+        from->default_next_bb = e;
+    }
+
+    std::shared_ptr<Operation> phi(const std::shared_ptr<BasicBlock> &bb,
+                                   std::vector<std::shared_ptr<Var>> args,
+                                   std::vector<std::shared_ptr<BasicBlock>> from) {
+        assert(!args.empty() && args.size() == from.size());
+        auto t = args[0]->type;
+        auto op = add_op(bb, Operation::T::PHINODE, std::move(args), t);
+        for (auto &b : from) {
+            op->phi_info.from.emplace_back(b);
+        }
+        return op;
+    }
+
+    std::vector<std::shared_ptr<Operation>> ops_of(Operation::T t) const {
+        std::vector<std::shared_ptr<Operation>> result;
+        for (auto &bb : f->bbs) {
+            for (auto &op : bb->ops) {
+                if (op->type == t) {
+                    result.emplace_back(op);
+                }
+            }
+        }
+        return result;
+    }
+
+    static std::vector<std::shared_ptr<Operation>> ops_of(const std::shared_ptr<BasicBlock> &bb, Operation::T t) {
+        std::vector<std::shared_ptr<Operation>> result;
+        for (auto &op : bb->ops) {
+            if (op->type == t) {
+                result.emplace_back(op);
+            }
+        }
+        return result;
+    }
+};
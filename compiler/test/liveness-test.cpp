@@ -0,0 +1,128 @@
+#include "hir-liveness.hpp"
+#include "hir-test.hpp"
+
+using namespace HIR;
+
+// push(int port, Packet *p) after replace_packet_access_op
+class LivenessTest : public HirTest {
+protected:
+    Type *i8 = int_type(8);
+    Type *i32 = int_type(32);
+    std::shared_ptr<Var> pkt;
+    std::shared_ptr<BasicBlock> entry;
+
+    void SetUp() override {
+        arg(ptr_type(i8), "_arg_0");
+        arg(i32, "_arg_1");
+        pkt = arg(ptr_type(new_type(Type::T::PACKET)), "_arg_2");
+        entry = new_bb("entry");
+        f->set_entry_idx(0);
+    }
+
+    std::shared_ptr<Var> add(const std::shared_ptr<BasicBlock> &bb, std::shared_ptr<Var> a, uint64_t c) {
+        return arith(bb, IntArithType::INT_ADD, {a, constant(a->type, c)}, a->type);
+    }
+
+    LivenessInfo run() {
+        return analyze_liveness(*f, CommonHdr::default_layout);
+    }
+
+    static std::unordered_set<Var *> vars(std::vector<std::shared_ptr<Var>> vs) {
+        std::unordered_set<Var *> result;
+        for (auto &v : vs) {
+            result.insert(v.get());
+        }
+        return result;
+    }
+};
+
+TEST_F(LivenessTest, phi_inputs_live_on_their_edge) {
+    // ttl = p->ttl; p->ttl = ttl == 0 ? ttl + 1 : ttl + 2
+    auto left = new_bb("left");
+    auto right = new_bb("right");
+    auto join = new_bb("join");
+    auto ttl = pkt_load(entry, pkt, "ipv4", "ttl", i8)->dst_vars[0];
+    branch(entry, cmp(entry, IntCmpType::EQ, ttl, constant(i8, 0)), left, right);
+    auto a = add(left, ttl, 1);
+    branch(left, nullptr, join);
+    auto b = add(right, ttl, 2);
+    branch(right, nullptr, join);
+    auto x = phi(join, {a, b}, {left, right})->dst_vars[0];
+    pkt_store(join, pkt, "ipv4", "ttl", x);
+    join->is_return = true;
+    auto info = run();
+
+    ASSERT_EQ(info.live_in[entry.get()].fields, std::set<std::string>{"ipv4.ttl"});
+    // the packet is carried for free
+    ASSERT_EQ(info.live_in[entry.get()].vars, vars({pkt}));
+    ASSERT_EQ(info.live_out[entry.get()].vars, vars({ttl, pkt}));
+    ASSERT_TRUE(info.live_out[entry.get()].fields.empty());
+    // the store at the end covers the field written
+    ASSERT_TRUE(info.live_in[join.get()].fields.empty());
+    ASSERT_EQ(info.live_in[join.get()].vars, vars({pkt}));
+    ASSERT_EQ(info.live_on_edge(*left, *join).vars, vars({a, pkt}));
+    ASSERT_EQ(info.live_on_edge(*right, *join).vars, vars({b, pkt}));
+
+    auto report = packing_report(*f, info);
+    ASSERT_EQ(report.num_stages, 3);
+    ASSERT_EQ(report.stage_of[left.get()], 1);
+    ASSERT_EQ(report.boundaries.size(), 2);
+    ASSERT_EQ(report.boundaries[0].var_bits, 8);
+    // both sides' values cross the second boundary
+    ASSERT_EQ(report.boundaries[1].live.vars, vars({a, b, pkt}));
+    ASSERT_EQ(report.boundaries[1].total_bits(), 16);
+    ASSERT_EQ(report.max_boundary, 1);
+}
+
+TEST_F(LivenessTest, loop_carries_values) {
+    // for (i = 0; i < n; i++); p->ttl = i, n from the packet
+    auto header = new_bb("header");
+    auto body = new_bb("body");
+    auto exit = new_bb("exit");
+    auto n = pkt_load(entry, pkt, "ipv4", "ttl", i8)->dst_vars[0];
+    branch(entry, nullptr, header);
+    auto i = phi(header, {constant(i8, 0), constant(i8, 0)}, {entry, body});
+    auto i_v = i->dst_vars[0];
+    branch(header, cmp(header, IntCmpType::ULT, i_v, n), body, exit);
+    auto next = add(body, i_v, 1);
+    i->args[1] = next;
+    branch(body, nullptr, header);
+    pkt_store(exit, pkt, "ipv4", "ttl", i_v);
+    exit->is_return = true;
+    auto info = run();
+
+    // the bound is needed around the loop, the counter goes back along
+    // the latch and out to exit
+    ASSERT_EQ(info.live_in[header.get()].vars, vars({n, pkt}));
+    ASSERT_EQ(info.live_in[body.get()].vars, vars({i_v, n, pkt}));
+    ASSERT_EQ(info.live_out[body.get()].vars, vars({next, n, pkt}));
+    ASSERT_EQ(info.live_on_edge(*body, *header).vars, vars({next, n, pkt}));
+    ASSERT_EQ(info.live_on_edge(*entry, *header).vars, vars({n, pkt}));
+    ASSERT_EQ(info.live_in[exit.get()].vars, vars({i_v, pkt}));
+
+    // the loop is a single stage
+    auto report = packing_report(*f, info);
+    ASSERT_EQ(report.num_stages, 3);
+    ASSERT_EQ(report.stage_of[header.get()], report.stage_of[body.get()]);
+    ASSERT_EQ(report.boundaries[0].live.vars, vars({n, pkt}));
+    ASSERT_EQ(report.boundaries[0].total_bits(), 8);
+    ASSERT_EQ(report.boundaries[1].live.vars, vars({i_v, pkt}));
+}
+
+TEST_F(LivenessTest, bit_fields_share_their_field) {
+    // ihl read before and after vihl is written, version never stored
+    auto ihl = pkt_load(entry, pkt, "ipv4", "ihl", i8)->dst_vars[0];
+    pkt_load(entry, pkt, "ipv4", "vihl", i8);
+    pkt_store(entry, pkt, "ipv4", "vihl", constant(i8, 0x45));
+    pkt_store(entry, pkt, "ipv4", "ttl", ihl);
+    entry->is_return = true;
+    auto info = run();
+
+    ASSERT_EQ(info.field_container.at("ipv4.ihl"), "ipv4.vihl");
+    // read at entry, both live from the start, counted once
+    LiveSet both;
+    both.fields = {"ipv4.ihl", "ipv4.vihl"};
+    ASSERT_EQ(info.live_in[entry.get()].fields, both.fields);
+    ASSERT_EQ(info.field_n_bits(both), 8);
+    ASSERT_EQ(info.max_bits[entry.get()], 8 + 8);
+}
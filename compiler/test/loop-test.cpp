@@ -0,0 +1,117 @@
+#include "hir-loop.hpp"
+#include "hir-test.hpp"
+
+using namespace HIR;
+
+/* for (i = 0; i < bound; i++) { _arg_1 += i; }
+ * entry -> header -> body -> header ... -> exit
+ */
+class LoopTest : public HirTest {
+protected:
+    Type *i32 = int_type(32);
+    std::shared_ptr<BasicBlock> entry;
+    std::shared_ptr<BasicBlock> header;
+    std::shared_ptr<BasicBlock> body;
+    std::shared_ptr<BasicBlock> exit;
+
+    std::shared_ptr<Var> constant(uint64_t c) {
+        return HirTest::constant(i32, c);
+    }
+
+    // v from constants and the arithmetic on them
+    static uint64_t value_of(const std::shared_ptr<Var> &v) {
+        if (v->is_constant) {
+            return v->constant;
+        }
+        auto op = v->src_op.lock();
+        assert(op != nullptr && op->type == Operation::T::ARITH);
+        std::vector<uint64_t> args;
+        for (auto &a : op->args) {
+            args.emplace_back(value_of(a));
+        }
+        return fold_int_arith(*op, args).value();
+    }
+
+    void build(std::shared_ptr<Var> bound) {
+        auto acc = arg(ptr_type(i32), "_arg_1");
+        entry = new_bb("entry");
+        header = new_bb("header");
+        body = new_bb("body");
+        exit = new_bb("exit");
+        f->set_entry_idx(0);
+
+        branch(entry, nullptr, header);
+        auto i = phi(header, {constant(0), constant(0)}, {entry, body});
+        auto i_v = i->dst_vars[0];
+        branch(header, cmp(header, IntCmpType::SLT, i_v, bound), body, exit);
+        store(body, acc, arith(body, IntArithType::INT_ADD, {load(body, acc), i_v}, i32));
+        i->args[1] = arith(body, IntArithType::INT_ADD, {i_v, constant(1)}, i32);
+        branch(body, nullptr, header);
+        exit->is_return = true;
+    }
+};
+
+TEST_F(LoopTest, counted_loop) {
+    build(constant(4));
+    auto info = analyze_loops(*f);
+    ASSERT_EQ(info.loops.size(), 1);
+    auto &loop = info.loops[0];
+    ASSERT_EQ(loop.header, header);
+    ASSERT_EQ(loop.preheader, entry);
+    ASSERT_EQ(loop.latches, std::vector<std::shared_ptr<BasicBlock>>{body});
+    ASSERT_EQ(loop.blocks.size(), 2);
+    ASSERT_EQ(loop.exiting, std::vector<std::shared_ptr<BasicBlock>>{header});
+    ASSERT_EQ(loop.depth, 1);
+    ASSERT_EQ(loop.induction_vars.size(), 1);
+    ASSERT_EQ(loop.induction_vars[0].init, 0);
+    ASSERT_EQ(loop.induction_vars[0].step, 1);
+    // the header runs once more to leave
+    ASSERT_EQ(loop.trip_count, 5);
+    ASSERT_EQ(info.loop_of.at(body), 0);
+    ASSERT_EQ(info.loop_of.count(exit), 0);
+}
+
+TEST_F(LoopTest, counted_loop_unrolled) {
+    build(constant(4));
+    ASSERT_EQ(unroll_small_loops(*f), 1);
+    ASSERT_TRUE(analyze_loops(*f).loops.empty());
+    // a straight line from entry to exit, adding i = 0, 1, 2 and 3
+    std::vector<uint64_t> added;
+    auto bb = f->bbs[f->entry_bb_idx()];
+    size_t n_blocks = 0;
+    while (bb != exit) {
+        ASSERT_TRUE(bb->branches.empty());
+        for (auto &op : ops_of(bb, Operation::T::STORE)) {
+            added.emplace_back(value_of(op->args[1]->src_op.lock()->args[1]));
+        }
+        bb = bb->default_next_bb.lock();
+        n_blocks++;
+    }
+    ASSERT_EQ(n_blocks, 1 + 5 + 4);
+    ASSERT_EQ(added, (std::vector<uint64_t>{0, 1, 2, 3}));
+}
+
+TEST_F(LoopTest, unknown_trip_count_kept) {
+    // for (i = 0; i < n; i++), n only known at run time
+    build(arg(i32, "_arg_2"));
+    auto info = analyze_loops(*f);
+    ASSERT_EQ(info.loops.size(), 1);
+    ASSERT_EQ(info.loops[0].induction_vars.size(), 1);
+    ASSERT_FALSE(info.loops[0].trip_count.has_value());
+    ASSERT_EQ(unroll_small_loops(*f), 0);
+    ASSERT_EQ(f->bbs.size(), 4);
+    ASSERT_EQ(analyze_loops(*f).loops.size(), 1);
+}
+
+TEST_F(LoopTest, long_loop_kept) {
+    build(constant(100));
+    ASSERT_EQ(analyze_loops(*f).loops[0].trip_count, 101);
+    ASSERT_FALSE(analyze_loops(*f, 16).loops[0].trip_count.has_value());
+    ASSERT_EQ(unroll_small_loops(*f), 0);
+    // within the trip count, over the size budget
+    UnrollOptions opts;
+    opts.max_trip_count = 128;
+    opts.max_unrolled_size = 100;
+    ASSERT_EQ(unroll_small_loops(*f, opts), 0);
+    ASSERT_EQ(f->bbs.size(), 4);
+}
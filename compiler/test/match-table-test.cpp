@@ -0,0 +1,153 @@
+#include "flow-table.hpp"
+#include "hir-table.hpp"
+#include "hir-test.hpp"
+
+#include <cstring>
+#include <random>
+#include <unordered_map>
+
+using namespace HIR;
+
+// everything collides, probe runs wrap around the slot array
+struct BadHash {
+    size_t operator()(uint32_t k) const { return (k % 3) + 6; }
+};
+
+TEST(FlowTableTest, insert_find_erase) {
+    FlowTable<uint32_t, int, BadHash> t(5);
+    ASSERT_EQ(t.num_slots(), 8);
+    for (uint32_t k = 0; k < 5; k++) {
+        ASSERT_EQ(t.insert(k, k * 10), decltype(t)::InsertResult::INSERTED);
+    }
+    ASSERT_EQ(t.insert(2, 21), decltype(t)::InsertResult::UPDATED);
+    ASSERT_EQ(t.insert(7, 70), decltype(t)::InsertResult::FULL);
+    ASSERT_EQ(*t.findp(2), 21);
+    ASSERT_EQ(t.findp(7), nullptr);
+
+    ASSERT_TRUE(t.erase(0));
+    ASSERT_FALSE(t.erase(0));
+    for (uint32_t k = 1; k < 5; k++) {
+        ASSERT_NE(t.findp(k), nullptr) << k;
+    }
+    ASSERT_EQ(t.insert(7, 70), decltype(t)::InsertResult::INSERTED);
+    ASSERT_EQ(t.size(), 5);
+}
+
+// random inserts, erases and lookups checked against std::unordered_map,
+// sized so the table fills up and erases leave deleted slots behind
+template <typename Table>
+static void check_against_unordered_map() {
+    Table t(1000);
+    std::unordered_map<uint32_t, uint32_t> ref;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 100000; i++) {
+        uint32_t k = rng() % 2000;
+        switch (rng() % 3) {
+        case 0: {
+            auto r = t.insert(k, i);
+            if (ref.size() < 1000 || ref.count(k)) {
+                ASSERT_NE(r, TableInsertResult::FULL);
+                ref[k] = i;
+            } else {
+                ASSERT_EQ(r, TableInsertResult::FULL);
+            }
+            break;
+        }
+        case 1:
+            ASSERT_EQ(t.erase(k), ref.erase(k) == 1);
+            break;
+        default: {
+            auto p = t.findp(k);
+            auto iter = ref.find(k);
+            ASSERT_EQ(p != nullptr, iter != ref.end());
+            if (p != nullptr) {
+                ASSERT_EQ(*p, iter->second);
+            }
+        }
+        }
+        ASSERT_EQ(t.size(), ref.size());
+    }
+}
+
+TEST(FlowTableTest, same_as_unordered_map) {
+    check_against_unordered_map<FlowTable<uint32_t, uint32_t>>();
+}
+
+TEST(SwissFlowTableTest, same_as_unordered_map) {
+    check_against_unordered_map<SwissFlowTable<uint32_t, uint32_t>>();
+}
+
+TEST(SwissFlowTableTest, packed_keys_in_batches) {
+    using Key = PackedKey<12>;
+    SwissFlowTable<Key, uint32_t, PackedKeyHash<12>> t(100);
+    ASSERT_EQ(t.num_slots(), 128);
+    std::vector<Key> keys(200);
+    for (uint32_t i = 0; i < keys.size(); i++) {
+        std::memset(keys[i].bytes, 0, 12);
+        // only the last bytes differ
+        std::memcpy(keys[i].bytes + 8, &i, 4);
+    }
+    for (uint32_t i = 0; i < 100; i++) {
+        ASSERT_EQ(t.insert(keys[i], i), TableInsertResult::INSERTED);
+    }
+    ASSERT_EQ(t.insert(keys[100], 100), TableInsertResult::FULL);
+    std::vector<uint32_t *> found(keys.size());
+    t.find_batch(keys.data(), keys.size(), found.data());
+    for (uint32_t i = 0; i < keys.size(); i++) {
+        if (i < 100) {
+            ASSERT_NE(found[i], nullptr) << i;
+            ASSERT_EQ(*found[i], i);
+        } else {
+            ASSERT_EQ(found[i], nullptr) << i;
+        }
+    }
+}
+
+using MatchTableTest = HirTest;
+
+TEST_F(MatchTableTest, flow_table_of_map_state) {
+    // HashMap<IPFlowID, Entry*>
+    auto i32 = int_type(32);
+    auto i16 = int_type(16);
+    auto addr = struct_type({i32}, {0}, 4);
+    auto flow = struct_type({addr, addr, i16, i16}, {0, 4, 8, 10}, 12);
+    auto map_t = new_type(Type::T::MAP);
+    map_t->map_info.key_t = flow;
+    map_t->map_info.val_t = i32;
+    auto ptr_map_t = new_type(Type::T::MAP);
+    ptr_map_t->map_info.key_t = flow;
+    ptr_map_t->map_info.val_t = ptr_type(i32);
+
+    with_element(nullptr);
+    auto map = state(map_t, 8, 8);
+    map->name = "map";
+    auto ptr_map = state(ptr_map_t, 72, 72);
+    ptr_map->name = "ptr_map";
+    state(i32, 4, 4)->name = "counter";
+
+    auto bb = new_bb();
+    f->set_entry_idx(0);
+    builtin_call(bb, "HashMapFindp", {map}, nullptr);
+    builtin_call(bb, "HashMapInsert", {map}, nullptr);
+    builtin_call(bb, "HashMapFindp", {ptr_map}, nullptr);
+
+    MatchTableOptions opts;
+    opts.capacity = 1024;
+    auto tables = match_tables(ele, opts);
+    ASSERT_EQ(tables.size(), 2);
+    auto &t = tables[0];
+    ASSERT_EQ(t.name, "map");
+    ASSERT_EQ(t.capacity, 1024);
+    ASSERT_TRUE(t.offloadable);
+    ASSERT_EQ(t.key_bits, 96);
+    ASSERT_EQ(t.key_fields.size(), 4);
+    ASSERT_EQ(t.key_fields[1].name, "1.0");
+    ASSERT_EQ(t.key_fields[1].bit_offset, 32);
+    ASSERT_EQ(t.key_fields[3].bit_offset, 80);
+    ASSERT_EQ(t.val_bits, 32);
+    ASSERT_EQ(t.lookups.size(), 1);
+    ASSERT_EQ(t.inserts.size(), 1);
+    // pointers in the value keep the table on the host
+    ASSERT_FALSE(tables[1].offloadable);
+    ASSERT_EQ(tables[1].lookups.size(), 1);
+}
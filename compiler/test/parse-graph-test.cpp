@@ -0,0 +1,94 @@
+#include "hir-parsegraph.hpp"
+#include "gtest/gtest.h"
+
+#include <sstream>
+
+using namespace HIR;
+
+static std::vector<std::string> parse_order(const ParseGraph &g) {
+    std::vector<std::string> result;
+    for (auto &s : g.states) {
+        result.emplace_back(s.header);
+    }
+    return result;
+}
+
+TEST(ParseGraphTest, ipv4_tcp) {
+    HeaderUsage usage;
+    usage.reads["ipv4"] = {"protocol", "daddr"};
+    usage.writes["tcp"] = {"dest"};
+    auto g = extract_parse_graph(CommonHdr::default_layout, usage);
+
+    ASSERT_EQ(g.start, "ether");
+    std::vector<std::string> expected = {"ether", "ipv4", "vlan", "tcp"};
+    ASSERT_EQ(parse_order(g), expected);
+    ASSERT_TRUE(g.unreachable.empty());
+
+    auto ether = g.find("ether");
+    ASSERT_EQ(ether->select_field, "ethertype");
+    ASSERT_EQ(ether->cases.size(), 2);
+    ASSERT_EQ(ether->default_next, "");
+    ASSERT_FALSE(ether->is_stack);
+
+    // tcp is the one after ipv4, not after ipv6 or inside a tunnel
+    auto ipv4 = g.find("ipv4");
+    ASSERT_EQ(ipv4->cases.size(), 1);
+    ASSERT_EQ(ipv4->cases[0].first, 6);
+    ASSERT_EQ(ipv4->cases[0].second, "tcp");
+    ASSERT_EQ(ipv4->fields_used.size(), 2);
+    ASSERT_EQ(g.find("ipv6"), nullptr);
+    ASSERT_EQ(g.find("gre"), nullptr);
+
+    ASSERT_TRUE(g.find("vlan")->is_stack);
+    ASSERT_EQ(g.find("tcp")->fields_used.count("dest"), 1);
+}
+
+TEST(ParseGraphTest, tunnel_header) {
+    HeaderUsage usage;
+    usage.reads["vxlan"] = {"vni"};
+    auto g = extract_parse_graph(CommonHdr::default_layout, usage);
+
+    ASSERT_NE(g.find("udp"), nullptr);
+    ASSERT_NE(g.find("ipv6"), nullptr);
+    auto vxlan = g.find("vxlan");
+    ASSERT_NE(vxlan, nullptr);
+    // the inner ethernet header is not needed
+    ASSERT_EQ(vxlan->default_next, "");
+    ASSERT_FALSE(g.find("ether")->is_stack);
+}
+
+TEST(ParseGraphTest, nothing_used) {
+    HeaderUsage usage;
+    auto g = extract_parse_graph(CommonHdr::default_layout, usage);
+    ASSERT_EQ(g.start, "");
+    ASSERT_TRUE(g.states.empty());
+
+    std::stringstream ss;
+    g.print_p4(ss, CommonHdr::default_layout, "P");
+    ASSERT_NE(ss.str().find("transition accept;"), std::string::npos);
+}
+
+TEST(ParseGraphTest, unreachable_header) {
+    HeaderUsage usage;
+    usage.reads["tcp"] = {"dest"};
+    PacketLayout no_parser(CommonHdr::default_layout.headers);
+    auto g = extract_parse_graph(no_parser, usage);
+    ASSERT_TRUE(g.states.empty());
+    ASSERT_EQ(g.unreachable, std::vector<std::string>{"tcp"});
+}
+
+TEST(ParseGraphTest, merge_usage) {
+    HeaderUsage a, b;
+    a.reads["ipv4"] = {"ttl"};
+    b.writes["ipv4"] = {"check"};
+    b.reads["udp"] = {"dest"};
+    a += b;
+    ASSERT_EQ(a.headers(), (std::set<std::string>{"ipv4", "udp"}));
+    ASSERT_EQ(a.reads["ipv4"].size(), 1);
+    ASSERT_EQ(a.writes["ipv4"].size(), 1);
+
+    auto g = extract_parse_graph(CommonHdr::default_layout, a);
+    ASSERT_EQ(g.find("ipv4")->fields_used.size(), 2);
+    ASSERT_EQ(g.find("ipv4")->cases.size(), 1);
+    ASSERT_EQ(g.find("ipv4")->cases[0].second, "udp");
+}
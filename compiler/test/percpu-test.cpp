@@ -0,0 +1,126 @@
+#include "hir-stateop.hpp"
+#include "hir-test.hpp"
+#include "percpu.hpp"
+
+#include <thread>
+
+using namespace HIR;
+
+TEST(PerCpuCounterTest, replicas_summed_on_read) {
+    PerCpuCounter<uint64_t> c(4);
+    std::vector<std::thread> threads;
+    for (size_t core = 0; core < 4; core++) {
+        threads.emplace_back([&c, core]() {
+            for (int i = 0; i < 10000; i++) {
+                c.add(core, core + 1);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    ASSERT_EQ(c.read(), 10000 * (1 + 2 + 3 + 4));
+    c.reset();
+    ASSERT_EQ(c.read(), 0);
+}
+
+TEST(PerCpuCounterTest, atomic_update) {
+    std::atomic<uint32_t> v{3};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&v]() {
+            for (int i = 0; i < 1000; i++) {
+                atomic_update(v, [](uint32_t x) { return x * 3 % 1000003; });
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    uint32_t expect = 3;
+    for (int i = 0; i < 4000; i++) {
+        expect = expect * 3 % 1000003;
+    }
+    ASSERT_EQ(v.load(), expect);
+}
+
+/* push(int port, Packet *p):
+ *   _count += p->length();
+ *   _last = ++_seq;
+ *   _seen = port;   if port >= _limit
+ */
+class ScalarStateTest : public HirTest {
+protected:
+    std::shared_ptr<Var> self;
+    std::shared_ptr<Var> port;
+    Type *i32 = int_type(32);
+    Type *i64 = int_type(64);
+
+    std::shared_ptr<Var> field(std::shared_ptr<BasicBlock> bb, int idx, Type *t) {
+        auto zero = constant(i32, 0);
+        return add_op(bb, Operation::T::GEP, {self, zero, constant(i32, idx)}, ptr_type(t))->dst_vars[0];
+    }
+
+    std::shared_ptr<Var> add(std::shared_ptr<BasicBlock> bb, std::shared_ptr<Var> a, std::shared_ptr<Var> b) {
+        return arith(bb, IntArithType::INT_ADD, {a, b}, a->type);
+    }
+
+    void SetUp() override {
+        with_element(struct_type({i64, i32, i32, i32, i32}, {0, 8, 12, 16, 20}, 24));
+        state(i64, 0, 0);
+        state(i32, 8, 1);
+        state(i32, 12, 2);
+        state(i32, 16, 3);
+        state(i32, 20, 4);
+
+        self = arg(ptr_type(ele.element_type));
+        port = arg(i32);
+        arg(new_type(Type::T::PACKET));
+
+        auto entry = new_bb("entry");
+        auto seen = new_bb("seen");
+        auto out = new_bb("out");
+        f->set_entry_idx(0);
+        out->is_return = true;
+
+        // _count += p->length(), as a 64 bit counter
+        auto len = add_op(entry, Operation::T::PKT_HDR_LOAD, {f->args[2]}, i64)->dst_vars[0];
+        auto count_ptr = field(entry, 0, i64);
+        store(entry, count_ptr, add(entry, len, load(entry, count_ptr)));
+
+        auto seq_ptr = field(entry, 1, i32);
+        auto next = add(entry, load(entry, seq_ptr), constant(i32, 1));
+        store(entry, seq_ptr, next);
+        store(entry, field(entry, 2, i32), next);
+
+        auto limit = load(entry, field(entry, 3, i32));
+        branch(entry, cmp(entry, IntCmpType::ULE, limit, port), seen, out);
+
+        store(seen, field(seen, 4, i32), port);
+        branch(seen, nullptr, out);
+    }
+};
+
+TEST_F(ScalarStateTest, classified) {
+    auto scalars = classify_scalar_state(ele);
+    ASSERT_EQ(scalars.size(), 5);
+    ASSERT_EQ(scalars[0].name, "state_0");
+    ASSERT_EQ(scalars[0].bits, 64);
+    ASSERT_EQ(scalars[0].update, ScalarUpdate::COMMUTATIVE);
+    ASSERT_EQ(scalars[0].ops.size(), 2);
+    // the new value is stored elsewhere too
+    ASSERT_EQ(scalars[1].update, ScalarUpdate::FETCH_ADD);
+    ASSERT_EQ(scalars[2].update, ScalarUpdate::ATOMIC);
+    ASSERT_EQ(scalars[3].update, ScalarUpdate::READ_ONLY);
+    ASSERT_EQ(scalars[4].offset, 20);
+    ASSERT_EQ(scalars[4].update, ScalarUpdate::ATOMIC);
+}
+
+TEST_F(ScalarStateTest, read_elsewhere_is_not_commutative) {
+    // a second load of _count, its value used
+    auto entry = f->bbs[0];
+    auto again = load(entry, field(entry, 0, i64));
+    store(entry, field(entry, 4, i32), again);
+    auto scalars = classify_scalar_state(ele);
+    ASSERT_EQ(scalars[0].update, ScalarUpdate::FETCH_ADD);
+}
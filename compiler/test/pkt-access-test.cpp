@@ -0,0 +1,294 @@
+#include "hir-common-pass.hpp"
+#include "hir-pktop.hpp"
+#include "hir-test.hpp"
+
+using namespace HIR;
+
+// builds an entry function (this, port, packet) the way the front end
+// would have translated it, before replace_packet_access_op
+class PktAccessTest : public HirTest {
+protected:
+    Type *i1, *i8, *i16, *i64, *i8_ptr, *i16_ptr, *pkt_ptr;
+
+    void SetUp() override {
+        i1 = int_type(1);
+        i8 = int_type(8);
+        i16 = int_type(16);
+        i64 = int_type(64);
+        i8_ptr = ptr_type(i8);
+        i16_ptr = ptr_type(i16);
+        pkt_ptr = ptr_type(new_type(Type::T::PACKET));
+        arg(ptr_type(i8));
+        arg(i64);
+        arg(pkt_ptr);
+        f->set_entry_idx(0);
+        with_element(nullptr);
+    }
+
+    std::shared_ptr<Var> gep(std::shared_ptr<BasicBlock> bb, std::shared_ptr<Var> base, std::shared_ptr<Var> idx) {
+        return add_op(bb, Operation::T::GEP, {base, idx}, base->type)->dst_vars[0];
+    }
+
+    // ip = p->ip_header(); hl = ip->ip_hl << 2
+    std::pair<std::shared_ptr<Var>, std::shared_ptr<Var>> ip_and_header_len(std::shared_ptr<BasicBlock> bb) {
+        auto ip = call(bb, "_ZNK6Packet9ip_headerEv", {f->args[2]}, i8_ptr)->dst_vars[0];
+        auto vihl = load(bb, ip);
+        auto ihl = arith(bb, IntArithType::INT_AND, {vihl, constant(i8, 15)}, i8);
+        auto shl = arith(bb, IntArithType::INT_SHL, {ihl, constant(i8, 2)}, i8);
+        auto hl = arith(bb, IntArithType::INT_ZEXT, {shl}, i64);
+        return {ip, hl};
+    }
+
+    // loads a 16 bit value at off bytes past the ip header
+    std::shared_ptr<Operation> load_after_ip(std::shared_ptr<BasicBlock> bb,
+                                             std::shared_ptr<Var> ip,
+                                             std::shared_ptr<Var> hl,
+                                             uint64_t off) {
+        auto th = gep(bb, ip, hl);
+        auto p = gep(bb, th, constant(i64, off));
+        auto p16 = add_op(bb, Operation::T::BITCAST, {p}, i16_ptr)->dst_vars[0];
+        return load(bb, p16)->src_op.lock();
+    }
+
+    void run() {
+        update_uses(*f);
+        replace_packet_access_op(ele, CommonHdr::default_layout);
+    }
+};
+
+TEST_F(PktAccessTest, transport_header_after_options) {
+    auto entry = new_bb();
+    auto tcp = new_bb();
+    auto other = new_bb();
+    auto [ip, hl] = ip_and_header_len(entry);
+    auto proto = load(entry, gep(entry, ip, constant(i64, 9)));
+    branch(entry, cmp(entry, IntCmpType::EQ, proto, constant(i8, 6)), tcp, other);
+    auto dport = load_after_ip(tcp, ip, hl, 2);
+    tcp->is_return = true;
+    // ipv4 may be followed by tcp, udp or gre
+    auto unknown = load_after_ip(other, ip, hl, 2);
+    other->is_return = true;
+    run();
+
+    ASSERT_EQ(dport->type, Operation::T::PKT_HDR_LOAD);
+    ASSERT_EQ(dport->pkt_op_info.header, "tcp");
+    ASSERT_EQ(dport->pkt_op_info.field, "dest");
+    ASSERT_EQ(dport->args[0], f->args[2]);
+    ASSERT_EQ(unknown->type, Operation::T::LOAD);
+}
+
+TEST_F(PktAccessTest, protocol_known_on_the_false_edge) {
+    auto entry = new_bb();
+    auto other = new_bb();
+    auto udp = new_bb();
+    auto [ip, hl] = ip_and_header_len(entry);
+    auto proto = load(entry, gep(entry, ip, constant(i64, 9)));
+    auto proto32 = arith(entry, IntArithType::INT_ZEXT, {proto}, int_type(32));
+    branch(entry, cmp(entry, IntCmpType::NE, proto32, constant(int_type(32), 17)), other, udp);
+    other->is_return = true;
+    auto len = load_after_ip(udp, ip, hl, 4);
+    udp->is_return = true;
+    run();
+
+    ASSERT_EQ(len->type, Operation::T::PKT_HDR_LOAD);
+    ASSERT_EQ(len->pkt_op_info.header, "udp");
+    ASSERT_EQ(len->pkt_op_info.field, "len");
+}
+
+TEST_F(PktAccessTest, protocol_stored_within_the_block) {
+    auto entry = new_bb();
+    auto tcp = new_bb();
+    auto other = new_bb();
+    auto [ip, hl] = ip_and_header_len(entry);
+    auto proto_ptr = gep(entry, ip, constant(i64, 9));
+    auto proto = load(entry, proto_ptr);
+    branch(entry, cmp(entry, IntCmpType::EQ, proto, constant(i8, 6)), tcp, other);
+    auto before = load_after_ip(tcp, ip, hl, 2);
+    // ip->ip_p = IP_PROTO_UDP, what follows ipv4 is not known any more
+    store(tcp, gep(tcp, ip, constant(i64, 9)), constant(i8, 17));
+    auto after = load_after_ip(tcp, ip, hl, 2);
+    tcp->is_return = true;
+    other->is_return = true;
+    run();
+
+    ASSERT_EQ(before->type, Operation::T::PKT_HDR_LOAD);
+    ASSERT_EQ(before->pkt_op_info.header, "tcp");
+    ASSERT_EQ(after->type, Operation::T::LOAD);
+}
+
+TEST_F(PktAccessTest, not_a_header_length) {
+    auto entry = new_bb();
+    auto ip = call(entry, "_ZNK6Packet9ip_headerEv", {f->args[2]}, i8_ptr)->dst_vars[0];
+    auto vihl = load(entry, ip);
+    // the version, not the header length
+    auto version = arith(entry, IntArithType::INT_LSHR, {vihl, constant(i8, 4)}, i8);
+    auto off = arith(entry, IntArithType::INT_ZEXT, {version}, i64);
+    auto proto = load(entry, gep(entry, ip, constant(i64, 9)));
+    auto tcp = new_bb();
+    auto other = new_bb();
+    branch(entry, cmp(entry, IntCmpType::EQ, proto, constant(i8, 6)), tcp, other);
+    auto x = load_after_ip(tcp, ip, off, 2);
+    tcp->is_return = true;
+    other->is_return = true;
+    run();
+    ASSERT_EQ(x->type, Operation::T::LOAD);
+}
+
+// "header field" of the load v was turned into, "" if it was not
+static std::string bit_field_of(const std::shared_ptr<HIR::Var> &v) {
+    auto op = v->src_op.lock();
+    if (op->type != HIR::Operation::T::PKT_HDR_LOAD) {
+        return "";
+    }
+    return op->pkt_op_info.header + " " + op->pkt_op_info.field;
+}
+
+TEST_F(PktAccessTest, bit_fields_of_a_byte) {
+    auto entry = new_bb();
+    entry->is_return = true;
+    auto ip = call(entry, "_ZNK6Packet9ip_headerEv", {f->args[2]}, i8_ptr)->dst_vars[0];
+    auto vihl = load(entry, ip);
+    auto ihl = arith(entry, IntArithType::INT_AND, {vihl, constant(i8, 15)}, i8);
+    auto version = arith(entry, IntArithType::INT_LSHR, {vihl, constant(i8, 4)}, i8);
+    auto tos = load(entry, gep(entry, ip, constant(i64, 1)));
+    // ip_tos & IP_ECN_MASK, shifted down: the ecn is the low 2 bits
+    auto ecn = arith(entry, IntArithType::INT_AND, {tos, constant(i8, 3)}, i8);
+    auto dscp = arith(entry, IntArithType::INT_LSHR, {tos, constant(i8, 2)}, i8);
+    // the low half of tos spans dscp and ecn
+    auto across = arith(entry, IntArithType::INT_AND, {tos, constant(i8, 15)}, i8);
+    run();
+
+    ASSERT_EQ(bit_field_of(ihl), "ipv4 ihl");
+    ASSERT_EQ(bit_field_of(version), "ipv4 version");
+    ASSERT_EQ(bit_field_of(ecn), "ipv4 ecn");
+    ASSERT_EQ(bit_field_of(dscp), "ipv4 dscp");
+    ASSERT_EQ(bit_field_of(across), "");
+    ASSERT_EQ(across->src_op.lock()->type, Operation::T::ARITH);
+}
+
+TEST_F(PktAccessTest, bit_fields_of_a_network_order_field) {
+    auto entry = new_bb();
+    entry->is_return = true;
+    auto ip = call(entry, "_ZNK6Packet9ip_headerEv", {f->args[2]}, i8_ptr)->dst_vars[0];
+    auto off_ptr = add_op(entry, Operation::T::BITCAST, {gep(entry, ip, constant(i64, 6))}, i16_ptr);
+    auto frag = load(entry, off_ptr->dst_vars[0]);
+    // ip_off & htons(IP_DF) != 0, the flag is bit 6 of the raw load
+    auto df = arith(entry, IntArithType::INT_AND, {frag, constant(i16, 0x40)}, i16);
+    cmp(entry, IntCmpType::NE, df, constant(i16, 0));
+    // ntohs(ip_off) & IP_OFFMASK
+    auto host = call(entry, "llvm.bswap.i16", {frag}, i16)->dst_vars[0];
+    auto offset = arith(entry, IntArithType::INT_AND, {host, constant(i16, 0x1fff)}, i16);
+    // ip_off & htons(IP_MF), used as a value, not only against 0
+    auto mf = arith(entry, IntArithType::INT_AND, {frag, constant(i16, 0x20)}, i16);
+    arith(entry, IntArithType::INT_ZEXT, {mf}, i64);
+    run();
+
+    ASSERT_EQ(bit_field_of(df), "ipv4 df");
+    ASSERT_EQ(bit_field_of(offset), "ipv4 frag_offset");
+    ASSERT_EQ(bit_field_of(mf), "");
+}
+
+class PktEncapTest : public PktAccessTest {
+protected:
+    std::shared_ptr<Operation> pkt_call(std::shared_ptr<BasicBlock> bb,
+                                        const std::string &fn,
+                                        std::shared_ptr<Var> len,
+                                        Type *dst_type) {
+        return call(bb, fn, {f->args[2], len}, dst_type);
+    }
+};
+
+TEST_F(PktEncapTest, push_mac_header) {
+    auto entry = new_bb();
+    auto push = pkt_call(entry, "_ZN6Packet15push_mac_headerEj", constant(int_type(32), 14), pkt_ptr);
+    auto q = push->dst_vars[0];
+    // the result is the same packet
+    call(entry, "unknown", {q}, i8);
+    entry->is_return = true;
+    run();
+
+    auto encap = ops_of(entry, Operation::T::PKT_ENCAP);
+    ASSERT_EQ(encap.size(), 1);
+    ASSERT_EQ(encap[0]->pkt_op_info.header, "ether");
+    ASSERT_EQ(encap[0]->args[0], f->args[2]);
+    ASSERT_EQ(encap[0]->dst_vars[0], q);
+    auto calls = ops_of(entry, Operation::T::FUNC_CALL);
+    ASSERT_EQ(calls.size(), 1);
+    ASSERT_EQ(calls[0]->args[0], f->args[2]);
+}
+
+TEST_F(PktEncapTest, pull_headers) {
+    auto entry = new_bb();
+    auto i32 = int_type(32);
+    pkt_call(entry, "_ZN6Packet4pullEj", constant(i32, 18), nullptr);
+    // VLANDecap: the tag behind the ethernet addresses
+    pkt_call(entry, "_ZN6Packet4pullEj", constant(i32, 4), nullptr);
+    pkt_call(entry, "_ZN6Packet4pushEj", constant(i32, 20), pkt_ptr);
+    pkt_call(entry, "_ZN6Packet4pullEj", param(i32), nullptr);
+    // no header or path of 3 bytes
+    pkt_call(entry, "_ZN6Packet4pullEj", constant(i32, 3), nullptr);
+    entry->is_return = true;
+    run();
+
+    auto decap = ops_of(entry, Operation::T::PKT_DECAP);
+    ASSERT_EQ(decap.size(), 3);
+    ASSERT_EQ(decap[0]->pkt_op_info.header, "ether");
+    ASSERT_EQ(decap[1]->pkt_op_info.header, "vlan");
+    ASSERT_EQ(decap[2]->pkt_op_info.header, "vlan");
+    auto encap = ops_of(entry, Operation::T::PKT_ENCAP);
+    ASSERT_EQ(encap.size(), 1);
+    ASSERT_EQ(encap[0]->pkt_op_info.header, "ipv4");
+    ASSERT_EQ(ops_of(entry, Operation::T::FUNC_CALL).size(), 2);
+}
+
+TEST_F(PktEncapTest, memcpy_fields) {
+    auto entry = new_bb();
+    auto data = call(entry, "_ZNK14WritablePacket4dataEv", {f->args[2]}, i8_ptr)->dst_vars[0];
+    auto tmp = add_op(entry, Operation::T::ALLOCA, {}, i8_ptr)->dst_vars[0];
+    auto memcpy = [&](std::shared_ptr<Var> dst, std::shared_ptr<Var> src, uint64_t n) {
+        call(entry, "llvm.memcpy.p0i8.p0i8.i64", {dst, src, constant(i64, n), constant(i1, 0)}, nullptr);
+    };
+    // EtherMirror
+    auto src = gep(entry, data, constant(i64, 6));
+    memcpy(tmp, data, 6);
+    memcpy(data, src, 6);
+    memcpy(src, tmp, 6);
+    // runs past the ethernet header
+    memcpy(tmp, gep(entry, data, constant(i64, 12)), 4);
+    entry->is_return = true;
+    run();
+
+    std::vector<std::string> fields;
+    for (auto &op : entry->ops) {
+        if (op->type == Operation::T::PKT_HDR_LOAD || op->type == Operation::T::PKT_HDR_STORE) {
+            ASSERT_EQ(op->pkt_op_info.header, "ether");
+            ASSERT_EQ(op->args[0], f->args[2]);
+            fields.emplace_back(op->pkt_op_info.field);
+        }
+    }
+    std::vector<std::string> expected = {"dst", "src", "dst", "src"};
+    ASSERT_EQ(fields, expected);
+    ASSERT_EQ(ops_of(entry, Operation::T::LOAD).size(), 1);
+    ASSERT_EQ(ops_of(entry, Operation::T::STORE).size(), 1);
+    auto store = ops_of(entry, Operation::T::STORE)[0];
+    ASSERT_EQ(store->args[1]->type->bitwidth, 48);
+    // data() and the last memcpy
+    ASSERT_EQ(ops_of(entry, Operation::T::FUNC_CALL).size(), 2);
+}
+
+TEST_F(PktEncapTest, data_not_at_start) {
+    auto entry = new_bb();
+    // a packet the trace does not know, e.g. loaded from a queue
+    auto other = load(entry, add_op(entry, Operation::T::ALLOCA, {}, ptr_type(pkt_ptr))->dst_vars[0]);
+    auto other_data = call(entry, "_ZNK6Packet4dataEv", {other}, i8_ptr)->dst_vars[0];
+    auto x = load(entry, other_data)->src_op.lock();
+    // Strip(14): data() is past the ethernet header
+    pkt_call(entry, "_ZN6Packet4pullEj", param(int_type(32)), nullptr);
+    auto data = call(entry, "_ZNK6Packet4dataEv", {f->args[2]}, i8_ptr)->dst_vars[0];
+    auto y = load(entry, data)->src_op.lock();
+    entry->is_return = true;
+    run();
+
+    ASSERT_EQ(x->type, Operation::T::LOAD);
+    ASSERT_EQ(y->type, Operation::T::LOAD);
+}
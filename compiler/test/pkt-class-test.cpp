@@ -0,0 +1,156 @@
+#include "hir-pktclass.hpp"
+#include "hir-test.hpp"
+
+using namespace HIR;
+
+// push(int port, Packet *p) after replace_packet_access_op, a class per
+// action the element takes on a packet
+class PktClassTest : public HirTest {
+protected:
+    Type *i8 = int_type(8);
+    Type *i16 = int_type(16);
+    Type *i32 = int_type(32);
+    std::shared_ptr<Var> self;
+    std::shared_ptr<Var> pkt;
+    std::shared_ptr<BasicBlock> entry;
+    std::shared_ptr<Var> proto;
+
+    void SetUp() override {
+        self = arg(ptr_type(i8), "_arg_0");
+        arg(i32, "_arg_1");
+        pkt = arg(ptr_type(new_type(Type::T::PACKET)), "_arg_2");
+        entry = new_bb("entry");
+        f->set_entry_idx(0);
+        proto = pkt_load(entry, pkt, "ipv4", "protocol", i8)->dst_vars[0];
+    }
+
+    std::shared_ptr<Var> is_proto(const std::shared_ptr<BasicBlock> &bb, uint64_t p) {
+        return cmp(bb, IntCmpType::EQ, proto, constant(i8, p));
+    }
+
+    // sends the packet out on port and returns
+    void output(const std::shared_ptr<BasicBlock> &bb, uint64_t port) {
+        builtin_call(bb, "PushPktFn", {self, constant(i32, port), pkt}, nullptr);
+        bb->is_return = true;
+    }
+
+    std::shared_ptr<BasicBlock> output(const std::string &name, uint64_t port) {
+        auto bb = new_bb(name);
+        output(bb, port);
+        return bb;
+    }
+
+    std::shared_ptr<BasicBlock> drop(const std::string &name) {
+        auto bb = new_bb(name);
+        builtin_call(bb, "PacketKillFn", {pkt}, nullptr);
+        bb->is_return = true;
+        return bb;
+    }
+
+    static const PacketClass *find_class(const PacketClassInfo &info, PacketClass::Action a) {
+        for (auto &c : info.classes) {
+            if (c.action == a) {
+                return &c;
+            }
+        }
+        return nullptr;
+    }
+
+    static const PacketClass *find_output(const PacketClassInfo &info, const std::string &port) {
+        for (auto &c : info.classes) {
+            if (c.action == PacketClass::Action::OUTPUT && c.out_ports.size() == 1 && c.out_ports[0]->str() == port) {
+                return &c;
+            }
+        }
+        return nullptr;
+    }
+};
+
+TEST_F(PktClassTest, classes_by_protocol) {
+    // tcp is rewritten and goes out on 0, udp on 1, the rest is dropped
+    auto tcp = new_bb("tcp");
+    pkt_store(tcp, pkt, "tcp", "dest", constant(i16, 80));
+    output(tcp, 0);
+    auto udp = output("udp", 1);
+    auto other = drop("other");
+    branch(entry, is_proto(entry, 6), tcp, other);
+    BasicBlock::BranchEntry br;
+    br.is_conditional = true;
+    br.cond_var = is_proto(entry, 17);
+    br.next_bb = udp;
+    entry->branches.emplace_back(br);
+
+    auto info = explore_packet_classes(*f);
+    ASSERT_TRUE(info.complete);
+    ASSERT_EQ(info.classes.size(), 3);
+    auto out_tcp = find_output(info, "0");
+    ASSERT_NE(out_tcp, nullptr);
+    ASSERT_EQ(out_tcp->rewrites.size(), 1);
+    ASSERT_EQ(out_tcp->rewrites.at("tcp.dest")->str(), "80");
+    ASSERT_EQ(out_tcp->pred.str(), "(ipv4.protocol == 6)");
+
+    auto out_udp = find_output(info, "1");
+    ASSERT_NE(out_udp, nullptr);
+    ASSERT_FALSE(out_udp->is_rewrite());
+    // protocol != 6 follows from protocol == 17
+    ASSERT_EQ(out_udp->pred.str(), "(ipv4.protocol == 17)");
+
+    auto dropped = find_class(info, PacketClass::Action::DROP);
+    ASSERT_NE(dropped, nullptr);
+    ASSERT_EQ(dropped->pred.str(), "(ipv4.protocol != 6) && (ipv4.protocol != 17)");
+    ASSERT_EQ(dropped->num_paths, 1);
+}
+
+TEST_F(PktClassTest, infeasible_path_pruned) {
+    // the assertion is behind protocol == 17 within protocol == 6
+    auto tcp = new_bb("tcp");
+    auto err = new_bb("err");
+    err->is_err = true;
+    auto out = output("out", 0);
+    auto other = drop("other");
+    branch(entry, is_proto(entry, 6), tcp, other);
+    branch(tcp, is_proto(tcp, 17), err, out);
+
+    auto info = explore_packet_classes(*f);
+    ASSERT_EQ(info.classes.size(), 2);
+    ASSERT_EQ(find_class(info, PacketClass::Action::ERROR), nullptr);
+    ASSERT_EQ(find_class(info, PacketClass::Action::OUTPUT)->pred.str(), "(ipv4.protocol == 6)");
+}
+
+TEST_F(PktClassTest, paths_merged_by_effect) {
+    // both sides of the branch set the ttl the same, join reads it back
+    auto left = new_bb("left");
+    auto right = new_bb("right");
+    auto join = new_bb("join");
+    auto err = new_bb("err");
+    err->is_err = true;
+    branch(entry, is_proto(entry, 6), left, right);
+    pkt_store(left, pkt, "ipv4", "ttl", constant(i8, 64));
+    branch(left, nullptr, join);
+    pkt_store(right, pkt, "ipv4", "ttl", constant(i8, 64));
+    branch(right, nullptr, join);
+    auto ttl = pkt_load(join, pkt, "ipv4", "ttl", i8)->dst_vars[0];
+    branch(join, cmp(join, IntCmpType::NE, ttl, constant(i8, 64)), err, output("out", 0));
+
+    auto info = explore_packet_classes(*f);
+    ASSERT_EQ(info.classes.size(), 1);
+    auto &c = info.classes[0];
+    ASSERT_EQ(c.action, PacketClass::Action::OUTPUT);
+    ASSERT_EQ(c.rewrites.at("ipv4.ttl")->str(), "64");
+    ASSERT_EQ(c.num_paths, 2);
+    ASSERT_TRUE(c.pred.always_true());
+    ASSERT_FALSE(c.pred.approximate);
+}
+
+TEST_F(PktClassTest, back_edge_not_followed) {
+    // body spins on itself while the protocol is 6
+    auto body = new_bb("body");
+    auto out = output("out", 0);
+    branch(entry, nullptr, body);
+    branch(body, is_proto(body, 6), body, out);
+
+    auto info = explore_packet_classes(*f);
+    ASSERT_FALSE(info.complete);
+    ASSERT_EQ(info.classes.size(), 1);
+    ASSERT_EQ(info.classes[0].pred.str(), "(ipv4.protocol != 6)");
+}
@@ -0,0 +1,104 @@
+#include "hir-common-pass.hpp"
+#include "hir-pktop.hpp"
+#include "hir-test.hpp"
+
+using namespace HIR;
+
+class PktCsumTest : public HirTest {
+protected:
+    std::shared_ptr<Var> pkt;
+    std::shared_ptr<BasicBlock> bb;
+    Type *i16 = int_type(16);
+    Type *i32 = int_type(32);
+    Type *i64 = int_type(64);
+
+    void SetUp() override {
+        pkt = arg(new_type(Type::T::PACKET));
+        bb = new_bb();
+        bb->is_return = true;
+        f->set_entry_idx(0);
+    }
+
+    std::shared_ptr<Var> arith(IntArithType t, std::vector<std::shared_ptr<Var>> args, Type *dst_type) {
+        return HirTest::arith(bb, t, std::move(args), dst_type);
+    }
+
+    std::shared_ptr<Var> bswap(std::shared_ptr<Var> v) {
+        return call(bb, "llvm.bswap.i16", {v}, i16)->dst_vars[0];
+    }
+
+    std::shared_ptr<Var> inv(std::shared_ptr<Var> v) {
+        return arith(IntArithType::INT_XOR, {v, constant(v->type, ~0ull)}, v->type);
+    }
+
+    std::shared_ptr<Var> load(const std::string &field) {
+        return pkt_load(bb, pkt, "ipv4", field, i16)->dst_vars[0];
+    }
+
+    std::shared_ptr<Operation> store(const std::string &field, std::shared_ptr<Var> v) {
+        return pkt_store(bb, pkt, "ipv4", field, v);
+    }
+
+    // sum + (sum >> 16), truncated
+    std::shared_ptr<Var> fold(std::shared_ptr<Var> sum) {
+        auto hi = arith(IntArithType::INT_LSHR, {sum, constant(sum->type, 16)}, sum->type);
+        return arith(IntArithType::INT_ADD, {hi, sum}, sum->type);
+    }
+
+    void run() {
+        update_uses(*f);
+        replace_checksum_update(*f);
+    }
+};
+
+TEST_F(PktCsumTest, dec_ip_ttl) {
+    // DecIPTTL: sum = (~ntohs(ip_sum) & 0xffff) + 0xfeff, ip_sum = ~htons(fold(sum))
+    auto sum = arith(IntArithType::INT_ZEXT, {bswap(inv(load("check")))}, i64);
+    sum = arith(IntArithType::INT_ADD, {sum, constant(i64, 0xfeff)}, i64);
+    auto t = arith(IntArithType::INT_TRUNC, {fold(sum)}, i16);
+    auto st = store("check", bswap(inv(t)));
+    run();
+
+    ASSERT_EQ(st->type, Operation::T::PKT_CSUM_UPDATE);
+    ASSERT_EQ(st->pkt_op_info.field, "check");
+    ASSERT_EQ(st->args[0], pkt);
+    // the host order 0xfeff in network order
+    ASSERT_TRUE(st->args[1]->is_constant);
+    ASSERT_EQ(st->args[1]->constant, 0xfffe);
+    ASSERT_EQ(st->dst_vars[0]->type, i16);
+}
+
+TEST_F(PktCsumTest, update_in_cksum) {
+    // click_update_in_cksum(&ip_sum, old, new)
+    auto old_hw = param(i16);
+    auto new_hw = param(i16);
+    auto a = arith(IntArithType::INT_ZEXT, {inv(load("check"))}, i32);
+    auto b = arith(IntArithType::INT_ZEXT, {inv(old_hw)}, i32);
+    auto c = arith(IntArithType::INT_ZEXT, {new_hw}, i32);
+    auto sum = arith(IntArithType::INT_ADD, {arith(IntArithType::INT_ADD, {a, b}, i32), c}, i32);
+    auto lo = arith(IntArithType::INT_AND, {sum, constant(i32, 0xffff)}, i32);
+    auto hi = arith(IntArithType::INT_LSHR, {sum, constant(i32, 16)}, i32);
+    sum = arith(IntArithType::INT_ADD, {lo, hi}, i32);
+    auto t = arith(IntArithType::INT_TRUNC, {fold(sum)}, i16);
+    auto st = store("check", inv(t));
+    run();
+
+    ASSERT_EQ(st->type, Operation::T::PKT_CSUM_UPDATE);
+    auto delta = st->args[1]->src_op.lock();
+    ASSERT_NE(delta, nullptr);
+    ASSERT_EQ(delta->type, Operation::T::ARITH);
+    ASSERT_EQ(delta->args[0], b);
+    ASSERT_EQ(delta->args[1], c);
+}
+
+TEST_F(PktCsumTest, not_a_checksum_patch) {
+    auto sum = arith(IntArithType::INT_ZEXT, {inv(load("check"))}, i32);
+    sum = arith(IntArithType::INT_ADD, {sum, constant(i32, 1)}, i32);
+    // no carry fold
+    auto plain = store("check", inv(arith(IntArithType::INT_TRUNC, {sum}, i16)));
+    // the complement of another field
+    auto other = store("id", inv(arith(IntArithType::INT_TRUNC, {fold(sum)}, i16)));
+    run();
+    ASSERT_EQ(plain->type, Operation::T::PKT_HDR_STORE);
+    ASSERT_EQ(other->type, Operation::T::PKT_HDR_STORE);
+}
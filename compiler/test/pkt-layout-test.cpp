@@ -0,0 +1,145 @@
+#include "pkt-layout.hpp"
+#include "gtest/gtest.h"
+
+#include <sstream>
+
+static std::optional<PacketLayout> parse(const std::string &text, std::string &err) {
+    std::istringstream is(text);
+    return PacketLayout::Parse(is, err);
+}
+
+TEST(PktLayoutTest, parse_headers_and_parser) {
+    std::string err;
+    auto layout = parse(
+        "# comment\n"
+        "header eth { dst 48 src 48 ethertype 16 }\n"
+        "header vlan {\n"
+        "    tci 16\n"
+        "    ethertype 16  # trailing comment\n"
+        "}\n"
+        "parser eth {\n"
+        "    select ethertype\n"
+        "    0x8100 -> vlan\n"
+        "    default -> accept\n"
+        "}\n"
+        "parser vlan { select ethertype 0x8100->vlan }\n"
+        "start eth\n", err);
+    ASSERT_TRUE(layout.has_value()) << err;
+    ASSERT_EQ(layout->start_header, "eth");
+    ASSERT_EQ(layout->headers.size(), 2);
+
+    auto &eth = layout->headers.at("eth");
+    ASSERT_EQ(eth.Name(), "eth_hdr_t");
+    ASSERT_EQ(eth.HeaderSize(), 14);
+    ASSERT_EQ(eth.FindFieldByOffset(0)->field_name, "dst");
+    ASSERT_EQ(eth.FindFieldByOffset(6)->field_name, "src");
+    ASSERT_EQ(eth.FindFieldByOffset(12)->field_n_bytes, 2);
+    ASSERT_EQ(eth.FindFieldByOffset(3), nullptr);
+    ASSERT_EQ(eth.FindFieldByOffset(14), nullptr);
+
+    auto &t = layout->transitions.at("eth");
+    ASSERT_EQ(t.select_field, "ethertype");
+    ASSERT_EQ(t.cases.size(), 1);
+    ASSERT_EQ(t.cases[0].first, 0x8100);
+    ASSERT_EQ(t.cases[0].second, "vlan");
+    ASSERT_EQ(t.default_next, "");
+}
+
+TEST(PktLayoutTest, reject_bad_layouts) {
+    const char *bad[] = {
+        "header a { x 8 x 8 }",
+        "header a { x 8 } header a { y 8 }",
+        "header a { x 4 }",
+        "header a { x }",
+        "header a { x 8 ",
+        "header a { x 8 } parser a { select y 1 -> a }",
+        "header a { x 8 } parser a { select x 256 -> a }",
+        "header a { x 8 } parser a { select x 1 -> a 1 -> a }",
+        "header a { x 8 } parser a { select x 1 -> b }",
+        "header a { x 8 } parser b { default -> a }",
+        "header a { x 8 } start b",
+        "header a { x 8 } frobnicate",
+        "header a { x 8 { y 4 z 3 } }",
+        "header a { x 8 { y 4 x 4 } }",
+        "header a { x 8 { y 8 } z 8 { y 8 } }",
+        "header a { x 8 { y 0 z 8 } }",
+        "header a { x 8 { y 4 z 4 }",
+        "header a length y * 4 { x 8 }",
+        "header a length x * 0 { x 8 }",
+        "header a length x 4 { x 8 }",
+    };
+    for (auto text : bad) {
+        std::string err;
+        auto layout = parse(text, err);
+        ASSERT_FALSE(layout.has_value()) << text;
+        ASSERT_FALSE(err.empty()) << text;
+    }
+}
+
+TEST(PktLayoutTest, parse_bit_fields) {
+    std::string err;
+    auto layout = parse(
+        "header vlan {\n"
+        "    tci 16 { pcp 3 dei 1 vid 12 }\n"
+        "    ethertype 16\n"
+        "}\n", err);
+    ASSERT_TRUE(layout.has_value()) << err;
+    auto &vlan = layout->headers.at("vlan");
+    ASSERT_EQ(vlan.HeaderSize(), 4);
+    auto tci = vlan.FindFieldByOffset(0);
+    ASSERT_NE(tci, nullptr);
+    ASSERT_EQ(tci->field_n_bytes, 2);
+    ASSERT_EQ(tci->bit_fields.size(), 3);
+    ASSERT_EQ(tci->bit_fields[1].name, "dei");
+    ASSERT_EQ(tci->bit_fields[1].bit_offset, 3);
+    ASSERT_EQ(tci->bit_fields[2].bit_offset, 4);
+    ASSERT_EQ(tci->bit_fields[2].n_bits, 12);
+    ASSERT_TRUE(vlan.FindFieldByOffset(2)->bit_fields.empty());
+    ASSERT_EQ(vlan.FindFieldByName("ethertype")->field_n_bytes, 2);
+    ASSERT_EQ(vlan.FindFieldByName("vid"), nullptr);
+    ASSERT_EQ(vlan.FindBitFieldByName("vid")->bit_offset, 4);
+    ASSERT_EQ(vlan.FindBitFieldByName("tci"), nullptr);
+    ASSERT_EQ(vlan.FieldNBits("tci"), 16);
+    ASSERT_EQ(vlan.FieldNBits("dei"), 1);
+    ASSERT_EQ(vlan.FieldNBits("nothing"), 0);
+}
+
+TEST(PktLayoutTest, parse_length_field) {
+    std::string err;
+    auto layout = parse(
+        "header ip length ihl * 4 {\n"
+        "    vihl 8 { version 4 ihl 4 }\n"
+        "    tos 8\n"
+        "}\n"
+        "header fixed { x 8 }\n", err);
+    ASSERT_TRUE(layout.has_value()) << err;
+    auto &ip = layout->headers.at("ip");
+    ASSERT_TRUE(ip.IsVarLength());
+    ASSERT_EQ(ip.Length().field, "ihl");
+    ASSERT_EQ(ip.Length().unit, 4);
+    ASSERT_EQ(ip.FindContainerByName("ihl")->field_name, "vihl");
+    ASSERT_EQ(ip.FindContainerByName("tos")->field_name, "tos");
+    ASSERT_EQ(ip.FindContainerByName("none"), nullptr);
+    ASSERT_FALSE(layout->headers.at("fixed").IsVarLength());
+}
+
+TEST(PktLayoutTest, error_has_line_number) {
+    std::string err;
+    auto layout = parse("header a {\n  x 8\n  y 3\n}\n", err);
+    ASSERT_FALSE(layout.has_value());
+    ASSERT_EQ(err.find("line 3:"), 0) << err;
+}
+
+TEST(PktLayoutTest, default_layout_is_valid) {
+    auto &layout = CommonHdr::default_layout;
+    ASSERT_EQ(layout.Validate(), "");
+    ASSERT_EQ(layout.start_header, "ether");
+    ASSERT_EQ(layout.headers.at("ipv4").FindFieldByOffset(9)->field_name, "protocol");
+    ASSERT_EQ(layout.headers.at("ipv6").HeaderSize(), 40);
+    ASSERT_EQ(layout.headers.at("vxlan").FindFieldByOffset(4)->field_name, "vni");
+    auto frag_off = layout.headers.at("ipv4").FindFieldByName("frag_off");
+    ASSERT_EQ(frag_off->bit_fields.back().name, "frag_offset");
+    ASSERT_EQ(frag_off->bit_fields.back().bit_offset, 3);
+    ASSERT_EQ(layout.headers.at("ipv4").Length().field, "ihl");
+    ASSERT_EQ(layout.headers.at("tcp").Length().unit, 4);
+}
@@ -0,0 +1,176 @@
+#include "hir-common-pass.hpp"
+#include "hir-pktop.hpp"
+#include "hir-test.hpp"
+
+using namespace HIR;
+
+class PktRedundancyTest : public HirTest {
+protected:
+    std::shared_ptr<Var> pkt;
+    Type *i32 = int_type(32);
+    Type *i8 = int_type(8);
+    Type *i1 = int_type(1);
+
+    void SetUp() override {
+        pkt = arg(new_type(Type::T::PACKET));
+    }
+
+    std::shared_ptr<Var> load(std::shared_ptr<BasicBlock> bb, const std::string &field, Type *t) {
+        return pkt_load(bb, pkt, "ipv4", field, t)->dst_vars[0];
+    }
+
+    void store(std::shared_ptr<BasicBlock> bb, const std::string &field, std::shared_ptr<Var> v) {
+        pkt_store(bb, pkt, "ipv4", field, v);
+    }
+
+    void ret(std::shared_ptr<BasicBlock> bb, std::shared_ptr<Var> v) {
+        bb->is_return = true;
+        bb->return_val = v;
+    }
+
+    // Packet::data() plus an offset not known here
+    std::shared_ptr<Var> raw_ptr(std::shared_ptr<BasicBlock> bb) {
+        auto data = call(bb, "_ZNK6Packet4dataEv", {pkt}, ptr_type(i8))->dst_vars[0];
+        return add_op(bb, Operation::T::GEP, {data, param(i32)}, ptr_type(i8))->dst_vars[0];
+    }
+
+    size_t count(Operation::T type) const {
+        return ops_of(type).size();
+    }
+
+    void run() {
+        f->set_entry_idx(0);
+        update_uses(*f);
+        remove_redundant_pkt_access(*f, CommonHdr::default_layout);
+    }
+};
+
+TEST_F(PktRedundancyTest, load_in_both_branches) {
+    auto entry = new_bb();
+    auto a = new_bb();
+    auto b = new_bb();
+    auto join = new_bb();
+    auto daddr = load(entry, "daddr", i32);
+    branch(entry, param(i1), a, b);
+    auto in_a = load(a, "daddr", i32);
+    store(a, "daddr", in_a);
+    a->default_next_bb = join;
+    auto in_b = load(b, "daddr", i32);
+    b->default_next_bb = join;
+    auto in_join = load(join, "daddr", i32);
+    ret(join, in_join);
+    (void)daddr;
+    (void)in_b;
+    run();
+
+    // only the load in the entry is left, the store writes back its value
+    ASSERT_EQ(count(Operation::T::PKT_HDR_LOAD), 1);
+    ASSERT_EQ(count(Operation::T::PKT_HDR_STORE), 0);
+    ASSERT_EQ(join->return_val, daddr);
+}
+
+TEST_F(PktRedundancyTest, store_to_load_forwarding) {
+    auto entry = new_bb();
+    auto a = new_bb();
+    auto b = new_bb();
+    auto join = new_bb();
+    auto v = param(i8);
+    branch(entry, param(i1), a, b);
+    store(a, "ttl", v);
+    a->default_next_bb = join;
+    b->default_next_bb = join;
+    auto in_join = load(join, "ttl", i8);
+    ret(join, in_join);
+    run();
+
+    // not stored on every path
+    ASSERT_EQ(count(Operation::T::PKT_HDR_LOAD), 1);
+
+    store(entry, "ttl", v);
+    run();
+    ASSERT_EQ(count(Operation::T::PKT_HDR_LOAD), 0);
+    ASSERT_EQ(join->return_val, v);
+}
+
+TEST_F(PktRedundancyTest, width_mismatch_is_not_forwarded) {
+    auto entry = new_bb();
+    store(entry, "daddr", param(i32));
+    ret(entry, load(entry, "daddr", i8));
+    run();
+    ASSERT_EQ(count(Operation::T::PKT_HDR_LOAD), 1);
+}
+
+TEST_F(PktRedundancyTest, dead_store) {
+    auto entry = new_bb();
+    auto next = new_bb();
+    auto x = param(i8);
+    auto y = param(i8);
+    store(entry, "ttl", x);
+    store(entry, "tos", x);
+    entry->default_next_bb = next;
+    store(next, "ttl", y);
+    auto tos = load(next, "tos", i8);
+    store(next, "tos", y);
+    ret(next, tos);
+    run();
+
+    // ttl is overwritten, tos is forwarded to its load and overwritten
+    ASSERT_EQ(count(Operation::T::PKT_HDR_LOAD), 0);
+    ASSERT_EQ(count(Operation::T::PKT_HDR_STORE), 2);
+    ASSERT_EQ(entry->ops.size(), 0);
+    ASSERT_EQ(next->return_val, x);
+}
+
+TEST_F(PktRedundancyTest, store_before_return_is_kept) {
+    auto entry = new_bb();
+    auto a = new_bb();
+    auto b = new_bb();
+    store(entry, "ttl", param(i8));
+    branch(entry, param(i1), a, b);
+    store(a, "ttl", param(i8));
+    ret(a, nullptr);
+    ret(b, nullptr);
+    run();
+    ASSERT_EQ(count(Operation::T::PKT_HDR_STORE), 2);
+}
+
+TEST_F(PktRedundancyTest, bit_field_and_calls) {
+    auto entry = new_bb();
+    auto ihl = load(entry, "ihl", i8);
+    // a store to the containing field changes the bit field
+    store(entry, "vihl", param(i8));
+    auto ihl2 = load(entry, "ihl", i8);
+    // Packet::transport_length() const only reads the packet
+    call(entry, "_ZNK6Packet16transport_lengthEv", {pkt}, nullptr);
+    load(entry, "ihl", i8);
+    // calls not given the packet can not change it
+    call(entry, "no_packet", {}, nullptr);
+    load(entry, "ihl", i8);
+    call(entry, "unknown_function", {pkt}, nullptr);
+    auto ihl3 = load(entry, "ihl", i8);
+    ret(entry, ihl3);
+    (void)ihl;
+    (void)ihl2;
+    run();
+    ASSERT_EQ(count(Operation::T::PKT_HDR_LOAD), 3);
+    ASSERT_EQ(count(Operation::T::PKT_HDR_STORE), 1);
+}
+
+TEST_F(PktRedundancyTest, variable_offset_store_between_loads) {
+    auto entry = new_bb();
+    load(entry, "ttl", i8);
+    HirTest::store(entry, raw_ptr(entry), param(i8));
+    ret(entry, load(entry, "ttl", i8));
+    run();
+    ASSERT_EQ(count(Operation::T::PKT_HDR_LOAD), 2);
+}
+
+TEST_F(PktRedundancyTest, variable_offset_load_between_stores) {
+    auto entry = new_bb();
+    store(entry, "ttl", param(i8));
+    auto raw = HirTest::load(entry, raw_ptr(entry));
+    store(entry, "ttl", param(i8));
+    ret(entry, raw);
+    run();
+    ASSERT_EQ(count(Operation::T::PKT_HDR_STORE), 2);
+}
@@ -0,0 +1,166 @@
+#include "hir-table.hpp"
+#include "rss-steering.hpp"
+#include "gtest/gtest.h"
+
+#include <array>
+
+using namespace HIR;
+
+static uint32_t ip(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    uint8_t bytes[4] = {a, b, c, d};
+    uint32_t v;
+    std::memcpy(&v, bytes, 4);
+    return v;
+}
+
+static uint16_t port(uint16_t p) {
+    uint8_t bytes[2] = {uint8_t(p >> 8), uint8_t(p & 0xff)};
+    uint16_t v;
+    std::memcpy(&v, bytes, 2);
+    return v;
+}
+
+TEST(RssSteeringTest, verification_suite) {
+    RssSteering rss(4);
+    auto s = ip(66, 9, 149, 187);
+    auto d = ip(161, 142, 100, 80);
+    ASSERT_EQ(rss.hash_ipv4(s, d), 0x323e8fc2u);
+    ASSERT_EQ(rss.hash_ipv4_l4(s, d, port(2794), port(1766)), 0x51ccc178u);
+    s = ip(199, 92, 111, 2);
+    d = ip(65, 69, 140, 83);
+    ASSERT_EQ(rss.hash_ipv4(s, d), 0xd718262au);
+    ASSERT_EQ(rss.hash_ipv4_l4(s, d, port(14230), port(4739)), 0xc626b0eau);
+}
+
+TEST(RssSteeringTest, reta_spreads_over_cores) {
+    RssSteering rss(3);
+    std::array<size_t, 3> hits = {0, 0, 0};
+    for (uint32_t h = 0; h < RssSteering::RETA_SIZE; h++) {
+        auto c = rss.core_of(h);
+        ASSERT_LT(c, 3);
+        hits[c]++;
+    }
+    for (auto n : hits) {
+        ASSERT_GE(n, RssSteering::RETA_SIZE / 3);
+    }
+}
+
+TEST(RssSteeringTest, symmetric_key) {
+    RssSteering rss(4, RSS_SYMMETRIC_KEY);
+    auto s = ip(66, 9, 149, 187);
+    auto d = ip(161, 142, 100, 80);
+    ASSERT_EQ(rss.hash_ipv4(s, d), rss.hash_ipv4(d, s));
+    ASSERT_EQ(rss.hash_ipv4_l4(s, d, port(2794), port(1766)), rss.hash_ipv4_l4(d, s, port(1766), port(2794)));
+    ASSERT_NE(RssSteering(4).hash_ipv4(s, d), RssSteering(4).hash_ipv4(d, s));
+}
+
+TEST(ShardedFlowTableTest, one_shard_per_core) {
+    ShardedFlowTable<SwissFlowTable<uint32_t, uint32_t>> t(4, 10);
+    ASSERT_EQ(t.n_shards(), 4);
+    ASSERT_EQ(t.shard(0).capacity(), 3);
+    RssSteering rss(4);
+    for (uint32_t i = 0; i < 8; i++) {
+        auto core = rss.core_of(rss.hash_ipv4(i, ~i));
+        t.shard(core).insert(i, i * 2);
+        ASSERT_EQ(*t.shard(core).findp(i), i * 2);
+    }
+    ASSERT_EQ(t.size(), 8);
+}
+
+class ShardTablesTest : public ::testing::Test {
+protected:
+    std::vector<MatchTable> tables;
+    StateAccessSummary summary;
+
+    void add_table(size_t state_idx) {
+        MatchTable t;
+        t.name = "map_" + std::to_string(state_idx);
+        t.state_idx = state_idx;
+        t.key_t = nullptr;
+        t.val_t = nullptr;
+        t.capacity = 1024;
+        tables.emplace_back(t);
+        summary.states[state_idx].state_idx = state_idx;
+    }
+
+    // the i-th field is copied to byte 4 * i of the key
+    void add_key(size_t state_idx, std::vector<std::string> fields, std::set<std::string> params = {}) {
+        StateKey k;
+        for (size_t i = 0; i < fields.size(); i++) {
+            k.pkt_fields.insert(fields[i]);
+            k.pkt_field_pos[fields[i]] = i * 4;
+        }
+        k.params = std::move(params);
+        summary.states[state_idx].keys.emplace_back(k);
+    }
+};
+
+TEST_F(ShardTablesTest, flow_keyed) {
+    add_table(3);
+    add_key(3, {"ipv4.saddr", "ipv4.daddr", "tcp.source", "tcp.dest"});
+    add_key(3, {"ipv4.saddr", "ipv4.daddr", "udp.src", "udp.dest", "ipv4.protocol"});
+    auto steering = shard_tables(tables, summary);
+    ASSERT_TRUE(tables[0].sharded);
+    ASSERT_EQ(steering.rss_type, "ipv4-l4");
+    ASSERT_EQ(steering.fields.size(), 4);
+    ASSERT_FALSE(steering.symmetric);
+}
+
+TEST_F(ShardTablesTest, weakest_key_picks_steering) {
+    add_table(3);
+    add_key(3, {"ipv4.saddr", "ipv4.daddr", "tcp.source", "tcp.dest"});
+    add_table(4);
+    add_key(4, {"ipv4.saddr", "ipv4.daddr"});
+    auto steering = shard_tables(tables, summary);
+    ASSERT_TRUE(tables[0].sharded);
+    ASSERT_TRUE(tables[1].sharded);
+    ASSERT_EQ(steering.rss_type, "ipv4");
+    ASSERT_EQ(steering.fields, (std::vector<std::string>{"ipv4.saddr", "ipv4.daddr"}));
+}
+
+TEST_F(ShardTablesTest, not_packet_keyed) {
+    add_table(3);
+    add_key(3, {"ipv4.saddr", "ipv4.daddr"});
+    add_key(3, {"ipv4.saddr", "ipv4.daddr"}, {"_arg_1"});
+    add_table(4);
+    add_key(4, {"ipv4.saddr", "tcp.source"});
+    add_table(5);
+    auto steering = shard_tables(tables, summary);
+    for (auto &t : tables) {
+        ASSERT_FALSE(t.sharded);
+    }
+    ASSERT_TRUE(steering.fields.empty());
+    ASSERT_EQ(steering.rss_type, "");
+}
+
+TEST_F(ShardTablesTest, reversed_insert) {
+    // IPRewriter: looked up by the packet's flow, the reply's flow inserted
+    add_table(3);
+    add_key(3, {"ipv4.saddr", "ipv4.daddr", "tcp.source", "tcp.dest"});
+    add_key(3, {"ipv4.daddr", "ipv4.saddr", "tcp.dest", "tcp.source"});
+    auto steering = shard_tables(tables, summary);
+    ASSERT_TRUE(tables[0].sharded);
+    ASSERT_EQ(steering.rss_type, "ipv4-l4");
+    ASSERT_TRUE(steering.symmetric);
+
+    // the same fields, not at the same places
+    tables.clear();
+    summary.states.clear();
+    add_table(3);
+    add_key(3, {"ipv4.saddr", "ipv4.daddr", "tcp.source", "tcp.dest"});
+    add_key(3, {"ipv4.saddr", "tcp.source", "ipv4.daddr", "tcp.dest"});
+    steering = shard_tables(tables, summary);
+    ASSERT_FALSE(tables[0].sharded);
+    ASSERT_TRUE(steering.fields.empty());
+}
+
+TEST_F(ShardTablesTest, fields_mixed_in_key) {
+    // keyed by saddr ^ daddr, equal keys do not mean equal addresses
+    add_table(3);
+    StateKey k;
+    k.pkt_fields = {"ipv4.saddr", "ipv4.daddr"};
+    k.pkt_field_pos = {{"ipv4.saddr", std::nullopt}, {"ipv4.daddr", std::nullopt}};
+    summary.states[3].keys.emplace_back(k);
+    shard_tables(tables, summary);
+    ASSERT_FALSE(tables[0].sharded);
+}
@@ -0,0 +1,221 @@
+#include "hir-common-pass.hpp"
+#include "hir-test.hpp"
+
+#include <algorithm>
+
+using namespace HIR;
+
+/* struct Args { int port; int len[2]; } a;
+ * entry:  a.port = port; a.len[1] = 5; br port == 0 ? left : right
+ * left:   a.len[0] = 1;                              -> join
+ * right:  a.len[0] = 2;                              -> join
+ * join:   return a.port + a.len[0] + a.len[1];
+ */
+class SroaTest : public HirTest {
+protected:
+    std::shared_ptr<Var> port;
+    std::shared_ptr<BasicBlock> entry;
+    std::shared_ptr<BasicBlock> join;
+    Type *i32 = int_type(32);
+    Type *args_t;
+    std::shared_ptr<Var> sum;
+
+    std::shared_ptr<Var> constant(uint64_t c) {
+        return HirTest::constant(i32, c);
+    }
+
+    std::shared_ptr<Var> field(std::shared_ptr<BasicBlock> bb, std::shared_ptr<Var> a, std::vector<uint64_t> idx) {
+        std::vector<std::shared_ptr<Var>> args = {a, constant(0)};
+        for (auto i : idx) {
+            args.emplace_back(constant(i));
+        }
+        return add_op(bb, Operation::T::GEP, args, ptr_type(i32))->dst_vars[0];
+    }
+
+    std::shared_ptr<Var> add(std::shared_ptr<BasicBlock> bb, std::shared_ptr<Var> a, std::shared_ptr<Var> b) {
+        return arith(bb, IntArithType::INT_ADD, {a, b}, i32);
+    }
+
+    void SetUp() override {
+        auto len_t = array_type(i32, 2);
+        args_t = struct_type({i32, len_t}, {0, 4}, 12);
+        port = arg(i32, "_arg_1");
+
+        entry = new_bb("entry");
+        auto left = new_bb("left");
+        auto right = new_bb("right");
+        join = new_bb("join");
+        f->set_entry_idx(0);
+
+        auto a = add_op(entry, Operation::T::ALLOCA, {}, ptr_type(args_t));
+        a->alloca_type = args_t;
+        auto a_ptr = a->dst_vars[0];
+        store(entry, field(entry, a_ptr, {0}), port);
+        auto len = add_op(entry, Operation::T::GEP, {a_ptr, constant(0), constant(1)}, ptr_type(len_t))->dst_vars[0];
+        store(entry, field(entry, len, {1}), constant(5));
+        branch(entry, cmp(entry, IntCmpType::EQ, port, constant(0)), left, right);
+
+        store(left, field(left, a_ptr, {1, 0}), constant(1));
+        branch(left, nullptr, join);
+        store(right, field(right, a_ptr, {1, 0}), constant(2));
+        branch(right, nullptr, join);
+
+        auto p = load(join, field(join, a_ptr, {0}));
+        auto l0 = load(join, field(join, a_ptr, {1, 0}));
+        auto l1 = load(join, field(join, a_ptr, {1, 1}));
+        sum = add(join, add(join, p, l0), l1);
+        join->is_return = true;
+    }
+};
+
+TEST_F(SroaTest, split_and_promoted) {
+    ASSERT_EQ(scalar_replace_aggregates(module, *f), 1);
+    ASSERT_TRUE(ops_of(Operation::T::GEP).empty());
+    // a.len[0] is stored on both sides, it stays in memory, as a scalar
+    auto allocas = ops_of(Operation::T::ALLOCA);
+    ASSERT_EQ(allocas.size(), 1);
+    ASSERT_EQ(allocas[0]->alloca_type->type, Type::T::INT);
+    ASSERT_EQ(ops_of(Operation::T::STORE).size(), 2);
+    auto loads = ops_of(Operation::T::LOAD);
+    ASSERT_EQ(loads.size(), 1);
+    ASSERT_EQ(loads[0]->args[0], allocas[0]->dst_vars[0]);
+
+    // a.port and a.len[1] are the values stored
+    auto outer = sum->src_op.lock();
+    ASSERT_TRUE(outer->args[1]->is_constant);
+    ASSERT_EQ(outer->args[1]->constant, 5);
+    auto inner = outer->args[0]->src_op.lock();
+    ASSERT_EQ(inner->args[0], port);
+    ASSERT_EQ(inner->args[1], loads[0]->dst_vars[0]);
+}
+
+TEST_F(SroaTest, escaping_alloca_kept) {
+    // the whole struct goes to a call
+    auto a_ptr = ops_of(Operation::T::ALLOCA)[0]->dst_vars[0];
+    call(join, "use", {a_ptr}, nullptr);
+    ASSERT_EQ(scalar_replace_aggregates(module, *f), 0);
+    auto allocas = ops_of(Operation::T::ALLOCA);
+    ASSERT_EQ(allocas.size(), 1);
+    ASSERT_EQ(allocas[0]->alloca_type, args_t);
+    ASSERT_EQ(ops_of(Operation::T::LOAD).size(), 3);
+}
+
+/* the flow and entry of MyIPRewriter::push, the key is built from the packet
+ * and copied into the entry, the way clang lowers the copy:
+ *   IPFlowID flow(p); MyIPRewriterEntry e;
+ *   e.flow = flow; e.rewritten.saddr = 0xdeadbeef;
+ *   p->ip_header()->ip_dst = e.flow.daddr; p->ip_header()->ip_src = e.rewritten.saddr;
+ */
+class RewriterEntryTest : public HirTest {
+protected:
+    std::shared_ptr<BasicBlock> bb;
+    std::shared_ptr<Var> pkt;
+    std::shared_ptr<Var> flow;
+    std::shared_ptr<Var> entry;
+    std::shared_ptr<Var> entry_bytes;
+    Type *i8 = int_type(8);
+    Type *i32 = int_type(32);
+    Type *i64 = int_type(64);
+    Type *entry_t;
+
+    std::shared_ptr<Var> alloca(Type *t) {
+        auto op = add_op(bb, Operation::T::ALLOCA, {}, ptr_type(t));
+        op->alloca_type = t;
+        return op->dst_vars[0];
+    }
+
+    std::shared_ptr<Var> bytes_of(std::shared_ptr<Var> ptr) {
+        return add_op(bb, Operation::T::BITCAST, {ptr}, ptr_type(i8))->dst_vars[0];
+    }
+
+    std::shared_ptr<Var> field(std::shared_ptr<Var> ptr, uint64_t i, uint64_t j) {
+        auto zero = HirTest::constant(i32, 0);
+        auto gep = add_op(bb, Operation::T::GEP, {ptr, zero, constant(i32, i), constant(i32, j)}, ptr_type(i32));
+        return gep->dst_vars[0];
+    }
+
+    void SetUp() override {
+        auto i16 = int_type(16);
+        auto flow_t = struct_type({i32, i32, i16, i16}, {0, 4, 8, 10}, 12);
+        entry_t = struct_type({flow_t, flow_t, i32}, {0, 12, 24}, 28);
+        pkt = arg(new_type(Type::T::PACKET), "_arg_2");
+        bb = new_bb("entry");
+        bb->is_return = true;
+        f->set_entry_idx(0);
+
+        flow = alloca(flow_t);
+        entry = alloca(entry_t);
+        builtin_call(bb, "IPFlowIDConstr", {flow, pkt, constant(int_type(1), 0)}, nullptr);
+        entry_bytes = bytes_of(entry);
+        call(bb,
+             "llvm.memcpy.p0i8.p0i8.i64",
+             {entry_bytes, bytes_of(flow), constant(i64, 12), constant(int_type(1), 0)},
+             nullptr);
+        store(bb, field(entry, 1, 0), constant(i32, 0xdeadbeef));
+        pkt_store(bb, pkt, "ipv4", "daddr", load(bb, field(entry, 0, 1)));
+        pkt_store(bb, pkt, "ipv4", "saddr", load(bb, field(entry, 1, 0)));
+    }
+};
+
+TEST_F(RewriterEntryTest, copied_key_split) {
+    // the flow goes to its constructor and stays, the entry is split
+    ASSERT_EQ(scalar_replace_aggregates(module, *f), 1);
+    auto allocas = ops_of(Operation::T::ALLOCA);
+    ASSERT_EQ(allocas.size(), 1);
+    ASSERT_EQ(allocas[0]->dst_vars[0], flow);
+    ASSERT_TRUE(ops_of(Operation::T::STORE).empty());
+    for (auto &c : ops_of(Operation::T::FUNC_CALL)) {
+        ASSERT_EQ(c->call_info.func_name, "IPFlowIDConstr");
+    }
+
+    // e.flow.daddr is read from the flow, 4 bytes in
+    auto stores = ops_of(Operation::T::PKT_HDR_STORE);
+    ASSERT_EQ(stores.size(), 2);
+    auto daddr = stores[0]->args[1]->src_op.lock();
+    ASSERT_EQ(daddr->type, Operation::T::LOAD);
+    auto cast = daddr->args[0]->src_op.lock();
+    ASSERT_EQ(cast->type, Operation::T::BITCAST);
+    ASSERT_EQ(cast->dst_vars[0]->type->pointee_type, i32);
+    auto gep = cast->args[0]->src_op.lock();
+    ASSERT_EQ(gep->type, Operation::T::GEP);
+    ASSERT_EQ(gep->args[1]->constant, 4);
+    ASSERT_EQ(gep->args[0]->src_op.lock()->args[0], flow);
+    // e.rewritten.saddr is the constant stored
+    ASSERT_TRUE(stores[1]->args[1]->is_constant);
+    ASSERT_EQ(stores[1]->args[1]->constant, 0xdeadbeef);
+}
+
+TEST_F(RewriterEntryTest, inserted_entry_kept) {
+    // the entry goes to the map as in MyIPRewriter, nothing is split
+    auto map = param(new_type(Type::T::MAP), "map_4");
+    builtin_call(bb, "HashMapInsert", {map, flow, entry}, int_type(1));
+    ASSERT_EQ(scalar_replace_aggregates(module, *f), 0);
+    ASSERT_EQ(ops_of(Operation::T::ALLOCA).size(), 2);
+    ASSERT_EQ(ops_of(Operation::T::FUNC_CALL).size(), 3);
+}
+
+TEST_F(RewriterEntryTest, cleared_entry_split) {
+    // memset(&e, 0, sizeof(e)) ahead of the copy, e.port read after it
+    auto set = call(bb,
+                    "llvm.memset.p0i8.i64",
+                    {entry_bytes, constant(i8, 0), constant(i64, 28), constant(int_type(1), 0)},
+                    nullptr);
+    bb->ops.pop_back();
+    auto copy = ops_of(Operation::T::FUNC_CALL)[1];
+    bb->ops.insert(std::find(bb->ops.begin(), bb->ops.end(), copy), set);
+    auto port = add_op(bb, Operation::T::GEP, {entry, constant(i32, 0), constant(i32, 2)}, ptr_type(i32));
+    auto store = pkt_store(bb, pkt, "tcp", "dest", load(bb, port->dst_vars[0]));
+
+    ASSERT_EQ(scalar_replace_aggregates(module, *f), 1);
+    ASSERT_EQ(ops_of(Operation::T::FUNC_CALL).size(), 1);
+    // e.flow.daddr and e.rewritten.saddr are written twice, they stay in
+    // memory as scalars
+    auto allocas = ops_of(Operation::T::ALLOCA);
+    ASSERT_EQ(allocas.size(), 3);
+    ASSERT_EQ(allocas[1]->alloca_type, i32);
+    ASSERT_EQ(allocas[2]->alloca_type, i32);
+    ASSERT_EQ(ops_of(Operation::T::STORE).size(), 4);
+    // e.port is only cleared
+    ASSERT_TRUE(store->args[1]->is_constant);
+    ASSERT_EQ(store->args[1]->constant, 0);
+}
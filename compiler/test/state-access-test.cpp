@@ -0,0 +1,149 @@
+#include "hir-stateop.hpp"
+#include "hir-test.hpp"
+
+using namespace HIR;
+
+/* push(int port, Packet *p):
+ *   _count++; _specs[port].last = _count;
+ *   if (Entry *e = _map.findp(IPFlowID(p))) e->n = _count;       hit
+ *   else _map.insert({p->ip_header()->saddr, port}, ...);        miss
+ */
+class StateAccessTest : public HirTest {
+protected:
+    std::shared_ptr<Var> self;
+    std::shared_ptr<Var> port;
+    std::shared_ptr<Var> pkt;
+    std::shared_ptr<Var> counter;
+    std::shared_ptr<Var> specs;
+    std::shared_ptr<Var> map;
+    Type *i32 = int_type(32);
+
+    std::shared_ptr<Var> constant(uint64_t c) {
+        return HirTest::constant(i32, c);
+    }
+
+    std::shared_ptr<Operation> struct_set(std::shared_ptr<BasicBlock> bb, std::shared_ptr<Var> obj, int field, std::shared_ptr<Var> v) {
+        auto op = add_op(bb, Operation::T::STRUCT_SET, {obj, v}, nullptr);
+        op->struct_ref_info = {field};
+        return op;
+    }
+
+    void SetUp() override {
+        auto spec_t = struct_type({i32, i32}, {0, 4}, 8);
+        auto vec_t = new_type(Type::T::VECTOR);
+        vec_t->vector_info.element_type = spec_t;
+        auto flow_t = struct_type({i32, i32}, {0, 4}, 8);
+        auto entry_t = struct_type({i32}, {0}, 4);
+        auto map_t = new_type(Type::T::MAP);
+        map_t->map_info.key_t = flow_t;
+        map_t->map_info.val_t = entry_t;
+        with_element(struct_type({i32, vec_t, map_t}, {0, 8, 24}, 40));
+        counter = state(i32, 0, 0);
+        specs = state(vec_t, 8, 1);
+        map = state(map_t, 24, 2);
+
+        self = arg(ptr_type(ele.element_type), "_arg_0");
+        port = arg(i32, "_arg_1");
+        pkt = arg(new_type(Type::T::PACKET), "_arg_2");
+
+        auto entry = new_bb("entry");
+        auto hit = new_bb("hit");
+        auto miss = new_bb("miss");
+        f->set_entry_idx(0);
+        hit->is_return = true;
+        miss->is_return = true;
+
+        auto count_ptr = add_op(entry, Operation::T::GEP, {self, constant(0), constant(0)}, ptr_type(i32))->dst_vars[0];
+        auto n = arith(entry, IntArithType::INT_ADD, {load(entry, count_ptr), constant(1)}, i32);
+        store(entry, count_ptr, n);
+        auto spec = add_op(entry, Operation::T::STATE_IDX, {specs, port}, ptr_type(spec_t));
+        struct_set(entry, spec->dst_vars[0], 1, n);
+
+        auto flow = add_op(entry, Operation::T::ALLOCA, {}, ptr_type(flow_t))->dst_vars[0];
+        builtin_call(entry, "IPFlowIDConstr", {flow, pkt, constant(0)}, nullptr);
+        auto found = builtin_call(entry, "HashMapFindp", {map, flow}, ptr_type(entry_t))->dst_vars[0];
+        branch(entry, cmp(entry, IntCmpType::EQ, found, constant(0)), miss, hit);
+
+        struct_set(hit, found, 0, n);
+
+        auto key = add_op(miss, Operation::T::ALLOCA, {}, ptr_type(flow_t))->dst_vars[0];
+        auto saddr = pkt_load(miss, pkt, "ipv4", "saddr", i32)->dst_vars[0];
+        struct_set(miss, key, 0, saddr);
+        struct_set(miss, key, 1, port);
+        auto val = add_op(miss, Operation::T::ALLOCA, {}, ptr_type(entry_t))->dst_vars[0];
+        builtin_call(miss, "HashMapInsert", {map, key, val}, int_type(1));
+    }
+};
+
+TEST_F(StateAccessTest, merged_over_paths) {
+    auto summary = summarize_state_access(ele);
+    ASSERT_EQ(summary.states.size(), 3);
+
+    auto &c = summary.states.at(0);
+    ASSERT_TRUE(c.read);
+    ASSERT_TRUE(c.written);
+    ASSERT_TRUE(c.keys.empty());
+
+    auto &v = summary.states.at(1);
+    ASSERT_FALSE(v.read);
+    ASSERT_TRUE(v.written);
+    ASSERT_EQ(v.keys.size(), 1);
+    ASSERT_EQ(v.keys[0].var, port);
+    ASSERT_EQ(v.keys[0].params, std::set<std::string>{"_arg_1"});
+    ASSERT_FALSE(v.keys[0].packet_only());
+
+    auto &m = summary.states.at(2);
+    ASSERT_TRUE(m.read);
+    ASSERT_TRUE(m.written);
+    ASSERT_TRUE(m.inserted);
+    ASSERT_EQ(m.keys.size(), 2);
+    auto &flow = m.keys[0];
+    ASSERT_TRUE(flow.packet_only());
+    ASSERT_EQ(flow.pkt_fields, (std::set<std::string>{"ipv4.saddr", "ipv4.daddr", "tcp.source", "tcp.dest"}));
+    ASSERT_EQ(flow.pkt_field_pos.at("ipv4.daddr"), 4);
+    ASSERT_EQ(flow.pkt_field_pos.at("tcp.dest"), 10);
+    auto &key = m.keys[1];
+    ASSERT_EQ(key.pkt_fields, std::set<std::string>{"ipv4.saddr"});
+    ASSERT_EQ(key.pkt_field_pos.at("ipv4.saddr"), 0);
+    ASSERT_EQ(key.params, std::set<std::string>{"_arg_1"});
+    ASSERT_FALSE(key.opaque);
+}
+
+TEST_F(StateAccessTest, reversed_flow_key) {
+    // IPFlowID(p, true), the flow of the reply
+    auto ctor = ops_of(Operation::T::FUNC_CALL)[0];
+    ASSERT_TRUE(is_builtin_call(*ctor, "IPFlowIDConstr"));
+    ctor->args[2] = constant(1);
+    auto flow = summarize_state_access(ele).states.at(2).keys[0];
+    ASSERT_EQ(flow.pkt_field_pos.at("ipv4.daddr"), 0);
+    ASSERT_EQ(flow.pkt_field_pos.at("ipv4.saddr"), 4);
+    ASSERT_EQ(flow.pkt_field_pos.at("tcp.dest"), 8);
+    ASSERT_EQ(flow.pkt_field_pos.at("tcp.source"), 10);
+
+    // not known which way
+    ctor->args[2] = param(int_type(1));
+    flow = summarize_state_access(ele).states.at(2).keys[0];
+    ASSERT_EQ(flow.pkt_fields.size(), 4);
+    ASSERT_FALSE(flow.pkt_field_pos.at("ipv4.saddr").has_value());
+}
+
+TEST_F(StateAccessTest, per_path) {
+    auto summary = summarize_state_access(ele);
+    ASSERT_EQ(summary.paths.size(), 2);
+    ASSERT_FALSE(summary.paths_truncated);
+    for (auto &p : summary.paths) {
+        ASSERT_EQ(p.states.size(), 3);
+        auto &m = p.states.at(2);
+        ASSERT_TRUE(m.read);
+        if (p.bbs.back()->name == "hit") {
+            // written through the pointer findp returned
+            ASSERT_TRUE(m.written);
+            ASSERT_FALSE(m.inserted);
+            ASSERT_EQ(m.keys.size(), 1);
+        } else {
+            ASSERT_EQ(p.bbs.back()->name, "miss");
+            ASSERT_TRUE(m.inserted);
+            ASSERT_EQ(m.keys.size(), 2);
+        }
+    }
+}
@@ -0,0 +1,145 @@
+#include "hir-stateop.hpp"
+#include "hir-table.hpp"
+#include "hir-test.hpp"
+#include "state-array.hpp"
+
+using namespace HIR;
+
+TEST(StateArrayTest, preallocated_and_bounded) {
+    StateArray<uint32_t> a(4);
+    ASSERT_EQ(a.capacity(), 4);
+    for (auto v : a) {
+        ASSERT_EQ(v, 0);
+    }
+    auto first = &a[0];
+    a[3] = 7;
+    a.fill(a[3] + 1);
+    ASSERT_EQ(&a[0], first);
+    ASSERT_EQ(a[1], 8);
+    ASSERT_EQ(a.ptr(3), &a[3]);
+    ASSERT_EQ(a.ptr(4), nullptr);
+}
+
+// push(int port, Packet *p) { _specs[port].count++; } with Vector<Spec> _specs
+class VectorLoweringTest : public HirTest {
+protected:
+    std::shared_ptr<BasicBlock> bb;
+    std::shared_ptr<Var> specs;
+    Type *i32 = int_type(32);
+    Type *spec_t;
+
+    std::shared_ptr<Var> constant(uint64_t c) {
+        return HirTest::constant(i32, c);
+    }
+
+    std::shared_ptr<Operation> add_op(Operation::T type, std::vector<std::shared_ptr<Var>> args, Type *dst_type) {
+        return HirTest::add_op(bb, type, std::move(args), dst_type);
+    }
+
+    void SetUp() override {
+        spec_t = struct_type({i32, i32}, {0, 4}, 8);
+        auto vec_t = new_type(Type::T::VECTOR);
+        vec_t->vector_info.element_type = spec_t;
+        vec_t->set_size(16);
+        with_element(struct_type({i32, vec_t}, {0, 8}, 24));
+        specs = state(vec_t, 8, 1);
+
+        bb = new_bb();
+        bb->is_return = true;
+        f->set_entry_idx(0);
+    }
+};
+
+TEST_F(VectorLoweringTest, vector_index_to_state_idx) {
+    auto self = arg(ptr_type(ele.element_type));
+    auto port = arg(i32);
+    arg(new_type(Type::T::PACKET));
+
+    auto vec = add_op(Operation::T::GEP, {self, constant(0), constant(1)}, ptr_type(specs->type));
+    auto idx = builtin_call(bb, "VectorIdxOp", {vec->dst_vars[0], port}, ptr_type(spec_t));
+    auto count_ptr = add_op(Operation::T::GEP, {idx->dst_vars[0], constant(0), constant(1)}, ptr_type(i32));
+    auto count = add_op(Operation::T::LOAD, {count_ptr->dst_vars[0]}, i32);
+    add_op(Operation::T::STORE, {count_ptr->dst_vars[0], count->dst_vars[0]}, nullptr);
+
+    update_uses(ele);
+    replace_vector_ops(ele);
+    ASSERT_EQ(idx->type, Operation::T::STATE_IDX);
+    ASSERT_EQ(idx->args.size(), 2);
+    ASSERT_EQ(idx->args[0], specs);
+    ASSERT_EQ(idx->args[1], port);
+
+    replace_regular_struct_access(*f);
+    auto get = bb->ops[3];
+    ASSERT_EQ(get->type, Operation::T::STRUCT_GET);
+    ASSERT_EQ(get->args[0], idx->dst_vars[0]);
+    ASSERT_EQ(get->struct_ref_info, std::vector<int>{1});
+    auto set = bb->ops[4];
+    ASSERT_EQ(set->type, Operation::T::STRUCT_SET);
+    ASSERT_TRUE(set->struct_set_have_writeback);
+
+    RegisterArrayOptions opts;
+    opts.capacities["vector_1"] = 16;
+    auto arrays = register_arrays(ele, opts);
+    ASSERT_EQ(arrays.size(), 1);
+    auto &a = arrays[0];
+    ASSERT_EQ(a.name, "vector_1");
+    ASSERT_EQ(a.state_idx, 1);
+    ASSERT_EQ(a.capacity, 16);
+    ASSERT_EQ(a.capacity_from, "config");
+    ASSERT_TRUE(a.offloadable);
+    ASSERT_EQ(a.elem_bits, 64);
+    ASSERT_EQ(a.accesses.size(), 1);
+    ASSERT_EQ(a.accesses[0], idx.get());
+    ASSERT_EQ(register_arrays(ele)[0].capacity_from, "default");
+}
+
+// Spec _specs[4]: push(int port, Packet *p) { _specs[port].count = _specs[2].count; }
+// the same element with a fixed size array in place of the vector
+using ArrayLoweringTest = VectorLoweringTest;
+
+TEST_F(ArrayLoweringTest, array_index_to_state_idx) {
+    ele.states.clear();
+    auto arr_t = array_type(spec_t, 4);
+    ele.element_type = struct_type({i32, arr_t}, {0, 8}, 40);
+    specs = state(arr_t, 8, 1);
+    auto self = arg(ptr_type(ele.element_type));
+    auto port = arg(i32);
+    arg(new_type(Type::T::PACKET));
+
+    auto src_ptr = add_op(Operation::T::GEP, {self, constant(0), constant(1), constant(2), constant(1)}, ptr_type(i32));
+    auto count = add_op(Operation::T::LOAD, {src_ptr->dst_vars[0]}, i32);
+    auto spec = add_op(Operation::T::GEP, {self, constant(0), constant(1), port}, ptr_type(spec_t));
+    auto dst_ptr = add_op(Operation::T::GEP, {spec->dst_vars[0], constant(0), constant(1)}, ptr_type(i32));
+    add_op(Operation::T::STORE, {dst_ptr->dst_vars[0], count->dst_vars[0]}, nullptr);
+
+    update_uses(ele);
+    replace_fixsized_array_ops(ele);
+    ASSERT_EQ(bb->ops.size(), 6);
+    // _specs[2] is split into the index and a gep within the element
+    auto idx = bb->ops[0];
+    ASSERT_EQ(idx->type, Operation::T::STATE_IDX);
+    ASSERT_EQ(idx->args[0], specs);
+    ASSERT_EQ(idx->args[1]->constant, 2);
+    ASSERT_EQ(idx->dst_vars[0]->type->pointee_type, spec_t);
+    ASSERT_EQ(src_ptr->type, Operation::T::GEP);
+    ASSERT_EQ(src_ptr->args.size(), 3);
+    ASSERT_EQ(src_ptr->args[0], idx->dst_vars[0]);
+    ASSERT_EQ(src_ptr->args[2]->constant, 1);
+    // _specs[port] ends at the element
+    ASSERT_EQ(spec->type, Operation::T::STATE_IDX);
+    ASSERT_EQ(spec->args[0], specs);
+    ASSERT_EQ(spec->args[1], port);
+    ASSERT_EQ(dst_ptr->type, Operation::T::GEP);
+
+    replace_regular_struct_access(*f);
+    auto set = bb->ops.back();
+    ASSERT_EQ(set->type, Operation::T::STRUCT_SET);
+    ASSERT_EQ(set->args[0], spec->dst_vars[0]);
+    ASSERT_EQ(set->struct_ref_info, std::vector<int>{1});
+
+    auto arrays = register_arrays(ele);
+    ASSERT_EQ(arrays.size(), 1);
+    ASSERT_EQ(arrays[0].capacity, 4);
+    ASSERT_EQ(arrays[0].capacity_from, "type");
+    ASSERT_EQ(arrays[0].accesses.size(), 2);
+}
@@ -0,0 +1,195 @@
+#include "hir-stateop.hpp"
+#include "hir-test.hpp"
+
+using namespace HIR;
+
+// push(int port, Packet *p) { int *c = port == 0 ? &_a : &_b; (*c)++; _total++; }
+class StatePtrPredicateTest : public HirTest {
+protected:
+    std::shared_ptr<Var> self;
+    std::shared_ptr<Var> port;
+    Type *i32 = int_type(32);
+
+    std::shared_ptr<Var> constant(uint64_t c) {
+        return HirTest::constant(i32, c);
+    }
+
+    std::shared_ptr<Var> field(std::shared_ptr<BasicBlock> bb, int idx) {
+        return add_op(bb, Operation::T::GEP, {self, constant(0), constant(idx)}, ptr_type(i32))->dst_vars[0];
+    }
+
+    std::shared_ptr<Var> is_port0(std::shared_ptr<BasicBlock> bb) {
+        return cmp(bb, IntCmpType::EQ, port, constant(0));
+    }
+
+    void increment(std::shared_ptr<BasicBlock> bb, std::shared_ptr<Var> ptr) {
+        store(bb, ptr, arith(bb, IntArithType::INT_ADD, {load(bb, ptr), constant(1)}, i32));
+    }
+
+    void SetUp() override {
+        with_element(struct_type({i32, i32, i32}, {0, 4, 8}, 12));
+        for (size_t i = 0; i < 3; i++) {
+            state(i32, i * 4, i);
+        }
+        self = arg(ptr_type(ele.element_type), "_arg_0");
+        port = arg(i32, "_arg_1");
+        arg(new_type(Type::T::PACKET), "_arg_2");
+    }
+
+    // entry picks the counter with a select, out bumps _total
+    void build_select() {
+        auto entry = new_bb("entry");
+        auto out = new_bb("out");
+        f->set_entry_idx(0);
+        auto cond = is_port0(entry);
+        auto a = field(entry, 0);
+        auto b = field(entry, 1);
+        auto c = add_op(entry, Operation::T::SELECT, {cond, a, b}, ptr_type(i32))->dst_vars[0];
+        increment(entry, c);
+        branch(entry, nullptr, out);
+        increment(out, field(out, 2));
+        out->is_return = true;
+    }
+
+    // entry branches, each side takes the address of one counter, join
+    // picks it with a phi
+    void build_phi() {
+        auto entry = new_bb("entry");
+        auto left = new_bb("left");
+        auto right = new_bb("right");
+        auto join = new_bb("join");
+        f->set_entry_idx(0);
+        branch(entry, is_port0(entry), left, right);
+        auto a = field(left, 0);
+        branch(left, nullptr, join);
+        auto b = field(right, 1);
+        branch(right, nullptr, join);
+        increment(join, phi(join, {a, b}, {left, right})->dst_vars[0]);
+        increment(join, field(join, 2));
+        join->is_return = true;
+    }
+
+    size_t count(const std::shared_ptr<BasicBlock> &bb, Operation::T t) {
+        return ops_of(bb, t).size();
+    }
+
+    // state_idx of the state field a load or store goes to
+    int state_of(const Operation &op) {
+        auto src = op.args[0]->src_op.lock();
+        if (src == nullptr || src->type != Operation::T::GEP || src->args[0] != self) {
+            return -1;
+        }
+        return src->args[2]->constant;
+    }
+};
+
+TEST_F(StatePtrPredicateTest, select_forked_within_budget) {
+    build_select();
+    update_uses(ele);
+    split_stateptr_branch(ele);
+    ASSERT_GT(f->bbs.size(), 2);
+    for (auto &bb : f->bbs) {
+        ASSERT_EQ(count(bb, Operation::T::SELECT), 0);
+    }
+}
+
+TEST_F(StatePtrPredicateTest, select_predicated) {
+    build_select();
+    update_uses(ele);
+    SplitStatePtrOptions opts;
+    opts.max_fork_ops = 0;
+    split_stateptr_branch(ele, opts);
+    // entry, a block per candidate store and out, the rest of out is
+    // not copied
+    ASSERT_EQ(f->bbs.size(), 4);
+    auto entry = f->bbs[f->entry_bb_idx()];
+    // a load of each for the load, the store is behind a branch on the
+    // select condition
+    ASSERT_EQ(count(entry, Operation::T::LOAD), 2);
+    ASSERT_EQ(count(entry, Operation::T::SELECT), 1);
+    ASSERT_EQ(count(entry, Operation::T::STORE), 0);
+    ASSERT_EQ(entry->branches.size(), 1);
+    auto picked = entry->branches[0].next_bb.lock();
+    auto other = entry->default_next_bb.lock();
+    ASSERT_EQ(picked->ops.size(), 1);
+    ASSERT_EQ(picked->ops[0]->type, Operation::T::STORE);
+    ASSERT_EQ(state_of(*picked->ops[0]), 0);
+    ASSERT_EQ(other->ops.size(), 1);
+    ASSERT_EQ(other->ops[0]->type, Operation::T::STORE);
+    ASSERT_EQ(state_of(*other->ops[0]), 1);
+    // both go on to out
+    ASSERT_EQ(picked->default_next_bb.lock(), other->default_next_bb.lock());
+    ASSERT_EQ(picked->default_next_bb.lock()->name, "out");
+}
+
+TEST_F(StatePtrPredicateTest, phi_forked_within_budget) {
+    build_phi();
+    update_uses(ele);
+    split_stateptr_branch(ele);
+    ASSERT_EQ(f->bbs.size(), 5);
+    for (auto &bb : f->bbs) {
+        ASSERT_EQ(count(bb, Operation::T::PHINODE), 0);
+    }
+}
+
+TEST_F(StatePtrPredicateTest, phi_predicated) {
+    build_phi();
+    update_uses(ele);
+    SplitStatePtrOptions opts;
+    opts.max_fork_ops = 0;
+    split_stateptr_branch(ele, opts);
+    // join is split around the counter store, _total is bumped once
+    ASSERT_EQ(f->bbs.size(), 7);
+    auto join = f->bbs[3];
+    ASSERT_EQ(join->name, "join");
+    // the pointer phi became a selector picking 0 or 1
+    auto sel = join->ops[0];
+    ASSERT_EQ(sel->type, Operation::T::PHINODE);
+    ASSERT_EQ(sel->dst_vars[0]->type->type, Type::T::INT);
+    ASSERT_EQ(sel->args[0]->constant, 0);
+    ASSERT_EQ(sel->args[1]->constant, 1);
+    ASSERT_EQ(count(join, Operation::T::PHINODE), 1);
+    for (auto &op : join->ops) {
+        if (op->type == Operation::T::LOAD) {
+            // the candidate addresses are computed again in join
+            ASSERT_EQ(op->args[0]->src_op.lock()->parent, join.get());
+            ASSERT_NE(state_of(*op), -1);
+        }
+    }
+    ASSERT_EQ(count(join, Operation::T::LOAD), 2);
+    ASSERT_EQ(count(join, Operation::T::STORE), 0);
+    ASSERT_FALSE(join->is_return);
+
+    // selector == 0 stores to the first candidate, the last one is the
+    // default
+    ASSERT_EQ(join->branches.size(), 1);
+    ASSERT_EQ(join->branches[0].cond_var->src_op.lock()->args[0], sel->dst_vars[0]);
+    std::vector<std::shared_ptr<BasicBlock>> stores = {join->branches[0].next_bb.lock(), join->default_next_bb.lock()};
+    std::shared_ptr<BasicBlock> rest;
+    for (size_t k = 0; k < stores.size(); k++) {
+        ASSERT_EQ(stores[k]->ops.size(), 1);
+        ASSERT_EQ(state_of(*stores[k]->ops[0]), k);
+        rest = stores[k]->default_next_bb.lock();
+    }
+    ASSERT_TRUE(rest->is_return);
+    ASSERT_EQ(count(rest, Operation::T::STORE), 1);
+    ASSERT_EQ(state_of(*ops_of(rest, Operation::T::STORE)[0]), 2);
+}
+
+TEST_F(StatePtrPredicateTest, escaping_pointer_still_forked) {
+    build_select();
+    // the picked pointer goes to a call, its accesses can not be guarded
+    auto entry = f->bbs[0];
+    std::shared_ptr<Var> picked;
+    for (auto &op : entry->ops) {
+        if (op->type == Operation::T::SELECT) {
+            picked = op->dst_vars[0];
+        }
+    }
+    call(entry, "update", {picked}, nullptr);
+    update_uses(ele);
+    SplitStatePtrOptions opts;
+    opts.max_fork_ops = 0;
+    split_stateptr_branch(ele, opts);
+    ASSERT_GT(f->bbs.size(), 2);
+}